@@ -203,9 +203,11 @@ rudp_error_t rudp_address_set(
 
    @param addr The address structure to initialize
    @param rudp A valid rudp context
+   @returns 0 on success, ENOMEM if there is no memory for the address,
+            structure must still be cleaned, and setting it fails
  */
 RUDP_EXPORT
-void rudp_address_init(struct rudp_address *addr, struct rudp *rudp);
+rudp_error_t rudp_address_init(struct rudp_address *addr, struct rudp *rudp);
 
 /**
    @this releases all data internally referenced by an address
@@ -0,0 +1,178 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_ALLOCATOR_H_
+/** @hidden */
+#define RUDP_ALLOCATOR_H_
+
+/**
+   @file
+   @module {Allocators}
+   @short Deterministic memory allocators
+
+   All memory the library uses for its objects (peers, packets,
+   addresses, etc.) goes through the @ref rudp_handler allocation
+   callbacks.  Two ready-made allocators working in a memory region
+   given by the user are provided.  None of them ever calls the
+   system allocator, and both are lock-free, so that one allocator
+   may serve rudp contexts running in different threads.
+
+   A pool allocator hands out fixed-size blocks from a few size
+   classes.  Each class holds a fixed count of blocks, a request is
+   served by the smallest class with a free block large enough.
+   Allocation and release take a bounded time.
+
+   A bump allocator hands out memory in sequence.  Only the latest
+   buffer can be given back individually, and all memory is reused
+   once no buffer is in use anymore.  It suits setups where objects
+   are allocated once, at start.
+
+   Both allocators embed a @ref rudp_handler, which is passed to
+   @ref rudp_init.  Its @tt log callback is NULL and may be changed
+   after initialization.
+
+   Sample usage:
+   @code
+    static const struct rudp_pool_class classes[] = {
+        { 256, 64 },
+        { 1024, 64 },
+        { 4352, 512 },
+    };
+    static uint8_t memory[3 << 20];
+    struct rudp_pool_allocator pool;
+
+    rudp_pool_allocator_init(&pool, memory, sizeof(memory),
+                             classes, 3);
+    rudp_init(&rudp, el, &pool.handler);
+   @end code
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <rudp/rudp.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+/** Maximal count of size classes of a pool allocator */
+#define RUDP_POOL_CLASS_MAX 8
+
+/**
+   @this describes a size class of a pool allocator.
+ */
+struct rudp_pool_class
+{
+    /** Size of blocks */
+    size_t size;
+    /** Count of blocks */
+    unsigned int count;
+};
+
+/**
+   @this is a pool allocator.  User should not use its fields
+   directly, but @tt handler.
+
+   @hidecontent
+ */
+struct rudp_pool_allocator
+{
+    struct rudp_handler handler;
+    struct {
+        uint8_t *base;
+        size_t stride;
+        size_t size;
+        unsigned int count;
+        // Free list head index, tagged against ABA
+        uint64_t head;
+    } class[RUDP_POOL_CLASS_MAX];
+    unsigned int class_count;
+};
+
+/**
+   @this is a bump allocator.  User should not use its fields
+   directly, but @tt handler.
+
+   @hidecontent
+ */
+struct rudp_bump_allocator
+{
+    struct rudp_handler handler;
+    uint8_t *base;
+    size_t size;
+    // Count of live buffers and offset of top, in one word
+    uint64_t state;
+};
+
+/**
+   @this computes the memory size needed by a pool allocator.
+
+   @param classes Size classes
+   @param count Count of size classes
+   @returns Size of memory to pass to @ref rudp_pool_allocator_init
+ */
+RUDP_EXPORT
+size_t rudp_pool_allocator_memory_size(const struct rudp_pool_class *classes,
+                                       unsigned int count);
+
+/**
+   @this initializes a pool allocator.  Memory must be kept valid as
+   long as any rudp context uses the allocator.
+
+   @param pool Pool allocator to initialize
+   @param memory Memory to carve blocks from, aligned on 16 bytes
+   @param size Size of @tt memory, see @ref
+          rudp_pool_allocator_memory_size
+   @param classes Size classes, in increasing block size order
+   @param count Count of size classes, at most @ref
+          #RUDP_POOL_CLASS_MAX
+   @returns 0 on success, EINVAL for invalid classes, ENOSPC if
+            @tt memory is too small
+ */
+RUDP_EXPORT
+rudp_error_t rudp_pool_allocator_init(struct rudp_pool_allocator *pool,
+                                      void *memory, size_t size,
+                                      const struct rudp_pool_class *classes,
+                                      unsigned int count);
+
+/**
+   @this retrieves the count of free blocks of a size class.  Result
+   is only a snapshot when other threads use the allocator.
+
+   @param pool A pool allocator
+   @param index Index of size class
+   @returns Count of free blocks
+ */
+RUDP_EXPORT
+unsigned int rudp_pool_allocator_free_blocks(
+    const struct rudp_pool_allocator *pool,
+    unsigned int index);
+
+/**
+   @this initializes a bump allocator.  Memory must be kept valid as
+   long as any rudp context uses the allocator.
+
+   @param bump Bump allocator to initialize
+   @param memory Memory to allocate from, aligned on 16 bytes
+   @param size Size of @tt memory
+ */
+RUDP_EXPORT
+void rudp_bump_allocator_init(struct rudp_bump_allocator *bump,
+                              void *memory, size_t size);
+
+/**
+   @this retrieves the memory size a bump allocator currently spans.
+
+   @param bump A bump allocator
+   @returns Size in use, from start of memory
+ */
+RUDP_EXPORT
+size_t rudp_bump_allocator_used(const struct rudp_bump_allocator *bump);
+
+#endif
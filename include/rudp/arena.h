@@ -0,0 +1,103 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_ARENA_H_
+/** @hidden */
+#define RUDP_ARENA_H_
+
+/**
+   @file
+   @module {Arena}
+   @short Huge page backed packet buffers
+
+   By default, each packet buffer of the pool is a separate heap
+   allocation.  Servers keeping hundreds of megabytes of packets in
+   flight then spend measurable time in TLB misses.
+
+   When enabled, the packet pool carves its buffers from a single
+   memory region of fixed capacity, mapped with huge pages when the
+   system provides them (@tt MAP_HUGETLB first, then transparent huge
+   pages).  Buffers are taken from and given back to a free list in
+   constant time.  When the arena is exhausted, buffers come from the
+   heap as usual.
+
+   Region is mapped once, and its bounds are reported by @ref
+   rudp_arena_info, so that it can be registered as a whole with
+   kernel interfaces working on preregistered buffers.
+
+   Sample usage:
+   @code
+    rudp_init(&rudp, el, RUDP_HANDLER_DEFAULT);
+    rudp_arena_enable(&rudp, 256 << 20);
+   @end code
+*/
+
+#include <stddef.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp;
+
+/**
+   @this defines how the arena is backed.
+ */
+enum rudp_arena_pages
+{
+    /** Explicit huge pages, from @tt MAP_HUGETLB */
+    RUDP_ARENA_HUGETLB,
+    /** Transparent huge pages, the kernel backed part of the arena with them */
+    RUDP_ARENA_THP,
+    /** Normal pages */
+    RUDP_ARENA_NORMAL,
+};
+
+/**
+   @this describes an enabled arena.
+ */
+struct rudp_arena_info
+{
+    /** Start of mapped region */
+    void *base;
+    /** Size of mapped region */
+    size_t size;
+    /** Kind of pages backing region */
+    enum rudp_arena_pages pages;
+    /** Count of packet buffers in region */
+    unsigned int capacity;
+    /** Count of packet buffers currently in use */
+    unsigned int used;
+};
+
+/**
+   @this makes the packet pool of a rudp context use an arena.  It
+   should be called before any endpoint is bound.  Arena is released
+   by @ref rudp_deinit.
+
+   @param rudp An initialized rudp context
+   @param size Size of the arena in bytes, rounded up to a huge page
+   @returns 0 on success, EBUSY if an arena is already enabled,
+            EINVAL if size is 0, or a mapping error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_arena_enable(struct rudp *rudp, size_t size);
+
+/**
+   @this retrieves arena state.
+
+   @param rudp A rudp context
+   @param info (out) Arena state
+   @returns 0 on success, ENOENT if no arena is enabled
+ */
+RUDP_EXPORT
+rudp_error_t rudp_arena_info(const struct rudp *rudp,
+                             struct rudp_arena_info *info);
+
+#endif
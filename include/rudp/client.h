@@ -74,11 +74,15 @@
 #include <rudp/address.h>
 #include <rudp/packet.h>
 #include <rudp/peer.h>
+#include <rudp/crypto.h>
 #include <ela/ela.h>
 
 struct rudp_client;
 struct rudp_link_info;
+struct rudp_client_mux;
+struct rudp_codec;
 struct rudp_peer;
+struct rudp_client_stream_handler;
 
 /**
    Client handler code callbacks
@@ -154,10 +158,21 @@ struct rudp_client_handler
 struct rudp_client
 {
     const struct rudp_client_handler *handler;
+    const struct rudp_client_stream_handler *stream_handler;
     struct rudp_peer peer;
     struct rudp_endpoint endpoint;
     struct rudp_address address;
+    struct rudp_list mcast_list;
+    struct rudp_list path_list;
+    struct rudp_list early_list;
+    struct rudp_list mux_item;
+    struct rudp_client_mux *mux;
+    const struct rudp_codec *codec;
+    struct rudp_crypto_policy crypto;
     struct rudp *rudp;
+    uint32_t shm_ring_size;
+    uint8_t path_scheduler;
+    char connecting;
     char connected;
 };
 
@@ -276,9 +291,31 @@ void rudp_client_set_ipv6(
     const struct in6_addr *address,
     const uint16_t port) RUDP_DEPRECATED;
 
+/**
+   @this enables the @xref {shmproto} {shared memory transport} to
+   servers running on the same host.  Once connected, the client
+   offers a shared memory segment to the server, which may accept it.
+   Data packets then flow through memory rings instead of the
+   network, whenever possible.  Disabled by default.
+
+   @param client An initialized client context structure
+   @param ring_size Size of each direction ring in bytes, a power of
+          two between 4096 and 64M, or 0 to disable
+   @returns 0 on success, EINVAL for an invalid ring size
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_set_shm(
+    struct rudp_client *client,
+    uint32_t ring_size);
+
 /**
    @this sends data to remote server
 
+   Data may be sent before the client is connected.  Messages sent
+   before @ref rudp_client_connect are queued, and the first ones go
+   along with the connection request, so that server gets them
+   without waiting for a round trip.  See @xref {earlydata}.
+
    @param client Source client
    @param reliable Whether to send the payload reliably
    @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
@@ -292,4 +329,35 @@ rudp_error_t rudp_client_send(struct rudp_client *client,
                               int reliable, int command,
                               const void *data, const size_t size);
 
+/**
+   @this sends data to remote server without copying it.
+
+   Library references the user buffer until it does not need it
+   anymore: once the message is acknowledged when reliable, once it
+   is sent otherwise, or when the client is closed first.  It then
+   calls @tt done, which may happen before this function returns.
+   Buffer must not change until then.
+
+   Message is otherwise handled as with @ref rudp_client_send, but
+   is never compressed.
+
+   @param client Source client
+   @param reliable Whether to send the payload reliably
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Payload
+   @param size Total payload size
+   @param done Function called when buffer is released
+   @param priv User private pointer passed to @tt done
+   @returns 0 once the message is queued, or the last socket error,
+   as the other send functions do.  Message is queued in both cases,
+   @tt done is then always called eventually.  On EINVAL or ENOMEM,
+   buffer is not referenced and @tt done is never called.
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_send_buffer(struct rudp_client *client,
+                                     int reliable, int command,
+                                     const void *data, size_t size,
+                                     rudp_buffer_done_func_t *done,
+                                     void *priv);
+
 #endif
@@ -0,0 +1,187 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_CODEC_H_
+/** @hidden */
+#define RUDP_CODEC_H_
+
+/**
+   @file
+   @module {Codec}
+   @short Payload compression
+
+   Data packets may be compressed on the wire.  A client offers one
+   codec in its connection request, the server picks it if it knows
+   the same codec, with the same dictionary, see @xref {codecproto}.
+   Once agreed, each data packet is compressed on its way out, and
+   uncompressed before being handed to the receiving application,
+   which sees no difference.
+
+   Compression is skipped for small packets, and for packets that
+   would not get smaller, they go out as is.  Packets sent with a
+   shared payload (groups, relays to many peers) are never
+   compressed.
+
+   A built-in LZ codec needing no external library is available, see
+   @ref rudp_codec_lz_init.  Short messages compress poorly on their
+   own, a dictionary holding typical message contents shared by both
+   sides makes a big difference there.  Other codecs may be plugged
+   in by filling a @ref rudp_codec structure.
+
+   Codec structures must stay valid as long as clients and servers
+   using them.
+
+   Sample usage:
+   @code
+    static struct rudp_codec_lz lz;
+
+    rudp_codec_lz_init(&lz, dictionary, sizeof(dictionary));
+
+    rudp_server_add_codec(&server, &lz.codec);
+    ...
+    rudp_client_set_codec(&client, &lz.codec);
+   @end code
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_client;
+struct rudp_server;
+
+/** @mgroup{Codec identifiers}
+    Built-in LZ codec */
+#define RUDP_CODEC_LZ 1
+
+/** @mgroup{Codec identifiers}
+    First identifier available for user codecs */
+#define RUDP_CODEC_USER 0x80
+
+/** Maximum count of codecs a server accepts */
+#define RUDP_CODEC_ACCEPT_MAX 4
+
+/** Maximum dictionary size of the built-in LZ codec */
+#define RUDP_CODEC_LZ_DICT_MAX 32768
+
+/** Count of entries of the built-in LZ codec match table */
+#define RUDP_CODEC_LZ_TABLE_SIZE 2048
+
+/**
+   Codec descriptor.  Both peers must use the same identifier and
+   dictionary identifier for a codec to be picked.
+ */
+struct rudp_codec
+{
+    /** Codec identifier, see @ref #RUDP_CODEC_LZ */
+    uint8_t id;
+    /** Identifier of the dictionary in use, 0 for none */
+    uint32_t dict_id;
+    /** Packets with less data are not compressed */
+    size_t min_size;
+
+    /**
+       Compresses data.
+
+       @param codec Codec descriptor
+       @param in Data to compress
+       @param len Size of data
+       @param out Output buffer
+       @param size Size of output buffer
+       @returns size of compressed data, or 0 if it does not fit in
+                output buffer
+     */
+    size_t (*compress)(const struct rudp_codec *codec,
+                       const uint8_t *in, size_t len,
+                       uint8_t *out, size_t size);
+
+    /**
+       Uncompresses data.
+
+       @param codec Codec descriptor
+       @param in Compressed data
+       @param len Size of compressed data
+       @param out Output buffer
+       @param size Size of output buffer
+       @returns size of data, or 0 if compressed data is invalid or
+                does not fit in output buffer
+     */
+    size_t (*decompress)(const struct rudp_codec *codec,
+                         const uint8_t *in, size_t len,
+                         uint8_t *out, size_t size);
+};
+
+/**
+   Built-in LZ codec context.  User should not use its fields
+   directly.
+
+   @hidecontent
+ */
+struct rudp_codec_lz
+{
+    struct rudp_codec codec;
+    const uint8_t *dict;
+    size_t dict_size;
+    uint16_t table[RUDP_CODEC_LZ_TABLE_SIZE];
+};
+
+/**
+   @this initializes the built-in LZ codec.  Dictionary is not
+   copied, it must stay valid as long as the codec is in use.
+
+   @param lz Codec context to initialize
+   @param dict Dictionary contents, may be NULL
+   @param dict_size Size of dictionary, up to @ref
+          #RUDP_CODEC_LZ_DICT_MAX
+   @returns 0 on success, EINVAL if dictionary is too big
+ */
+RUDP_EXPORT
+rudp_error_t rudp_codec_lz_init(struct rudp_codec_lz *lz,
+                                const void *dict, size_t dict_size);
+
+/**
+   @this computes the identifier of a dictionary, as a user codec
+   should put in its @tt dict_id field.
+
+   @param dict Dictionary contents
+   @param dict_size Size of dictionary
+   @returns a non-zero identifier, 0 for an empty dictionary
+ */
+RUDP_EXPORT
+uint32_t rudp_codec_dict_id(const void *dict, size_t dict_size);
+
+/**
+   @this sets the codec a client offers in its connection requests.
+   It applies to subsequent connections.
+
+   @param client An initialized and unconnected client context
+   @param codec Codec to offer, NULL for none
+   @returns 0 on success, EBUSY if the client is connected
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_set_codec(struct rudp_client *client,
+                                   const struct rudp_codec *codec);
+
+/**
+   @this adds a codec a server accepts from its clients.  It applies
+   to subsequent connections.
+
+   @param server An initialized server context
+   @param codec Codec to accept
+   @returns 0 on success, ENOSPC if @ref #RUDP_CODEC_ACCEPT_MAX
+            codecs are already accepted
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_add_codec(struct rudp_server *server,
+                                   const struct rudp_codec *codec);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_CRYPTO_H_
+/** @hidden */
+#define RUDP_CRYPTO_H_
+
+/**
+   @file
+   @module {Crypto}
+   @short Encrypted connections
+
+   Connections may be encrypted and authenticated without any
+   tunnel.  Peers exchange ephemeral X25519 public keys in the
+   connection request and response, derive one key for each
+   direction, and then seal every packet with ChaCha20-Poly1305,
+   see @xref {cryptoproto}.  No external library is needed.
+
+   Without a pre-shared key, encryption protects against passive
+   eavesdroppers only, as nothing tells a peer it talks to the
+   expected one.  When both sides know a pre-shared key, it is mixed
+   in the session keys: a man in the middle cannot read nor forge
+   anything, and peers holding different keys never get a single
+   packet through.
+
+   A client asking for encryption never falls back to clear text.
+   If server does not agree, connection does not complete, and
+   client eventually gets the @tt server_lost callback.
+
+   Shared memory rings (@xref {shmproto}) and multicast channels are
+   not encrypted.  Multipath probes (@xref {mpathproto}) stay in
+   clear text as well, as they are sent straight to the endpoint:
+   they carry the multipath token, a path index and a timestamp, so
+   an eavesdropper can tell which paths belong to a connection.
+   Each sealed packet is 28 bytes larger.
+
+   Sample usage:
+   @code
+    rudp_server_set_encryption(&server, RUDP_CRYPTO_REQUIRED, psk);
+    ...
+    rudp_client_set_encryption(&client, 1, psk);
+    rudp_client_connect(&client);
+   @end code
+*/
+
+#include <stdint.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_client;
+struct rudp_server;
+
+/** Size of keys */
+#define RUDP_CRYPTO_KEY_SIZE 32
+
+/** @mgroup{Encryption modes}
+    Connections are not encrypted. */
+#define RUDP_CRYPTO_OFF 0
+
+/** @mgroup{Encryption modes}
+    Connections are encrypted when clients ask for it. */
+#define RUDP_CRYPTO_ALLOWED 1
+
+/** @mgroup{Encryption modes}
+    Clients not asking for encryption are refused. */
+#define RUDP_CRYPTO_REQUIRED 2
+
+/**
+   Encryption settings of a client or server.  User should not use
+   its fields directly.
+
+   @hidecontent
+ */
+struct rudp_crypto_policy
+{
+    uint8_t mode;
+    uint8_t psk_set;
+    uint8_t psk[RUDP_CRYPTO_KEY_SIZE];
+};
+
+/**
+   @this makes a client encrypt its connections.  It applies to
+   subsequent connections.
+
+   @param client An initialized and unconnected client context
+   @param enable Whether to encrypt connections
+   @param psk Pre-shared key of @ref #RUDP_CRYPTO_KEY_SIZE bytes,
+          may be NULL
+   @returns 0 on success, EBUSY if the client is connected
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_set_encryption(struct rudp_client *client,
+                                        int enable,
+                                        const uint8_t *psk);
+
+/**
+   @this sets whether a server encrypts connections of its clients.
+   It applies to subsequent connections.
+
+   @param server An initialized server context
+   @param mode One of @ref #RUDP_CRYPTO_OFF, @ref
+          #RUDP_CRYPTO_ALLOWED or @ref #RUDP_CRYPTO_REQUIRED
+   @param psk Pre-shared key of @ref #RUDP_CRYPTO_KEY_SIZE bytes,
+          may be NULL
+   @returns 0 on success, EINVAL for an invalid mode
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_set_encryption(struct rudp_server *server,
+                                        int mode,
+                                        const uint8_t *psk);
+
+#endif
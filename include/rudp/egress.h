@@ -0,0 +1,144 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_EGRESS_H_
+/** @hidden */
+#define RUDP_EGRESS_H_
+
+/**
+   @file
+   @module {Egress}
+   @short Fair egress scheduling across peers
+
+   By default, each peer sends its queued packets as soon as its own
+   service timer fires.  When many peers sharing an endpoint have a
+   backlog, the first ones to be serviced send everything they have,
+   and others wait.
+
+   An egress scheduler takes over the transmission decision for a
+   set of peers attached to it.  Peers with packets to send are
+   served in turn with deficit round robin: each time a peer is
+   visited, it is granted a quantum of bytes multiplied by its weight,
+   and sends as many packets as this credit permits.  Credit a peer
+   could not use because its next packet is too big is kept for the
+   next round.  All packets of a scheduling round are sent in a
+   single endpoint batch.
+
+   A global rate limit can be set in addition.  Rounds stop when the
+   limit is reached and resume when enough credit came back.  Rate
+   accounts for UDP payload bytes only.
+
+   Scheduler contexts use the same @xref {olc} {life cycle} as other
+   complex objects of the library.  Servers embed one, see @ref
+   rudp_server_set_fair_queueing.
+*/
+
+#include <rudp/list.h>
+#include <rudp/time.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+#include <ela/ela.h>
+
+struct rudp;
+struct rudp_peer;
+struct rudp_endpoint;
+
+/**
+   @this is an egress scheduler context structure.  User should not
+   use its fields directly.
+
+   @hidecontent
+ */
+struct rudp_egress
+{
+    struct rudp *rudp;
+    struct rudp_endpoint *endpoint;
+    struct rudp_list active_list;
+    struct ela_event_source *service_source;
+    rudp_time_t last_refill;
+    int64_t tokens;
+    uint64_t rate;
+    uint32_t quantum;
+    uint8_t scheduled;
+};
+
+/**
+   @this initializes an egress scheduler.
+
+   @param egress Scheduler unitialized context structure
+   @param rudp A valid rudp context
+   @param endpoint Endpoint attached peers send through
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_egress_init(
+    struct rudp_egress *egress,
+    struct rudp *rudp,
+    struct rudp_endpoint *endpoint);
+
+/**
+   @this frees all internally allocated scheduler data.  Attached
+   peers must be detached before.
+
+   @param egress An initialized scheduler context
+ */
+RUDP_EXPORT
+void rudp_egress_deinit(struct rudp_egress *egress);
+
+/**
+   @this sets the global rate limit of a scheduler.
+
+   @param egress An initialized scheduler context
+   @param bytes_per_sec Rate limit, 0 for no limit (default)
+ */
+RUDP_EXPORT
+void rudp_egress_set_rate(
+    struct rudp_egress *egress,
+    uint64_t bytes_per_sec);
+
+/**
+   @this sets the base quantum of the scheduler, i.e. the count of
+   bytes a weight 1 peer may send each round.  Default is 1500.
+
+   @param egress An initialized scheduler context
+   @param quantum Quantum in bytes, must not be 0
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_egress_set_quantum(
+    struct rudp_egress *egress,
+    uint32_t quantum);
+
+/**
+   @this attaches a peer to a scheduler.  Peer must use the same
+   endpoint as the scheduler.  If peer is already attached, this only
+   updates its weight.
+
+   @param egress An initialized scheduler context
+   @param peer Peer to attach
+   @param weight Relative share of the peer, 0 is handled as 1
+ */
+RUDP_EXPORT
+void rudp_egress_attach(
+    struct rudp_egress *egress,
+    struct rudp_peer *peer,
+    unsigned int weight);
+
+/**
+   @this detaches a peer from its scheduler.  Peer sends its packets
+   by itself again.
+
+   @param peer Peer to detach
+ */
+RUDP_EXPORT
+void rudp_egress_detach(struct rudp_peer *peer);
+
+#endif
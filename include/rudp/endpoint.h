@@ -25,6 +25,15 @@
    complex objects of the library.  Before use, endpoint contexts must
    be initialized with @ref rudp_endpoint_init, and after use, they must
    be cleaned with @ref rudp_endpoint_deinit.
+
+   Outgoing packets are normally sent as soon as they are passed to
+   the endpoint.  Between calls to @ref rudp_endpoint_batch_begin and
+   @ref rudp_endpoint_batch_flush, they are accumulated instead, and
+   sent with as few system calls as possible (using @tt sendmmsg
+   where available).
+
+   Large datagrams may be sent with @tt MSG_ZEROCOPY, see @ref
+   rudp_endpoint_set_zerocopy.
 */
 
 #include <rudp/address.h>
@@ -34,6 +43,25 @@
 struct rudp_peer;
 struct rudp_endpoint;
 struct rudp_packet_chain;
+struct rudp_endpoint_tx_batch;
+struct rudp_stats_endpoint;
+struct rudp_xdp;
+struct rudp_zerocopy;
+
+/** @mgroup{Endpoint flags}
+    Allow other sockets to bind the same address (@tt SO_REUSEADDR) */
+#define RUDP_ENDPOINT_REUSEADDR 1
+
+/** @mgroup{Endpoint flags}
+    Accept IPv4 traffic on an IPv6 socket (@tt IPV6_V6ONLY cleared).
+    IPv4-mapped remote addresses are handled as plain IPv4 ones, see
+    @xref {dualstack}.  Ignored on IPv4 sockets. */
+#define RUDP_ENDPOINT_DUALSTACK 2
+
+/** @mgroup{Endpoint flags}
+    Let other sockets bind the same address and share its traffic
+    (@tt SO_REUSEPORT), see @xref {Shard} */
+#define RUDP_ENDPOINT_REUSEPORT 4
 
 /**
    Endpoint handler code callbacks
@@ -79,6 +107,12 @@ struct rudp_endpoint
     struct rudp *rudp;
     struct ela_event_source *ela_source;
     int socket_fd;
+    uint32_t flags;
+    struct rudp_endpoint_tx_batch *tx_batch;
+    unsigned int tx_batch_depth;
+    struct rudp_stats_endpoint *stats;
+    struct rudp_xdp *xdp;
+    struct rudp_zerocopy *zerocopy;
 };
 
 /**
@@ -168,6 +202,18 @@ void rudp_endpoint_set_ipv6(
     const struct in6_addr *address,
     const uint16_t port) RUDP_DEPRECATED;
 
+/**
+   @this sets socket options to use when binding the endpoint.  This
+   has no effect on an already bound endpoint.
+
+   @param endpoint An initialized endpoint context structure
+   @param flags A mask of @xref {Endpoint flags}
+ */
+RUDP_EXPORT
+void rudp_endpoint_set_flags(
+    struct rudp_endpoint *endpoint,
+    uint32_t flags);
+
 /**
    @this open and binds an endpoint to its address
 
@@ -198,6 +244,63 @@ rudp_error_t rudp_endpoint_send(struct rudp_endpoint *endpoint,
                                 const struct rudp_address *addr,
                                 const void *data, size_t len);
 
+/**
+   @this starts accumulating outgoing packets of the endpoint instead
+   of sending them immediately.  Calls may be nested, packets are
+   actually sent when the outermost @ref rudp_endpoint_batch_flush is
+   called.
+
+   @param endpoint Endpoint
+   @returns 0 on success, ENOMEM if batch storage could not be
+   allocated, in which case packets are still sent immediately
+ */
+RUDP_EXPORT
+rudp_error_t rudp_endpoint_batch_begin(struct rudp_endpoint *endpoint);
+
+/**
+   @this ends a batch started with @ref rudp_endpoint_batch_begin.
+   When the outermost batch ends, all accumulated packets are sent.
+
+   @param endpoint Endpoint
+   @returns the first error encountered while sending, if any
+ */
+RUDP_EXPORT
+rudp_error_t rudp_endpoint_batch_flush(struct rudp_endpoint *endpoint);
+
+/**
+   @this makes a bound endpoint send datagrams of at least @tt
+   threshold bytes with @tt MSG_ZEROCOPY (Linux).
+
+   Kernel then reads outgoing packets straight from library buffers,
+   which are kept until the kernel tells they are not used anymore,
+   through the socket error queue.  Pinning pages and handling
+   notifications has a cost of its own: it only pays off for large
+   datagrams.  Kernel documentation puts the limit around 10 KB.
+   Datagrams going through loopback are always copied.
+
+   Datagrams sent through an AF_XDP socket are not concerned.
+
+   @param endpoint A bound endpoint
+   @param threshold Minimal datagram size, 0 to stop using
+          @tt MSG_ZEROCOPY
+   @returns 0 on success, EINVAL if endpoint is not bound, ENOTSUP if
+            the system does not support it
+ */
+RUDP_EXPORT
+rudp_error_t rudp_endpoint_set_zerocopy(struct rudp_endpoint *endpoint,
+                                        size_t threshold);
+
+/**
+   @this retrieves counters of datagrams sent with @tt MSG_ZEROCOPY.
+
+   @param endpoint An endpoint
+   @param sent (out) Count of datagrams sent with @tt MSG_ZEROCOPY
+   @param copied (out) Count of those the kernel copied anyway
+ */
+RUDP_EXPORT
+void rudp_endpoint_zerocopy_stats(const struct rudp_endpoint *endpoint,
+                                  uint64_t *sent, uint64_t *copied);
+
 /**
    @this receives data from the associated socket.
 
@@ -206,7 +309,8 @@ rudp_error_t rudp_endpoint_send(struct rudp_endpoint *endpoint,
    @param len (inout) On call: size avaiable in @tt data. On return:
           size actually read
    @param addr (out) Peer address
-   @returns a possible error, 0 if received
+   @returns a possible error, 0 if received, EMSGSIZE if the datagram
+            was larger than @tt data and got dropped
  */
 RUDP_EXPORT
 rudp_error_t rudp_endpoint_recv(struct rudp_endpoint *endpoint,
@@ -0,0 +1,147 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_GROUP_H_
+/** @hidden */
+#define RUDP_GROUP_H_
+
+/**
+   @file
+   @module {Group}
+   @short Server-side publish/subscribe groups
+
+   Groups are sets of peers of a given server.  Peers join and leave
+   groups at will, and data can be sent to all the members of a group
+   at once with @ref rudp_server_group_send.
+
+   Sending to a group copies the payload once, all the outgoing
+   packets share it.  Packets are sent right away, in batches, through
+   the server endpoint.
+
+   Group contexts use the same @xref {olc} {life cycle} as other
+   complex objects of the library.  Before use, group contexts must
+   be initialized with @ref rudp_server_group_init, and after use,
+   they must be cleaned with @ref rudp_server_group_deinit.  Groups
+   must be deinitialized before their server.
+
+   Peers leave all their groups automatically when they are dropped.
+
+   Sample usage:
+   @code
+    struct rudp_server_group lobby;
+
+    rudp_server_group_init(&lobby, &server);
+
+    // in peer_new handler
+    rudp_server_group_join(&lobby, peer);
+
+    // anytime
+    rudp_server_group_send(&lobby, 1, 0, "hello", 5);
+
+    rudp_server_group_deinit(&lobby);
+   @end code
+*/
+
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+#include <stdlib.h>
+
+struct rudp_server;
+struct rudp_peer;
+struct rudp_server_group_slot;
+
+/**
+   @this is a group context structure.  User should not use its
+   fields directly.
+
+   @hidecontent
+ */
+struct rudp_server_group
+{
+    struct rudp_server *server;
+    struct rudp_server_group_slot *slot;
+    size_t count;
+    size_t size;
+};
+
+/**
+   @this initializes a group context.
+
+   @param group Group unitialized context structure
+   @param server Server the group members belong to
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_group_init(
+    struct rudp_server_group *group,
+    struct rudp_server *server);
+
+/**
+   @this removes all members from the group and frees all internally
+   allocated group data.
+
+   @param group An initialized group context
+ */
+RUDP_EXPORT
+void rudp_server_group_deinit(struct rudp_server_group *group);
+
+/**
+   @this adds a peer to the group.
+
+   @param group Group context
+   @param peer Peer to add
+   @returns 0 on success, EEXIST if peer is already member of the
+   group, ENOMEM if allocation failed
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_group_join(
+    struct rudp_server_group *group,
+    struct rudp_peer *peer);
+
+/**
+   @this removes a peer from the group.
+
+   @param group Group context
+   @param peer Peer to remove
+   @returns 0 on success, ENOENT if peer is not member of the group
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_group_leave(
+    struct rudp_server_group *group,
+    struct rudp_peer *peer);
+
+/**
+   @this retrieves the count of peers currently in the group.
+
+   @param group Group context
+   @returns the member count
+ */
+RUDP_EXPORT
+size_t rudp_server_group_count(const struct rudp_server_group *group);
+
+/**
+   @this sends data to all the members of the group.
+
+   @param group Destination group
+   @param reliable Whether to send the payload reliably
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Payload
+   @param size Total payload size
+
+   @returns An error level
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_group_send(
+    struct rudp_server_group *group,
+    int reliable, int command,
+    const void *data, const size_t size);
+
+#endif
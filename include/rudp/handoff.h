@@ -0,0 +1,154 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_HANDOFF_H_
+/** @hidden */
+#define RUDP_HANDOFF_H_
+
+/**
+   @file
+   @module {Handoff}
+   @short Server handoff to another process
+
+   A running server may be handed over to another process, typically
+   a newer version of the same program, without its peers noticing.
+   The server sockets (one per listening address) are passed to the
+   new process along with the state of every peer: address, server
+   address it talks to, sequence numbers, round-trip time
+   estimation and packets waiting in the send queue.  Datagrams
+   received during the handoff wait in the socket buffer and are
+   processed by the new process.
+
+   Both processes must be connected through a stream Unix socket,
+   set up by the application, e.g. on a well-known path the old
+   process listens on.  Old process calls @ref
+   rudp_server_handoff_send, new process calls @ref
+   rudp_server_handoff_receive on an initialized, unbound server.
+   Both calls block until the whole state is transferred.  Both
+   processes must run the same build of the library.
+
+   User code may attach a blob of private data to each peer, up to
+   @ref RUDP_HANDOFF_USER_SIZE bytes, with a save callback on the
+   sending side, and get it back with a load callback on the
+   receiving side.  This is the place to restore the user data
+   pointer with @ref rudp_server_peer_data_set, since @tt peer_new
+   server handler is not called for restored peers.
+
+   Group membership, multicast channels, fair queueing settings and
+   AF_XDP sockets are not transferred, new process has to set them
+   up again.  Multipath peers fall back to their first path.  Peers
+   using the @xref {shmproto} {shared memory transport} cannot be
+   handed off.  New process must accept the same codecs as the old
+   one, see @ref rudp_server_add_codec, before receiving peers that
+   use compression.  Session keys of encrypted peers go through the
+   handoff socket, it must not be reachable by other programs.
+   Queued messages sent from user buffers are copied, buffers are
+   released along with the old peers.
+
+   Streamed messages (see @xref {Stream}) and file transfers going on
+   are not transferred.  Old process ends them with @tt ECONNRESET
+   while releasing its peers.  Remote side is not told: a message it
+   was receiving only ends with @tt ECONNABORTED when the next one
+   begins, and the rest of a message it was sending is ignored by the
+   new process.  File transfers may be offered again to resume.
+
+   Sample usage:
+   @code
+    // old process
+    int fd = accept(listen_fd, NULL, NULL);
+    if ( rudp_server_handoff_send(&server, fd, save_peer, ctx) == 0 )
+        exit(0);
+
+    // new process
+    rudp_server_init(&server, rudp, &my_server_handlers);
+    rudp_server_handoff_receive(&server, fd, load_peer, ctx);
+   @end code
+*/
+
+#include <stddef.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_server;
+struct rudp_peer;
+
+/** Maximum size of user data attached to a peer */
+#define RUDP_HANDOFF_USER_SIZE 4096
+
+/**
+   @this is the prototype of a peer user data save callback.
+
+   @param server Server being handed off
+   @param peer Peer to save data of
+   @param buffer Buffer of @ref RUDP_HANDOFF_USER_SIZE bytes
+   @param priv User private pointer
+   @returns the count of bytes written to buffer
+ */
+typedef size_t rudp_handoff_save_func_t(struct rudp_server *server,
+                                        struct rudp_peer *peer,
+                                        void *buffer, void *priv);
+
+/**
+   @this is the prototype of a peer user data load callback.
+
+   @param server Server being restored
+   @param peer Restored peer
+   @param data User data saved for this peer
+   @param size Size of user data
+   @param priv User private pointer
+ */
+typedef void rudp_handoff_load_func_t(struct rudp_server *server,
+                                      struct rudp_peer *peer,
+                                      const void *data, size_t size,
+                                      void *priv);
+
+/**
+   @this hands a bound server over to another process.
+
+   On success, server is left closed and all its peers are released
+   without notifying remote side nor calling @tt peer_dropped server
+   handler.  Server may then be deinitialized.  On error, server is
+   left untouched and keeps running.
+
+   @param server A bound server context
+   @param fd A connected stream Unix socket
+   @param save User data save callback, may be NULL
+   @param priv Private pointer passed to callback
+   @returns 0 on success, EBUSY if a peer uses the shared memory
+            transport, EBADF if server is not bound, or a socket
+            error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_handoff_send(
+    struct rudp_server *server,
+    int fd,
+    rudp_handoff_save_func_t *save,
+    void *priv);
+
+/**
+   @this takes a server over from another process.
+
+   @param server An initialized, unbound server context, without
+          additional addresses
+   @param fd A connected stream Unix socket
+   @param load User data load callback, may be NULL
+   @param priv Private pointer passed to callback
+   @returns 0 on success, EPROTO if transferred state is invalid or
+            comes from an incompatible library, or a socket error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_handoff_receive(
+    struct rudp_server *server,
+    int fd,
+    rudp_handoff_load_func_t *load,
+    void *priv);
+
+#endif
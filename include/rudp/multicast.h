@@ -0,0 +1,287 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_MULTICAST_H_
+/** @hidden */
+#define RUDP_MULTICAST_H_
+
+/**
+   @file
+   @module {Multicast}
+   @short One-to-many multicast channels
+
+   A multicast channel sends data once to an IP multicast group,
+   whatever the count of receivers.  Channel data is sent by a
+   @ref rudp_mcast_sender attached to a server, and received by
+   @ref rudp_mcast_receiver contexts attached to clients of this
+   server.  Both sides agree on a 16-bit channel number.
+
+   Channels are either unreliable (losses are not recovered, packets
+   are delivered as they come, stale ones are dropped) or reliable.
+
+   In reliable mode, receivers detect holes in the channel sequence
+   and ask for the missing packets with a @ref RUDP_CMD_MCAST_NACK
+   packet sent through their usual unicast connection to the server.
+   In order not to flood the server when a loss is shared by many
+   receivers, NACKs are delayed by a random time.  If the missing
+   packet comes in the meantime, no NACK is sent.
+
+   Sender collects the NACKs for some time.  If at least a threshold
+   count of receivers asked for a given packet, it is sent again to
+   the multicast group, else it is repaired through the unicast
+   connection of each requester.  Repaired packets are delivered in
+   order, missing packets are given up after a few retries.
+
+   Sender and receiver contexts use the same @xref {olc} {life cycle}
+   as other complex objects of the library.  They must be deinitialized
+   before their server or client.
+
+   Sample usage:
+   @code
+    // server side
+    struct rudp_mcast_sender sender;
+
+    rudp_mcast_sender_init(&sender, &server, 1);
+    rudp_mcast_sender_open(&sender, group_addr, group_addr_len, 0);
+    rudp_mcast_sender_send(&sender, 0, data, size);
+
+    // client side
+    struct rudp_mcast_receiver receiver;
+
+    rudp_mcast_receiver_init(&receiver, &client, &my_handler, 1, 1);
+    rudp_mcast_receiver_open(&receiver, group_addr, group_addr_len, 0);
+   @end code
+
+   For testing on a single host, multicast may be used on the
+   loopback interface, passing its index (@tt {if_nametoindex("lo")})
+   as interface on both sides.
+*/
+
+#include <rudp/list.h>
+#include <rudp/time.h>
+#include <rudp/address.h>
+#include <rudp/endpoint.h>
+#include <rudp/compiler.h>
+#include <ela/ela.h>
+
+struct rudp_server;
+struct rudp_client;
+struct rudp_mcast_receiver;
+struct rudp_mcast_history;
+struct rudp_mcast_repair;
+struct rudp_mcast_slot;
+
+/**
+   @this is a multicast sender context structure.  User should not
+   use its fields directly.
+
+   @hidecontent
+ */
+struct rudp_mcast_sender
+{
+    struct rudp_server *server;
+    struct rudp_list server_item;
+    struct rudp_endpoint endpoint;
+    struct rudp_address group;
+    struct ela_event_source *repair_source;
+    struct rudp_mcast_history *history;
+    struct rudp_mcast_repair *repair;
+    rudp_time_t repair_delay;
+    unsigned int repair_threshold;
+    uint16_t channel;
+    uint16_t seq;
+    char repair_scheduled;
+};
+
+/**
+   @this initializes a multicast sender.
+
+   @param sender Sender unitialized context structure
+   @param server Server whose peers may ask for repairs
+   @param channel Channel number
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_mcast_sender_init(
+    struct rudp_mcast_sender *sender,
+    struct rudp_server *server,
+    uint16_t channel);
+
+/**
+   @this opens the sending socket of the channel.
+
+   @param sender An initialized sender context
+   @param group Multicast group address and port
+   @param len Size of the address structure
+   @param ifindex Index of the interface to send through, 0 for the
+          system default
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_mcast_sender_open(
+    struct rudp_mcast_sender *sender,
+    const struct sockaddr *group,
+    socklen_t len,
+    unsigned int ifindex);
+
+/**
+   @this sets the repair policy of the channel.
+
+   @param sender An initialized sender context
+   @param threshold Count of requesters from which a lost packet is
+          sent again to the multicast group rather than unicast.
+          Defaults to 2.
+   @param delay Time NACKs are collected for before repairing, in
+          milliseconds.  Defaults to 10.
+ */
+RUDP_EXPORT
+void rudp_mcast_sender_set_repair(
+    struct rudp_mcast_sender *sender,
+    unsigned int threshold,
+    rudp_time_t delay);
+
+/**
+   @this sends data to the channel.
+
+   @param sender Sender context
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Payload
+   @param size Total payload size
+   @returns An error level
+ */
+RUDP_EXPORT
+rudp_error_t rudp_mcast_sender_send(
+    struct rudp_mcast_sender *sender,
+    int command,
+    const void *data, const size_t size);
+
+/**
+   @this closes the sending socket of the channel.  The sender
+   context stays initialized.
+
+   @param sender An open sender context
+ */
+RUDP_EXPORT
+void rudp_mcast_sender_close(struct rudp_mcast_sender *sender);
+
+/**
+   @this frees all internally allocated sender data.
+
+   @param sender An initialized sender context
+ */
+RUDP_EXPORT
+void rudp_mcast_sender_deinit(struct rudp_mcast_sender *sender);
+
+/**
+   Multicast receiver handler code callbacks
+ */
+struct rudp_mcast_receiver_handler
+{
+    /**
+       @this is called for each channel packet, in channel order.
+
+       @param receiver Receiver context
+       @param command User command used
+       @param data Data buffer
+       @param len Useful data length
+     */
+    void (*handle_packet)(
+        struct rudp_mcast_receiver *receiver,
+        int command, const void *data, size_t len);
+
+    /**
+       @this is called when channel packets are definitely lost.  This
+       handler may be NULL.
+
+       @param receiver Receiver context
+       @param count Count of packets lost
+     */
+    void (*packet_lost)(
+        struct rudp_mcast_receiver *receiver,
+        unsigned int count);
+};
+
+/**
+   @this is a multicast receiver context structure.  User should not
+   use its fields directly.
+
+   @hidecontent
+ */
+struct rudp_mcast_receiver
+{
+    const struct rudp_mcast_receiver_handler *handler;
+    struct rudp_client *client;
+    struct rudp_list client_item;
+    struct rudp_endpoint endpoint;
+    struct ela_event_source *nack_source;
+    struct rudp_mcast_slot *slot;
+    rudp_time_t nack_delay;
+    rudp_time_t nack_deadline;
+    uint16_t channel;
+    uint16_t next_seq;
+    uint16_t max_seq;
+    uint8_t reliable;
+    uint8_t started;
+};
+
+/**
+   @this initializes a multicast receiver.
+
+   @param receiver Receiver unitialized context structure
+   @param client Client connected to the server sending the channel
+   @param handler A receiver handler descriptor
+   @param channel Channel number
+   @param reliable Whether to recover lost packets
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_mcast_receiver_init(
+    struct rudp_mcast_receiver *receiver,
+    struct rudp_client *client,
+    const struct rudp_mcast_receiver_handler *handler,
+    uint16_t channel,
+    int reliable);
+
+/**
+   @this joins the multicast group and starts receiving the channel.
+
+   @param receiver An initialized receiver context
+   @param group Multicast group address and port
+   @param len Size of the address structure
+   @param ifindex Index of the interface to join the group on, 0 for
+          the system default
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_mcast_receiver_open(
+    struct rudp_mcast_receiver *receiver,
+    const struct sockaddr *group,
+    socklen_t len,
+    unsigned int ifindex);
+
+/**
+   @this leaves the multicast group.  The receiver context stays
+   initialized.
+
+   @param receiver An open receiver context
+ */
+RUDP_EXPORT
+void rudp_mcast_receiver_close(struct rudp_mcast_receiver *receiver);
+
+/**
+   @this frees all internally allocated receiver data.
+
+   @param receiver An initialized receiver context
+ */
+RUDP_EXPORT
+void rudp_mcast_receiver_deinit(struct rudp_mcast_receiver *receiver);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_MULTIPATH_H_
+/** @hidden */
+#define RUDP_MULTIPATH_H_
+
+/**
+   @file
+   @module {Multipath}
+   @short Connections over several paths
+
+   A client connection may use several paths at once, for instance
+   a wired and a wireless interface.  A path is a pair of local and
+   remote addresses.  First path is the one the client connected
+   on, additional paths are declared with @ref rudp_client_add_path
+   and brought up once connected.  Server must allow multipath
+   connections with @ref rudp_server_set_multipath.
+
+   Each path is probed periodically, which gives its own round-trip
+   time and loss rate estimations.  A path that stops answering is
+   marked down and not used anymore until it answers again.  All
+   the paths share the connection sequence space, so the connection
+   survives the loss of any path, including the first one, as long
+   as one path is up.
+
+   A scheduler chooses the path each packet is sent on, see @ref
+   rudp_path_scheduler.  Server peers use the scheduler chosen by
+   the client.
+
+   Sample usage:
+   @code
+    rudp_client_set_ipv4(&client, &server_ip, port);
+    rudp_client_add_path(&client, (struct sockaddr *)&wifi_ip,
+                         sizeof(wifi_ip), NULL, 0, 1);
+    rudp_client_set_path_scheduler(&client, RUDP_PATH_LOWEST_RTT);
+    rudp_client_connect(&client);
+   @end code
+*/
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <rudp/error.h>
+#include <rudp/time.h>
+#include <rudp/compiler.h>
+
+struct rudp_client;
+struct rudp_server;
+struct rudp_peer;
+
+/** Maximum count of paths of a connection, including the first one */
+#define RUDP_PATH_MAX 4
+
+/**
+   Path schedulers
+ */
+enum rudp_path_scheduler
+{
+    /** Each packet goes on the path with the lowest round-trip time */
+    RUDP_PATH_LOWEST_RTT,
+    /** Packets are spread on paths, in proportion of path weights */
+    RUDP_PATH_WEIGHTED,
+    /** Each packet goes on all the paths */
+    RUDP_PATH_REDUNDANT,
+};
+
+/**
+   Path state, as returned by @ref rudp_client_path_info and @ref
+   rudp_server_path_info.
+ */
+struct rudp_path_info
+{
+    /** Smoothed round-trip time, in milliseconds */
+    rudp_time_t srtt;
+    /** Round-trip time variation, in milliseconds */
+    rudp_time_t rttvar;
+    /** Estimated probe loss rate, in thousandths */
+    unsigned int loss_permille;
+    /** Whether path is answering */
+    int up;
+    /** Count of packets sent on this path */
+    uint64_t packets_out;
+};
+
+/**
+   @this declares an additional path for a client connection.  Path
+   is brought up once client is connected.
+
+   @param client An initialized, not yet connected client
+   @param local Local address to bind path to, may be NULL
+   @param local_len Size of local address
+   @param remote Server address on this path, NULL for the address
+          client connects to
+   @param remote_len Size of remote address
+   @param weight Path weight for @ref RUDP_PATH_WEIGHTED scheduler,
+          0 is handled as 1
+   @returns 0 on success, ENOSPC if client has too many paths,
+            EINVAL for an invalid address
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_add_path(
+    struct rudp_client *client,
+    const struct sockaddr *local, socklen_t local_len,
+    const struct sockaddr *remote, socklen_t remote_len,
+    unsigned int weight);
+
+/**
+   @this chooses the path scheduler of a client.  Default is @ref
+   RUDP_PATH_LOWEST_RTT.  It must be set before connection.
+
+   @param client An initialized client
+   @param scheduler Path scheduler
+ */
+RUDP_EXPORT
+void rudp_client_set_path_scheduler(
+    struct rudp_client *client,
+    enum rudp_path_scheduler scheduler);
+
+/**
+   @this retrieves the state of a path of a connected client.
+
+   @param client A connected client
+   @param path Path index, 0 being the first path
+   @param info Returned path state
+   @returns 0 on success, ENOENT if there is no such path
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_path_info(
+    struct rudp_client *client,
+    unsigned int path,
+    struct rudp_path_info *info);
+
+/**
+   @this allows clients of a server to use multipath connections.
+   Disabled by default.
+
+   @param server An initialized server context structure
+   @param enable Whether to accept multipath connections
+ */
+RUDP_EXPORT
+void rudp_server_set_multipath(
+    struct rudp_server *server,
+    int enable);
+
+/**
+   @this retrieves the state of a path to a server peer.
+
+   @param server Server context this peer belongs to
+   @param peer Peer context
+   @param path Path index, 0 being the first path
+   @param info Returned path state
+   @returns 0 on success, ENOENT if there is no such path
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_path_info(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    unsigned int path,
+    struct rudp_path_info *info);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_MUX_H_
+/** @hidden */
+#define RUDP_MUX_H_
+
+/**
+   @file
+   @module {Mux}
+   @short Many clients sharing one socket
+
+   By default, each client context opens and binds its own socket.
+   Programs opening many outgoing connections may rather have them
+   share the socket of a client multiplexer: clients are attached to
+   it with @ref rudp_client_set_mux before they connect, and incoming
+   packets are dispatched to them by source address.
+
+   As a server tells connections apart by their source address, a
+   multiplexer may only carry one connection to a given server.
+   Connecting a second client to the same server through the same
+   multiplexer fails with EADDRINUSE, another multiplexer must be
+   used.
+
+   Sending to many clients of a multiplexer can be done in a batch,
+   between calls to @ref rudp_client_mux_batch_begin and @ref
+   rudp_client_mux_batch_flush, see @xref {Endpoint}.
+
+   Multiplexer contexts use the same @xref {olc} {life cycle} as
+   other complex objects of the library.  Before use, multiplexer
+   contexts must be initialized with @ref rudp_client_mux_init, and
+   after use, they must be cleaned with @ref rudp_client_mux_deinit.
+   Attached clients must be closed before their multiplexer.
+
+   Sample usage:
+   @code
+    struct rudp_client_mux mux;
+
+    rudp_client_mux_init(&mux, &rudp);
+    rudp_client_mux_set_ipv4(&mux, &any, 0);
+    rudp_client_mux_bind(&mux);
+
+    for ( i = 0; i < count; ++i ) {
+        rudp_client_init(&clients[i], &rudp, &handler);
+        rudp_client_set_ipv4(&clients[i], &servers[i], port);
+        rudp_client_set_mux(&clients[i], &mux);
+        rudp_client_connect(&clients[i]);
+    }
+   @end code
+*/
+
+#include <rudp/endpoint.h>
+#include <rudp/list.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_client;
+
+/** Count of buckets of the client lookup table */
+#define RUDP_CLIENT_MUX_BUCKETS 256
+
+/**
+   @this is a client multiplexer context structure.  User should not
+   use its fields directly.
+
+   @hidecontent
+ */
+struct rudp_client_mux
+{
+    struct rudp_endpoint endpoint;
+    struct rudp *rudp;
+    struct rudp_list bucket[RUDP_CLIENT_MUX_BUCKETS];
+    unsigned int client_count;
+};
+
+/**
+   @this initializes a client multiplexer context.
+
+   @param mux Multiplexer uninitialized context structure
+   @param rudp A valid rudp context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_mux_init(struct rudp_client_mux *mux,
+                                  struct rudp *rudp);
+
+/**
+   @this specifies an IPv4 address to bind the shared socket to.
+
+   @param mux An initialized multiplexer context
+   @param address Local address, may be INADDR_ANY
+   @param port Local port, may be 0
+ */
+RUDP_EXPORT
+void rudp_client_mux_set_ipv4(struct rudp_client_mux *mux,
+                              const struct in_addr *address,
+                              const uint16_t port);
+
+/**
+   @this specifies an address to bind the shared socket to, IPv6
+   addresses must be given this way.
+
+   @param mux An initialized multiplexer context
+   @param addr Address to bind to
+   @param addrlen Size of address
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_mux_set_addr(struct rudp_client_mux *mux,
+                                      const struct sockaddr *addr,
+                                      socklen_t addrlen);
+
+/**
+   @this makes the shared socket reach both IPv4 and IPv6 servers.
+   It must be called before @ref rudp_client_mux_bind, with an IPv6
+   address set, see @xref {dualstack}.
+
+   @param mux An initialized multiplexer context
+   @param enable Whether to reach IPv4 servers from an IPv6 socket
+ */
+RUDP_EXPORT
+void rudp_client_mux_set_dualstack(struct rudp_client_mux *mux,
+                                   int enable);
+
+/**
+   @this binds the shared socket.  Attached clients may connect
+   afterwards.
+
+   @param mux An initialized multiplexer context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_mux_bind(struct rudp_client_mux *mux);
+
+/**
+   @this closes the shared socket.  All attached clients must be
+   closed before.
+
+   @param mux A bound multiplexer context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_mux_close(struct rudp_client_mux *mux);
+
+/**
+   @this frees all internal data of a multiplexer context.
+
+   @param mux An initialized and unbound multiplexer context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_mux_deinit(struct rudp_client_mux *mux);
+
+/**
+   @this makes a client use the socket of a multiplexer instead of
+   its own.  It must be called before @ref rudp_client_connect, and
+   applies to subsequent connections.
+
+   @param client An initialized and unconnected client context
+   @param mux Multiplexer to use, NULL to use an own socket again
+   @returns 0 on success, EBUSY if the client is connected
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_set_mux(struct rudp_client *client,
+                                 struct rudp_client_mux *mux);
+
+/**
+   @this starts a batch of outgoing packets on the shared socket.
+   Packets sent by attached clients until the matching @ref
+   rudp_client_mux_batch_flush go out with as few system calls as
+   possible.
+
+   @param mux A bound multiplexer context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_mux_batch_begin(struct rudp_client_mux *mux);
+
+/**
+   @this ends a batch started with @ref rudp_client_mux_batch_begin.
+
+   @param mux A bound multiplexer context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_mux_batch_flush(struct rudp_client_mux *mux);
+
+#endif
@@ -113,6 +113,120 @@ enum rudp_command
      */
     RUDP_CMD_PONG = 5,
 
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item mcast_data.
+       @item Semantic @item Multicast channel data, either sent to
+                            the multicast group, or repaired through
+                            an unicast connection
+       @item Expected answer @item None
+       @item Notes @item Must not be RELIABLE.
+       @end table
+     */
+    RUDP_CMD_MCAST_DATA = 6,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item mcast_nack.
+       @item Semantic @item Multicast channel packets are missing
+       @item Expected answer @item Matching mcast_data packets, either
+                                   unicast or multicast
+       @item Notes @item Must not be RELIABLE.
+       @end table
+     */
+    RUDP_CMD_MCAST_NACK = 7,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item shm_offer.
+       @item Semantic @item Proposes a same-host shared memory
+                            transport
+       @item Expected answer @item shm_accept
+       @item Notes @item Must be RELIABLE.
+       @end table
+     */
+    RUDP_CMD_SHM_OFFER = 8,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item shm_accept.
+       @item Semantic @item Answers SHM_OFFER
+       @item Expected answer @item None
+       @item Notes @item Must be RELIABLE.
+       @end table
+     */
+    RUDP_CMD_SHM_ACCEPT = 9,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item path_token.
+       @item Semantic @item Announces a multipath connection token
+       @item Expected answer @item None
+       @item Notes @item Must be RELIABLE.
+       @end table
+     */
+    RUDP_CMD_PATH_TOKEN = 10,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item path_probe.
+       @item Semantic @item Adds a path to a multipath connection
+       @item Expected answer @item path_probe_ack
+       @item Notes @item Not sequenced, sent on the new path.
+       @end table
+     */
+    RUDP_CMD_PATH_JOIN = 11,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item path_probe.
+       @item Semantic @item Measures a path of a multipath connection
+       @item Expected answer @item path_probe_ack
+       @item Notes @item Not sequenced, sent on the probed path.
+       @end table
+     */
+    RUDP_CMD_PATH_PROBE = 12,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item path_probe.
+       @item Semantic @item Answers PATH_JOIN or PATH_PROBE
+       @item Expected answer @item None
+       @item Notes @item Not sequenced, sent back on the same path.
+       @end table
+     */
+    RUDP_CMD_PATH_PROBE_ACK = 13,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item bundle
+       @item Semantic @item Carries several packets in one datagram
+       @item Expected answer @item As for each carried packet
+       @item Notes @item Not sequenced, carried packets are.
+       @end table
+     */
+    RUDP_CMD_BUNDLE = 14,
+
+    /**
+       @table 2
+       @item @item
+       @item Relevant field @item sealed
+       @item Semantic @item Carries an encrypted packet
+       @item Expected answer @item As for the carried packet
+       @item Notes @item Not sequenced, carried packet is.
+       @end table
+     */
+    RUDP_CMD_SEALED = 15,
+
     /**
        @table 2
        @item @item
@@ -139,6 +253,26 @@ enum rudp_command
     Packet was retransmitted at least once. */
 #define RUDP_OPT_RETRANSMITTED 4
 
+/** @mgroup{Flags}
+    Packet data is compressed with the codec agreed on at connection
+    (@xref {codecproto}). */
+#define RUDP_OPT_COMPRESSED 8
+
+/** @mgroup{Flags}
+    Mask of the shard tag (@xref {shardproto}).  Not a flag, 0 when
+    untagged. */
+#define RUDP_OPT_SHARD_MASK 0x70
+
+/** @mgroup{Flags}
+    Position of the shard tag in options */
+#define RUDP_OPT_SHARD_SHIFT 4
+
+/** @mgroup{Flags}
+    Packet is a fragment of a streamed message, its data starts with
+    the rest of a @ref rudp_packet_stream header (@xref
+    {streamproto}). */
+#define RUDP_OPT_STREAM 0x80
+
 #define RUDP_CMD_APP_MAX (0xff - RUDP_CMD_APP)
 
 /**
@@ -172,6 +306,39 @@ struct rudp_packet_conn_rsp
     uint32_t accepted;
 };
 
+/** @mgroup{Connection options}
+    Codec offer or choice (@xref {codecproto}) */
+#define RUDP_CONN_OPT_CODEC 1
+
+/** @mgroup{Connection options}
+    X25519 public key (@xref {cryptoproto}) */
+#define RUDP_CONN_OPT_KEY 2
+
+/** @mgroup{Connection options}
+    Shard tag, one byte (@xref {shardproto}) */
+#define RUDP_CONN_OPT_SHARD 3
+
+/**
+   Connection option, connection request and response packets may be
+   followed by options.  Unknown options are ignored.
+ */
+struct rudp_conn_option
+{
+    uint8_t type;
+    uint8_t len;
+    uint8_t value[0];
+};
+
+/**
+   Value of a @ref #RUDP_CONN_OPT_CODEC option.
+ */
+struct rudp_conn_option_codec
+{
+    uint8_t codec;
+    uint8_t reserved[3];
+    uint32_t dict_id;
+};
+
 /**
    Data packet (@xref {protocol}).
  */
@@ -181,6 +348,146 @@ struct rudp_packet_data
     uint8_t data[0];
 };
 
+/** @mgroup{Stream flags}
+    First fragment of a streamed message */
+#define RUDP_STREAM_BEGIN 1
+
+/** @mgroup{Stream flags}
+    Last fragment of a streamed message */
+#define RUDP_STREAM_END 2
+
+/** @mgroup{Stream flags}
+    Packet belongs to the transfer of file @tt id (@xref
+    {transferproto}), first fragment of its data may start past 0 */
+#define RUDP_STREAM_FILE 4
+
+/** @mgroup{Stream flags}
+    File offer, with file size */
+#define RUDP_STREAM_OFFER 8
+
+/** @mgroup{Stream flags}
+    File offer answer, with the offset data is wanted from.  An offset
+    equal to file size means receiver has the whole file. */
+#define RUDP_STREAM_ACCEPT 16
+
+/** @mgroup{Stream flags}
+    File offer answer when there is no receiver for this file, or
+    transfer abandoned by either side */
+#define RUDP_STREAM_REFUSE 32
+
+/**
+   Streamed message fragment packet (@xref {streamproto}).  Sizes are
+   64-bit big-endian values, file identifier is 32-bit big-endian, 0
+   for user messages.
+ */
+struct rudp_packet_stream
+{
+    struct rudp_packet_header header;
+    uint8_t flags;
+    uint8_t reserved[3];
+    uint32_t id;
+    uint8_t size[8];
+    uint8_t offset[8];
+    uint8_t data[0];
+};
+
+/**
+   Multicast channel data packet (@xref {multicast}).
+ */
+struct rudp_packet_mcast_data
+{
+    struct rudp_packet_header header;
+    uint16_t channel;
+    uint16_t seq;
+    uint8_t command;
+    uint8_t reserved;
+    uint8_t data[0];
+};
+
+/**
+   Multicast channel negative acknowledge packet (@xref {multicast}).
+ */
+struct rudp_packet_mcast_nack
+{
+    struct rudp_packet_header header;
+    uint16_t channel;
+    uint16_t count;
+    uint16_t seq[0];
+};
+
+/** Size of the shared memory segment name field */
+#define RUDP_SHM_NAME_SIZE 32
+
+/**
+   Shared memory transport offer packet (@xref {shmproto}).
+ */
+struct rudp_packet_shm_offer
+{
+    struct rudp_packet_header header;
+    uint32_t token;
+    uint32_t ring_size;
+    char name[RUDP_SHM_NAME_SIZE];
+};
+
+/**
+   Shared memory transport offer answer packet (@xref {shmproto}).
+ */
+struct rudp_packet_shm_accept
+{
+    struct rudp_packet_header header;
+    uint32_t token;
+    uint32_t accepted;
+};
+
+/** Size of the multipath connection token */
+#define RUDP_PATH_TOKEN_SIZE 8
+
+/**
+   Multipath token announce packet (@xref {mpathproto}).
+ */
+struct rudp_packet_path_token
+{
+    struct rudp_packet_header header;
+    uint8_t token[RUDP_PATH_TOKEN_SIZE];
+    uint8_t scheduler;
+    uint8_t reserved[3];
+};
+
+/**
+   Multipath join, probe and probe answer packet (@xref {mpathproto}).
+ */
+struct rudp_packet_path_probe
+{
+    struct rudp_packet_header header;
+    uint8_t token[RUDP_PATH_TOKEN_SIZE];
+    uint8_t path;
+    uint8_t reserved[3];
+    uint32_t timestamp;
+};
+
+/**
+   Bundle packet (@xref {bundleproto}).  Header is followed by
+   records, each made of a 16-bit packet size and a whole packet.
+ */
+struct rudp_packet_bundle
+{
+    struct rudp_packet_header header;
+    uint8_t records[0];
+};
+
+/**
+   Sealed packet (@xref {cryptoproto}).  Header is followed by the
+   encrypted packet and a 16-byte authentication tag.
+ */
+struct rudp_packet_sealed
+{
+    uint8_t command;
+    uint8_t opt;
+    uint8_t reserved[2];
+    uint8_t counter[8];
+    uint8_t data[0];
+};
+
 /**
    Structure factoring all the possible packet types.
  */
@@ -191,9 +498,51 @@ struct rudp_packet
         struct rudp_packet_conn_req conn_req;
         struct rudp_packet_conn_rsp conn_rsp;
         struct rudp_packet_data data;
+        struct rudp_packet_stream stream;
+        struct rudp_packet_mcast_data mcast_data;
+        struct rudp_packet_mcast_nack mcast_nack;
+        struct rudp_packet_shm_offer shm_offer;
+        struct rudp_packet_shm_accept shm_accept;
+        struct rudp_packet_path_token path_token;
+        struct rudp_packet_path_probe path_probe;
+        struct rudp_packet_bundle bundle;
+        struct rudp_packet_sealed sealed;
     };
 };
 
+/**
+   @this is the prototype of a user buffer release callback, see
+   @ref rudp_client_send_buffer and @ref rudp_server_send_buffer.
+   Library does not reference buffer anymore, user may reuse or free
+   it.
+
+   @param data User buffer
+   @param size Size of user buffer
+   @param priv User private pointer
+ */
+typedef void rudp_buffer_done_func_t(const void *data, size_t size,
+                                     void *priv);
+
+/**
+   Shared payload structure.  A payload is reference counted and may
+   be attached to many packet chains at once, it is sent right after
+   the packet data of each of them.  It is released when its last
+   reference goes away.
+ */
+struct rudp_payload
+{
+    const void *data;
+    size_t len;
+    unsigned int refcount;
+    /** Packet chain holding data, freed along with payload, if any */
+    struct rudp_packet_chain *chain;
+    /** Called on release for user-owned data, if any */
+    rudp_buffer_done_func_t *done;
+    void *done_priv;
+    /** Data is a copy following the structure, freed along with it */
+    uint8_t copied;
+};
+
 /**
    Packet chain structure
  */
@@ -203,6 +552,12 @@ struct rudp_packet_chain
     struct rudp_packet *packet;
     size_t alloc_size;
     size_t len;
+    /** Optional shared payload, sent after @tt len bytes of @tt packet */
+    struct rudp_payload *payload;
+    /** Count of zero-copy sends kernel may still read chain for */
+    uint16_t pinned;
+    /** Chain was freed while pinned, it goes on last completion */
+    uint8_t orphan;
 };
 
 /**
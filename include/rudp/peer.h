@@ -44,6 +44,15 @@ struct rudp_endpoint;
 struct rudp_link_info;
 struct rudp_packet_header;
 struct rudp_packet_chain;
+struct rudp_egress;
+struct rudp_stats_peer;
+struct rudp_shm;
+struct rudp_mpath;
+struct rudp_redundancy_queue;
+struct rudp_codec;
+struct rudp_crypto;
+struct rudp_crypto_policy;
+struct rudp_stream;
 
 /**
    Peer handler code callbacks
@@ -84,6 +93,54 @@ struct rudp_peer_handler
        @param peer Peer context
      */
     void (*dropped)(struct rudp_peer *peer);
+
+    /**
+       @this is called on reception of a library extension packet
+       (e.g. @ref RUDP_CMD_MCAST_DATA or @ref RUDP_CMD_MCAST_NACK),
+       once it is sequenced.  This handler may be NULL, extension
+       packets are ignored then.
+
+       Packet chain ownership is not given to handler, handler must
+       copy data and forget the chain afterwards.
+
+       @param peer Peer context
+       @param packet Packet descriptor structure
+     */
+    void (*handle_command)(
+        struct rudp_peer *peer,
+        struct rudp_packet_chain *packet);
+
+    /**
+       @this is called when a streamed message starts (@xref
+       {Stream}).  Stream handlers may be NULL, streamed messages
+       are ignored then.
+
+       @param peer Peer context
+       @param command User command used
+       @param size Total message size
+     */
+    void (*stream_begin)(struct rudp_peer *peer, int command, uint64_t size);
+
+    /**
+       @this is called for each fragment of a streamed message, in
+       order.
+
+       @param peer Peer context
+       @param offset Offset of data in message
+       @param data Fragment data
+       @param len Fragment data length
+     */
+    void (*stream_chunk)(struct rudp_peer *peer, uint64_t offset,
+                         const void *data, size_t len);
+
+    /**
+       @this is called when a streamed message ends.
+
+       @param peer Peer context
+       @param err 0 if the message is complete, or the reason it is
+              not
+     */
+    void (*stream_end)(struct rudp_peer *peer, rudp_error_t err);
 };
 
 /**
@@ -118,11 +175,31 @@ struct rudp_peer
     uint16_t out_seq_acked;
     uint8_t must_ack:1;
     uint8_t scheduled:1;
+    uint8_t egress_active:1;
+    uint8_t egress_rexmit:1;
+    uint8_t shm_accept:1;
+    uint8_t mpath_accept:1;
+    uint8_t codec_active:1;
+    uint8_t codec_accept_count;
+    uint8_t shard_tag;
     uint8_t state;
     struct rudp_list sendq;
     struct rudp *rudp;
     struct ela_event_source *service_source;
     rudp_error_t sendto_err;
+    struct rudp_egress *egress;
+    struct rudp_list egress_item;
+    uint32_t egress_weight;
+    int32_t egress_deficit;
+    struct rudp_stats_peer *stats;
+    struct rudp_shm *shm;
+    struct rudp_mpath *mpath;
+    struct rudp_redundancy_queue *redundancy;
+    const struct rudp_codec *codec;
+    const struct rudp_codec *const *codec_accept;
+    struct rudp_crypto *crypto;
+    const struct rudp_crypto_policy *crypto_policy;
+    struct rudp_stream *stream;
 };
 
 /**
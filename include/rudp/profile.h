@@ -0,0 +1,149 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_PROFILE_H_
+/** @hidden */
+#define RUDP_PROFILE_H_
+
+/**
+   @file
+   @module {Profile}
+   @short Packet pipeline CPU cost accounting
+
+   When enabled, the library accumulates the CPU time spent in each
+   stage of the packet pipeline, measured with the processor cycle
+   counter (the time stamp counter on x86, a monotonic nanosecond
+   clock elsewhere).
+
+   Stages nest (e.g. user packet handler is called from protocol
+   processing, and may send packets).  Time is accounted exclusively:
+   time spent in a nested stage is not counted in the calling stage.
+   This tells apart the kernel (@ref RUDP_STAGE_RECV and @ref
+   RUDP_STAGE_SEND), the library and the application (@ref
+   RUDP_STAGE_APP).
+
+   When disabled (default), cost is a pointer test per stage.
+
+   Sample usage:
+   @code
+    struct rudp_profile_report report;
+
+    rudp_profile_enable(&rudp);
+
+    // run for a while
+
+    rudp_profile_report(&rudp, &report);
+    for ( i = 0; i < RUDP_STAGE_COUNT; ++i )
+        printf("%s: %llu calls, %llu cycles\n",
+               rudp_profile_stage_name(i),
+               report.stage[i].calls, report.stage[i].cycles);
+   @end code
+*/
+
+#include <stdint.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp;
+
+/**
+   @this defines the instrumented pipeline stages.
+ */
+enum rudp_profile_stage
+{
+    /** Reception system call */
+    RUDP_STAGE_RECV,
+    /** Lookup of the peer a packet comes from */
+    RUDP_STAGE_LOOKUP,
+    /** Protocol processing of incoming packets */
+    RUDP_STAGE_PROTOCOL,
+    /** User packet handlers */
+    RUDP_STAGE_APP,
+    /** Send queue processing */
+    RUDP_STAGE_SEND_QUEUE,
+    /** Transmission system calls */
+    RUDP_STAGE_SEND,
+    /** Count of stages */
+    RUDP_STAGE_COUNT,
+};
+
+/**
+   @this is the accounting of one stage.
+ */
+struct rudp_profile_stage_report
+{
+    /** Count of times the stage was entered */
+    uint64_t calls;
+    /** Cycles spent in the stage, excluding nested stages */
+    uint64_t cycles;
+};
+
+/**
+   @this is a profile report.
+ */
+struct rudp_profile_report
+{
+    /** Per-stage accounting, indexed by @ref rudp_profile_stage */
+    struct rudp_profile_stage_report stage[RUDP_STAGE_COUNT];
+    /** Cycles elapsed since profiling was enabled or reset */
+    uint64_t elapsed_cycles;
+    /** Measured cycle counter frequency, in cycles per microsecond */
+    uint64_t cycles_per_usec;
+};
+
+/**
+   @this enables pipeline profiling.  Counters start from 0.
+
+   @param rudp An initialized rudp context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_profile_enable(struct rudp *rudp);
+
+/**
+   @this disables pipeline profiling and discards counters.  This is
+   also done by @ref rudp_deinit.
+
+   @param rudp A rudp context
+ */
+RUDP_EXPORT
+void rudp_profile_disable(struct rudp *rudp);
+
+/**
+   @this resets profile counters.
+
+   @param rudp A rudp context with profiling enabled
+ */
+RUDP_EXPORT
+void rudp_profile_reset(struct rudp *rudp);
+
+/**
+   @this retrieves the current profile counters.
+
+   @param rudp A rudp context with profiling enabled
+   @param report (out) Report structure
+   @returns a possible error, EINVAL if profiling is disabled
+ */
+RUDP_EXPORT
+rudp_error_t rudp_profile_report(
+    struct rudp *rudp,
+    struct rudp_profile_report *report);
+
+/**
+   @this retrieves a stage name, for display purposes.
+
+   @param stage A stage
+   @returns a constant string
+ */
+RUDP_EXPORT
+const char *rudp_profile_stage_name(enum rudp_profile_stage stage);
+
+#endif
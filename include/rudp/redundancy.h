@@ -0,0 +1,131 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_REDUNDANCY_H_
+/** @hidden */
+#define RUDP_REDUNDANCY_H_
+
+/**
+   @file
+   @module {Redundancy}
+   @short Redundant sending of critical messages
+
+   Small latency-critical messages, like input events, may be sent
+   more than once instead of waiting for a retransmit when they get
+   lost.  This trades bandwidth for latency, and makes the effective
+   loss rate drop close to zero.
+
+   Two modes exist, they may be combined:
+   @list
+     @item @ref RUDP_REDUNDANCY_COPIES sends copies of the message,
+       spaced in time, so that a burst of losses does not take all
+       of them,
+     @item @ref RUDP_REDUNDANCY_BUNDLE carries the message again in
+       the next datagrams sent to the peer (data, acks, ...), see
+       @xref {bundleproto}.
+   @end list
+
+   Copies are exact duplicates of the original packet, receiver
+   drops extra ones with the usual sequence checks.  Copies of a
+   reliable message stop as soon as it is acknowledged.
+
+   Redundancy is not used while peers talk through the
+   @xref {shmproto} {shared memory transport}, which is lossless.
+
+   Sample usage:
+   @code
+    static const struct rudp_redundancy input_redundancy = {
+        .mode = RUDP_REDUNDANCY_COPIES | RUDP_REDUNDANCY_BUNDLE,
+        .copies = 2,
+        .spacing = 5,
+    };
+
+    rudp_client_send_redundant(&client, 1, CMD_INPUT,
+                               &event, sizeof(event),
+                               &input_redundancy);
+   @end code
+*/
+
+#include <stdlib.h>
+#include <rudp/error.h>
+#include <rudp/time.h>
+#include <rudp/compiler.h>
+
+struct rudp_client;
+struct rudp_server;
+struct rudp_peer;
+
+/** @mgroup{Redundancy modes}
+    Message is sent again after some time. */
+#define RUDP_REDUNDANCY_COPIES 1
+
+/** @mgroup{Redundancy modes}
+    Message is carried again by the next datagrams sent to the peer. */
+#define RUDP_REDUNDANCY_BUNDLE 2
+
+/** Maximum count of additional transmissions of a message */
+#define RUDP_REDUNDANCY_MAX_COPIES 8
+
+/**
+   Redundancy parameters of a message.
+ */
+struct rudp_redundancy
+{
+    /** A mask of @xref {Redundancy modes} */
+    unsigned int mode;
+    /** Count of additional transmissions in each mode, up to @ref
+        RUDP_REDUNDANCY_MAX_COPIES */
+    unsigned int copies;
+    /** Time between copies, in milliseconds */
+    rudp_time_t spacing;
+};
+
+/**
+   @this sends data to remote server, with redundancy.
+
+   @param client Source client
+   @param reliable Whether to send the payload reliably
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Payload
+   @param size Total payload size
+   @param redundancy Redundancy parameters, NULL for none
+
+   @returns An error level
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_send_redundant(
+    struct rudp_client *client,
+    int reliable, int command,
+    const void *data, const size_t size,
+    const struct rudp_redundancy *redundancy);
+
+/**
+   @this sends data from this server to a peer, with redundancy.
+
+   @param server Source server
+   @param peer Destination peer
+   @param reliable Whether to send the payload reliably
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Payload
+   @param size Total payload size
+   @param redundancy Redundancy parameters, NULL for none
+
+   @returns An error level
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_send_redundant(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    int reliable, int command,
+    const void *data, const size_t size,
+    const struct rudp_redundancy *redundancy);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_RELAY_H_
+/** @hidden */
+#define RUDP_RELAY_H_
+
+/**
+   @file
+   @module {Relay}
+   @short Server-side packet relaying
+
+   A server may forward packets it receives from a peer to other
+   peers, like a TURN relay.  From the @tt handle_packet server
+   handler, user code calls @ref rudp_server_relay or @ref
+   rudp_server_relay_many, and the packet being handled goes on to
+   its destinations with the same command and payload.
+
+   Relaying does not copy the payload: the receive buffer is kept
+   and only the packet header is rewritten for the destination
+   connection.  When the packet goes to several peers, they all
+   share the same buffer, see @ref rudp_server_group_send.  Receive
+   buffers that can not be kept (e.g. on @xref {XDP} endpoints) are
+   copied once.
+
+   A packet may only be relayed once.  After that, payload pointer
+   passed to the handler must not be used anymore.
+
+   Sample usage:
+   @code
+    static void handle_packet(struct rudp_server *server,
+                              struct rudp_peer *peer, int command,
+                              const void *data, size_t len)
+    {
+        struct rudp_peer *dest = lookup_destination(data, len);
+
+        rudp_server_relay(server, dest, 1);
+    }
+   @end code
+*/
+
+#include <stdlib.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_server;
+struct rudp_peer;
+
+/**
+   @this forwards the packet being handled to another peer.  It must
+   be called from the @tt handle_packet server handler.
+
+   @param server Server context
+   @param peer Destination peer
+   @param reliable Whether to forward the packet reliably
+   @returns 0 on success, EINVAL if no packet is being handled or it
+            was already relayed, ENOMEM
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_relay(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    int reliable);
+
+/**
+   @this forwards the packet being handled to a set of peers.  It
+   must be called from the @tt handle_packet server handler.
+
+   @param server Server context
+   @param peers Destination peers
+   @param count Count of destination peers
+   @param reliable Whether to forward the packet reliably
+   @returns 0 on success, EINVAL if no packet is being handled or it
+            was already relayed, ENOMEM
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_relay_many(
+    struct rudp_server *server,
+    struct rudp_peer *const *peers,
+    size_t count,
+    int reliable);
+
+#endif
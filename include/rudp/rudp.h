@@ -38,7 +38,9 @@
 
    Memory allocation is handler through alloc/free-like functions.
 
-   @see rudp_handler for functions to implement.
+   @see rudp_handler for functions to implement.  Pool and bump
+   allocators are provided in @ref rudp_pool_allocator and @ref
+   rudp_bump_allocator.
 
    Librudp provides sane defaults for the needed handlers, not
    reporting any log messages, and using @tt malloc and @tt free from
@@ -83,6 +85,10 @@ enum rudp_log_level
 };
 
 struct rudp;
+struct rudp_stats;
+struct rudp_profile;
+struct rudp_arena;
+struct rudp_packet_chain;
 
 /**
    Master state handler code callbacks
@@ -122,6 +128,18 @@ struct rudp_handler
        @param buffer Previously allocated buffer to release
      */
     void (*mem_free)(struct rudp *rudp, void *buffer);
+
+    /**
+       @this is called instead of @tt mem_free when not NULL.  It
+       gets the size asked for when the buffer was allocated, so that
+       allocators need not record it.  @tt mem_free may then be
+       NULL.
+
+       @param rudp The rudp context
+       @param buffer Previously allocated buffer to release
+       @param size Size of buffer, as passed to @tt mem_alloc
+     */
+    void (*mem_free_sized)(struct rudp *rudp, void *buffer, size_t size);
 };
 
 extern const struct rudp_handler rudp_handler_default;
@@ -147,9 +165,18 @@ struct rudp
     const struct rudp_handler *handler;
     struct ela_el *el;
     struct rudp_list free_packet_list;
+    struct rudp_list free_large_list;
+    struct rudp_list file_sender_list;
+    struct rudp_list file_receiver_list;
+    struct rudp_stats *stats;
+    struct rudp_profile *profile;
+    struct rudp_arena *arena;
+    struct rudp_packet_chain *rx_chain;
+    void *rx_overflow;
     unsigned int seed;
-    uint16_t allocated_packets;
-    uint16_t free_packets;
+    uint32_t allocated_packets;
+    uint32_t free_packets;
+    uint16_t free_large_packets;
 };
 
 /**
@@ -40,6 +40,21 @@
    bound with @ref rudp_server_bind.  After successful binding, the
    server waits for clients and data packets.
 
+   A server may listen on more addresses or ports, declared with @ref
+   rudp_server_add_addr.  All peers share the same table, whatever
+   the address they reached, and answers always go through the socket
+   a peer first talked to.
+
+   @label {dualstack}
+
+   A server bound to an IPv6 address may also serve IPv4 clients on
+   the same socket, see @ref rudp_server_set_dualstack.  The system
+   shows them as IPv4-mapped IPv6 addresses (@tt {::ffff:a.b.c.d}).
+   The library turns these to plain IPv4 addresses on reception, and
+   back on sending, so that all peers share one table and a given
+   client always has the same address, whatever the socket it comes
+   through.
+
    @label {peer_user_data}
 
    User code may store an user-handled user data pointer inside the
@@ -70,11 +85,15 @@
 #include <rudp/list.h>
 #include <rudp/endpoint.h>
 #include <rudp/packet.h>
+#include <rudp/egress.h>
+#include <rudp/codec.h>
+#include <rudp/crypto.h>
 #include <rudp/compiler.h>
 #include <ela/ela.h>
 
 struct rudp_server;
 struct rudp_link_info;
+struct rudp_server_stream_handler;
 struct rudp_peer;
 
 /**
@@ -161,13 +180,33 @@ struct rudp_server_handler
 struct rudp_server
 {
     const struct rudp_server_handler *handler;
+    const struct rudp_server_stream_handler *stream_handler;
     struct rudp_list peer_list;
+    struct rudp_list mcast_list;
+    struct rudp_list listener_list;
     struct rudp_endpoint endpoint;
+    struct rudp_egress egress;
     struct rudp *rudp;
+    struct rudp_packet_chain *relay_chain;
+    struct rudp_peer *new_peer;
+    const struct rudp_codec *codec[RUDP_CODEC_ACCEPT_MAX];
+    uint8_t codec_count;
+    struct rudp_crypto_policy crypto;
+    char fair_queueing;
+    char shm;
+    char multipath;
+    uint8_t shard_index;
+    uint8_t shard_count;
+    uint8_t shard_steering;
+    int shard_cpu;
 };
 
 struct rudp_peer;
 
+/** Maximum count of addresses a server listens on, see @ref
+    rudp_server_add_addr */
+#define RUDP_SERVER_LISTENER_MAX 16
+
 /**
    @this initializes the server context.
 
@@ -251,6 +290,25 @@ rudp_error_t rudp_server_set_addr(
     const struct sockaddr *addr,
     socklen_t addrlen);
 
+/**
+   @this adds an address the server listens on, along with the main
+   one.  Each address gets its own socket, bound with the server, or
+   right away if the server is already bound.  Socket options (e.g.
+   @ref rudp_server_set_dualstack) apply to all of them.
+
+   @param server An initialized server context structure
+   @param addr IPv4 or IPv6 address to use
+   @param addrlen Size of the address structure
+   @returns 0 on success, ENOSPC if there are @ref
+            RUDP_SERVER_LISTENER_MAX addresses already, ENOMEM, or
+            a binding error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_add_addr(
+    struct rudp_server *server,
+    const struct sockaddr *addr,
+    socklen_t addrlen);
+
 /**
    @this specifies an IPv4 address to bind to.  @see
    rudp_address_set_ipv4 for details.
@@ -302,6 +360,36 @@ rudp_error_t rudp_server_send(
     int reliable, int command,
     const void *data, const size_t size);
 
+/**
+   @this sends data from this server to a peer without copying it.
+
+   Library references the user buffer until it does not need it
+   anymore: once the message is acknowledged when reliable, once it
+   is sent otherwise, or when the peer is dropped first.  It then
+   calls @tt done, which may happen before this function returns.
+   Buffer must not change until then.
+
+   @param server Source server
+   @param peer Destination peer
+   @param reliable Whether to send the payload reliably
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Payload
+   @param size Total packet size
+   @param done Function called when buffer is released
+   @param priv User private pointer passed to @tt done
+   @returns 0 once the message is queued, or the last socket error,
+   as the other send functions do.  Message is queued in both cases,
+   @tt done is then always called eventually.  On EINVAL or ENOMEM,
+   buffer is not referenced and @tt done is never called.
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_send_buffer(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    int reliable, int command,
+    const void *data, size_t size,
+    rudp_buffer_done_func_t *done, void *priv);
+
 /**
    @this sends data from this server to all peers.
 
@@ -346,6 +434,67 @@ void rudp_server_peer_data_set(
     struct rudp_peer *peer,
     void *data);
 
+/**
+   @this enables or disables fair queueing of the packets sent to
+   server peers.  When enabled, peers with a backlog are served in
+   turn by an @xref {Egress} {egress scheduler}, optionally limited
+   to a global rate.  When disabled (default), each peer sends its
+   packets as soon as possible.
+
+   @param server An initialized server context structure
+   @param enable Whether to enable fair queueing
+   @param bytes_per_sec Global rate limit, 0 for none.  Only
+          enforced when fair queueing is enabled.
+ */
+RUDP_EXPORT
+void rudp_server_set_fair_queueing(
+    struct rudp_server *server,
+    int enable,
+    uint64_t bytes_per_sec);
+
+/**
+   @this makes the server accept both IPv4 and IPv6 clients on a
+   single IPv6 socket.  It must be called before @ref
+   rudp_server_bind, with an IPv6 address (usually @tt in6addr_any)
+   set.  IPv4 clients get plain IPv4 addresses, see @xref
+   {dualstack}.
+
+   @param server An initialized server context structure
+   @param enable Whether to accept IPv4 clients on an IPv6 socket
+ */
+RUDP_EXPORT
+void rudp_server_set_dualstack(
+    struct rudp_server *server,
+    int enable);
+
+/**
+   @this allows clients running on the same host to switch to the
+   @xref {shmproto} {shared memory transport}.  Disabled by default,
+   offers from clients are refused.
+
+   @param server An initialized server context structure
+   @param enable Whether to accept shared memory offers
+ */
+RUDP_EXPORT
+void rudp_server_set_shm(
+    struct rudp_server *server,
+    int enable);
+
+/**
+   @this sets the relative share of the server egress bandwidth
+   given to a peer when fair queueing is enabled.  Default weight
+   is 1.
+
+   @param server Server context this peer belongs to
+   @param peer Peer context
+   @param weight Peer weight, 0 is handled as 1
+ */
+RUDP_EXPORT
+void rudp_server_peer_set_weight(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    unsigned int weight);
+
 /**
    @this cleanly drops connection to one client.
 
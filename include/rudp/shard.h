@@ -0,0 +1,116 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_SHARD_H_
+/** @hidden */
+#define RUDP_SHARD_H_
+
+/**
+   @file
+   @module {Shard}
+   @short Servers sharded over threads and CPUs (Linux)
+
+   A server may be split in shards, each one a separate server
+   context with its own rudp context and event loop, usually run by
+   its own thread.  All shards bind the same address with @tt
+   SO_REUSEPORT, and the kernel picks the shard each datagram goes
+   to.
+
+   Shards of a server bind in index order, as the kernel numbers
+   sockets of a group in the order they join it.  If one shard closes,
+   all of them should be closed and bound again.
+
+   Shard answering a connection request gives its index to the
+   client (see @xref {shardproto}), and the client tags every packet
+   it sends afterwards with it.  A program attached to the sockets
+   steers tagged packets to that shard, whatever the address they come
+   from, so that additional paths of a multipath connection (see @xref
+   {mpathproto}) reach the shard owning the peer.  Untagged packets,
+   i.e. connection requests, are steered by one of the policies of
+   @ref rudp_shard_steering.
+
+   Keeping a shard close to the network hardware takes: pinning its
+   thread with @ref rudp_shard_pin_thread before its rudp context
+   and packet arena are set up, so that memory comes from the NUMA
+   node of that CPU, and steering interrupts of network queues to the
+   same CPUs.
+
+   Sample usage, for shard @tt i of @tt n, in its own thread:
+   @code
+    rudp_shard_pin_thread(cpu[i]);
+    rudp_init(&rudp, el, RUDP_HANDLER_DEFAULT);
+    rudp_arena_enable(&rudp, 64 << 20);
+    rudp_server_init(&server, &rudp, &handler);
+    rudp_server_set_ipv4(&server, &any, port);
+    rudp_server_set_shard(&server, i, n, RUDP_SHARD_STEER_CPU, cpu[i]);
+    rudp_server_bind(&server);
+   @end code
+*/
+
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_server;
+
+/** Maximal count of shards of a server */
+#define RUDP_SHARD_MAX 7
+
+/**
+   @this defines how untagged packets are steered to shards.
+ */
+enum rudp_shard_steering
+{
+    /** By a hash of addresses and ports.  On kernels supporting it
+        (6.1 and up), shards whose CPU handled the packet are
+        preferred. */
+    RUDP_SHARD_STEER_HASH,
+    /** To shard whose index is the receiving CPU number modulo the
+        count of shards.  Shards must thus be pinned so that the CPU of
+        shard @tt i is @tt i modulo the count of shards, e.g. shards 0
+        to 3 on CPUs 4 to 7; packets received on other CPUs go to the
+        shard of the same residue. */
+    RUDP_SHARD_STEER_CPU,
+};
+
+/**
+   @this makes a server one shard of a sharded server.  It must be
+   called before @ref rudp_server_bind.
+
+   @param server An initialized server context structure
+   @param index Index of this shard
+   @param count Count of shards, at most @ref #RUDP_SHARD_MAX
+   @param steering Steering of untagged packets
+   @param cpu CPU handling this shard, to be set as the incoming CPU
+          of its sockets (@tt SO_INCOMING_CPU), or -1
+   @returns 0 on success, EINVAL for an invalid index or count, or
+            for a CPU not matching index with @ref
+            RUDP_SHARD_STEER_CPU, EBUSY if server is bound, ENOTSUP
+            on other systems than Linux
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_set_shard(
+    struct rudp_server *server,
+    unsigned int index,
+    unsigned int count,
+    enum rudp_shard_steering steering,
+    int cpu);
+
+/**
+   @this pins the calling thread to a CPU, and makes it allocate
+   memory from the NUMA node of this CPU, when possible.
+
+   @param cpu CPU to run on
+   @returns 0 on success, or an error from the system
+ */
+RUDP_EXPORT
+rudp_error_t rudp_shard_pin_thread(int cpu);
+
+#endif
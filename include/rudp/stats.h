@@ -0,0 +1,278 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_STATS_H_
+/** @hidden */
+#define RUDP_STATS_H_
+
+/**
+   @file
+   @module {Statistics}
+   @short Shared-memory statistics segment
+
+   A rudp context may publish its counters in a shared memory segment
+   (in @tt {/dev/shm} on Linux), where any other process may read
+   them without disturbing the library: there is no lock and no
+   system call involved on the writer side.
+
+   Segment contains global counters, and a fixed count of endpoint
+   and peer slots.  Endpoints get a slot when bound, peers when
+   initialized, as long as there are free slots, and only after
+   statistics were enabled with @ref rudp_stats_open.  Counters are
+   updated as traffic goes, gauges (RTT, queue depth, ...) are
+   refreshed periodically.
+
+   Each record is protected by a sequence counter which is odd while
+   the writer updates the record.  Readers copy the record and retry
+   if the counter was odd or changed in the meantime.  @ref
+   rudp_stats_reader_open and related functions implement this.  The
+   @tt rudpstat tool shipped with the library uses them.
+
+   Sample usage:
+   @code
+    // in the application
+    rudp_init(&rudp, el, RUDP_HANDLER_DEFAULT);
+    rudp_stats_open(&rudp, "myapp", 4, 1024);
+
+    // in a monitoring tool
+    struct rudp_stats_reader reader;
+    struct rudp_stats_peer peer;
+
+    rudp_stats_reader_open(&reader, "myapp");
+    for ( i = 0; i < reader.segment->max_peers; ++i )
+        if ( rudp_stats_reader_peer(&reader, i, &peer) )
+            printf("%s %d\n", peer.address, peer.srtt);
+    rudp_stats_reader_close(&reader);
+   @end code
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp;
+
+/** Segment magic value, "rudp" */
+#define RUDP_STATS_MAGIC 0x72756470
+/** Segment layout version */
+#define RUDP_STATS_VERSION 1
+/** Size of address text fields */
+#define RUDP_STATS_ADDRESS_SIZE 56
+
+/**
+   @this contains traffic counters, common to all records.
+ */
+struct rudp_stats_counters
+{
+    /** Count of packets received */
+    uint64_t packets_in;
+    /** Count of packets sent */
+    uint64_t packets_out;
+    /** Count of bytes received, UDP payload */
+    uint64_t bytes_in;
+    /** Count of bytes sent, UDP payload */
+    uint64_t bytes_out;
+    /** Count of reliable packets sent again */
+    uint64_t retransmits;
+    /** Count of send system call failures */
+    uint64_t send_errors;
+};
+
+/**
+   @this is the global record of the segment.
+ */
+struct rudp_stats_global
+{
+    /** Sequence counter, odd while record is updated */
+    uint32_t seq;
+    /** Count of endpoint slots in use */
+    uint32_t endpoints;
+    /** Count of peer slots in use */
+    uint32_t peers;
+    /** Count of peers that could not get a slot */
+    uint32_t peers_untracked;
+    /** Count of allocated packet buffers */
+    uint32_t allocated_packets;
+    /** Count of packet buffers in the free pool */
+    uint32_t free_packets;
+    /** Last refresh time, in library timestamp unit */
+    int64_t refresh_time;
+    /** Traffic of all endpoints */
+    struct rudp_stats_counters counters;
+};
+
+/**
+   @this is an endpoint record.
+ */
+struct rudp_stats_endpoint
+{
+    /** Sequence counter, odd while record is updated */
+    uint32_t seq;
+    /** Whether slot is used by an endpoint */
+    uint32_t in_use;
+    /** Bound address */
+    char address[RUDP_STATS_ADDRESS_SIZE];
+    /** Endpoint traffic */
+    struct rudp_stats_counters counters;
+};
+
+/**
+   @this is a peer record.
+ */
+struct rudp_stats_peer
+{
+    /** Sequence counter, odd while record is updated */
+    uint32_t seq;
+    /** Whether slot is used by a peer */
+    uint32_t in_use;
+    /** Remote address */
+    char address[RUDP_STATS_ADDRESS_SIZE];
+    /** Peer traffic */
+    struct rudp_stats_counters counters;
+    /** Smoothed RTT, in milliseconds */
+    int32_t srtt;
+    /** RTT variance, in milliseconds */
+    int32_t rttvar;
+    /** Current retransmit timeout, in milliseconds */
+    int32_t rto;
+    /** Count of packets in the send queue */
+    uint32_t queue_depth;
+    /** Peer state: 0 new, 1 running, 2 connecting, 3 dead */
+    uint32_t state;
+    uint32_t reserved;
+};
+
+/**
+   @this is the segment header.  It is followed by the endpoint
+   records, then by the peer records, at given offsets.
+ */
+struct rudp_stats_segment
+{
+    /** @ref #RUDP_STATS_MAGIC */
+    uint32_t magic;
+    /** @ref #RUDP_STATS_VERSION */
+    uint32_t version;
+    /** Writer process */
+    uint32_t pid;
+    /** Count of endpoint records */
+    uint32_t max_endpoints;
+    /** Count of peer records */
+    uint32_t max_peers;
+    /** Offset of first endpoint record from segment start */
+    uint32_t endpoint_offset;
+    /** Offset of first peer record from segment start */
+    uint32_t peer_offset;
+    uint32_t reserved;
+    /** Global record */
+    struct rudp_stats_global global;
+};
+
+/**
+   @this creates a shared memory statistics segment and starts
+   publishing counters of the rudp context into it.
+
+   @param rudp An initialized rudp context
+   @param name Segment name, without slashes.  Actual shared memory
+          object is named @tt {/rudp.<name>}.
+   @param max_endpoints Count of endpoint records
+   @param max_peers Count of peer records
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_stats_open(
+    struct rudp *rudp,
+    const char *name,
+    unsigned int max_endpoints,
+    unsigned int max_peers);
+
+/**
+   @this stops publishing counters and removes the segment.  This is
+   also done by @ref rudp_deinit.
+
+   @param rudp A rudp context
+ */
+RUDP_EXPORT
+void rudp_stats_close(struct rudp *rudp);
+
+/**
+   @this is a statistics segment reader context.
+ */
+struct rudp_stats_reader
+{
+    /** Mapped segment */
+    const struct rudp_stats_segment *segment;
+    /** Mapping size */
+    size_t size;
+};
+
+/**
+   @this maps a statistics segment for reading.
+
+   @param reader Reader context to initialize
+   @param name Segment name, as passed to @ref rudp_stats_open
+   @returns a possible error, EPROTO if segment layout is not
+            supported
+ */
+RUDP_EXPORT
+rudp_error_t rudp_stats_reader_open(
+    struct rudp_stats_reader *reader,
+    const char *name);
+
+/**
+   @this unmaps a statistics segment.
+
+   @param reader An open reader context
+ */
+RUDP_EXPORT
+void rudp_stats_reader_close(struct rudp_stats_reader *reader);
+
+/**
+   @this takes a consistent snapshot of the global record.
+
+   @param reader An open reader context
+   @param global (out) Record copy
+   @returns whether a consistent copy could be taken
+ */
+RUDP_EXPORT
+int rudp_stats_reader_global(
+    const struct rudp_stats_reader *reader,
+    struct rudp_stats_global *global);
+
+/**
+   @this takes a consistent snapshot of an endpoint record.
+
+   @param reader An open reader context
+   @param index Record index, lower than max_endpoints
+   @param endpoint (out) Record copy
+   @returns whether a consistent copy of a used record could be taken
+ */
+RUDP_EXPORT
+int rudp_stats_reader_endpoint(
+    const struct rudp_stats_reader *reader,
+    unsigned int index,
+    struct rudp_stats_endpoint *endpoint);
+
+/**
+   @this takes a consistent snapshot of a peer record.
+
+   @param reader An open reader context
+   @param index Record index, lower than max_peers
+   @param peer (out) Record copy
+   @returns whether a consistent copy of a used record could be taken
+ */
+RUDP_EXPORT
+int rudp_stats_reader_peer(
+    const struct rudp_stats_reader *reader,
+    unsigned int index,
+    struct rudp_stats_peer *peer);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_STREAM_H_
+/** @hidden */
+#define RUDP_STREAM_H_
+
+/**
+   @file
+   @module {Stream}
+   @short Streamed delivery of large messages
+
+   A message sent with @ref rudp_client_send or @ref rudp_server_send
+   goes in a single datagram, and must fit in it.  Larger messages,
+   up to many megabytes, may be streamed instead.  They are always
+   reliable.
+
+   Sender gives a buffer, that the library references until the whole
+   message is acknowledged, see @ref rudp_client_send_stream.  It is
+   cut in fragments that fit in a network packet and reference the
+   buffer without copying it.  Only a window of @ref
+   #RUDP_STREAM_WINDOW fragments is queued at once, more are queued as
+   acknowledges come, so that sender memory does not grow with the
+   message size either.  Streamed messages sent to the same peer are
+   delivered in order.
+
+   Receiver gets the message piece by piece, through a stream handler
+   (see @ref rudp_client_set_stream_handler and @ref
+   rudp_server_set_stream_handler): @tt begin when the first
+   fragment comes, @tt chunk for each fragment, in order, as soon as
+   it is received, and @tt end once the message is complete or lost.
+   Fragment memory is reused as soon as @tt chunk returns, so that
+   the message is never held whole by the library.
+
+   Other messages sent meanwhile may be received between chunks of a
+   streamed message.  Without a stream handler, streamed messages are
+   acknowledged and ignored.
+
+   Sample usage:
+   @code
+    static void done(const void *data, size_t size, void *priv)
+    {
+        free((void *)data);
+    }
+
+    rudp_client_send_stream(&client, 3, image, image_size, done, NULL);
+   @end code
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <rudp/packet.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_client;
+struct rudp_server;
+struct rudp_peer;
+
+/** Count of fragments of streamed messages queued at once to a peer */
+#define RUDP_STREAM_WINDOW 64
+
+/**
+   Client stream handler, see @xref {Stream}.
+ */
+struct rudp_client_stream_handler
+{
+    /**
+       @this is called when a streamed message starts.
+
+       @param client Client context
+       @param command User command used
+       @param size Total message size
+     */
+    void (*begin)(struct rudp_client *client, int command, uint64_t size);
+
+    /**
+       @this is called for each fragment of the message, in order.
+       Data is only valid during the call.
+
+       @param client Client context
+       @param offset Offset of data in message
+       @param data Fragment data
+       @param len Fragment data length
+     */
+    void (*chunk)(struct rudp_client *client, uint64_t offset,
+                  const void *data, size_t len);
+
+    /**
+       @this is called when the message ends.
+
+       @param client Client context
+       @param err 0 if the message is complete, ECONNRESET if the
+              connection went away first, ECONNABORTED if another
+              message began before this one ended, EPROTO if the
+              stream is broken
+     */
+    void (*end)(struct rudp_client *client, rudp_error_t err);
+};
+
+/**
+   Server stream handler, see @xref {Stream}.
+ */
+struct rudp_server_stream_handler
+{
+    /**
+       @this is called when a streamed message starts.
+
+       @param server Server context
+       @param peer Relevant peer
+       @param command User command used
+       @param size Total message size
+     */
+    void (*begin)(struct rudp_server *server, struct rudp_peer *peer,
+                  int command, uint64_t size);
+
+    /**
+       @this is called for each fragment of the message, in order.
+       Data is only valid during the call.
+
+       @param server Server context
+       @param peer Relevant peer
+       @param offset Offset of data in message
+       @param data Fragment data
+       @param len Fragment data length
+     */
+    void (*chunk)(struct rudp_server *server, struct rudp_peer *peer,
+                  uint64_t offset, const void *data, size_t len);
+
+    /**
+       @this is called when the message ends.  When the peer drops,
+       it is called before @ref rudp_server_handler::peer_dropped.
+
+       @param server Server context
+       @param peer Relevant peer
+       @param err 0 if the message is complete, ECONNRESET if the
+              connection went away first, ECONNABORTED if another
+              message began before this one ended, EPROTO if the
+              stream is broken
+     */
+    void (*end)(struct rudp_server *server, struct rudp_peer *peer,
+                rudp_error_t err);
+};
+
+/**
+   @this sets the handler of streamed messages from the server.
+
+   @param client An initialized client context
+   @param handler Stream handler, or NULL to ignore streamed messages
+ */
+RUDP_EXPORT
+void rudp_client_set_stream_handler(
+    struct rudp_client *client,
+    const struct rudp_client_stream_handler *handler);
+
+/**
+   @this sets the handler of streamed messages from clients.
+
+   @param server An initialized server context
+   @param handler Stream handler, or NULL to ignore streamed messages
+ */
+RUDP_EXPORT
+void rudp_server_set_stream_handler(
+    struct rudp_server *server,
+    const struct rudp_server_stream_handler *handler);
+
+/**
+   @this streams a message to the server, see @xref {Stream}.
+
+   Library references the buffer until the whole message is
+   acknowledged, or the client is closed first.  It then calls @tt
+   done.  Buffer must not change until then.
+
+   @param client A connected, or connecting, client
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Message
+   @param size Message size
+   @param done Function called when buffer is released, may be NULL
+   @param priv User private pointer passed to @tt done
+   @returns 0 once the message is queued, ENOTCONN if the client is
+   not connecting, EINVAL for an invalid command.  On error, buffer is
+   not referenced and @tt done is never called.
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_send_stream(struct rudp_client *client,
+                                     int command,
+                                     const void *data, size_t size,
+                                     rudp_buffer_done_func_t *done,
+                                     void *priv);
+
+/**
+   @this streams a message to a peer, see @ref
+   rudp_client_send_stream.
+
+   @param server Server context
+   @param peer Destination peer
+   @param command User command code. It may be between 0 and RUDP_CMD_APP_MAX.
+   @param data Message
+   @param size Message size
+   @param done Function called when buffer is released, may be NULL
+   @param priv User private pointer passed to @tt done
+   @returns 0 once the message is queued, EINVAL for an invalid
+   command
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_send_stream(struct rudp_server *server,
+                                     struct rudp_peer *peer,
+                                     int command,
+                                     const void *data, size_t size,
+                                     rudp_buffer_done_func_t *done,
+                                     void *priv);
+
+#endif
@@ -0,0 +1,364 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_TRANSFER_H_
+/** @hidden */
+#define RUDP_TRANSFER_H_
+
+/**
+   @file
+   @module {File transfer}
+   @short Resumable transfers of memory mapped files
+
+   A file is sent by a @ref rudp_file_sender to a @ref
+   rudp_file_receiver of the other side of a connection, either way.
+   Both sides agree on a 32-bit file identifier.  Sender offers the
+   file, receiver answers with the offset it wants data from, and the
+   file is streamed from there (see @xref {Stream} and @xref
+   {transferproto}).
+
+   Sender maps the file in memory, and network packets reference
+   its pages, the file is never copied in user space.  Receiver
+   preallocates the destination file to the offered size, maps it,
+   and writes each fragment at its offset as it comes.  As with other
+   streamed messages, only a window of packets is in flight at once.
+
+   Transfers are resumable: if the connection goes away, both sides
+   get @tt ECONNRESET, and receiver keeps what it has.  Once connected
+   again, sender sends the same file again, and receiver asks for the
+   missing part only.  Offers carry the modification time of the file
+   as its version, and receiver starts over when the file changed,
+   even at the same size.  A receiver created after a restart may be
+   told how much of its destination file is valid, see @ref
+   rudp_file_receiver_open.
+
+   Both sides report progress and throughput, see @ref
+   rudp_file_progress.
+
+   Sender and receiver contexts use the same @xref {olc} {life cycle}
+   as other complex objects of the library.
+
+   Sample usage:
+   @code
+    // server side, in peer_new handler
+    rudp_file_sender_init(&sender, &rudp, &sender_handler, 42);
+    rudp_file_sender_open(&sender, "/srv/firmware.bin");
+    rudp_server_send_file(&server, peer, &sender);
+
+    // client side
+    rudp_file_receiver_init(&receiver, &rudp, &receiver_handler, 42);
+    rudp_file_receiver_open(&receiver, "/tmp/firmware.bin", 0);
+   @end code
+*/
+
+#include <stdint.h>
+#include <rudp/list.h>
+#include <rudp/time.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp;
+struct rudp_client;
+struct rudp_server;
+struct rudp_peer;
+struct rudp_file_sender;
+struct rudp_file_receiver;
+struct rudp_file_map;
+
+/** Minimal interval between two progress reports, in milliseconds */
+#define RUDP_FILE_PROGRESS_INTERVAL 250
+
+/**
+   Transfer progress, see @ref rudp_file_sender_progress and @ref
+   rudp_file_receiver_progress.
+ */
+struct rudp_file_progress
+{
+    /** File size */
+    uint64_t size;
+    /** Bytes received, or acknowledged to sender */
+    uint64_t done;
+    /** Time since transfer started or resumed, in milliseconds */
+    rudp_time_t elapsed;
+    /** Bytes per second since transfer started or resumed */
+    uint64_t rate;
+};
+
+/**
+   File sender handler code callbacks
+ */
+struct rudp_file_sender_handler
+{
+    /**
+       @this is called while file is being sent, at most every @ref
+       #RUDP_FILE_PROGRESS_INTERVAL milliseconds.
+
+       @param sender Sender context
+       @param progress Transfer progress
+     */
+    void (*progress)(struct rudp_file_sender *sender,
+                     const struct rudp_file_progress *progress);
+
+    /**
+       @this is called when transfer ends.
+
+       @param sender Sender context
+       @param err 0 once the receiver has the whole file, ECONNRESET
+              if the connection went away first, ECONNREFUSED if
+              there is no receiver for this file
+     */
+    void (*end)(struct rudp_file_sender *sender, rudp_error_t err);
+};
+
+/**
+   File receiver handler code callbacks
+ */
+struct rudp_file_receiver_handler
+{
+    /**
+       @this is called while file is being received, at most every
+       @ref #RUDP_FILE_PROGRESS_INTERVAL milliseconds.
+
+       @param receiver Receiver context
+       @param progress Transfer progress
+     */
+    void (*progress)(struct rudp_file_receiver *receiver,
+                     const struct rudp_file_progress *progress);
+
+    /**
+       @this is called when transfer ends.
+
+       @param receiver Receiver context
+       @param err 0 once the whole file is written, ECONNRESET if the
+              connection went away first, ECONNABORTED if sender
+              started again or gave up, EPROTO if the stream is
+              broken, EFBIG if the offered file is too large to be
+              mapped, or an error from the system if destination could
+              not be prepared
+     */
+    void (*end)(struct rudp_file_receiver *receiver, rudp_error_t err);
+
+    /**
+       @this is called when a peer offers the file, before anything is
+       written to the destination.  A refused peer is told there is no
+       receiver, and receiver stays open for other offers.  This
+       callback may be NULL, then offers are accepted from any peer.
+       It must not close the receiver.
+
+       @param receiver Receiver context
+       @param peer Peer offering the file
+       @param size Offered file size
+       @returns non-zero to accept the offer
+     */
+    int (*accept)(struct rudp_file_receiver *receiver,
+                  struct rudp_peer *peer, uint64_t size);
+};
+
+/**
+   @this is a file sender context structure.  User should not use its
+   fields directly.
+
+   @hidecontent
+ */
+struct rudp_file_sender
+{
+    const struct rudp_file_sender_handler *handler;
+    struct rudp_list rudp_item;
+    struct rudp *rudp;
+    struct rudp_peer *peer;
+    struct rudp_file_map *map;
+    uint64_t size;
+    uint64_t start;
+    uint64_t acked;
+    uint64_t version;
+    rudp_time_t start_time;
+    rudp_time_t last_progress;
+    uint32_t id;
+    char sending;
+};
+
+/**
+   @this is a file receiver context structure.  User should not use
+   its fields directly.
+
+   @hidecontent
+ */
+struct rudp_file_receiver
+{
+    const struct rudp_file_receiver_handler *handler;
+    struct rudp_list rudp_item;
+    struct rudp *rudp;
+    struct rudp_peer *peer;
+    uint8_t *base;
+    uint64_t size;
+    uint64_t offset;
+    uint64_t start;
+    uint64_t version;
+    rudp_time_t start_time;
+    rudp_time_t last_progress;
+    uint32_t id;
+    int fd;
+    char mapped;
+};
+
+/**
+   @this initializes a file sender.
+
+   @param sender Sender unitialized context structure
+   @param rudp Library context
+   @param handler Sender handler
+   @param id File identifier, as known by receiver
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_file_sender_init(
+    struct rudp_file_sender *sender,
+    struct rudp *rudp,
+    const struct rudp_file_sender_handler *handler,
+    uint32_t id);
+
+/**
+   @this maps the file to send.
+
+   @param sender An initialized sender context
+   @param path File path
+   @returns 0 on success, EBUSY if a file is already open, or an
+            error from the system
+ */
+RUDP_EXPORT
+rudp_error_t rudp_file_sender_open(
+    struct rudp_file_sender *sender,
+    const char *path);
+
+/**
+   @this stops sending, and releases the file.  Mapping is kept until
+   no packet references it anymore.
+
+   @param sender An initialized sender context
+ */
+RUDP_EXPORT
+void rudp_file_sender_close(struct rudp_file_sender *sender);
+
+/**
+   @this deinitializes a file sender, closing it if needed.
+
+   @param sender An initialized sender context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_file_sender_deinit(struct rudp_file_sender *sender);
+
+/**
+   @this retrieves current progress of a sender.
+
+   @param sender An initialized sender context
+   @param progress Progress structure to fill
+ */
+RUDP_EXPORT
+void rudp_file_sender_progress(const struct rudp_file_sender *sender,
+                               struct rudp_file_progress *progress);
+
+/**
+   @this sends a file to the server.
+
+   @param client A connected, or connecting, client
+   @param sender A sender with an open file
+   @returns 0 once the file is offered, ENOTCONN if the client is not
+            connecting, EINVAL if no file is open, EBUSY if sender is
+            already sending
+ */
+RUDP_EXPORT
+rudp_error_t rudp_client_send_file(struct rudp_client *client,
+                                   struct rudp_file_sender *sender);
+
+/**
+   @this sends a file to a peer.
+
+   @param server Server context
+   @param peer Destination peer
+   @param sender A sender with an open file
+   @returns 0 once the file is offered, EINVAL if no file is open,
+            EBUSY if sender is already sending
+ */
+RUDP_EXPORT
+rudp_error_t rudp_server_send_file(struct rudp_server *server,
+                                   struct rudp_peer *peer,
+                                   struct rudp_file_sender *sender);
+
+/**
+   @this initializes a file receiver.  File offers with @tt id are
+   accepted from any peer of the library context, one at a time,
+   unless handler's @tt accept callback refuses them.
+
+   @param receiver Receiver unitialized context structure
+   @param rudp Library context
+   @param handler Receiver handler
+   @param id File identifier, as known by sender
+   @returns 0 on success, EEXIST if a receiver already has this
+            identifier
+ */
+RUDP_EXPORT
+rudp_error_t rudp_file_receiver_init(
+    struct rudp_file_receiver *receiver,
+    struct rudp *rudp,
+    const struct rudp_file_receiver_handler *handler,
+    uint32_t id);
+
+/**
+   @this opens the destination file, creating it if needed.  It is
+   resized to the offered size when the sender offers the file.
+
+   @param receiver An initialized receiver context
+   @param path File path
+   @param offset Count of bytes already valid at the start of the
+          file, from an interrupted transfer, or 0.  Receiver does not
+          know which version of the file they come from, they are
+          trusted for the first offer.
+   @returns 0 on success, EBUSY if a file is already open, or an
+            error from the system
+ */
+RUDP_EXPORT
+rudp_error_t rudp_file_receiver_open(
+    struct rudp_file_receiver *receiver,
+    const char *path,
+    uint64_t offset);
+
+/**
+   @this closes the destination file.  A transfer in progress is
+   abandoned, and its sender is told there is no receiver anymore.
+
+   @param receiver An initialized receiver context
+ */
+RUDP_EXPORT
+void rudp_file_receiver_close(struct rudp_file_receiver *receiver);
+
+/**
+   @this deinitializes a file receiver, closing it if needed.
+
+   @param receiver An initialized receiver context
+   @returns a possible error
+ */
+RUDP_EXPORT
+rudp_error_t rudp_file_receiver_deinit(struct rudp_file_receiver *receiver);
+
+/**
+   @this retrieves current progress of a receiver.  Its @tt done
+   field is also the count of valid bytes to give to @ref
+   rudp_file_receiver_open if the receiver is created again later.
+
+   @param receiver An initialized receiver context
+   @param progress Progress structure to fill
+ */
+RUDP_EXPORT
+void rudp_file_receiver_progress(const struct rudp_file_receiver *receiver,
+                                 struct rudp_file_progress *progress);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_XDP_H_
+/** @hidden */
+#define RUDP_XDP_H_
+
+/**
+   @file
+   @module {XDP}
+   @short AF_XDP endpoint backend (Linux)
+
+   A bound endpoint may additionally receive and transmit its
+   datagrams through an AF_XDP socket attached to one queue of a
+   network interface, bypassing the kernel network stack.
+
+   A small XDP program is attached to the interface.  It redirects
+   IPv4 UDP datagrams addressed to the endpoint port (and address, if
+   bound to one) that arrive on the given queue to the AF_XDP socket.
+   Everything else, including IP fragments and packets with IP
+   options, goes through the kernel stack as usual, and still reaches
+   the endpoint through its normal socket.
+
+   Received frames are handed to the endpoint handler in place, from
+   the shared packet memory area (UMEM), without any copy.  Ethernet,
+   IPv4 and UDP headers are handled by the library.  Link-layer
+   addresses of remote hosts are learned from received frames:
+   packets to a remote host that was never heard of through the
+   AF_XDP socket, or that do not fit in a frame, are sent through the
+   normal socket.
+
+   Generic (SKB) mode works on any interface, including veth pairs,
+   and is what should be used for testing.  Native mode needs driver
+   support.
+
+   Sample usage:
+   @code
+    rudp_server_bind(&server);
+    err = rudp_endpoint_xdp_attach(&server.endpoint, "eth0", 0,
+                                   RUDP_XDP_SKB_MODE);
+   @end code
+*/
+
+#include <stdint.h>
+#include <rudp/error.h>
+#include <rudp/compiler.h>
+
+struct rudp_endpoint;
+
+/** @mgroup{XDP flags}
+    Attach XDP program in generic (SKB) mode */
+#define RUDP_XDP_SKB_MODE 1
+/** @mgroup{XDP flags}
+    Require zero-copy UMEM operation from the driver */
+#define RUDP_XDP_ZEROCOPY 2
+
+/**
+   @this attaches an AF_XDP socket to a bound endpoint.
+
+   @param endpoint A bound IPv4 (or dual stack) endpoint
+   @param ifname Network interface name
+   @param queue Interface receive queue index
+   @param flags A mask of @xref {XDP flags}
+   @returns a possible error, ENOTSUP if AF_XDP is not available on
+            this system, EBUSY if endpoint already has an AF_XDP
+            socket
+ */
+RUDP_EXPORT
+rudp_error_t rudp_endpoint_xdp_attach(
+    struct rudp_endpoint *endpoint,
+    const char *ifname,
+    unsigned int queue,
+    uint32_t flags);
+
+/**
+   @this detaches the AF_XDP socket from an endpoint.  Endpoint goes
+   on with its normal socket.  This is also done by @ref
+   rudp_endpoint_close.
+
+   @param endpoint An endpoint
+ */
+RUDP_EXPORT
+void rudp_endpoint_xdp_detach(struct rudp_endpoint *endpoint);
+
+#endif
@@ -44,14 +44,18 @@ rudp_error_t rudp_address_set_hostname(
     if ( hostname == NULL )
         return EINVAL;
 
+    if ( rua->addr == NULL )
+        return ENOMEM;
+
     if ( rua->hostname )
-        free(rua->hostname);
+        rudp_free(rua->rudp, rua->hostname, strlen(rua->hostname) + 1);
 
     rua->port = port;
 
-    rua->hostname = strdup(hostname);
+    rua->hostname = rudp_alloc(rua->rudp, strlen(hostname) + 1);
     if ( rua->hostname == NULL )
         return ENOMEM;
+    strcpy(rua->hostname, hostname);
 
     struct addrinfo hints;
     memset(&hints, 0, sizeof(hints));
@@ -96,15 +100,15 @@ void rudp_address_deinit(struct rudp_address *rua)
     }
 
     if ( rua->hostname )
-        free(rua->hostname);
+        rudp_free(rua->rudp, rua->hostname, strlen(rua->hostname) + 1);
     if ( rua->addr )
-        rudp_free(rua->rudp, rua->addr);
+        rudp_free(rua->rudp, rua->addr, sizeof(struct sockaddr_storage));
     rua->hostname = NULL;
     rua->resolver_state = RUDP_RESOLV_NONE;
     rua->text[0] = 0;
 }
 
-void rudp_address_init(struct rudp_address *rua, struct rudp *rudp)
+rudp_error_t rudp_address_init(struct rudp_address *rua, struct rudp *rudp)
 {
     memset(rua, 0, sizeof(*rua));
     rua->text[0] = 0;
@@ -112,7 +116,14 @@ void rudp_address_init(struct rudp_address *rua, struct rudp *rudp)
     rua->rudp = rudp;
     rua->resolver_state = RUDP_RESOLV_NONE;
     rua->addr = rudp_alloc(rudp, sizeof(struct sockaddr_storage));
+
+    // Address stays unset, setters refuse it
+    if ( rua->addr == NULL )
+        return ENOMEM;
+
     memset(rua->addr, 0, sizeof(struct sockaddr_storage));
+
+    return 0;
 }
 
 void rudp_address_set_ipv4(
@@ -124,6 +135,9 @@ void rudp_address_set_ipv4(
 
     rua->text[0] = 0;
 
+    if ( addr == NULL )
+        return;
+
     rua->resolver_state = RUDP_RESOLV_ADDR;
 
     rua->port = port;
@@ -142,6 +156,9 @@ void rudp_address_set_ipv6(
 
     rua->text[0] = 0;
 
+    if ( addr == NULL )
+        return;
+
     memset(addr, 0, sizeof(*addr));
 
     rua->resolver_state = RUDP_RESOLV_ADDR;
@@ -160,6 +177,9 @@ rudp_error_t rudp_address_set(
     if (size < sizeof (*sockaddr) || size > sizeof (*rua->addr))
         return EINVAL;
 
+    if ( rua->addr == NULL )
+        return ENOMEM;
+
     switch (sockaddr->sa_family)
     {
     case AF_INET:
@@ -226,14 +246,13 @@ rudp_error_t rudp_address_get(
     socklen_t *addrsize)
 {
     const struct sockaddr_in *addr4 = (const struct sockaddr_in *)rua->addr;
-    int family = addr4->sin_family;
 
     switch ( (enum resolver_state)rua->resolver_state )
     {
     case RUDP_RESOLV_ADDR:
     case RUDP_RESOLV_DONE:
         *addr = rua->addr;
-        *addrsize = family == AF_INET ?
+        *addrsize = addr4->sin_family == AF_INET ?
             sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
         return 0;
 
@@ -256,7 +275,7 @@ int rudp_address_compare(const struct rudp_address *rua,
     struct sockaddr_in6 *right6 = (struct sockaddr_in6 *)addr;
     struct sockaddr_in *right = (struct sockaddr_in *)addr;
 
-    if ( left->sin_family != right->sin_family )
+    if ( left == NULL || left->sin_family != right->sin_family )
         return 1;
 
     if ( left->sin_family == AF_INET )
@@ -0,0 +1,282 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/allocator.h>
+
+#define ALLOC_ALIGN 16
+#define ALLOC_ROUND(x) (((x) + ALLOC_ALIGN - 1) & ~(size_t)(ALLOC_ALIGN - 1))
+
+/*
+  Pool free lists are Treiber stacks.  Head holds index + 1 of first
+  free block in its low half, 0 when empty, and a tag bumped on each
+  change in its high half, so that a stale head never compares equal.
+  Free blocks hold index + 1 of next one.
+ */
+#define POOL_INDEX(head) ((uint32_t)(head))
+#define POOL_TAG_ONE ((uint64_t)1 << 32)
+
+static
+struct rudp_pool_allocator *pool_of(struct rudp *rudp)
+{
+    return (struct rudp_pool_allocator *)rudp->handler;
+}
+
+static
+uint32_t *pool_block(struct rudp_pool_allocator *pool,
+                     unsigned int c, uint32_t index)
+{
+    return (uint32_t *)(pool->class[c].base + pool->class[c].stride * index);
+}
+
+static
+void *pool_pop(struct rudp_pool_allocator *pool, unsigned int c)
+{
+    uint64_t head = __atomic_load_n(&pool->class[c].head, __ATOMIC_ACQUIRE);
+    uint64_t next;
+    uint32_t *block;
+
+    do {
+        if ( POOL_INDEX(head) == 0 )
+            return NULL;
+
+        // Block may be taken meanwhile, tag then makes exchange fail
+        block = pool_block(pool, c, POOL_INDEX(head) - 1);
+        next = (head & ~(POOL_TAG_ONE - 1)) + POOL_TAG_ONE
+            + __atomic_load_n(block, __ATOMIC_RELAXED);
+    } while ( !__atomic_compare_exchange_n(&pool->class[c].head, &head, next,
+                                           1, __ATOMIC_ACQUIRE,
+                                           __ATOMIC_ACQUIRE) );
+
+    return block;
+}
+
+static
+void pool_push(struct rudp_pool_allocator *pool, unsigned int c,
+               uint8_t *buffer)
+{
+    uint32_t index = (buffer - pool->class[c].base) / pool->class[c].stride;
+    uint32_t *block = (uint32_t *)buffer;
+    uint64_t head = __atomic_load_n(&pool->class[c].head, __ATOMIC_RELAXED);
+    uint64_t next;
+
+    do {
+        __atomic_store_n(block, POOL_INDEX(head), __ATOMIC_RELAXED);
+        next = (head & ~(POOL_TAG_ONE - 1)) + POOL_TAG_ONE + index + 1;
+    } while ( !__atomic_compare_exchange_n(&pool->class[c].head, &head, next,
+                                           1, __ATOMIC_RELEASE,
+                                           __ATOMIC_RELAXED) );
+}
+
+static
+void *pool_alloc(struct rudp *rudp, size_t size)
+{
+    struct rudp_pool_allocator *pool = pool_of(rudp);
+    unsigned int c;
+
+    // Next classes take over when the best fitting one is empty
+    for ( c = 0; c < pool->class_count; ++c ) {
+        void *block;
+
+        if ( pool->class[c].size < size )
+            continue;
+
+        block = pool_pop(pool, c);
+        if ( block )
+            return block;
+    }
+
+    return NULL;
+}
+
+static
+void pool_free_sized(struct rudp *rudp, void *buffer, size_t size)
+{
+    struct rudp_pool_allocator *pool = pool_of(rudp);
+    uint8_t *ptr = buffer;
+    unsigned int c;
+
+    for ( c = 0; c < pool->class_count; ++c ) {
+        if ( pool->class[c].size < size
+             || ptr < pool->class[c].base
+             || ptr >= pool->class[c].base
+                       + pool->class[c].stride * pool->class[c].count )
+            continue;
+
+        pool_push(pool, c, ptr);
+        return;
+    }
+}
+
+static
+void pool_free(struct rudp *rudp, void *buffer)
+{
+    pool_free_sized(rudp, buffer, 0);
+}
+
+size_t rudp_pool_allocator_memory_size(const struct rudp_pool_class *classes,
+                                       unsigned int count)
+{
+    size_t size = 0;
+    unsigned int c;
+
+    for ( c = 0; c < count; ++c )
+        size += ALLOC_ROUND(classes[c].size) * classes[c].count;
+
+    return size;
+}
+
+rudp_error_t rudp_pool_allocator_init(struct rudp_pool_allocator *pool,
+                                      void *memory, size_t size,
+                                      const struct rudp_pool_class *classes,
+                                      unsigned int count)
+{
+    uint8_t *base = memory;
+    unsigned int c, i;
+
+    if ( count == 0 || count > RUDP_POOL_CLASS_MAX )
+        return EINVAL;
+
+    for ( c = 0; c < count; ++c )
+        if ( classes[c].size < sizeof(uint32_t) || classes[c].count == 0
+             || classes[c].count >= UINT32_MAX
+             || (c && classes[c].size <= classes[c - 1].size) )
+            return EINVAL;
+
+    if ( size < rudp_pool_allocator_memory_size(classes, count) )
+        return ENOSPC;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->handler.mem_alloc = pool_alloc;
+    pool->handler.mem_free = pool_free;
+    pool->handler.mem_free_sized = pool_free_sized;
+    pool->class_count = count;
+
+    for ( c = 0; c < count; ++c ) {
+        pool->class[c].base = base;
+        pool->class[c].stride = ALLOC_ROUND(classes[c].size);
+        pool->class[c].size = pool->class[c].stride;
+        pool->class[c].count = classes[c].count;
+
+        for ( i = 0; i < classes[c].count; ++i )
+            *pool_block(pool, c, i) = i + 1 < classes[c].count ? i + 2 : 0;
+        pool->class[c].head = 1;
+
+        base += pool->class[c].stride * classes[c].count;
+    }
+
+    return 0;
+}
+
+unsigned int rudp_pool_allocator_free_blocks(
+    const struct rudp_pool_allocator *pool,
+    unsigned int index)
+{
+    struct rudp_pool_allocator *p = (struct rudp_pool_allocator *)pool;
+    uint32_t next;
+    unsigned int count = 0;
+
+    if ( index >= pool->class_count )
+        return 0;
+
+    next = POOL_INDEX(__atomic_load_n(&p->class[index].head,
+                                      __ATOMIC_ACQUIRE));
+    while ( next && count < pool->class[index].count ) {
+        next = __atomic_load_n(pool_block(p, index, next - 1),
+                               __ATOMIC_RELAXED);
+        count++;
+    }
+
+    return count;
+}
+
+/*
+  Bump allocator state holds the offset of top in its low bits, and
+  the count of live buffers above.  Both change in a single exchange.
+ */
+#define BUMP_TOP_BITS 40
+#define BUMP_TOP(state) ((state) & (((uint64_t)1 << BUMP_TOP_BITS) - 1))
+#define BUMP_LIVE_ONE ((uint64_t)1 << BUMP_TOP_BITS)
+
+static
+struct rudp_bump_allocator *bump_of(struct rudp *rudp)
+{
+    return (struct rudp_bump_allocator *)rudp->handler;
+}
+
+static
+void *bump_alloc(struct rudp *rudp, size_t size)
+{
+    struct rudp_bump_allocator *bump = bump_of(rudp);
+    uint64_t state = __atomic_load_n(&bump->state, __ATOMIC_RELAXED);
+    uint64_t next;
+
+    size = ALLOC_ROUND(size);
+
+    do {
+        if ( bump->size - BUMP_TOP(state) < size )
+            return NULL;
+
+        next = state + BUMP_LIVE_ONE + size;
+    } while ( !__atomic_compare_exchange_n(&bump->state, &state, next,
+                                           1, __ATOMIC_ACQ_REL,
+                                           __ATOMIC_RELAXED) );
+
+    return bump->base + BUMP_TOP(state);
+}
+
+static
+void bump_free_sized(struct rudp *rudp, void *buffer, size_t size)
+{
+    struct rudp_bump_allocator *bump = bump_of(rudp);
+    uint64_t state = __atomic_load_n(&bump->state, __ATOMIC_RELAXED);
+    size_t offset = (uint8_t *)buffer - bump->base;
+    uint64_t next;
+
+    size = ALLOC_ROUND(size);
+
+    do {
+        next = state - BUMP_LIVE_ONE;
+
+        if ( next < BUMP_LIVE_ONE )
+            // Last one, everything is reusable
+            next = 0;
+        else if ( size && offset + size == BUMP_TOP(state) )
+            next -= size;
+    } while ( !__atomic_compare_exchange_n(&bump->state, &state, next,
+                                           1, __ATOMIC_ACQ_REL,
+                                           __ATOMIC_RELAXED) );
+}
+
+static
+void bump_free(struct rudp *rudp, void *buffer)
+{
+    bump_free_sized(rudp, buffer, 0);
+}
+
+void rudp_bump_allocator_init(struct rudp_bump_allocator *bump,
+                              void *memory, size_t size)
+{
+    memset(bump, 0, sizeof(*bump));
+    bump->handler.mem_alloc = bump_alloc;
+    bump->handler.mem_free = bump_free;
+    bump->handler.mem_free_sized = bump_free_sized;
+    bump->base = memory;
+    bump->size = size < BUMP_LIVE_ONE ? size : BUMP_LIVE_ONE - 1;
+    bump->state = 0;
+}
+
+size_t rudp_bump_allocator_used(const struct rudp_bump_allocator *bump)
+{
+    return BUMP_TOP(__atomic_load_n(&bump->state, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,222 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <rudp/arena.h>
+#include <rudp/packet.h>
+#include <rudp/rudp.h>
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_arena.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#if defined(__linux__) && !defined(MADV_POPULATE_WRITE)
+# define MADV_POPULATE_WRITE 23
+#endif
+
+#define ARENA_HUGE_PAGE_SIZE (2 << 20)
+#define ARENA_SLOT_ALIGN 64
+
+#if defined(MADV_HUGEPAGE)
+/*
+  Kernel may not back an advised region with huge pages, it only
+  tells in smaps of the mapping holding it.
+ */
+static
+int arena_has_huge_pages(const void *base)
+{
+    char line[256];
+    unsigned long start, end, kb;
+    int found = 0, huge = 0;
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+
+    if ( smaps == NULL )
+        return 0;
+
+    while ( fgets(line, sizeof(line), smaps) ) {
+        if ( sscanf(line, "%lx-%lx ", &start, &end) == 2 )
+            found = start <= (unsigned long)base
+                && (unsigned long)base < end;
+        else if ( found && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ) {
+            huge = kb != 0;
+            break;
+        }
+    }
+
+    fclose(smaps);
+
+    return huge;
+}
+#endif
+
+/*
+  Takes faults now rather than on packet path.
+ */
+static
+void arena_prefault(uint8_t *base, size_t size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t i;
+
+#if defined(MADV_POPULATE_WRITE)
+    if ( madvise(base, size, MADV_POPULATE_WRITE) == 0 )
+        return;
+#endif
+
+    if ( page <= 0 )
+        page = 4096;
+
+    for ( i = 0; i < size; i += page )
+        ((volatile uint8_t *)base)[i] = 0;
+}
+
+static
+void *arena_map(size_t size, enum rudp_arena_pages *pages)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    uint8_t *base, *aligned;
+    size_t head;
+#if defined(MADV_HUGEPAGE)
+    int advised;
+#endif
+
+#if defined(MAP_HUGETLB)
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                flags | MAP_HUGETLB
+# if defined(MAP_POPULATE)
+                | MAP_POPULATE
+# endif
+                , -1, 0);
+    if ( base != MAP_FAILED ) {
+        *pages = RUDP_ARENA_HUGETLB;
+        return base;
+    }
+#endif
+
+    // Transparent huge pages need a 2 MB aligned region, map more and trim
+    base = mmap(NULL, size + ARENA_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                flags, -1, 0);
+    if ( base == MAP_FAILED )
+        return NULL;
+
+    aligned = (uint8_t *)(((uintptr_t)base + ARENA_HUGE_PAGE_SIZE - 1)
+                          & ~(uintptr_t)(ARENA_HUGE_PAGE_SIZE - 1));
+    head = aligned - base;
+    if ( head )
+        munmap(base, head);
+    munmap(aligned + size, ARENA_HUGE_PAGE_SIZE - head);
+
+    *pages = RUDP_ARENA_NORMAL;
+
+#if defined(MADV_HUGEPAGE)
+    // Advice must come before the first fault to get huge pages
+    advised = madvise(aligned, size, MADV_HUGEPAGE) == 0;
+#endif
+
+    arena_prefault(aligned, size);
+
+#if defined(MADV_HUGEPAGE)
+    if ( advised && arena_has_huge_pages(aligned) )
+        *pages = RUDP_ARENA_THP;
+#endif
+
+    return aligned;
+}
+
+rudp_error_t rudp_arena_enable(struct rudp *rudp, size_t size)
+{
+    struct rudp_arena *arena;
+    void **next;
+    unsigned int i;
+
+    if ( rudp->arena )
+        return EBUSY;
+
+    if ( size == 0 )
+        return EINVAL;
+
+    arena = rudp_alloc(rudp, sizeof(*arena));
+    if ( arena == NULL )
+        return ENOMEM;
+
+    arena->size = (size + ARENA_HUGE_PAGE_SIZE - 1)
+        & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+    arena->base = arena_map(arena->size, &arena->pages);
+    if ( arena->base == NULL ) {
+        rudp_error_t err = errno;
+
+        rudp_free(rudp, arena, sizeof(*arena));
+        return err;
+    }
+
+    arena->slot_size = (sizeof(struct rudp_packet_chain)
+                        + RUDP_RECV_BUFFER_SIZE + ARENA_SLOT_ALIGN - 1)
+        & ~(size_t)(ARENA_SLOT_ALIGN - 1);
+    arena->capacity = arena->size / arena->slot_size;
+    arena->used = 0;
+
+    // Slots are handed out in address order
+    next = &arena->free;
+    for ( i = 0; i < arena->capacity; ++i ) {
+        void *slot = arena->base + i * arena->slot_size;
+
+        *next = slot;
+        next = slot;
+    }
+    *next = NULL;
+
+    rudp->arena = arena;
+
+    return 0;
+}
+
+rudp_error_t rudp_arena_info(const struct rudp *rudp,
+                             struct rudp_arena_info *info)
+{
+    const struct rudp_arena *arena = rudp->arena;
+
+    if ( arena == NULL )
+        return ENOENT;
+
+    info->base = arena->base;
+    info->size = arena->size;
+    info->pages = arena->pages;
+    info->capacity = arena->capacity;
+    info->used = arena->used;
+
+    return 0;
+}
+
+void rudp_arena_close(struct rudp *rudp)
+{
+    struct rudp_arena *arena = rudp->arena;
+
+    if ( arena == NULL )
+        return;
+
+    if ( arena->used )
+        rudp_log_printf(rudp, RUDP_LOG_WARN,
+                        "Arena released with %u packets in use\n",
+                        arena->used);
+
+    munmap(arena->base, arena->size);
+    rudp->arena = NULL;
+    rudp_free(rudp, arena, sizeof(*arena));
+}
@@ -18,6 +18,12 @@
 #include <rudp/peer.h>
 #include "rudp_list.h"
 #include "rudp_packet.h"
+#include "rudp_peer.h"
+#include "rudp_multicast.h"
+#include "rudp_shm.h"
+#include "rudp_mpath.h"
+#include "rudp_mux.h"
+#include "rudp_stream.h"
 
 static const struct rudp_endpoint_handler client_endpoint_handler;
 static const struct rudp_peer_handler client_peer_handler;
@@ -29,12 +35,35 @@ rudp_error_t rudp_client_init(
 {
     rudp_endpoint_init(&client->endpoint, rudp, &client_endpoint_handler);
     rudp_address_init(&client->address, rudp);
+    rudp_list_init(&client->mcast_list);
+    rudp_list_init(&client->path_list);
+    rudp_list_init(&client->early_list);
+    rudp_list_init(&client->mux_item);
+    client->mux = NULL;
+    client->codec = NULL;
+    memset(&client->crypto, 0, sizeof(client->crypto));
     client->rudp = rudp;
     client->handler = handler;
+    client->stream_handler = NULL;
+    client->shm_ring_size = 0;
+    client->path_scheduler = RUDP_PATH_LOWEST_RTT;
+    client->connecting = 0;
     client->connected = 0;
     return 0;
 }
 
+static
+void client_early_flush(struct rudp_client *client)
+{
+    struct rudp_packet_chain *pc, *tmp;
+
+    rudp_list_for_each_safe(pc, tmp, &client->early_list, chain_item)
+    {
+        rudp_list_remove(&pc->chain_item);
+        rudp_packet_chain_free(client->rudp, pc);
+    }
+}
+
 rudp_error_t rudp_client_connect(struct rudp_client *client)
 {
     const struct sockaddr_storage *addr;
@@ -45,12 +74,41 @@ rudp_error_t rudp_client_connect(struct rudp_client *client)
     if ( err )
         return err;
 
+    if ( client->mux ) {
+        err = rudp_mux_client_attach(client->mux, client, addr);
+        if ( err )
+            return err;
+    }
+
     rudp_peer_from_sockaddr(&client->peer, client->rudp,
-                            addr,
-                            &client_peer_handler, &client->endpoint);
+                            addr, &client_peer_handler,
+                            client->mux ? &client->mux->endpoint
+                                        : &client->endpoint);
+
+    // Compression starts once server picks the codec
+    client->peer.codec = client->codec;
+    client->peer.crypto_policy = &client->crypto;
 
     rudp_peer_send_connect(&client->peer);
 
+    // Early data goes right after connection request
+    struct rudp_packet_chain *pc, *tmp;
+    rudp_list_for_each_safe(pc, tmp, &client->early_list, chain_item)
+    {
+        rudp_list_remove(&pc->chain_item);
+
+        if ( pc->packet->header.opt & RUDP_OPT_RELIABLE )
+            rudp_peer_send_reliable(&client->peer, pc);
+        else
+            rudp_peer_send_unreliable(&client->peer, pc);
+    }
+
+    client->connecting = 1;
+
+    // Shared socket is already bound
+    if ( client->mux )
+        return 0;
+
     memset(&bind_addr, 0, sizeof (bind_addr));
     bind_addr.sa_family = addr->ss_family;
     rudp_endpoint_set_addr(&client->endpoint, &bind_addr, sizeof (bind_addr));
@@ -58,19 +116,35 @@ rudp_error_t rudp_client_connect(struct rudp_client *client)
     return rudp_endpoint_bind(&client->endpoint);
 }
 
+static
+void client_endpoint_release(struct rudp_client *client)
+{
+    if ( client->mux )
+        rudp_mux_client_detach(client);
+    else
+        rudp_endpoint_close(&client->endpoint);
+}
+
 rudp_error_t rudp_client_close(struct rudp_client *client)
 {
+    client->connecting = 0;
+    client->connected = 0;
+    client_early_flush(client);
+
     rudp_peer_send_close_noqueue(&client->peer);
 
     rudp_peer_deinit(&client->peer);
 
-    rudp_endpoint_close(&client->endpoint);
+    client_endpoint_release(client);
     return 0;
 }
 
 rudp_error_t rudp_client_deinit(struct rudp_client *client)
 {
+    client_early_flush(client);
+    rudp_mpath_client_deinit(client);
     rudp_endpoint_deinit(&client->endpoint);
+    rudp_address_deinit(&client->address);
     return 0;
 }
 
@@ -87,6 +161,45 @@ void client_handle_data_packet(
         header->data, pc->len - sizeof(header));
 }
 
+static
+void client_handle_command(
+    struct rudp_peer *peer,
+    struct rudp_packet_chain *pc)
+{
+    struct rudp_client *client = __container_of(peer, client, peer);
+
+    if ( pc->packet->header.command == RUDP_CMD_MCAST_DATA )
+        rudp_mcast_receiver_handle_repair(client, pc);
+}
+
+static
+void client_stream_begin(struct rudp_peer *peer, int command, uint64_t size)
+{
+    struct rudp_client *client = __container_of(peer, client, peer);
+
+    if ( client->stream_handler )
+        client->stream_handler->begin(client, command, size);
+}
+
+static
+void client_stream_chunk(struct rudp_peer *peer, uint64_t offset,
+                         const void *data, size_t len)
+{
+    struct rudp_client *client = __container_of(peer, client, peer);
+
+    if ( client->stream_handler )
+        client->stream_handler->chunk(client, offset, data, len);
+}
+
+static
+void client_stream_end(struct rudp_peer *peer, rudp_error_t err)
+{
+    struct rudp_client *client = __container_of(peer, client, peer);
+
+    if ( client->stream_handler )
+        client->stream_handler->end(client, err);
+}
+
 static
 void client_link_info(struct rudp_peer *peer, struct rudp_link_info *info)
 {
@@ -100,49 +213,107 @@ void client_peer_dropped(struct rudp_peer *peer)
 {
     struct rudp_client *client = __container_of(peer, client, peer);
 
+    client->connecting = 0;
     client->connected = 0;
 
     rudp_peer_deinit(&client->peer);
 
-    rudp_endpoint_close(&client->endpoint);
+    client_endpoint_release(client);
 
     client->handler->server_lost(client);
 }
 
 static const struct rudp_peer_handler client_peer_handler = {
     .handle_packet = client_handle_data_packet,
+    .handle_command = client_handle_command,
     .link_info = client_link_info,
     .dropped = client_peer_dropped,
+    .stream_begin = client_stream_begin,
+    .stream_chunk = client_stream_chunk,
+    .stream_end = client_stream_end,
 };
 
 /*
   - socket watcher
      - endpoint packet reader
-        - client packet handler <===
-           - peer packet handler
+        - (mux packet handler)
+           - client packet handler <===
+              - peer packet handler
  */
-static
-void client_handle_endpoint_packet(struct rudp_endpoint *endpoint,
-                                   const struct sockaddr_storage *addr,
-                                   struct rudp_packet_chain *pc)
+void rudp_client_incoming(struct rudp_client *client,
+                          struct rudp_endpoint *endpoint,
+                          const struct sockaddr_storage *addr,
+                          struct rudp_packet_chain *pc)
 {
-    struct rudp_client *client = __container_of(endpoint, client, endpoint);
-
     rudp_log_printf(client->rudp, RUDP_LOG_INFO,
                     "Endpoint handling packet\n");
 
+    if ( rudp_mpath_is_path_packet(pc) ) {
+        if ( client->peer.mpath )
+            rudp_mpath_handle_path_packet(&client->peer, endpoint, addr, pc);
+        return;
+    }
+
     rudp_error_t err = rudp_peer_incoming_packet(&client->peer, pc);
     if ( err == 0 && client->connected == 0 )
     {
+        client->connecting = 0;
         client->connected = 1;
+
+        if ( client->shm_ring_size )
+            rudp_shm_offer(&client->peer, client->shm_ring_size);
+
+        if ( rudp_mpath_client_start(client) )
+            rudp_log_printf(client->rudp, RUDP_LOG_WARN,
+                            "Extra paths not started, no path token\n");
+
         client->handler->connected(client);
     }
 }
 
+static
+void client_handle_endpoint_packet(struct rudp_endpoint *endpoint,
+                                   const struct sockaddr_storage *addr,
+                                   struct rudp_packet_chain *pc)
+{
+    struct rudp_client *client = __container_of(endpoint, client, endpoint);
+
+    rudp_client_incoming(client, endpoint, addr, pc);
+}
+
 static const struct rudp_endpoint_handler client_endpoint_handler = {
     .handle_packet = client_handle_endpoint_packet,
 };
 
+static
+rudp_error_t client_send_chain(
+    struct rudp_client *client,
+    int reliable, int command,
+    struct rudp_packet_chain *pc)
+{
+    rudp_error_t err;
+
+    pc->packet->header.command = RUDP_CMD_APP + command;
+
+    // Kept until connection is attempted
+    if ( !client->connected && !client->connecting ) {
+        pc->packet->header.opt = reliable ? RUDP_OPT_RELIABLE : 0;
+        rudp_list_append(&client->early_list, &pc->chain_item);
+        return 0;
+    }
+
+    if ( reliable )
+        err = rudp_peer_send_reliable(&client->peer, pc);
+    else
+        err = rudp_peer_send_unreliable(&client->peer, pc);
+
+    // Goes out with the batch of shared socket
+    if ( client->mux && client->mux->endpoint.tx_batch_depth )
+        rudp_peer_flush(&client->peer);
+
+    return err;
+}
+
 rudp_error_t rudp_client_send(
     struct rudp_client *client,
     int reliable, int command,
@@ -152,9 +323,6 @@ rudp_error_t rudp_client_send(
     if ( (command + RUDP_CMD_APP) > 255 )
         return EINVAL;
 
-    if ( !client->connected )
-        return EINVAL;
-
     struct rudp_packet_chain *pc = rudp_packet_chain_alloc(
         client->rudp, sizeof(struct rudp_packet_header) + size);
     if ( pc == NULL )
@@ -162,12 +330,68 @@ rudp_error_t rudp_client_send(
 
     memcpy(&pc->packet->data.data[0], data, size);
 
-    pc->packet->header.command = RUDP_CMD_APP + command;
+    return client_send_chain(client, reliable, command, pc);
+}
 
-    if ( reliable )
-        return rudp_peer_send_reliable(&client->peer, pc);
-    else
-        return rudp_peer_send_unreliable(&client->peer, pc);
+rudp_error_t rudp_client_send_buffer(
+    struct rudp_client *client,
+    int reliable, int command,
+    const void *data, size_t size,
+    rudp_buffer_done_func_t *done, void *priv)
+{
+    struct rudp_payload *payload;
+    struct rudp_packet_chain *pc;
+
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    payload = rudp_payload_wrap(client->rudp, data, size, done, priv);
+    if ( payload == NULL )
+        return ENOMEM;
+
+    pc = rudp_packet_chain_alloc_payload(
+        client->rudp, sizeof(struct rudp_packet_header), payload);
+    if ( pc == NULL ) {
+        // Not referenced yet, user keeps the buffer
+        payload->done = NULL;
+        rudp_payload_unref(client->rudp, payload);
+        return ENOMEM;
+    }
+    rudp_payload_unref(client->rudp, payload);
+
+    // Queued even on a socket error, buffer is released as usual
+    return client_send_chain(client, reliable, command, pc);
+}
+
+void rudp_client_set_stream_handler(
+    struct rudp_client *client,
+    const struct rudp_client_stream_handler *handler)
+{
+    client->stream_handler = handler;
+}
+
+rudp_error_t rudp_client_send_stream(
+    struct rudp_client *client,
+    int command,
+    const void *data, size_t size,
+    rudp_buffer_done_func_t *done, void *priv)
+{
+    rudp_error_t err;
+
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    if ( !client->connected && !client->connecting )
+        return ENOTCONN;
+
+    err = rudp_stream_send(&client->peer, RUDP_CMD_APP + command,
+                           data, size, done, priv);
+
+    // Goes out with the batch of shared socket
+    if ( client->mux && client->mux->endpoint.tx_batch_depth )
+        rudp_peer_flush(&client->peer);
+
+    return err;
 }
 
 rudp_error_t rudp_client_set_hostname(
@@ -211,3 +435,26 @@ rudp_error_t rudp_client_set_addr(
 {
     return rudp_address_set(&client->address, addr, addrlen);
 }
+
+rudp_error_t rudp_client_set_shm(
+    struct rudp_client *client,
+    uint32_t ring_size)
+{
+    if ( ring_size && (ring_size < 4096 || ring_size > (64 << 20)
+                       || (ring_size & (ring_size - 1))) )
+        return EINVAL;
+
+    client->shm_ring_size = ring_size;
+    return 0;
+}
+
+rudp_error_t rudp_client_set_mux(
+    struct rudp_client *client,
+    struct rudp_client_mux *mux)
+{
+    if ( client->connected || client->connecting )
+        return EBUSY;
+
+    client->mux = mux;
+    return 0;
+}
@@ -0,0 +1,471 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/codec.h>
+#include <rudp/client.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_codec.h"
+
+/* Built-in LZ codec */
+
+/*
+  Compressed data is a list of sequences, each made of:
+  - a token byte, literal count in high nibble, match length minus
+    LZ_MIN_MATCH in low nibble, 15 meaning more length bytes follow,
+  - more literal count bytes, added up until one is not 255,
+  - literals,
+  - match offset, 16-bit little-endian,
+  - more match length bytes, as for literals.
+  Last sequence stops after its literals.
+
+  Matches may reach into the dictionary, as if it was right before
+  data.
+ */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 11
+#define LZ_MIN_SIZE 32
+#define LZ_DICT_MIN_SIZE 8
+
+/*
+  Dictionary followed by data, addressed as one buffer.
+ */
+struct lz_window
+{
+    const uint8_t *dict;
+    size_t dict_size;
+    const uint8_t *data;
+};
+
+static inline
+uint8_t lz_byte(const struct lz_window *w, size_t pos)
+{
+    if ( pos < w->dict_size )
+        return w->dict[pos];
+    return w->data[pos - w->dict_size];
+}
+
+static inline
+uint32_t lz_read32(const struct lz_window *w, size_t pos)
+{
+    uint32_t v;
+
+    if ( pos >= w->dict_size ) {
+        memcpy(&v, w->data + pos - w->dict_size, sizeof(v));
+        return v;
+    }
+
+    if ( pos + sizeof(v) <= w->dict_size ) {
+        memcpy(&v, w->dict + pos, sizeof(v));
+        return v;
+    }
+
+    uint8_t b[4] = {
+        lz_byte(w, pos), lz_byte(w, pos + 1),
+        lz_byte(w, pos + 2), lz_byte(w, pos + 3),
+    };
+    memcpy(&v, b, sizeof(v));
+    return v;
+}
+
+static inline
+unsigned int lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static
+uint8_t *lz_length_put(uint8_t *op, const uint8_t *oend, size_t n)
+{
+    for ( n -= 15; op < oend; n -= 255 ) {
+        if ( n < 255 ) {
+            *op++ = n;
+            return op;
+        }
+        *op++ = 255;
+    }
+
+    return NULL;
+}
+
+static
+int lz_length_get(const uint8_t **ip, const uint8_t *iend, size_t *n)
+{
+    uint8_t b;
+
+    do {
+        if ( *ip == iend )
+            return -1;
+        b = *(*ip)++;
+        *n += b;
+    } while ( b == 255 );
+
+    return 0;
+}
+
+/*
+  Literals are always taken from data, never from dictionary.  A
+  null match length ends the stream.
+ */
+static
+uint8_t *lz_sequence_put(uint8_t *op, const uint8_t *oend,
+                         const uint8_t *literals, size_t lit,
+                         size_t offset, size_t mlen)
+{
+    size_t mcode = mlen ? mlen - LZ_MIN_MATCH : 0;
+
+    if ( op == oend )
+        return NULL;
+
+    *op++ = ((lit < 15 ? lit : 15) << 4) | (mcode < 15 ? mcode : 15);
+
+    if ( lit >= 15 && (op = lz_length_put(op, oend, lit)) == NULL )
+        return NULL;
+
+    if ( (size_t)(oend - op) < lit )
+        return NULL;
+    memcpy(op, literals, lit);
+    op += lit;
+
+    if ( mlen == 0 )
+        return op;
+
+    if ( oend - op < 2 )
+        return NULL;
+    *op++ = offset;
+    *op++ = offset >> 8;
+
+    if ( mcode >= 15 )
+        op = lz_length_put(op, oend, mcode);
+
+    return op;
+}
+
+static
+size_t lz_compress(const struct rudp_codec *codec,
+                   const uint8_t *in, size_t len,
+                   uint8_t *out, size_t size)
+{
+    const struct rudp_codec_lz *lz = __container_of(codec, lz, codec);
+    const struct lz_window w = { lz->dict, lz->dict_size, in };
+    const size_t end = lz->dict_size + len;
+    size_t p = lz->dict_size, anchor = p;
+    uint8_t *op = out;
+    const uint8_t *oend = out + size;
+    uint16_t table[RUDP_CODEC_LZ_TABLE_SIZE];
+
+    // Positions are 16-bit
+    if ( end >= 0xffff )
+        return 0;
+
+    memcpy(table, lz->table, sizeof(table));
+
+    while ( p + LZ_MIN_MATCH <= end ) {
+        uint32_t seq = lz_read32(&w, p);
+        unsigned int h = lz_hash(seq);
+        size_t ref = table[h];
+        size_t mlen = LZ_MIN_MATCH;
+
+        table[h] = p + 1;
+
+        if ( ref == 0 || lz_read32(&w, ref - 1) != seq ) {
+            p++;
+            continue;
+        }
+        ref--;
+
+        while ( p + mlen < end
+                && lz_byte(&w, ref + mlen) == lz_byte(&w, p + mlen) )
+            mlen++;
+
+        op = lz_sequence_put(op, oend, in + anchor - lz->dict_size,
+                             p - anchor, p - ref, mlen);
+        if ( op == NULL )
+            return 0;
+
+        p += mlen;
+        anchor = p;
+    }
+
+    op = lz_sequence_put(op, oend, in + anchor - lz->dict_size,
+                         end - anchor, 0, 0);
+
+    return op ? (size_t)(op - out) : 0;
+}
+
+static
+size_t lz_decompress(const struct rudp_codec *codec,
+                     const uint8_t *in, size_t len,
+                     uint8_t *out, size_t size)
+{
+    const struct rudp_codec_lz *lz = __container_of(codec, lz, codec);
+    const uint8_t *ip = in, *iend = in + len;
+    uint8_t *op = out;
+    const uint8_t *oend = out + size;
+
+    while ( ip < iend ) {
+        uint8_t token = *ip++;
+        size_t lit = token >> 4;
+        size_t mlen = token & 15;
+        size_t offset, ref;
+
+        if ( lit == 15 && lz_length_get(&ip, iend, &lit) )
+            return 0;
+
+        if ( (size_t)(iend - ip) < lit || (size_t)(oend - op) < lit )
+            return 0;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        if ( ip == iend )
+            break;
+
+        if ( iend - ip < 2 )
+            return 0;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if ( mlen == 15 && lz_length_get(&ip, iend, &mlen) )
+            return 0;
+        mlen += LZ_MIN_MATCH;
+
+        if ( offset == 0
+             || offset > (size_t)(op - out) + lz->dict_size
+             || (size_t)(oend - op) < mlen )
+            return 0;
+
+        // Match may overlap its own output, copy bytewise
+        ref = lz->dict_size + (op - out) - offset;
+        for ( ; mlen && ref < lz->dict_size; --mlen )
+            *op++ = lz->dict[ref++];
+        for ( ; mlen; --mlen )
+            *op++ = out[ref++ - lz->dict_size];
+    }
+
+    return op - out;
+}
+
+rudp_error_t rudp_codec_lz_init(struct rudp_codec_lz *lz,
+                                const void *dict, size_t dict_size)
+{
+    const struct lz_window w = { dict, dict_size, NULL };
+    size_t p;
+
+    if ( dict_size > RUDP_CODEC_LZ_DICT_MAX )
+        return EINVAL;
+
+    lz->codec.id = RUDP_CODEC_LZ;
+    lz->codec.dict_id = rudp_codec_dict_id(dict, dict_size);
+    lz->codec.min_size = dict_size ? LZ_DICT_MIN_SIZE : LZ_MIN_SIZE;
+    lz->codec.compress = lz_compress;
+    lz->codec.decompress = lz_decompress;
+    lz->dict = dict;
+    lz->dict_size = dict_size;
+
+    memset(lz->table, 0, sizeof(lz->table));
+
+    // Later positions win, they are closer to data
+    for ( p = 0; p + LZ_MIN_MATCH <= dict_size; ++p )
+        lz->table[lz_hash(lz_read32(&w, p))] = p + 1;
+
+    return 0;
+}
+
+uint32_t rudp_codec_dict_id(const void *dict, size_t dict_size)
+{
+    const uint8_t *d = dict;
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    if ( dict_size == 0 )
+        return 0;
+
+    for ( i = 0; i < dict_size; ++i )
+        h = (h ^ d[i]) * 16777619u;
+
+    return h ? h : 1;
+}
+
+/* Peer stage */
+
+void rudp_codec_offer(struct rudp_peer *peer, struct rudp_packet_chain *req)
+{
+    struct rudp_conn_option_codec offer;
+
+    if ( peer->codec == NULL )
+        return;
+
+    memset(&offer, 0, sizeof(offer));
+    offer.codec = peer->codec->id;
+    offer.dict_id = htonl(peer->codec->dict_id);
+
+    rudp_packet_conn_option_add(req, RUDP_CONN_OPT_CODEC,
+                                &offer, sizeof(offer));
+}
+
+/*
+  Reads a codec option of a connection packet, 0 when there is
+  none.
+ */
+static
+int codec_option_get(const struct rudp_packet_chain *pc, size_t offset,
+                     struct rudp_conn_option_codec *option)
+{
+    size_t len;
+    const uint8_t *value = rudp_packet_conn_option_find(
+        pc, offset, RUDP_CONN_OPT_CODEC, &len);
+
+    if ( value == NULL || len < sizeof(*option) )
+        return 0;
+
+    memcpy(option, value, sizeof(*option));
+    option->dict_id = ntohl(option->dict_id);
+
+    return 1;
+}
+
+void rudp_codec_answer(struct rudp_peer *peer,
+                       const struct rudp_packet_chain *req,
+                       struct rudp_packet_chain *rsp)
+{
+    struct rudp_conn_option_codec offer;
+    unsigned int i;
+
+    if ( !codec_option_get(req, sizeof(struct rudp_packet_conn_req),
+                           &offer) )
+        return;
+
+    for ( i = 0; i < peer->codec_accept_count; ++i ) {
+        const struct rudp_codec *codec = peer->codec_accept[i];
+
+        if ( codec->id != offer.codec || codec->dict_id != offer.dict_id )
+            continue;
+
+        // Same offer is answered the same way
+        peer->codec = codec;
+        peer->codec_active = 1;
+        rudp_codec_offer(peer, rsp);
+        return;
+    }
+}
+
+void rudp_codec_handle_answer(struct rudp_peer *peer,
+                              const struct rudp_packet_chain *rsp)
+{
+    struct rudp_conn_option_codec answer;
+
+    if ( peer->codec == NULL )
+        return;
+
+    if ( codec_option_get(rsp, sizeof(struct rudp_packet_conn_rsp),
+                          &answer)
+         && answer.codec == peer->codec->id
+         && answer.dict_id == peer->codec->dict_id ) {
+        peer->codec_active = 1;
+        return;
+    }
+
+    rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                    "Codec %d refused by peer\n", peer->codec->id);
+    peer->codec = NULL;
+}
+
+void rudp_codec_compress(struct rudp_peer *peer,
+                         struct rudp_packet_chain *pc)
+{
+    const struct rudp_codec *codec = peer->codec;
+    const size_t header = sizeof(struct rudp_packet_header);
+    struct rudp_packet_chain *out;
+    size_t len = pc->len - header;
+    size_t size;
+
+    // Receiver must be able to hold uncompressed data
+    if ( pc->payload || pc->packet->header.command < RUDP_CMD_APP
+         || len < codec->min_size || pc->len > RUDP_RECV_BUFFER_SIZE )
+        return;
+
+    out = rudp_packet_chain_alloc(peer->rudp, pc->len);
+    if ( out == NULL )
+        return;
+
+    // Anything not smaller is sent as is
+    size = codec->compress(codec, pc->packet->data.data, len,
+                           out->packet->data.data, len - 1);
+    if ( size ) {
+        memcpy(pc->packet->data.data, out->packet->data.data, size);
+        pc->len = header + size;
+        pc->packet->header.opt |= RUDP_OPT_COMPRESSED;
+    }
+
+    rudp_packet_chain_free(peer->rudp, out);
+}
+
+struct rudp_packet_chain *rudp_codec_decompress(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc)
+{
+    const struct rudp_codec *codec = peer->codec;
+    const size_t header = sizeof(struct rudp_packet_header);
+    struct rudp_packet_chain *out;
+    size_t size;
+
+    if ( codec == NULL )
+        return NULL;
+
+    out = rudp_packet_chain_alloc(peer->rudp, RUDP_RECV_BUFFER_SIZE);
+    if ( out == NULL )
+        return NULL;
+
+    size = codec->decompress(codec, pc->packet->data.data,
+                             pc->len - header, out->packet->data.data,
+                             RUDP_RECV_BUFFER_SIZE - header);
+    if ( size == 0 ) {
+        rudp_packet_chain_free(peer->rudp, out);
+        return NULL;
+    }
+
+    out->packet->header = pc->packet->header;
+    out->packet->header.opt &= ~RUDP_OPT_COMPRESSED;
+    out->len = header + size;
+
+    return out;
+}
+
+/* User API */
+
+rudp_error_t rudp_client_set_codec(struct rudp_client *client,
+                                   const struct rudp_codec *codec)
+{
+    if ( client->connected || client->connecting )
+        return EBUSY;
+
+    client->codec = codec;
+    return 0;
+}
+
+rudp_error_t rudp_server_add_codec(struct rudp_server *server,
+                                   const struct rudp_codec *codec)
+{
+    if ( server->codec_count == RUDP_CODEC_ACCEPT_MAX )
+        return ENOSPC;
+
+    server->codec[server->codec_count++] = codec;
+    return 0;
+}
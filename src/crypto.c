@@ -0,0 +1,1104 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/crypto.h>
+#include <rudp/client.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_crypto.h"
+#include "rudp_shard.h"
+
+#define CRYPTO_TAG_SIZE 16
+#define CRYPTO_CONFIRM_SIZE 16
+#define CRYPTO_REPLAY_WINDOW 64
+
+struct rudp_crypto
+{
+    uint32_t tx_key[8];
+    uint32_t rx_key[8];
+    uint64_t tx_counter;
+    uint64_t rx_counter;
+    uint64_t rx_window;
+    uint8_t secret[RUDP_CRYPTO_KEY_SIZE];
+    uint8_t public[RUDP_CRYPTO_KEY_SIZE];
+    uint8_t active;
+};
+
+static inline
+uint32_t load32_le(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+        | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline
+void store32_le(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline
+void store64_le(uint8_t *p, uint64_t v)
+{
+    store32_le(p, v);
+    store32_le(p + 4, v >> 32);
+}
+
+/*
+  Compilers may drop a plain memset of data never read again.
+ */
+static
+void crypto_wipe(void *data, size_t size)
+{
+    volatile uint8_t *p = data;
+
+    while ( size-- )
+        *p++ = 0;
+}
+
+/* ChaCha20 (RFC 8439) */
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define CHACHA_QR(a, b, c, d)                   \
+    do {                                        \
+        a += b; d ^= a; d = ROTL32(d, 16);      \
+        c += d; b ^= c; b = ROTL32(b, 12);      \
+        a += b; d ^= a; d = ROTL32(d, 8);       \
+        c += d; b ^= c; b = ROTL32(b, 7);       \
+    } while (0)
+
+/*
+  Same quarter round on the four lanes of a 4-block batch.  Lanes
+  are innermost, so that each step maps to one vector instruction.
+ */
+#define CHACHA_QR4(x, a, b, c, d)                                       \
+    do {                                                                \
+        int l_;                                                         \
+        for ( l_ = 0; l_ < 4; ++l_ ) {                                  \
+            x[a][l_] += x[b][l_]; x[d][l_] ^= x[a][l_];                 \
+            x[d][l_] = ROTL32(x[d][l_], 16);                            \
+        }                                                               \
+        for ( l_ = 0; l_ < 4; ++l_ ) {                                  \
+            x[c][l_] += x[d][l_]; x[b][l_] ^= x[c][l_];                 \
+            x[b][l_] = ROTL32(x[b][l_], 12);                            \
+        }                                                               \
+        for ( l_ = 0; l_ < 4; ++l_ ) {                                  \
+            x[a][l_] += x[b][l_]; x[d][l_] ^= x[a][l_];                 \
+            x[d][l_] = ROTL32(x[d][l_], 8);                             \
+        }                                                               \
+        for ( l_ = 0; l_ < 4; ++l_ ) {                                  \
+            x[c][l_] += x[d][l_]; x[b][l_] ^= x[c][l_];                 \
+            x[b][l_] = ROTL32(x[b][l_], 7);                             \
+        }                                                               \
+    } while (0)
+
+static
+void chacha_init(uint32_t state[16], const uint32_t key[8],
+                 uint32_t counter, const uint8_t nonce[12])
+{
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    memcpy(&state[4], key, 8 * sizeof(uint32_t));
+    state[12] = counter;
+    state[13] = load32_le(nonce);
+    state[14] = load32_le(nonce + 4);
+    state[15] = load32_le(nonce + 8);
+}
+
+/*
+  Four consecutive keystream blocks at once, 256 bytes.
+ */
+static
+void chacha_blocks4(const uint32_t state[16], uint8_t out[256])
+{
+    uint32_t x[16][4];
+    int i, l;
+
+    for ( i = 0; i < 16; ++i )
+        for ( l = 0; l < 4; ++l )
+            x[i][l] = state[i];
+    for ( l = 0; l < 4; ++l )
+        x[12][l] += l;
+
+    for ( i = 0; i < 10; ++i ) {
+        CHACHA_QR4(x, 0, 4, 8, 12);
+        CHACHA_QR4(x, 1, 5, 9, 13);
+        CHACHA_QR4(x, 2, 6, 10, 14);
+        CHACHA_QR4(x, 3, 7, 11, 15);
+        CHACHA_QR4(x, 0, 5, 10, 15);
+        CHACHA_QR4(x, 1, 6, 11, 12);
+        CHACHA_QR4(x, 2, 7, 8, 13);
+        CHACHA_QR4(x, 3, 4, 9, 14);
+    }
+
+    for ( l = 0; l < 4; ++l )
+        for ( i = 0; i < 16; ++i )
+            store32_le(out + 64 * l + 4 * i,
+                       x[i][l] + state[i] + (i == 12 ? l : 0));
+}
+
+/*
+  Xors data with keystream, starting at block counter of state.
+ */
+static
+void chacha_xor(uint32_t state[16], uint8_t *out, const uint8_t *in,
+                size_t len)
+{
+    uint8_t ks[256];
+    size_t i, n;
+
+    while ( len ) {
+        chacha_blocks4(state, ks);
+        state[12] += 4;
+
+        n = len < sizeof(ks) ? len : sizeof(ks);
+        for ( i = 0; i < n; ++i )
+            out[i] = in[i] ^ ks[i];
+
+        out += n;
+        in += n;
+        len -= n;
+    }
+
+    crypto_wipe(ks, sizeof(ks));
+}
+
+/*
+  HChaCha20, derives a key from a key and 16 bytes of input.
+ */
+static
+void hchacha(uint8_t out[32], const uint8_t key[32], const uint8_t in[16])
+{
+    uint32_t x[16];
+    int i;
+
+    x[0] = 0x61707865;
+    x[1] = 0x3320646e;
+    x[2] = 0x79622d32;
+    x[3] = 0x6b206574;
+    for ( i = 0; i < 8; ++i )
+        x[4 + i] = load32_le(key + 4 * i);
+    for ( i = 0; i < 4; ++i )
+        x[12 + i] = load32_le(in + 4 * i);
+
+    for ( i = 0; i < 10; ++i ) {
+        CHACHA_QR(x[0], x[4], x[8], x[12]);
+        CHACHA_QR(x[1], x[5], x[9], x[13]);
+        CHACHA_QR(x[2], x[6], x[10], x[14]);
+        CHACHA_QR(x[3], x[7], x[11], x[15]);
+        CHACHA_QR(x[0], x[5], x[10], x[15]);
+        CHACHA_QR(x[1], x[6], x[11], x[12]);
+        CHACHA_QR(x[2], x[7], x[8], x[13]);
+        CHACHA_QR(x[3], x[4], x[9], x[14]);
+    }
+
+    for ( i = 0; i < 4; ++i ) {
+        store32_le(out + 4 * i, x[i]);
+        store32_le(out + 16 + 4 * i, x[12 + i]);
+    }
+
+    crypto_wipe(x, sizeof(x));
+}
+
+/* Poly1305 (RFC 8439), 26-bit limbs */
+
+struct poly1305
+{
+    uint32_t r[5];
+    uint32_t h[5];
+    uint32_t pad[4];
+    uint8_t buffer[16];
+    size_t leftover;
+};
+
+static
+void poly1305_init(struct poly1305 *st, const uint8_t key[32])
+{
+    int i;
+
+    st->r[0] = load32_le(key + 0) & 0x3ffffff;
+    st->r[1] = (load32_le(key + 3) >> 2) & 0x3ffff03;
+    st->r[2] = (load32_le(key + 6) >> 4) & 0x3ffc0ff;
+    st->r[3] = (load32_le(key + 9) >> 6) & 0x3f03fff;
+    st->r[4] = (load32_le(key + 12) >> 8) & 0x00fffff;
+
+    for ( i = 0; i < 5; ++i )
+        st->h[i] = 0;
+    for ( i = 0; i < 4; ++i )
+        st->pad[i] = load32_le(key + 16 + 4 * i);
+
+    st->leftover = 0;
+}
+
+static
+void poly1305_blocks(struct poly1305 *st, const uint8_t *m, size_t len,
+                     uint32_t hibit)
+{
+    const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2],
+        r3 = st->r[3], r4 = st->r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2],
+        h3 = st->h[3], h4 = st->h[4];
+
+    for ( ; len >= 16; m += 16, len -= 16 ) {
+        uint64_t d0, d1, d2, d3, d4;
+        uint32_t c;
+
+        h0 += load32_le(m + 0) & 0x3ffffff;
+        h1 += (load32_le(m + 3) >> 2) & 0x3ffffff;
+        h2 += (load32_le(m + 6) >> 4) & 0x3ffffff;
+        h3 += (load32_le(m + 9) >> 6) & 0x3ffffff;
+        h4 += (load32_le(m + 12) >> 8) | hibit;
+
+        d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3
+            + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4
+            + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0
+            + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1
+            + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2
+            + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        c = d0 >> 26; h0 = d0 & 0x3ffffff;
+        d1 += c; c = d1 >> 26; h1 = d1 & 0x3ffffff;
+        d2 += c; c = d2 >> 26; h2 = d2 & 0x3ffffff;
+        d3 += c; c = d3 >> 26; h3 = d3 & 0x3ffffff;
+        d4 += c; c = d4 >> 26; h4 = d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+    }
+
+    st->h[0] = h0;
+    st->h[1] = h1;
+    st->h[2] = h2;
+    st->h[3] = h3;
+    st->h[4] = h4;
+}
+
+static
+void poly1305_update(struct poly1305 *st, const uint8_t *m, size_t len)
+{
+    size_t n;
+
+    if ( st->leftover ) {
+        n = 16 - st->leftover;
+        if ( n > len )
+            n = len;
+        memcpy(st->buffer + st->leftover, m, n);
+        st->leftover += n;
+        m += n;
+        len -= n;
+        if ( st->leftover < 16 )
+            return;
+        poly1305_blocks(st, st->buffer, 16, 1 << 24);
+        st->leftover = 0;
+    }
+
+    n = len & ~(size_t)15;
+    poly1305_blocks(st, m, n, 1 << 24);
+    m += n;
+    len -= n;
+
+    memcpy(st->buffer, m, len);
+    st->leftover = len;
+}
+
+static
+void poly1305_pad(struct poly1305 *st)
+{
+    static const uint8_t zero[16];
+
+    if ( st->leftover )
+        poly1305_update(st, zero, 16 - st->leftover);
+}
+
+static
+void poly1305_finish(struct poly1305 *st, uint8_t mac[16])
+{
+    uint32_t h0, h1, h2, h3, h4, c;
+    uint32_t g0, g1, g2, g3, g4, mask;
+    uint64_t f;
+
+    if ( st->leftover ) {
+        st->buffer[st->leftover] = 1;
+        memset(st->buffer + st->leftover + 1, 0, 15 - st->leftover);
+        poly1305_blocks(st, st->buffer, 16, 0);
+    }
+
+    h0 = st->h[0]; h1 = st->h[1]; h2 = st->h[2];
+    h3 = st->h[3]; h4 = st->h[4];
+
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    // h - p, picked in constant time if not negative
+    g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    g4 = h4 + c - (1 << 26);
+
+    mask = (g4 >> 31) - 1;
+    g0 &= mask; g1 &= mask; g2 &= mask; g3 &= mask; g4 &= mask;
+    mask = ~mask;
+    h0 = (h0 & mask) | g0;
+    h1 = (h1 & mask) | g1;
+    h2 = (h2 & mask) | g2;
+    h3 = (h3 & mask) | g3;
+    h4 = (h4 & mask) | g4;
+
+    h0 = h0 | (h1 << 26);
+    h1 = (h1 >> 6) | (h2 << 20);
+    h2 = (h2 >> 12) | (h3 << 14);
+    h3 = (h3 >> 18) | (h4 << 8);
+
+    f = (uint64_t)h0 + st->pad[0]; h0 = f;
+    f = (uint64_t)h1 + st->pad[1] + (f >> 32); h1 = f;
+    f = (uint64_t)h2 + st->pad[2] + (f >> 32); h2 = f;
+    f = (uint64_t)h3 + st->pad[3] + (f >> 32); h3 = f;
+
+    store32_le(mac + 0, h0);
+    store32_le(mac + 4, h1);
+    store32_le(mac + 8, h2);
+    store32_le(mac + 12, h3);
+
+    crypto_wipe(st, sizeof(*st));
+}
+
+/* ChaCha20-Poly1305 AEAD (RFC 8439) */
+
+static
+void aead_tag(uint32_t state[16], uint8_t tag[CRYPTO_TAG_SIZE],
+              const uint8_t *aad, size_t aad_len,
+              const uint8_t *ct, size_t ct_len)
+{
+    struct poly1305 poly;
+    uint8_t block[64];
+    uint8_t lengths[16];
+
+    // One-time key is the first half of block 0
+    state[12] = 0;
+    chacha_xor(state, block, (const uint8_t [64]){ 0 }, 64);
+    poly1305_init(&poly, block);
+    crypto_wipe(block, sizeof(block));
+
+    poly1305_update(&poly, aad, aad_len);
+    poly1305_pad(&poly);
+    poly1305_update(&poly, ct, ct_len);
+    poly1305_pad(&poly);
+    store64_le(lengths, aad_len);
+    store64_le(lengths + 8, ct_len);
+    poly1305_update(&poly, lengths, sizeof(lengths));
+    poly1305_finish(&poly, tag);
+}
+
+static
+void aead_seal(const uint32_t key[8], const uint8_t nonce[12],
+               const uint8_t *aad, size_t aad_len,
+               uint8_t *out, const uint8_t *in, size_t len)
+{
+    uint32_t state[16];
+
+    chacha_init(state, key, 1, nonce);
+    chacha_xor(state, out, in, len);
+    aead_tag(state, out + len, aad, aad_len, out, len);
+    crypto_wipe(state, sizeof(state));
+}
+
+/*
+  Tag is checked before anything is decrypted.
+ */
+static
+int aead_open(const uint32_t key[8], const uint8_t nonce[12],
+              const uint8_t *aad, size_t aad_len,
+              uint8_t *out, const uint8_t *in, size_t len)
+{
+    uint32_t state[16];
+    uint8_t tag[CRYPTO_TAG_SIZE];
+    uint8_t diff = 0;
+    size_t i;
+
+    chacha_init(state, key, 0, nonce);
+    aead_tag(state, tag, aad, aad_len, in, len);
+    for ( i = 0; i < CRYPTO_TAG_SIZE; ++i )
+        diff |= tag[i] ^ in[len + i];
+
+    if ( diff ) {
+        crypto_wipe(state, sizeof(state));
+        return -1;
+    }
+
+    state[12] = 1;
+    chacha_xor(state, out, in, len);
+    crypto_wipe(state, sizeof(state));
+
+    return 0;
+}
+
+/* X25519 (RFC 7748), radix 2^16 field elements */
+
+typedef int64_t gf[16];
+
+static const gf gf_121665 = { 0xdb41, 1 };
+
+static
+void gf_carry(gf o)
+{
+    int64_t c;
+    int i;
+
+    for ( i = 0; i < 16; ++i ) {
+        o[i] += (int64_t)1 << 16;
+        c = o[i] >> 16;
+        o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+        o[i] -= c * ((int64_t)1 << 16);
+    }
+}
+
+static
+void gf_swap(gf p, gf q, int b)
+{
+    int64_t t, c = ~(int64_t)(b - 1);
+    int i;
+
+    for ( i = 0; i < 16; ++i ) {
+        t = c & (p[i] ^ q[i]);
+        p[i] ^= t;
+        q[i] ^= t;
+    }
+}
+
+static
+void gf_pack(uint8_t o[32], const gf n)
+{
+    gf m, t;
+    int i, j, b;
+
+    for ( i = 0; i < 16; ++i )
+        t[i] = n[i];
+    gf_carry(t);
+    gf_carry(t);
+    gf_carry(t);
+
+    for ( j = 0; j < 2; ++j ) {
+        m[0] = t[0] - 0xffed;
+        for ( i = 1; i < 15; ++i ) {
+            m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+            m[i - 1] &= 0xffff;
+        }
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        b = (m[15] >> 16) & 1;
+        m[14] &= 0xffff;
+        gf_swap(t, m, 1 - b);
+    }
+
+    for ( i = 0; i < 16; ++i ) {
+        o[2 * i] = t[i] & 0xff;
+        o[2 * i + 1] = t[i] >> 8;
+    }
+}
+
+static
+void gf_unpack(gf o, const uint8_t n[32])
+{
+    int i;
+
+    for ( i = 0; i < 16; ++i )
+        o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+    o[15] &= 0x7fff;
+}
+
+static
+void gf_add(gf o, const gf a, const gf b)
+{
+    int i;
+
+    for ( i = 0; i < 16; ++i )
+        o[i] = a[i] + b[i];
+}
+
+static
+void gf_sub(gf o, const gf a, const gf b)
+{
+    int i;
+
+    for ( i = 0; i < 16; ++i )
+        o[i] = a[i] - b[i];
+}
+
+static
+void gf_mul(gf o, const gf a, const gf b)
+{
+    int64_t t[31];
+    int i, j;
+
+    for ( i = 0; i < 31; ++i )
+        t[i] = 0;
+    for ( i = 0; i < 16; ++i )
+        for ( j = 0; j < 16; ++j )
+            t[i + j] += a[i] * b[j];
+    for ( i = 0; i < 15; ++i )
+        t[i] += 38 * t[i + 16];
+    for ( i = 0; i < 16; ++i )
+        o[i] = t[i];
+    gf_carry(o);
+    gf_carry(o);
+}
+
+static
+void gf_inv(gf o, const gf in)
+{
+    gf c;
+    int a;
+
+    for ( a = 0; a < 16; ++a )
+        c[a] = in[a];
+    for ( a = 253; a >= 0; --a ) {
+        gf_mul(c, c, c);
+        if ( a != 2 && a != 4 )
+            gf_mul(c, c, in);
+    }
+    for ( a = 0; a < 16; ++a )
+        o[a] = c[a];
+}
+
+static
+void x25519(uint8_t q[32], const uint8_t n[32], const uint8_t p[32])
+{
+    uint8_t z[32];
+    gf a, b, c, d, e, f, x;
+    int64_t r;
+    int i;
+
+    memcpy(z, n, 32);
+    z[31] = (z[31] & 127) | 64;
+    z[0] &= 248;
+
+    gf_unpack(x, p);
+    for ( i = 0; i < 16; ++i ) {
+        b[i] = x[i];
+        a[i] = c[i] = d[i] = 0;
+    }
+    a[0] = d[0] = 1;
+
+    // Montgomery ladder, constant time
+    for ( i = 254; i >= 0; --i ) {
+        r = (z[i >> 3] >> (i & 7)) & 1;
+        gf_swap(a, b, r);
+        gf_swap(c, d, r);
+        gf_add(e, a, c);
+        gf_sub(a, a, c);
+        gf_add(c, b, d);
+        gf_sub(b, b, d);
+        gf_mul(d, e, e);
+        gf_mul(f, a, a);
+        gf_mul(a, c, a);
+        gf_mul(c, b, e);
+        gf_add(e, a, c);
+        gf_sub(a, a, c);
+        gf_mul(b, a, a);
+        gf_sub(c, d, f);
+        gf_mul(a, c, gf_121665);
+        gf_add(a, a, d);
+        gf_mul(c, c, a);
+        gf_mul(a, d, f);
+        gf_mul(d, b, x);
+        gf_mul(b, e, e);
+        gf_swap(a, b, r);
+        gf_swap(c, d, r);
+    }
+
+    gf_inv(c, c);
+    gf_mul(a, a, c);
+    gf_pack(q, a);
+
+    crypto_wipe(z, sizeof(z));
+}
+
+static
+void x25519_base(uint8_t q[32], const uint8_t n[32])
+{
+    static const uint8_t base[32] = { 9 };
+
+    x25519(q, n, base);
+}
+
+/* Key exchange */
+
+rudp_error_t rudp_crypto_random(void *data, size_t size)
+{
+    uint8_t *p = data;
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+
+    if ( fd == -1 )
+        return errno;
+
+    while ( size ) {
+        ssize_t ret = read(fd, p, size);
+
+        if ( ret > 0 ) {
+            p += ret;
+            size -= ret;
+        } else if ( ret == 0 || errno != EINTR ) {
+            close(fd);
+            return ret == 0 ? EIO : errno;
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+static
+rudp_error_t crypto_new(struct rudp_peer *peer)
+{
+    struct rudp_crypto *crypto = rudp_alloc(peer->rudp, sizeof(*crypto));
+    rudp_error_t err;
+
+    if ( crypto == NULL )
+        return ENOMEM;
+
+    memset(crypto, 0, sizeof(*crypto));
+
+    err = rudp_crypto_random(crypto->secret, sizeof(crypto->secret));
+    if ( err ) {
+        rudp_free(peer->rudp, crypto, sizeof(*crypto));
+        return err;
+    }
+
+    x25519_base(crypto->public, crypto->secret);
+    peer->crypto = crypto;
+
+    return 0;
+}
+
+/*
+  Each direction gets its own key, derived from the shared secret
+  (mixed with the pre-shared key, if any) and the public key of its
+  sender.  Confirmation value proves to the connecting peer that the
+  other one got the same secret, thus the same pre-shared key.
+
+  When expect is given, it is checked against the confirmation value
+  first, and nothing is changed on mismatch.
+ */
+static
+rudp_error_t crypto_derive(struct rudp_peer *peer,
+                           const uint8_t remote[RUDP_CRYPTO_KEY_SIZE],
+                           uint8_t confirm[CRYPTO_CONFIRM_SIZE],
+                           const uint8_t *expect)
+{
+    static const uint8_t label[16] = "rudp session key";
+    static const uint8_t confirm_label[16] = "rudp key confirm";
+    const struct rudp_crypto_policy *policy = peer->crypto_policy;
+    struct rudp_crypto *crypto = peer->crypto;
+    uint8_t secret[RUDP_CRYPTO_KEY_SIZE];
+    uint8_t key[RUDP_CRYPTO_KEY_SIZE];
+    uint8_t check = 0;
+    uint8_t diff = 0;
+    int i;
+
+    x25519(secret, crypto->secret, remote);
+
+    // Low order points give an all-zero secret
+    for ( i = 0; i < RUDP_CRYPTO_KEY_SIZE; ++i )
+        check |= secret[i];
+    if ( check == 0 )
+        return EACCES;
+
+    if ( policy->psk_set )
+        for ( i = 0; i < RUDP_CRYPTO_KEY_SIZE; ++i )
+            secret[i] ^= policy->psk[i];
+
+    hchacha(key, secret, label);
+
+    hchacha(secret, key, confirm_label);
+    memcpy(confirm, secret, CRYPTO_CONFIRM_SIZE);
+
+    if ( expect != NULL ) {
+        for ( i = 0; i < CRYPTO_CONFIRM_SIZE; ++i )
+            diff |= confirm[i] ^ expect[i];
+
+        if ( diff ) {
+            crypto_wipe(secret, sizeof(secret));
+            crypto_wipe(key, sizeof(key));
+            return EACCES;
+        }
+    }
+
+    hchacha(secret, key, crypto->public);
+    for ( i = 0; i < 8; ++i )
+        crypto->tx_key[i] = load32_le(secret + 4 * i);
+
+    hchacha(secret, key, remote);
+    for ( i = 0; i < 8; ++i )
+        crypto->rx_key[i] = load32_le(secret + 4 * i);
+
+    crypto_wipe(secret, sizeof(secret));
+    crypto_wipe(key, sizeof(key));
+    crypto_wipe(crypto->secret, sizeof(crypto->secret));
+    crypto->active = 1;
+
+    return 0;
+}
+
+rudp_error_t rudp_crypto_offer(struct rudp_peer *peer,
+                               struct rudp_packet_chain *req)
+{
+    rudp_error_t err;
+
+    if ( peer->crypto_policy == NULL
+         || peer->crypto_policy->mode == RUDP_CRYPTO_OFF )
+        return 0;
+
+    err = crypto_new(peer);
+    if ( err )
+        return err;
+
+    return rudp_packet_conn_option_add(req, RUDP_CONN_OPT_KEY,
+                                       peer->crypto->public,
+                                       RUDP_CRYPTO_KEY_SIZE);
+}
+
+static
+const uint8_t *crypto_option_get(const struct rudp_packet_chain *pc,
+                                 size_t offset, size_t size)
+{
+    size_t len;
+    const uint8_t *value = rudp_packet_conn_option_find(
+        pc, offset, RUDP_CONN_OPT_KEY, &len);
+
+    if ( value == NULL || len != size )
+        return NULL;
+
+    return value;
+}
+
+/*
+  Response option holds the public key followed by the confirmation
+  value.
+ */
+rudp_error_t rudp_crypto_answer(struct rudp_peer *peer,
+                                const struct rudp_packet_chain *req,
+                                struct rudp_packet_chain *rsp)
+{
+    const struct rudp_crypto_policy *policy = peer->crypto_policy;
+    const uint8_t *remote = crypto_option_get(
+        req, sizeof(struct rudp_packet_conn_req), RUDP_CRYPTO_KEY_SIZE);
+    uint8_t option[RUDP_CRYPTO_KEY_SIZE + CRYPTO_CONFIRM_SIZE];
+    rudp_error_t err;
+
+    if ( policy == NULL || policy->mode == RUDP_CRYPTO_OFF )
+        return 0;
+
+    if ( remote == NULL )
+        return policy->mode == RUDP_CRYPTO_REQUIRED ? EACCES : 0;
+
+    err = crypto_new(peer);
+    if ( err == 0 ) {
+        memcpy(option, peer->crypto->public, RUDP_CRYPTO_KEY_SIZE);
+        err = crypto_derive(peer, remote, option + RUDP_CRYPTO_KEY_SIZE,
+                            NULL);
+    }
+    if ( err == 0 )
+        err = rudp_packet_conn_option_add(rsp, RUDP_CONN_OPT_KEY,
+                                          option, sizeof(option));
+
+    if ( err )
+        rudp_crypto_close(peer);
+
+    return err;
+}
+
+rudp_error_t rudp_crypto_handle_answer(struct rudp_peer *peer,
+                                       const struct rudp_packet_chain *rsp)
+{
+    const struct rudp_crypto_policy *policy = peer->crypto_policy;
+    uint8_t confirm[CRYPTO_CONFIRM_SIZE];
+    const uint8_t *remote;
+
+    // Asked for encryption, clear text is not an option
+    if ( policy == NULL || policy->mode == RUDP_CRYPTO_OFF )
+        return 0;
+
+    if ( peer->crypto == NULL || peer->crypto->active )
+        return EACCES;
+
+    remote = crypto_option_get(rsp, sizeof(struct rudp_packet_conn_rsp),
+                               RUDP_CRYPTO_KEY_SIZE + CRYPTO_CONFIRM_SIZE);
+    if ( remote == NULL )
+        return EACCES;
+
+    /*
+      Different pre-shared keys, or a forged response: keep our
+      secret, the genuine response may still come.
+     */
+    return crypto_derive(peer, remote, confirm,
+                         remote + RUDP_CRYPTO_KEY_SIZE);
+}
+
+int rudp_crypto_seals(const struct rudp_peer *peer,
+                      const struct rudp_packet_chain *pc)
+{
+    uint8_t command = pc->packet->header.command;
+
+    return peer->crypto != NULL && peer->crypto->active
+        && command != RUDP_CMD_CONN_REQ && command != RUDP_CMD_CONN_RSP;
+}
+
+int rudp_crypto_expects_sealed(const struct rudp_peer *peer,
+                               const struct rudp_packet_chain *pc)
+{
+    uint8_t command = pc->packet->header.command;
+
+    return peer->crypto != NULL
+        && command != RUDP_CMD_CONN_REQ && command != RUDP_CMD_CONN_RSP;
+}
+
+static
+void crypto_nonce(uint8_t nonce[12], const struct rudp_packet_sealed *sealed)
+{
+    memset(nonce, 0, 4);
+    memcpy(nonce + 4, sealed->counter, sizeof(sealed->counter));
+}
+
+struct rudp_packet_chain *rudp_crypto_seal(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc)
+{
+    struct rudp_crypto *crypto = peer->crypto;
+    size_t len = rudp_packet_chain_size(pc);
+    struct rudp_packet_chain *out;
+    struct rudp_packet_sealed *sealed;
+    uint8_t *plain = (uint8_t *)pc->packet;
+    uint8_t nonce[12];
+    uint64_t counter = crypto->tx_counter++;
+    int i;
+
+    out = rudp_packet_chain_alloc(peer->rudp,
+                                  sizeof(*sealed) + len + CRYPTO_TAG_SIZE);
+    if ( out == NULL )
+        return NULL;
+
+    sealed = &out->packet->sealed;
+    memset(sealed, 0, sizeof(*sealed));
+    sealed->command = RUDP_CMD_SEALED;
+    // Tag is authenticated along with the rest of the header
+    if ( peer->shard_tag )
+        rudp_shard_stamp(peer, &sealed->opt);
+    for ( i = 0; i < 8; ++i )
+        sealed->counter[i] = counter >> (56 - 8 * i);
+    crypto_nonce(nonce, sealed);
+
+    // Shared payload is gathered first, it is sealed along
+    if ( pc->payload ) {
+        memcpy(sealed->data, pc->packet, pc->len);
+        memcpy(sealed->data + pc->len, pc->payload->data, pc->payload->len);
+        plain = sealed->data;
+    }
+
+    aead_seal(crypto->tx_key, nonce, (const uint8_t *)sealed,
+              sizeof(*sealed), sealed->data, plain, len);
+
+    return out;
+}
+
+/*
+  Sliding window over the highest counters seen, as IPsec does.
+  Replays and counters too old to tell are refused.
+ */
+static
+int crypto_replayed(const struct rudp_crypto *crypto, uint64_t counter)
+{
+    if ( counter > crypto->rx_counter )
+        return 0;
+
+    if ( crypto->rx_counter - counter >= CRYPTO_REPLAY_WINDOW )
+        return 1;
+
+    return (crypto->rx_window >> (crypto->rx_counter - counter)) & 1;
+}
+
+static
+void crypto_replay_update(struct rudp_crypto *crypto, uint64_t counter)
+{
+    uint64_t shift;
+
+    if ( counter <= crypto->rx_counter ) {
+        crypto->rx_window |= (uint64_t)1 << (crypto->rx_counter - counter);
+        return;
+    }
+
+    shift = counter - crypto->rx_counter;
+    crypto->rx_window = shift < CRYPTO_REPLAY_WINDOW
+        ? (crypto->rx_window << shift) | 1 : 1;
+    crypto->rx_counter = counter;
+}
+
+struct rudp_packet_chain *rudp_crypto_open(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc)
+{
+    struct rudp_crypto *crypto = peer->crypto;
+    const struct rudp_packet_sealed *sealed = &pc->packet->sealed;
+    struct rudp_packet_chain *out;
+    uint8_t nonce[12];
+    uint64_t counter = 0;
+    size_t len;
+    int i;
+
+    if ( crypto == NULL || !crypto->active
+         || pc->len < sizeof(*sealed) + sizeof(struct rudp_packet_header)
+                      + CRYPTO_TAG_SIZE )
+        return NULL;
+
+    for ( i = 0; i < 8; ++i )
+        counter = (counter << 8) | sealed->counter[i];
+
+    // First packet carries counter 0, window starts empty
+    if ( (crypto->rx_window || counter) && crypto_replayed(crypto, counter) )
+        return NULL;
+
+    len = pc->len - sizeof(*sealed) - CRYPTO_TAG_SIZE;
+    out = rudp_packet_chain_alloc(peer->rudp, len);
+    if ( out == NULL )
+        return NULL;
+
+    crypto_nonce(nonce, sealed);
+
+    if ( aead_open(crypto->rx_key, nonce, (const uint8_t *)sealed,
+                   sizeof(*sealed), (uint8_t *)out->packet,
+                   sealed->data, len) ) {
+        rudp_packet_chain_free(peer->rudp, out);
+        return NULL;
+    }
+
+    crypto_replay_update(crypto, counter);
+
+    return out;
+}
+
+void rudp_crypto_close(struct rudp_peer *peer)
+{
+    struct rudp_crypto *crypto = peer->crypto;
+
+    if ( crypto == NULL )
+        return;
+
+    peer->crypto = NULL;
+    crypto_wipe(crypto, sizeof(*crypto));
+    rudp_free(peer->rudp, crypto, sizeof(*crypto));
+}
+
+int rudp_crypto_state_save(const struct rudp_peer *peer,
+                           struct rudp_crypto_state *state)
+{
+    const struct rudp_crypto *crypto = peer->crypto;
+    int i;
+
+    if ( crypto == NULL || !crypto->active )
+        return 0;
+
+    for ( i = 0; i < 8; ++i ) {
+        store32_le(state->tx_key + 4 * i, crypto->tx_key[i]);
+        store32_le(state->rx_key + 4 * i, crypto->rx_key[i]);
+    }
+    state->tx_counter = crypto->tx_counter;
+    state->rx_counter = crypto->rx_counter;
+    state->rx_window = crypto->rx_window;
+
+    return 1;
+}
+
+rudp_error_t rudp_crypto_state_restore(struct rudp_peer *peer,
+                                       const struct rudp_crypto_state *state)
+{
+    struct rudp_crypto *crypto;
+    int i;
+
+    rudp_crypto_close(peer);
+
+    crypto = rudp_alloc(peer->rudp, sizeof(*crypto));
+    if ( crypto == NULL )
+        return ENOMEM;
+
+    memset(crypto, 0, sizeof(*crypto));
+    for ( i = 0; i < 8; ++i ) {
+        crypto->tx_key[i] = load32_le(state->tx_key + 4 * i);
+        crypto->rx_key[i] = load32_le(state->rx_key + 4 * i);
+    }
+    crypto->tx_counter = state->tx_counter;
+    crypto->rx_counter = state->rx_counter;
+    crypto->rx_window = state->rx_window;
+    crypto->active = 1;
+
+    peer->crypto = crypto;
+
+    return 0;
+}
+
+/* User API */
+
+static
+void crypto_policy_set(struct rudp_crypto_policy *policy, int mode,
+                       const uint8_t *psk)
+{
+    policy->mode = mode;
+    policy->psk_set = psk != NULL;
+    if ( psk )
+        memcpy(policy->psk, psk, RUDP_CRYPTO_KEY_SIZE);
+    else
+        memset(policy->psk, 0, RUDP_CRYPTO_KEY_SIZE);
+}
+
+rudp_error_t rudp_client_set_encryption(struct rudp_client *client,
+                                        int enable,
+                                        const uint8_t *psk)
+{
+    if ( client->connected || client->connecting )
+        return EBUSY;
+
+    crypto_policy_set(&client->crypto,
+                      enable ? RUDP_CRYPTO_REQUIRED : RUDP_CRYPTO_OFF, psk);
+    return 0;
+}
+
+rudp_error_t rudp_server_set_encryption(struct rudp_server *server,
+                                        int mode,
+                                        const uint8_t *psk)
+{
+    if ( mode != RUDP_CRYPTO_OFF && mode != RUDP_CRYPTO_ALLOWED
+         && mode != RUDP_CRYPTO_REQUIRED )
+        return EINVAL;
+
+    crypto_policy_set(&server->crypto, mode, psk);
+    return 0;
+}
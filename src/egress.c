@@ -0,0 +1,232 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/egress.h>
+#include <rudp/endpoint.h>
+#include <rudp/peer.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_peer.h"
+#include "rudp_egress.h"
+
+#define EGRESS_DEFAULT_QUANTUM 1500
+/* Rate limited credit may not accumulate for more than this */
+#define EGRESS_BURST_MS 10
+#define EGRESS_MIN_BURST 8192
+
+static void egress_service(struct rudp_egress *egress);
+static void _egress_service(struct ela_event_source *src,
+                            int fd, uint32_t mask, void *data);
+
+rudp_error_t rudp_egress_init(
+    struct rudp_egress *egress,
+    struct rudp *rudp,
+    struct rudp_endpoint *endpoint)
+{
+    ela_source_alloc(rudp->el, _egress_service, egress,
+                     &egress->service_source);
+
+    rudp_list_init(&egress->active_list);
+    egress->rudp = rudp;
+    egress->endpoint = endpoint;
+    egress->quantum = EGRESS_DEFAULT_QUANTUM;
+    egress->rate = 0;
+    egress->tokens = 0;
+    egress->last_refill = rudp_timestamp();
+    egress->scheduled = 0;
+
+    return 0;
+}
+
+void rudp_egress_deinit(struct rudp_egress *egress)
+{
+    struct rudp_peer *peer, *tmp;
+    rudp_list_for_each_safe(peer, tmp, &egress->active_list, egress_item)
+    {
+        rudp_egress_forget(peer);
+        peer->egress = NULL;
+        rudp_peer_egress_done(peer);
+    }
+
+    if ( egress->scheduled )
+        ela_remove(egress->rudp->el, egress->service_source);
+    ela_source_free(egress->rudp->el, egress->service_source);
+    egress->service_source = NULL;
+}
+
+static
+int64_t egress_burst(const struct rudp_egress *egress)
+{
+    int64_t burst = egress->rate * EGRESS_BURST_MS / 1000;
+
+    return burst < EGRESS_MIN_BURST ? EGRESS_MIN_BURST : burst;
+}
+
+void rudp_egress_set_rate(
+    struct rudp_egress *egress,
+    uint64_t bytes_per_sec)
+{
+    egress->rate = bytes_per_sec;
+    egress->tokens = egress_burst(egress);
+    egress->last_refill = rudp_timestamp();
+}
+
+rudp_error_t rudp_egress_set_quantum(
+    struct rudp_egress *egress,
+    uint32_t quantum)
+{
+    if ( quantum == 0 )
+        return EINVAL;
+
+    egress->quantum = quantum;
+    return 0;
+}
+
+void rudp_egress_attach(
+    struct rudp_egress *egress,
+    struct rudp_peer *peer,
+    unsigned int weight)
+{
+    if ( peer->egress != egress )
+        rudp_egress_detach(peer);
+
+    peer->egress = egress;
+    peer->egress_weight = weight ? weight : 1;
+}
+
+void rudp_egress_detach(struct rudp_peer *peer)
+{
+    if ( peer->egress == NULL )
+        return;
+
+    if ( peer->egress_active )
+        rudp_egress_forget(peer);
+
+    peer->egress = NULL;
+    rudp_peer_egress_done(peer);
+}
+
+static
+void egress_schedule(struct rudp_egress *egress, rudp_time_t delta)
+{
+    struct timeval tv;
+
+    if ( delta <= 0 )
+        delta = 1;
+
+    rudp_timestamp_to_timeval(&tv, delta);
+    ela_set_timeout(egress->rudp->el, egress->service_source,
+                    &tv, ELA_EVENT_ONCE);
+    ela_add(egress->rudp->el, egress->service_source);
+    egress->scheduled = 1;
+}
+
+void rudp_egress_wake(struct rudp_egress *egress, struct rudp_peer *peer)
+{
+    if ( peer->egress_active )
+        return;
+
+    peer->egress_active = 1;
+    peer->egress_deficit = 0;
+    rudp_list_append(&egress->active_list, &peer->egress_item);
+
+    if ( !egress->scheduled )
+        egress_schedule(egress, 0);
+}
+
+void rudp_egress_forget(struct rudp_peer *peer)
+{
+    rudp_list_remove(&peer->egress_item);
+    peer->egress_active = 0;
+    peer->egress_rexmit = 0;
+    peer->egress_deficit = 0;
+}
+
+static
+void egress_refill(struct rudp_egress *egress)
+{
+    rudp_time_t now = rudp_timestamp();
+    int64_t burst = egress_burst(egress);
+
+    egress->tokens += egress->rate * (now - egress->last_refill) / 1000;
+    if ( egress->tokens > burst )
+        egress->tokens = burst;
+    egress->last_refill = now;
+}
+
+/*
+  Deficit round robin.  Peer at head of active list gets its quantum
+  and sends what it can, then goes to the tail if it still has
+  packets waiting, or leaves the list.
+ */
+static
+void egress_service(struct rudp_egress *egress)
+{
+    egress->scheduled = 0;
+
+    if ( egress->rate )
+        egress_refill(egress);
+
+    rudp_endpoint_batch_begin(egress->endpoint);
+
+    while ( !rudp_list_empty(&egress->active_list) ) {
+        struct rudp_peer *peer;
+        size_t sent;
+        int more;
+
+        if ( egress->rate && egress->tokens <= 0 )
+            break;
+
+        peer = __container_of(egress->active_list.next, peer, egress_item);
+        peer->egress_deficit += egress->quantum * peer->egress_weight;
+
+        // Peers of other server addresses get their own batch
+        if ( peer->endpoint != egress->endpoint )
+            rudp_endpoint_batch_begin(peer->endpoint);
+
+        sent = rudp_peer_egress_send(peer, peer->egress_deficit, &more);
+
+        if ( peer->endpoint != egress->endpoint )
+            rudp_endpoint_batch_flush(peer->endpoint);
+
+        peer->egress_deficit -= sent;
+        if ( egress->rate )
+            egress->tokens -= sent;
+
+        rudp_list_remove(&peer->egress_item);
+
+        if ( more ) {
+            rudp_list_append(&egress->active_list, &peer->egress_item);
+        } else {
+            peer->egress_active = 0;
+            peer->egress_deficit = 0;
+            rudp_peer_egress_done(peer);
+        }
+    }
+
+    rudp_endpoint_batch_flush(egress->endpoint);
+
+    if ( rudp_list_empty(&egress->active_list) )
+        return;
+
+    // Rate limited, wait for credit to come back
+    egress_schedule(egress, 1 - egress->tokens * 1000 / (int64_t)egress->rate);
+}
+
+static void _egress_service(struct ela_event_source *src,
+                            int fd, uint32_t mask, void *data)
+{
+    return egress_service((struct rudp_egress *)data);
+}
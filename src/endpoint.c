@@ -9,17 +9,42 @@
   See AUTHORS for details
  */
 
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
 #include <rudp/error.h>
 #include <rudp/endpoint.h>
 #include <rudp/packet.h>
 #include "rudp_packet.h"
 #include "rudp_error.h"
+#include "rudp_endpoint.h"
+#include "rudp_stats.h"
+#include "rudp_profile.h"
+#include "rudp_xdp.h"
+#include "rudp_zerocopy.h"
+
+#ifndef MSG_ZEROCOPY
+# define MSG_ZEROCOPY 0
+#endif
+
+struct rudp_endpoint_tx_batch
+{
+    struct mmsghdr msg[RUDP_ENDPOINT_BATCH_SIZE];
+    struct iovec iov[RUDP_ENDPOINT_BATCH_SIZE][3];
+    struct sockaddr_storage addr[RUDP_ENDPOINT_BATCH_SIZE];
+    struct rudp_packet_header header[RUDP_ENDPOINT_BATCH_SIZE];
+    struct rudp_packet_chain *release[RUDP_ENDPOINT_BATCH_SIZE];
+    struct rudp_zerocopy_slot *zerocopy[RUDP_ENDPOINT_BATCH_SIZE];
+    unsigned int count;
+};
 
 static void _endpoint_handle_incoming(struct ela_event_source *src,
                                       int fd, uint32_t mask, void *data);
+static rudp_error_t endpoint_batch_send(struct rudp_endpoint *endpoint);
 
 void rudp_endpoint_init(
     struct rudp_endpoint *endpoint,
@@ -28,8 +53,14 @@ void rudp_endpoint_init(
 {
     rudp_address_init(&endpoint->addr, rudp);
     endpoint->socket_fd = -1;
+    endpoint->flags = 0;
     endpoint->rudp = rudp;
     endpoint->handler = handler;
+    endpoint->tx_batch = NULL;
+    endpoint->tx_batch_depth = 0;
+    endpoint->stats = NULL;
+    endpoint->xdp = NULL;
+    endpoint->zerocopy = NULL;
     ela_source_alloc(rudp->el, _endpoint_handle_incoming,
                      endpoint, &endpoint->ela_source);
 }
@@ -39,6 +70,67 @@ void rudp_endpoint_deinit(struct rudp_endpoint *endpoint)
 {
     rudp_address_deinit(&endpoint->addr);
     ela_source_free(endpoint->rudp->el, endpoint->ela_source);
+
+    if ( endpoint->tx_batch ) {
+        endpoint_batch_send(endpoint);
+        rudp_free(endpoint->rudp, endpoint->tx_batch,
+                  sizeof(*endpoint->tx_batch));
+    }
+    endpoint->tx_batch = NULL;
+}
+
+static rudp_error_t endpoint_recvmsg(struct rudp_endpoint *endpoint,
+                                     struct iovec *iov, size_t iovcnt,
+                                     size_t *len,
+                                     struct sockaddr_storage *addr);
+
+/*
+  Datagrams are read in a pool chain, anything past it spills in an
+  overflow area shared by all endpoints of the context.  Only
+  datagrams that actually spilled are moved to a large chain.
+ */
+static
+rudp_error_t endpoint_recv_chain(struct rudp_endpoint *endpoint,
+                                 struct rudp_packet_chain **pcp,
+                                 struct sockaddr_storage *addr)
+{
+    struct rudp *rudp = endpoint->rudp;
+    struct rudp_packet_chain *pc = *pcp, *large;
+    const size_t overflow = RUDP_RECV_LARGE_SIZE - RUDP_RECV_BUFFER_SIZE;
+    struct iovec iov[2];
+    size_t len;
+    rudp_error_t err;
+
+    if ( rudp->rx_overflow == NULL )
+        rudp->rx_overflow = rudp_alloc(rudp, overflow);
+
+    iov[0].iov_base = pc->packet;
+    iov[0].iov_len = RUDP_RECV_BUFFER_SIZE;
+    iov[1].iov_base = rudp->rx_overflow;
+    iov[1].iov_len = overflow;
+
+    // Without overflow area, large datagrams are only detected
+    err = endpoint_recvmsg(endpoint, iov, rudp->rx_overflow ? 2 : 1,
+                           &len, addr);
+    if ( err )
+        return err;
+
+    if ( len > RUDP_RECV_BUFFER_SIZE ) {
+        large = rudp_packet_chain_alloc(rudp, RUDP_RECV_LARGE_SIZE);
+        if ( large == NULL )
+            return ENOMEM;
+
+        memcpy(large->packet, pc->packet, RUDP_RECV_BUFFER_SIZE);
+        memcpy((uint8_t *)large->packet + RUDP_RECV_BUFFER_SIZE,
+               rudp->rx_overflow, len - RUDP_RECV_BUFFER_SIZE);
+
+        rudp_packet_chain_free(rudp, pc);
+        *pcp = pc = large;
+    }
+
+    pc->len = len;
+
+    return 0;
 }
 
 /*
@@ -51,17 +143,65 @@ _endpoint_handle_incoming(struct ela_event_source *src,
                           int fd, uint32_t mask, void *data)
 {
     struct rudp_endpoint *endpoint = data;
-    struct rudp_packet_chain *pc = rudp_packet_chain_alloc(
-        endpoint->rudp, RUDP_RECV_BUFFER_SIZE);
+    struct rudp_packet_chain *pc;
     struct sockaddr_storage addr;
 
-    rudp_error_t ret = rudp_endpoint_recv(
-        endpoint, pc->packet, &pc->len, &addr);
+    // Completions wake us up as well
+    if ( endpoint->zerocopy )
+        rudp_zerocopy_complete(endpoint);
+
+    pc = rudp_packet_chain_alloc(endpoint->rudp, RUDP_RECV_BUFFER_SIZE);
+    if ( pc == NULL ) {
+        // Datagram is dropped, socket would wake us up for it again
+        recv(fd, NULL, 0, MSG_DONTWAIT);
+        if ( endpoint->stats )
+            rudp_stats_endpoint_error(endpoint);
+        return;
+    }
 
-    if (ret == 0)
+    rudp_error_t ret = endpoint_recv_chain(endpoint, &pc, &addr);
+
+    // Datagram dropped for want of room to hold it
+    if ( (ret == EMSGSIZE || ret == ENOMEM) && endpoint->stats )
+        rudp_stats_endpoint_error(endpoint);
+
+    if (ret == 0) {
+        if ( endpoint->stats )
+            rudp_stats_endpoint_in(endpoint, pc->len);
+        endpoint->rudp->rx_chain = pc;
         endpoint->handler->handle_packet(endpoint, &addr, pc);
+        // Handler code may have kept it
+        pc = endpoint->rudp->rx_chain;
+        endpoint->rudp->rx_chain = NULL;
+    }
+
+    if ( pc )
+        rudp_packet_chain_free(endpoint->rudp, pc);
+}
+
+static
+rudp_error_t endpoint_watch(struct rudp_endpoint *endpoint)
+{
+    ela_error_t eerr = ela_set_fd(
+        endpoint->rudp->el, endpoint->ela_source,
+        endpoint->socket_fd,
+        ELA_EVENT_READABLE);
+
+    if ( eerr )
+        goto ela_err;
+
+    eerr = ela_add(endpoint->rudp->el, endpoint->ela_source);
+
+    if ( eerr )
+        goto ela_err;
+
+    rudp_stats_endpoint_register(endpoint->rudp, endpoint);
+
+    return 0;
 
-    rudp_packet_chain_free(endpoint->rudp, pc);
+ela_err:
+    rudp_endpoint_close(endpoint);
+    return rudp_error_from_ela(eerr);
 }
 
 rudp_error_t rudp_endpoint_bind(struct rudp_endpoint *endpoint)
@@ -80,14 +220,38 @@ rudp_error_t rudp_endpoint_bind(struct rudp_endpoint *endpoint)
         return err;
     }
 
-    int ret = socket(addr ? addr->ss_family : AF_INET6, SOCK_DGRAM, 0);
+    int family = addr ? addr->ss_family : AF_INET6;
+    int ret = socket(family, SOCK_DGRAM, 0);
 
     if ( ret == -1 )
         return errno;
 
     endpoint->socket_fd = ret;
 
-    if ( addr )
+    if ( family != AF_INET6 )
+        endpoint->flags &= ~RUDP_ENDPOINT_DUALSTACK;
+
+    if ( endpoint->flags & RUDP_ENDPOINT_DUALSTACK ) {
+        int off = 0;
+        ret = setsockopt(endpoint->socket_fd, IPPROTO_IPV6, IPV6_V6ONLY,
+                         &off, sizeof(off));
+    }
+
+    if ( ret != -1 && endpoint->flags & RUDP_ENDPOINT_REUSEADDR ) {
+        int on = 1;
+        ret = setsockopt(endpoint->socket_fd, SOL_SOCKET, SO_REUSEADDR,
+                         &on, sizeof(on));
+    }
+
+#ifdef SO_REUSEPORT
+    if ( ret != -1 && endpoint->flags & RUDP_ENDPOINT_REUSEPORT ) {
+        int on = 1;
+        ret = setsockopt(endpoint->socket_fd, SOL_SOCKET, SO_REUSEPORT,
+                         &on, sizeof(on));
+    }
+#endif
+
+    if ( addr && ret != -1 )
         ret = bind(endpoint->socket_fd,
                    (const struct sockaddr *)addr,
                    size);
@@ -100,68 +264,204 @@ rudp_error_t rudp_endpoint_bind(struct rudp_endpoint *endpoint)
         return e;
     }
 
-    ela_error_t eerr = ela_set_fd(
-        endpoint->rudp->el, endpoint->ela_source,
-        endpoint->socket_fd,
-        ELA_EVENT_READABLE);
+    return endpoint_watch(endpoint);
+}
 
-    if ( eerr )
-        goto ela_err;
+rudp_error_t rudp_endpoint_adopt(struct rudp_endpoint *endpoint, int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t size = sizeof(addr);
 
-    eerr = ela_add(endpoint->rudp->el, endpoint->ela_source);
+    if ( getsockname(fd, (struct sockaddr *)&addr, &size) ) {
+        rudp_error_t e = errno;
 
-    if ( eerr )
-        goto ela_err;
+        close(fd);
+        return e;
+    }
 
-    return 0;
+    rudp_address_set(&endpoint->addr, (struct sockaddr *)&addr, size);
+    endpoint->socket_fd = fd;
 
-ela_err:
-    rudp_endpoint_close(endpoint);
-    return rudp_error_from_ela(eerr);
+    // Socket keeps its dual-stack setting across processes
+    if ( addr.ss_family == AF_INET6 ) {
+        int v6only = 1;
+        socklen_t len = sizeof(v6only);
+
+        if ( getsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, &len) == 0
+             && !v6only )
+            endpoint->flags |= RUDP_ENDPOINT_DUALSTACK;
+    }
+
+    return endpoint_watch(endpoint);
 }
 
 
 void rudp_endpoint_close(struct rudp_endpoint *endpoint)
 {
+    // Batched datagrams may hold zero-copy slots
+    if ( endpoint->zerocopy && endpoint->tx_batch
+         && endpoint->tx_batch->count )
+        endpoint_batch_send(endpoint);
+    rudp_zerocopy_close(endpoint);
+
+    rudp_endpoint_xdp_detach(endpoint);
+    rudp_stats_endpoint_unregister(endpoint->rudp, endpoint);
     ela_remove(endpoint->rudp->el, endpoint->ela_source);
     close(endpoint->socket_fd);
     endpoint->socket_fd = -1;
 }
 
-rudp_error_t rudp_endpoint_recv(struct rudp_endpoint *endpoint,
-                                void *data, size_t *len,
-                                struct sockaddr_storage *addr)
+/*
+  Dual-stack sockets see IPv4 peers as ::ffff:a.b.c.d.  They are
+  turned to plain IPv4 addresses on reception, so that a peer has only
+  one address, and back on sending.
+ */
+static
+void endpoint_addr_unmap(struct sockaddr_storage *addr)
 {
-    int ret;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+    struct sockaddr_in in;
 
-    size_t available = *len;
-    socklen_t slen = sizeof(*addr);
+    if ( addr->ss_family != AF_INET6
+         || !IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr) )
+        return;
 
-    ret = recvfrom(endpoint->socket_fd, data, available, 0,
-                   (struct sockaddr *)addr, &slen);
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = in6->sin6_port;
+    memcpy(&in.sin_addr, &in6->sin6_addr.s6_addr[12], sizeof(in.sin_addr));
+
+    memset(addr, 0, sizeof(*addr));
+    memcpy(addr, &in, sizeof(in));
+}
+
+static
+const struct sockaddr_storage *endpoint_addr_map(
+    const struct rudp_endpoint *endpoint,
+    const struct sockaddr_storage *addr,
+    socklen_t *size,
+    struct sockaddr_storage *mapped)
+{
+    const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)mapped;
+
+    if ( !(endpoint->flags & RUDP_ENDPOINT_DUALSTACK)
+         || addr->ss_family != AF_INET )
+        return addr;
+
+    memset(in6, 0, sizeof(*in6));
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = in->sin_port;
+    in6->sin6_addr.s6_addr[10] = 0xff;
+    in6->sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&in6->sin6_addr.s6_addr[12], &in->sin_addr, sizeof(in->sin_addr));
+
+    *size = sizeof(*in6);
+    return mapped;
+}
+
+static
+rudp_error_t endpoint_recvmsg(struct rudp_endpoint *endpoint,
+                              struct iovec *iov, size_t iovcnt,
+                              size_t *len,
+                              struct sockaddr_storage *addr)
+{
+    struct msghdr msg;
+    ssize_t ret;
+    // Woken up by completions only, there may be nothing to read
+    int flags = endpoint->zerocopy ? MSG_DONTWAIT : 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = sizeof(*addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    rudp_profile_enter(endpoint->rudp, RUDP_STAGE_RECV);
+    ret = recvmsg(endpoint->socket_fd, &msg, flags);
+    rudp_profile_leave(endpoint->rudp, RUDP_STAGE_RECV);
 
     if ( ret == -1 )
         return errno;
 
+    // Rest of datagram is lost, never hand a truncated one over
+    if ( msg.msg_flags & MSG_TRUNC )
+        return EMSGSIZE;
+
     *len = ret;
 
+    if ( endpoint->flags & RUDP_ENDPOINT_DUALSTACK )
+        endpoint_addr_unmap(addr);
+
     return 0;
 }
 
+rudp_error_t rudp_endpoint_recv(struct rudp_endpoint *endpoint,
+                                void *data, size_t *len,
+                                struct sockaddr_storage *addr)
+{
+    struct iovec iov;
+
+    iov.iov_base = data;
+    iov.iov_len = *len;
+
+    return endpoint_recvmsg(endpoint, &iov, 1, len, addr);
+}
+
+/*
+  Tries to send through the AF_XDP socket, returns whether it did.
+ */
+static
+int endpoint_xdp_send(struct rudp_endpoint *endpoint,
+                      const struct sockaddr_storage *address,
+                      const struct iovec *iov, size_t iovcnt)
+{
+    rudp_error_t err;
+
+    rudp_profile_enter(endpoint->rudp, RUDP_STAGE_SEND);
+    err = rudp_xdp_send(endpoint, address, iov, iovcnt);
+    if ( err == 0 && endpoint->tx_batch_depth == 0 )
+        rudp_xdp_kick(endpoint);
+    rudp_profile_leave(endpoint->rudp, RUDP_STAGE_SEND);
+
+    return err == 0;
+}
+
 rudp_error_t rudp_endpoint_send(struct rudp_endpoint *endpoint,
                                 const struct rudp_address *addr,
                                 const void *data, size_t len)
 {
     const struct sockaddr_storage *address;
+    struct sockaddr_storage mapped;
     socklen_t size;
 
     rudp_error_t err = rudp_address_get(addr, &address, &size);
     if ( err )
         return err;
 
+    if ( endpoint->xdp ) {
+        struct iovec iov = { (void *)data, len };
+
+        if ( endpoint_xdp_send(endpoint, address, &iov, 1) ) {
+            if ( endpoint->stats )
+                rudp_stats_endpoint_out(endpoint, len);
+            return 0;
+        }
+    }
+
+    address = endpoint_addr_map(endpoint, address, &size, &mapped);
+
+    rudp_profile_enter(endpoint->rudp, RUDP_STAGE_SEND);
     int ret = sendto(endpoint->socket_fd, data, len, 0,
                      (const struct sockaddr *)address,
                      size);
+    rudp_profile_leave(endpoint->rudp, RUDP_STAGE_SEND);
+
+    if ( endpoint->stats ) {
+        rudp_stats_endpoint_out(endpoint, len);
+        if ( ret == -1 )
+            rudp_stats_endpoint_error(endpoint);
+    }
 
     if ( ret == -1 )
         return errno;
@@ -169,6 +469,196 @@ rudp_error_t rudp_endpoint_send(struct rudp_endpoint *endpoint,
     return 0;
 }
 
+static
+size_t endpoint_chain_iov(struct iovec *iov,
+                          const struct rudp_packet_header *header,
+                          const struct rudp_packet_chain *pc)
+{
+    size_t count = 0;
+
+    iov[count].iov_base = (void *)header;
+    iov[count++].iov_len = sizeof(*header);
+
+    if ( pc->len > sizeof(*header) ) {
+        iov[count].iov_base = (uint8_t *)pc->packet + sizeof(*header);
+        iov[count++].iov_len = pc->len - sizeof(*header);
+    }
+
+    if ( pc->payload && pc->payload->len ) {
+        iov[count].iov_base = (void *)pc->payload->data;
+        iov[count++].iov_len = pc->payload->len;
+    }
+
+    return count;
+}
+
+static
+rudp_error_t endpoint_batch_send(struct rudp_endpoint *endpoint)
+{
+    struct rudp_endpoint_tx_batch *batch = endpoint->tx_batch;
+    rudp_error_t err = 0;
+    unsigned int sent = 0, i;
+
+    rudp_profile_enter(endpoint->rudp, RUDP_STAGE_SEND);
+
+    while ( sent < batch->count ) {
+        // Zero-copy datagrams and others go in separate calls
+        int zerocopy = batch->zerocopy[sent] != NULL;
+        unsigned int run = 1;
+
+        while ( sent + run < batch->count
+                && (batch->zerocopy[sent + run] != NULL) == zerocopy )
+            run++;
+
+        int ret = sendmmsg(endpoint->socket_fd, &batch->msg[sent], run,
+                           zerocopy ? MSG_ZEROCOPY : 0);
+
+        if ( ret == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            // Kernel ran out of memory to pin, send a copy
+            if ( zerocopy && errno == ENOBUFS ) {
+                rudp_zerocopy_sent(endpoint, batch->zerocopy[sent], 0);
+                batch->zerocopy[sent] = NULL;
+                continue;
+            }
+
+            // Skip the offending packet, retry the rest
+            if ( err == 0 )
+                err = errno;
+            if ( endpoint->stats )
+                rudp_stats_endpoint_error(endpoint);
+            if ( zerocopy )
+                rudp_zerocopy_sent(endpoint, batch->zerocopy[sent], 0);
+            sent++;
+        } else {
+            for ( i = 0; zerocopy && i < (unsigned int)ret; ++i )
+                rudp_zerocopy_sent(endpoint, batch->zerocopy[sent + i], 1);
+            sent += ret;
+        }
+    }
+
+    rudp_profile_leave(endpoint->rudp, RUDP_STAGE_SEND);
+
+    for ( i = 0; i < batch->count; ++i )
+        if ( batch->release[i] )
+            rudp_packet_chain_free(endpoint->rudp, batch->release[i]);
+
+    batch->count = 0;
+
+    return err;
+}
+
+rudp_error_t rudp_endpoint_batch_begin(struct rudp_endpoint *endpoint)
+{
+    if ( endpoint->tx_batch == NULL ) {
+        endpoint->tx_batch = rudp_alloc(endpoint->rudp,
+                                        sizeof(*endpoint->tx_batch));
+        if ( endpoint->tx_batch == NULL )
+            return ENOMEM;
+        endpoint->tx_batch->count = 0;
+    }
+
+    endpoint->tx_batch_depth++;
+
+    return 0;
+}
+
+rudp_error_t rudp_endpoint_batch_flush(struct rudp_endpoint *endpoint)
+{
+    if ( endpoint->tx_batch_depth == 0 || --endpoint->tx_batch_depth )
+        return 0;
+
+    rudp_xdp_kick(endpoint);
+
+    return endpoint_batch_send(endpoint);
+}
+
+rudp_error_t rudp_endpoint_send_chain(struct rudp_endpoint *endpoint,
+                                      const struct rudp_address *addr,
+                                      struct rudp_packet_chain *pc,
+                                      int release)
+{
+    struct rudp_endpoint_tx_batch *batch = endpoint->tx_batch;
+    const struct sockaddr_storage *address;
+    struct sockaddr_storage mapped;
+    socklen_t size;
+    rudp_error_t err = rudp_address_get(addr, &address, &size);
+
+    if ( err )
+        goto out;
+
+    if ( endpoint->stats )
+        rudp_stats_endpoint_out(endpoint, rudp_packet_chain_size(pc));
+
+    if ( endpoint->xdp ) {
+        struct iovec iov[3];
+        size_t count = endpoint_chain_iov(iov, &pc->packet->header, pc);
+
+        if ( endpoint_xdp_send(endpoint, address, iov, count) )
+            goto out;
+    }
+
+    address = endpoint_addr_map(endpoint, address, &size, &mapped);
+
+    struct rudp_zerocopy_slot *slot = rudp_zerocopy_reserve(endpoint, pc);
+
+    if ( endpoint->tx_batch_depth ) {
+        unsigned int i = batch->count++;
+        struct msghdr *hdr = &batch->msg[i].msg_hdr;
+
+        memcpy(&batch->addr[i], address, size);
+        batch->header[i] = pc->packet->header;
+        batch->release[i] = release ? pc : NULL;
+        batch->zerocopy[i] = slot;
+
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = &batch->addr[i];
+        hdr->msg_namelen = size;
+        hdr->msg_iov = batch->iov[i];
+        hdr->msg_iovlen = endpoint_chain_iov(
+            batch->iov[i], slot ? &slot->header : &batch->header[i], pc);
+
+        if ( batch->count == RUDP_ENDPOINT_BATCH_SIZE )
+            return endpoint_batch_send(endpoint);
+        return 0;
+    }
+
+    struct iovec iov[3];
+    struct msghdr hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = (void *)address;
+    hdr.msg_namelen = size;
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = endpoint_chain_iov(
+        iov, slot ? &slot->header : &pc->packet->header, pc);
+
+    rudp_profile_enter(endpoint->rudp, RUDP_STAGE_SEND);
+    int ret = sendmsg(endpoint->socket_fd, &hdr, slot ? MSG_ZEROCOPY : 0);
+    if ( ret == -1 && slot && errno == ENOBUFS ) {
+        // Kernel ran out of memory to pin, send a copy
+        rudp_zerocopy_sent(endpoint, slot, 0);
+        slot = NULL;
+        ret = sendmsg(endpoint->socket_fd, &hdr, 0);
+    }
+    if ( ret == -1 ) {
+        err = errno;
+        if ( endpoint->stats )
+            rudp_stats_endpoint_error(endpoint);
+    }
+    if ( slot )
+        rudp_zerocopy_sent(endpoint, slot, ret != -1);
+    rudp_profile_leave(endpoint->rudp, RUDP_STAGE_SEND);
+
+out:
+    if ( release )
+        rudp_packet_chain_free(endpoint->rudp, pc);
+
+    return err;
+}
+
 void rudp_endpoint_set_ipv4(
     struct rudp_endpoint *endpoint,
     const struct in_addr *address,
@@ -211,6 +701,13 @@ rudp_error_t rudp_endpoint_set_hostname(
                                      hostname, port, ip_flags);
 }
 
+void rudp_endpoint_set_flags(
+    struct rudp_endpoint *endpoint,
+    uint32_t flags)
+{
+    endpoint->flags = flags;
+}
+
 int rudp_endpoint_address_compare(const struct rudp_endpoint *endpoint,
                                   const struct sockaddr_storage *addr)
 {
@@ -0,0 +1,211 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/group.h>
+#include <rudp/server.h>
+#include "rudp_list.h"
+#include "rudp_packet.h"
+#include "rudp_rudp.h"
+#include "rudp_server.h"
+
+#define GROUP_INITIAL_SIZE 16
+
+/*
+  Each membership has a link structure, chained in the peer's group
+  list.  Link knows the index of the member slot in the group, and
+  slot points back to the link.  This way, leaving a group (or
+  dropping a peer) is o(1): last slot is moved to the freed one.
+ */
+struct server_group_link
+{
+    struct rudp_list peer_item;
+    struct rudp_server_group *group;
+    size_t index;
+};
+
+struct rudp_server_group_slot
+{
+    struct server_peer *peer;
+    struct server_group_link *link;
+};
+
+rudp_error_t rudp_server_group_init(
+    struct rudp_server_group *group,
+    struct rudp_server *server)
+{
+    group->server = server;
+    group->slot = NULL;
+    group->count = 0;
+    group->size = 0;
+    return 0;
+}
+
+static
+void group_slot_remove(struct rudp_server_group *group, size_t index)
+{
+    struct server_group_link *link = group->slot[index].link;
+
+    rudp_list_remove(&link->peer_item);
+    rudp_free(group->server->rudp, link, sizeof(*link));
+
+    group->count--;
+    if ( index != group->count ) {
+        group->slot[index] = group->slot[group->count];
+        group->slot[index].link->index = index;
+    }
+}
+
+void rudp_server_group_deinit(struct rudp_server_group *group)
+{
+    while ( group->count )
+        group_slot_remove(group, group->count - 1);
+
+    if ( group->slot )
+        rudp_free(group->server->rudp, group->slot,
+                  sizeof(*group->slot) * group->size);
+    group->slot = NULL;
+    group->size = 0;
+}
+
+static
+struct server_group_link *group_link_lookup(
+    struct rudp_server_group *group,
+    struct server_peer *peer)
+{
+    struct server_group_link *link;
+    rudp_list_for_each(link, &peer->group_list, peer_item)
+    {
+        if ( link->group == group )
+            return link;
+    }
+    return NULL;
+}
+
+static
+rudp_error_t group_grow(struct rudp_server_group *group)
+{
+    size_t size = group->size ? group->size * 2 : GROUP_INITIAL_SIZE;
+    struct rudp_server_group_slot *slot =
+        rudp_alloc(group->server->rudp, sizeof(*slot) * size);
+
+    if ( slot == NULL )
+        return ENOMEM;
+
+    if ( group->slot ) {
+        memcpy(slot, group->slot, sizeof(*slot) * group->count);
+        rudp_free(group->server->rudp, group->slot,
+                  sizeof(*slot) * group->size);
+    }
+
+    group->slot = slot;
+    group->size = size;
+
+    return 0;
+}
+
+rudp_error_t rudp_server_group_join(
+    struct rudp_server_group *group,
+    struct rudp_peer *_peer)
+{
+    struct server_peer *peer = (struct server_peer *)_peer;
+    struct server_group_link *link;
+    rudp_error_t err;
+
+    if ( group_link_lookup(group, peer) )
+        return EEXIST;
+
+    if ( group->count == group->size ) {
+        err = group_grow(group);
+        if ( err )
+            return err;
+    }
+
+    link = rudp_alloc(group->server->rudp, sizeof(*link));
+    if ( link == NULL )
+        return ENOMEM;
+
+    link->group = group;
+    link->index = group->count++;
+    rudp_list_insert(&peer->group_list, &link->peer_item);
+
+    group->slot[link->index].peer = peer;
+    group->slot[link->index].link = link;
+
+    return 0;
+}
+
+rudp_error_t rudp_server_group_leave(
+    struct rudp_server_group *group,
+    struct rudp_peer *_peer)
+{
+    struct server_peer *peer = (struct server_peer *)_peer;
+    struct server_group_link *link = group_link_lookup(group, peer);
+
+    if ( link == NULL )
+        return ENOENT;
+
+    group_slot_remove(group, link->index);
+
+    return 0;
+}
+
+size_t rudp_server_group_count(const struct rudp_server_group *group)
+{
+    return group->count;
+}
+
+void rudp_server_group_peer_forget(struct server_peer *peer)
+{
+    struct server_group_link *link, *tmp;
+    rudp_list_for_each_safe(link, tmp, &peer->group_list, peer_item)
+    {
+        group_slot_remove(link->group, link->index);
+    }
+}
+
+rudp_error_t rudp_server_group_send(
+    struct rudp_server_group *group,
+    int reliable, int command,
+    const void *data, const size_t size)
+{
+    struct rudp_server *server = group->server;
+    rudp_error_t err = 0;
+    size_t i;
+
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    if ( group->count == 0 )
+        return 0;
+
+    struct rudp_payload *payload = rudp_payload_alloc(server->rudp,
+                                                      data, size);
+    if ( payload == NULL )
+        return ENOMEM;
+
+    rudp_server_batch_begin(server);
+
+    for ( i = 0; i < group->count; ++i ) {
+        err = rudp_server_send_payload(server, group->slot[i].peer,
+                                       reliable, command, payload);
+        if ( err == ENOMEM )
+            break;
+    }
+
+    rudp_server_batch_flush(server);
+    rudp_payload_unref(server->rudp, payload);
+
+    return err == ENOMEM ? err : 0;
+}
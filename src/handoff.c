@@ -0,0 +1,579 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/handoff.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_endpoint.h"
+#include "rudp_peer.h"
+#include "rudp_server.h"
+#include "rudp_crypto.h"
+
+/* "rhnd" */
+#define HANDOFF_MAGIC 0x72686e64
+#define HANDOFF_VERSION 4
+#define HANDOFF_BUFFER_SIZE 65536
+#define HANDOFF_PACKET_MAX 65536
+
+/*
+  Stream layout, in host order: header (sent along with the server
+  sockets, main one first), then for each peer a peer record, its queued packets, each
+  as a 32-bit length followed by packet bytes, and its user data.
+ */
+struct handoff_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t peer_record_size;
+    uint32_t peer_count;
+    uint32_t socket_count;
+};
+
+struct handoff_peer
+{
+    struct sockaddr_storage addr;
+    uint32_t addr_size;
+    uint32_t endpoint;
+    uint32_t egress_weight;
+    uint32_t sendq_count;
+    uint32_t user_size;
+    uint32_t codec_dict_id;
+    uint8_t codec;
+    uint8_t codec_active;
+    uint8_t crypto;
+    uint8_t reserved;
+    struct rudp_crypto_state crypto_state;
+    struct rudp_peer_state state;
+};
+
+/*
+  Buffered blocking access to the handoff socket.  First error is
+  sticky.
+ */
+struct handoff_stream
+{
+    int fd;
+    rudp_error_t err;
+    size_t len;
+    size_t pos;
+    uint8_t buffer[HANDOFF_BUFFER_SIZE];
+};
+
+static
+void stream_flush(struct handoff_stream *stream)
+{
+    size_t done = 0;
+
+    while ( stream->err == 0 && done < stream->len ) {
+        ssize_t ret = write(stream->fd, stream->buffer + done,
+                            stream->len - done);
+
+        if ( ret > 0 )
+            done += ret;
+        else if ( ret == -1 && errno != EINTR )
+            stream->err = errno;
+    }
+
+    stream->len = 0;
+}
+
+static
+void stream_write(struct handoff_stream *stream,
+                  const void *data, size_t size)
+{
+    const uint8_t *ptr = data;
+
+    while ( stream->err == 0 && size ) {
+        size_t chunk = HANDOFF_BUFFER_SIZE - stream->len;
+
+        if ( chunk > size )
+            chunk = size;
+
+        memcpy(stream->buffer + stream->len, ptr, chunk);
+        stream->len += chunk;
+        ptr += chunk;
+        size -= chunk;
+
+        if ( stream->len == HANDOFF_BUFFER_SIZE )
+            stream_flush(stream);
+    }
+}
+
+static
+void stream_read(struct handoff_stream *stream, void *data, size_t size)
+{
+    uint8_t *ptr = data;
+
+    while ( stream->err == 0 && size ) {
+        size_t chunk = stream->len - stream->pos;
+
+        if ( chunk == 0 ) {
+            ssize_t ret = read(stream->fd, stream->buffer,
+                               HANDOFF_BUFFER_SIZE);
+
+            if ( ret > 0 ) {
+                stream->len = ret;
+                stream->pos = 0;
+            } else if ( ret == 0 ) {
+                stream->err = EPROTO;
+            } else if ( errno != EINTR ) {
+                stream->err = errno;
+            }
+            continue;
+        }
+
+        if ( chunk > size )
+            chunk = size;
+
+        memcpy(ptr, stream->buffer + stream->pos, chunk);
+        stream->pos += chunk;
+        ptr += chunk;
+        size -= chunk;
+    }
+}
+
+/*
+  Header goes with the sockets, it is sent unbuffered.
+ */
+static
+rudp_error_t handoff_send_header(int fd, const int *socket_fd,
+                                 const struct handoff_header *header)
+{
+    union {
+        struct cmsghdr cmsg;
+        char space[CMSG_SPACE(sizeof(int) * RUDP_SERVER_LISTENER_MAX)];
+    } control;
+    struct iovec iov = {
+        .iov_base = (void *)header,
+        .iov_len = sizeof(*header),
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.space,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * header->socket_count),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    ssize_t ret;
+
+    memset(&control, 0, sizeof(control));
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * header->socket_count);
+    memcpy(CMSG_DATA(cmsg), socket_fd, sizeof(int) * header->socket_count);
+
+    do
+        ret = sendmsg(fd, &msg, 0);
+    while ( ret == -1 && errno == EINTR );
+
+    if ( ret == -1 )
+        return errno;
+
+    // Rest of header, if any, goes without the socket
+    while ( (size_t)ret < sizeof(*header) ) {
+        ssize_t more = write(fd, (const uint8_t *)header + ret,
+                             sizeof(*header) - ret);
+
+        if ( more > 0 )
+            ret += more;
+        else if ( more == -1 && errno != EINTR )
+            return errno;
+    }
+
+    return 0;
+}
+
+/*
+  Received sockets are stored in socket_fd, unused slots are -1.
+ */
+static
+rudp_error_t handoff_receive_header(struct handoff_stream *stream,
+                                    struct handoff_header *header,
+                                    int *socket_fd)
+{
+    union {
+        struct cmsghdr cmsg;
+        char space[CMSG_SPACE(sizeof(int) * RUDP_SERVER_LISTENER_MAX)];
+    } control;
+    struct iovec iov = {
+        .iov_base = header,
+        .iov_len = sizeof(*header),
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.space,
+        .msg_controllen = sizeof(control.space),
+    };
+    struct cmsghdr *cmsg;
+    unsigned int count = 0, i;
+    ssize_t ret;
+
+    for ( i = 0; i < RUDP_SERVER_LISTENER_MAX; ++i )
+        socket_fd[i] = -1;
+
+    do
+        ret = recvmsg(stream->fd, &msg, MSG_CMSG_CLOEXEC);
+    while ( ret == -1 && errno == EINTR );
+
+    if ( ret == -1 )
+        return errno;
+    if ( ret == 0 )
+        return EPROTO;
+
+    // Every received socket is either kept in socket_fd or closed
+    for ( cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) )
+        if ( cmsg->cmsg_level == SOL_SOCKET
+             && cmsg->cmsg_type == SCM_RIGHTS
+             && cmsg->cmsg_len >= CMSG_LEN(sizeof(int)) ) {
+            unsigned int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int fd;
+
+            for ( i = 0; i < n; ++i ) {
+                memcpy(&fd, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+                if ( count < RUDP_SERVER_LISTENER_MAX )
+                    socket_fd[count++] = fd;
+                else
+                    close(fd);
+            }
+        }
+
+    // Some sockets were dropped by the kernel, listeners would be missing
+    if ( msg.msg_flags & MSG_CTRUNC ) {
+        stream->err = EPROTO;
+        return stream->err;
+    }
+
+    stream_read(stream, (uint8_t *)header + ret, sizeof(*header) - ret);
+
+    if ( stream->err == 0
+         && (count == 0
+             || header->socket_count != count
+             || header->magic != HANDOFF_MAGIC
+             || header->version != HANDOFF_VERSION
+             || header->peer_record_size != sizeof(struct handoff_peer)) )
+        stream->err = EPROTO;
+
+    return stream->err;
+}
+
+static
+void handoff_send_peer(struct handoff_stream *stream,
+                       struct server_peer *peer,
+                       rudp_handoff_save_func_t *save, void *priv,
+                       uint8_t *user)
+{
+    const struct sockaddr_storage *addr;
+    struct rudp_packet_chain *pc;
+    struct handoff_peer record;
+    socklen_t size;
+
+    memset(&record, 0, sizeof(record));
+
+    if ( rudp_address_get(&peer->base.address, &addr, &size) == 0 ) {
+        memcpy(&record.addr, addr, size);
+        record.addr_size = size;
+    }
+
+    record.endpoint = rudp_server_endpoint_index(peer->server,
+                                                 peer->base.endpoint);
+
+    record.egress_weight = peer->base.egress_weight;
+
+    if ( peer->base.codec ) {
+        record.codec = peer->base.codec->id;
+        record.codec_dict_id = peer->base.codec->dict_id;
+        record.codec_active = peer->base.codec_active;
+    }
+
+    record.crypto = rudp_crypto_state_save(&peer->base, &record.crypto_state);
+
+    rudp_list_for_each(pc, &peer->base.sendq, chain_item)
+        record.sendq_count++;
+
+    if ( save ) {
+        record.user_size = save(peer->server, &peer->base, user, priv);
+        if ( record.user_size > RUDP_HANDOFF_USER_SIZE )
+            record.user_size = RUDP_HANDOFF_USER_SIZE;
+    }
+
+    rudp_peer_state_save(&peer->base, &record.state);
+
+    stream_write(stream, &record, sizeof(record));
+    memset(&record.crypto_state, 0, sizeof(record.crypto_state));
+
+    rudp_list_for_each(pc, &peer->base.sendq, chain_item)
+    {
+        uint32_t len = rudp_packet_chain_size(pc);
+
+        stream_write(stream, &len, sizeof(len));
+        stream_write(stream, pc->packet, pc->len);
+        if ( pc->payload )
+            stream_write(stream, pc->payload->data, pc->payload->len);
+    }
+
+    stream_write(stream, user, record.user_size);
+}
+
+rudp_error_t rudp_server_handoff_send(
+    struct rudp_server *server,
+    int fd,
+    rudp_handoff_save_func_t *save,
+    void *priv)
+{
+    struct rudp *rudp = server->rudp;
+    struct handoff_header header;
+    struct handoff_stream *stream;
+    struct server_peer *peer, *tmp;
+    struct rudp_server_listener *listener;
+    int socket_fd[RUDP_SERVER_LISTENER_MAX];
+    uint8_t *user;
+    rudp_error_t err;
+
+    if ( server->endpoint.socket_fd == -1 )
+        return EBADF;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = HANDOFF_MAGIC;
+    header.version = HANDOFF_VERSION;
+    header.peer_record_size = sizeof(struct handoff_peer);
+
+    socket_fd[header.socket_count++] = server->endpoint.socket_fd;
+    rudp_list_for_each(listener, &server->listener_list, item)
+    {
+        if ( listener->endpoint.socket_fd == -1 )
+            return EBADF;
+        socket_fd[header.socket_count++] = listener->endpoint.socket_fd;
+    }
+
+    rudp_list_for_each(peer, &server->peer_list, server_item)
+    {
+        if ( peer->base.shm )
+            return EBUSY;
+        header.peer_count++;
+    }
+
+    stream = rudp_alloc(rudp, sizeof(*stream) + RUDP_HANDOFF_USER_SIZE);
+    if ( stream == NULL )
+        return ENOMEM;
+
+    stream->fd = fd;
+    stream->err = 0;
+    stream->len = 0;
+    stream->pos = 0;
+    user = (uint8_t *)(stream + 1);
+
+    err = handoff_send_header(fd, socket_fd, &header);
+    if ( err )
+        goto out;
+
+    rudp_list_for_each(peer, &server->peer_list, server_item)
+        handoff_send_peer(stream, peer, save, priv, user);
+
+    stream_flush(stream);
+    err = stream->err;
+    if ( err )
+        goto out;
+
+    rudp_log_printf(rudp, RUDP_LOG_INFO,
+                    "Server handed off with %u peers\n",
+                    (unsigned int)header.peer_count);
+
+    // New process owns them now, leave silently
+    rudp_list_for_each_safe(peer, tmp, &server->peer_list, server_item)
+        rudp_server_client_close(server, &peer->base);
+
+    rudp_server_listeners_close(server);
+    rudp_endpoint_close(&server->endpoint);
+
+out:
+    rudp_free(rudp, stream, sizeof(*stream) + RUDP_HANDOFF_USER_SIZE);
+    return err;
+}
+
+/*
+  New process must accept the codecs peers agreed on.
+ */
+static
+const struct rudp_codec *handoff_codec_find(const struct rudp_server *server,
+                                            const struct handoff_peer *record)
+{
+    unsigned int i;
+
+    for ( i = 0; i < server->codec_count; ++i ) {
+        const struct rudp_codec *codec = server->codec[i];
+
+        if ( codec->id == record->codec
+             && codec->dict_id == record->codec_dict_id )
+            return codec;
+    }
+
+    return NULL;
+}
+
+static
+rudp_error_t handoff_receive_peer(struct handoff_stream *stream,
+                                  struct rudp_server *server,
+                                  rudp_handoff_load_func_t *load, void *priv,
+                                  uint8_t *user)
+{
+    struct handoff_peer record;
+    struct rudp_endpoint *endpoint;
+    struct server_peer *peer;
+    uint32_t i;
+
+    stream_read(stream, &record, sizeof(record));
+    if ( stream->err )
+        return stream->err;
+
+    if ( record.addr_size == 0
+         || record.addr_size > sizeof(record.addr)
+         || record.user_size > RUDP_HANDOFF_USER_SIZE )
+        return EPROTO;
+
+    endpoint = rudp_server_endpoint_get(server, record.endpoint);
+    if ( endpoint == NULL )
+        return EPROTO;
+
+    peer = rudp_server_peer_new(server, endpoint, &record.addr);
+    if ( peer == NULL )
+        return ENOMEM;
+
+    if ( record.codec ) {
+        peer->base.codec = handoff_codec_find(server, &record);
+        if ( peer->base.codec == NULL )
+            return EPROTO;
+        peer->base.codec_active = record.codec_active;
+    }
+
+    if ( record.crypto ) {
+        rudp_error_t err = rudp_crypto_state_restore(&peer->base,
+                                                     &record.crypto_state);
+        memset(&record.crypto_state, 0, sizeof(record.crypto_state));
+        if ( err )
+            return err;
+    }
+
+    for ( i = 0; i < record.sendq_count; ++i ) {
+        struct rudp_packet_chain *pc;
+        uint32_t len = 0;
+
+        stream_read(stream, &len, sizeof(len));
+        if ( stream->err )
+            return stream->err;
+
+        if ( len < sizeof(struct rudp_packet_header)
+             || len > HANDOFF_PACKET_MAX )
+            return EPROTO;
+
+        pc = rudp_packet_chain_alloc(server->rudp, len);
+        if ( pc == NULL )
+            return ENOMEM;
+
+        rudp_list_append(&peer->base.sendq, &pc->chain_item);
+        stream_read(stream, pc->packet, len);
+    }
+
+    stream_read(stream, user, record.user_size);
+    if ( stream->err )
+        return stream->err;
+
+    rudp_peer_state_restore(&peer->base, &record.state);
+    rudp_server_peer_set_weight(server, &peer->base, record.egress_weight);
+
+    if ( load )
+        load(server, &peer->base, user, record.user_size, priv);
+
+    return 0;
+}
+
+rudp_error_t rudp_server_handoff_receive(
+    struct rudp_server *server,
+    int fd,
+    rudp_handoff_load_func_t *load,
+    void *priv)
+{
+    struct rudp *rudp = server->rudp;
+    struct handoff_header header;
+    struct handoff_stream *stream;
+    struct server_peer *peer, *tmp;
+    uint8_t *user;
+    rudp_error_t err;
+    int socket_fd[RUDP_SERVER_LISTENER_MAX];
+    uint32_t i;
+
+    // Additional addresses come from the former process
+    if ( server->endpoint.socket_fd != -1
+         || !rudp_list_empty(&server->listener_list) )
+        return EBUSY;
+
+    stream = rudp_alloc(rudp, sizeof(*stream) + RUDP_HANDOFF_USER_SIZE);
+    if ( stream == NULL )
+        return ENOMEM;
+
+    stream->fd = fd;
+    stream->err = 0;
+    stream->len = 0;
+    stream->pos = 0;
+    user = (uint8_t *)(stream + 1);
+
+    err = handoff_receive_header(stream, &header, socket_fd);
+    if ( err ) {
+        for ( i = 0; i < RUDP_SERVER_LISTENER_MAX; ++i )
+            if ( socket_fd[i] != -1 )
+                close(socket_fd[i]);
+        goto out;
+    }
+
+    err = rudp_endpoint_adopt(&server->endpoint, socket_fd[0]);
+    if ( err ) {
+        for ( i = 1; i < header.socket_count; ++i )
+            close(socket_fd[i]);
+        goto out;
+    }
+
+    for ( i = 1; i < header.socket_count; ++i ) {
+        if ( err == 0 )
+            err = rudp_server_listener_adopt(server, socket_fd[i]);
+        else
+            close(socket_fd[i]);
+    }
+
+    for ( i = 0; i < header.peer_count && err == 0; ++i )
+        err = handoff_receive_peer(stream, server, load, priv, user);
+
+    if ( err ) {
+        rudp_list_for_each_safe(peer, tmp, &server->peer_list, server_item)
+            rudp_server_client_close(server, &peer->base);
+        rudp_server_listeners_close(server);
+        rudp_server_listeners_free(server);
+        rudp_endpoint_close(&server->endpoint);
+        goto out;
+    }
+
+    rudp_log_printf(rudp, RUDP_LOG_INFO,
+                    "Server taken over on %s with %u peers\n",
+                    rudp_address_text(&server->endpoint.addr),
+                    (unsigned int)header.peer_count);
+
+out:
+    rudp_free(rudp, stream, sizeof(*stream) + RUDP_HANDOFF_USER_SIZE);
+    return err;
+}
@@ -0,0 +1,972 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/multicast.h>
+#include <rudp/server.h>
+#include <rudp/client.h>
+#include <rudp/peer.h>
+#include "rudp_list.h"
+#include "rudp_packet.h"
+#include "rudp_rudp.h"
+#include "rudp_endpoint.h"
+#include "rudp_peer.h"
+#include "rudp_multicast.h"
+#include "rudp_server.h"
+
+/* Count of sent packets kept for repairs, must be a power of 2 */
+#define MCAST_HISTORY 256
+/* Count of different packets that may be pending repair */
+#define MCAST_REPAIR_MAX 64
+/* Max count of requesters repaired through unicast */
+#define MCAST_UNICAST_MAX 8
+/* Receiver reordering window, must be a power of 2 */
+#define MCAST_WINDOW 128
+#define MCAST_NACK_MAX 32
+#define MCAST_NACK_RETRIES 5
+
+#define MCAST_DEFAULT_THRESHOLD 2
+#define MCAST_DEFAULT_REPAIR_DELAY 10
+#define MCAST_DEFAULT_NACK_DELAY 20
+
+struct rudp_mcast_history
+{
+    struct rudp_payload *payload;
+    uint16_t seq;
+    uint8_t command;
+};
+
+struct rudp_mcast_repair
+{
+    struct rudp_peer *peer[MCAST_UNICAST_MAX];
+    unsigned int count;
+    uint16_t seq;
+    uint8_t used;
+};
+
+enum mcast_slot_state
+{
+    MCAST_SLOT_EMPTY,
+    MCAST_SLOT_PRESENT,
+    MCAST_SLOT_LOST,
+};
+
+struct rudp_mcast_slot
+{
+    struct rudp_packet_chain *pc;
+    rudp_time_t nack_at;
+    uint8_t state;
+    uint8_t tries;
+};
+
+static
+rudp_error_t mcast_socket_setup(int fd, int family, unsigned int ifindex)
+{
+    int on = 1;
+
+    if ( family == AF_INET ) {
+        struct ip_mreqn mreq;
+
+        if ( setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+                        &on, sizeof(on)) == -1 )
+            return errno;
+
+        if ( ifindex == 0 )
+            return 0;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_ifindex = ifindex;
+        if ( setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF,
+                        &mreq, sizeof(mreq)) == -1 )
+            return errno;
+    } else {
+        if ( setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP,
+                        &on, sizeof(on)) == -1 )
+            return errno;
+
+        if ( ifindex == 0 )
+            return 0;
+
+        if ( setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+                        &ifindex, sizeof(ifindex)) == -1 )
+            return errno;
+    }
+
+    return 0;
+}
+
+static
+rudp_error_t mcast_socket_join(int fd, const struct sockaddr *group,
+                               unsigned int ifindex)
+{
+    if ( group->sa_family == AF_INET ) {
+        struct ip_mreqn mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.imr_multiaddr = ((const struct sockaddr_in *)group)->sin_addr;
+        mreq.imr_ifindex = ifindex;
+        if ( setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                        &mreq, sizeof(mreq)) == -1 )
+            return errno;
+    } else {
+        struct ipv6_mreq mreq;
+
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.ipv6mr_multiaddr =
+            ((const struct sockaddr_in6 *)group)->sin6_addr;
+        mreq.ipv6mr_interface = ifindex;
+        if ( setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+                        &mreq, sizeof(mreq)) == -1 )
+            return errno;
+    }
+
+    return 0;
+}
+
+/*
+  Sets the endpoint address to the wildcard address of the group
+  family, with given port.
+ */
+static
+rudp_error_t mcast_endpoint_set_any(struct rudp_endpoint *endpoint,
+                                    const struct sockaddr *group,
+                                    socklen_t len,
+                                    int keep_port)
+{
+    struct sockaddr_storage bind_addr;
+
+    if ( group->sa_family == AF_INET && len >= sizeof(struct sockaddr_in) ) {
+        struct sockaddr_in *addr = (struct sockaddr_in *)&bind_addr;
+
+        memset(&bind_addr, 0, sizeof(bind_addr));
+        addr->sin_family = AF_INET;
+        if ( keep_port )
+            addr->sin_port = ((const struct sockaddr_in *)group)->sin_port;
+        return rudp_endpoint_set_addr(endpoint, (struct sockaddr *)addr,
+                                      sizeof(*addr));
+    }
+
+    if ( group->sa_family == AF_INET6 && len >= sizeof(struct sockaddr_in6) ) {
+        struct sockaddr_in6 *addr = (struct sockaddr_in6 *)&bind_addr;
+
+        memset(&bind_addr, 0, sizeof(bind_addr));
+        addr->sin6_family = AF_INET6;
+        if ( keep_port )
+            addr->sin6_port = ((const struct sockaddr_in6 *)group)->sin6_port;
+        return rudp_endpoint_set_addr(endpoint, (struct sockaddr *)addr,
+                                      sizeof(*addr));
+    }
+
+    return EAFNOSUPPORT;
+}
+
+/* Sender */
+
+static void _mcast_sender_repair(struct ela_event_source *src,
+                                 int fd, uint32_t mask, void *data);
+
+static
+void mcast_sender_handle_packet(struct rudp_endpoint *endpoint,
+                                const struct sockaddr_storage *addr,
+                                struct rudp_packet_chain *pc)
+{
+    // Nobody is expected to talk to us there
+}
+
+static const struct rudp_endpoint_handler mcast_sender_endpoint_handler = {
+    .handle_packet = mcast_sender_handle_packet,
+};
+
+rudp_error_t rudp_mcast_sender_init(
+    struct rudp_mcast_sender *sender,
+    struct rudp_server *server,
+    uint16_t channel)
+{
+    struct rudp *rudp = server->rudp;
+
+    sender->history = rudp_alloc(rudp,
+                                 sizeof(*sender->history) * MCAST_HISTORY);
+    sender->repair = rudp_alloc(rudp,
+                                sizeof(*sender->repair) * MCAST_REPAIR_MAX);
+    if ( sender->history == NULL || sender->repair == NULL ) {
+        if ( sender->history )
+            rudp_free(rudp, sender->history,
+                      sizeof(*sender->history) * MCAST_HISTORY);
+        if ( sender->repair )
+            rudp_free(rudp, sender->repair,
+                      sizeof(*sender->repair) * MCAST_REPAIR_MAX);
+        return ENOMEM;
+    }
+
+    memset(sender->history, 0, sizeof(*sender->history) * MCAST_HISTORY);
+    memset(sender->repair, 0, sizeof(*sender->repair) * MCAST_REPAIR_MAX);
+
+    rudp_endpoint_init(&sender->endpoint, rudp,
+                       &mcast_sender_endpoint_handler);
+    rudp_address_init(&sender->group, rudp);
+    ela_source_alloc(rudp->el, _mcast_sender_repair, sender,
+                     &sender->repair_source);
+
+    sender->server = server;
+    sender->channel = channel;
+    sender->seq = 0;
+    sender->repair_threshold = MCAST_DEFAULT_THRESHOLD;
+    sender->repair_delay = MCAST_DEFAULT_REPAIR_DELAY;
+    sender->repair_scheduled = 0;
+
+    rudp_list_insert(&server->mcast_list, &sender->server_item);
+
+    return 0;
+}
+
+rudp_error_t rudp_mcast_sender_open(
+    struct rudp_mcast_sender *sender,
+    const struct sockaddr *group,
+    socklen_t len,
+    unsigned int ifindex)
+{
+    rudp_error_t err = rudp_address_set(&sender->group, group, len);
+    if ( err )
+        return err;
+
+    err = mcast_endpoint_set_any(&sender->endpoint, group, len, 0);
+    if ( err )
+        return err;
+
+    err = rudp_endpoint_bind(&sender->endpoint);
+    if ( err )
+        return err;
+
+    err = mcast_socket_setup(sender->endpoint.socket_fd,
+                             group->sa_family, ifindex);
+    if ( err ) {
+        rudp_endpoint_close(&sender->endpoint);
+        return err;
+    }
+
+    rudp_log_printf(sender->server->rudp, RUDP_LOG_INFO,
+                    "Multicast channel %d sending to %s\n",
+                    sender->channel, rudp_address_text(&sender->group));
+
+    return 0;
+}
+
+void rudp_mcast_sender_set_repair(
+    struct rudp_mcast_sender *sender,
+    unsigned int threshold,
+    rudp_time_t delay)
+{
+    if ( threshold == 0 )
+        threshold = 1;
+    if ( threshold > MCAST_UNICAST_MAX )
+        threshold = MCAST_UNICAST_MAX;
+
+    sender->repair_threshold = threshold;
+    sender->repair_delay = delay;
+}
+
+static
+void mcast_data_fill(struct rudp_packet_chain *pc,
+                     uint16_t channel,
+                     const struct rudp_mcast_history *entry,
+                     int retransmitted)
+{
+    struct rudp_packet_mcast_data *data = &pc->packet->mcast_data;
+
+    memset(data, 0, sizeof(*data));
+    data->header.command = RUDP_CMD_MCAST_DATA;
+    data->header.opt = retransmitted ? RUDP_OPT_RETRANSMITTED : 0;
+    data->channel = htons(channel);
+    data->seq = htons(entry->seq);
+    data->command = entry->command;
+}
+
+static
+rudp_error_t mcast_sender_transmit(struct rudp_mcast_sender *sender,
+                                   const struct rudp_mcast_history *entry,
+                                   int retransmitted)
+{
+    struct rudp_packet_chain *pc = rudp_packet_chain_alloc_payload(
+        sender->server->rudp, sizeof(struct rudp_packet_mcast_data),
+        entry->payload);
+
+    if ( pc == NULL )
+        return ENOMEM;
+
+    mcast_data_fill(pc, sender->channel, entry, retransmitted);
+
+    return rudp_endpoint_send_chain(&sender->endpoint, &sender->group,
+                                    pc, 1);
+}
+
+rudp_error_t rudp_mcast_sender_send(
+    struct rudp_mcast_sender *sender,
+    int command,
+    const void *data, const size_t size)
+{
+    struct rudp *rudp = sender->server->rudp;
+
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    struct rudp_payload *payload = rudp_payload_alloc(rudp, data, size);
+    if ( payload == NULL )
+        return ENOMEM;
+
+    struct rudp_mcast_history *entry =
+        &sender->history[sender->seq & (MCAST_HISTORY - 1)];
+
+    if ( entry->payload )
+        rudp_payload_unref(rudp, entry->payload);
+
+    entry->payload = payload;
+    entry->seq = sender->seq++;
+    entry->command = RUDP_CMD_APP + command;
+
+    return mcast_sender_transmit(sender, entry, 0);
+}
+
+static
+void mcast_sender_repair_request(struct rudp_mcast_sender *sender,
+                                 struct rudp_peer *peer,
+                                 uint16_t seq)
+{
+    struct rudp_mcast_history *entry =
+        &sender->history[seq & (MCAST_HISTORY - 1)];
+    struct rudp_mcast_repair *repair = NULL;
+    unsigned int i;
+
+    if ( entry->payload == NULL || entry->seq != seq ) {
+        rudp_log_printf(sender->server->rudp, RUDP_LOG_DEBUG,
+                        "%s seq %04x too old for repair\n",
+                        __FUNCTION__, seq);
+        return;
+    }
+
+    for ( i = 0; i < MCAST_REPAIR_MAX; ++i ) {
+        if ( sender->repair[i].used && sender->repair[i].seq == seq ) {
+            repair = &sender->repair[i];
+            break;
+        }
+        if ( repair == NULL && !sender->repair[i].used )
+            repair = &sender->repair[i];
+    }
+
+    // Full, requester will retry
+    if ( repair == NULL )
+        return;
+
+    if ( !repair->used ) {
+        repair->used = 1;
+        repair->seq = seq;
+        repair->count = 0;
+    }
+
+    for ( i = 0; i < repair->count && i < MCAST_UNICAST_MAX; ++i )
+        if ( repair->peer[i] == peer )
+            return;
+
+    if ( repair->count < MCAST_UNICAST_MAX )
+        repair->peer[repair->count] = peer;
+    repair->count++;
+}
+
+void rudp_mcast_sender_handle_nack(struct rudp_server *server,
+                                   struct rudp_peer *peer,
+                                   const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_mcast_nack *nack = &pc->packet->mcast_nack;
+    struct rudp_mcast_sender *sender;
+    uint16_t channel, count, i;
+
+    if ( pc->len < sizeof(*nack) )
+        return;
+
+    channel = ntohs(nack->channel);
+    count = ntohs(nack->count);
+
+    if ( pc->len < sizeof(*nack) + count * sizeof(uint16_t) )
+        return;
+
+    rudp_list_for_each(sender, &server->mcast_list, server_item)
+    {
+        if ( sender->channel != channel )
+            continue;
+
+        for ( i = 0; i < count; ++i )
+            mcast_sender_repair_request(sender, peer, ntohs(nack->seq[i]));
+
+        if ( !sender->repair_scheduled ) {
+            struct timeval tv;
+
+            rudp_timestamp_to_timeval(&tv, sender->repair_delay);
+            ela_set_timeout(server->rudp->el, sender->repair_source,
+                            &tv, ELA_EVENT_ONCE);
+            ela_add(server->rudp->el, sender->repair_source);
+            sender->repair_scheduled = 1;
+        }
+        return;
+    }
+}
+
+static
+void mcast_sender_repair(struct rudp_mcast_sender *sender)
+{
+    struct rudp *rudp = sender->server->rudp;
+    unsigned int i, j;
+
+    sender->repair_scheduled = 0;
+
+    rudp_server_batch_begin(sender->server);
+
+    for ( i = 0; i < MCAST_REPAIR_MAX; ++i ) {
+        struct rudp_mcast_repair *repair = &sender->repair[i];
+        struct rudp_mcast_history *entry =
+            &sender->history[repair->seq & (MCAST_HISTORY - 1)];
+
+        if ( !repair->used )
+            continue;
+
+        repair->used = 0;
+
+        if ( entry->payload == NULL || entry->seq != repair->seq )
+            continue;
+
+        rudp_log_printf(rudp, RUDP_LOG_DEBUG,
+                        "%s seq %04x asked by %d peers, %s\n",
+                        __FUNCTION__, repair->seq, repair->count,
+                        repair->count >= sender->repair_threshold
+                        ? "multicast" : "unicast");
+
+        if ( repair->count >= sender->repair_threshold ) {
+            mcast_sender_transmit(sender, entry, 1);
+            continue;
+        }
+
+        for ( j = 0; j < repair->count; ++j ) {
+            struct rudp_packet_chain *pc = rudp_packet_chain_alloc_payload(
+                rudp, sizeof(struct rudp_packet_mcast_data), entry->payload);
+
+            if ( pc == NULL )
+                break;
+
+            mcast_data_fill(pc, sender->channel, entry, 1);
+            rudp_peer_send_unreliable(repair->peer[j], pc);
+            rudp_peer_flush(repair->peer[j]);
+        }
+    }
+
+    rudp_server_batch_flush(sender->server);
+}
+
+static void _mcast_sender_repair(struct ela_event_source *src,
+                                 int fd, uint32_t mask, void *data)
+{
+    return mcast_sender_repair((struct rudp_mcast_sender *)data);
+}
+
+void rudp_mcast_sender_peer_forget(struct rudp_server *server,
+                                   struct rudp_peer *peer)
+{
+    struct rudp_mcast_sender *sender;
+    unsigned int i, j;
+
+    rudp_list_for_each(sender, &server->mcast_list, server_item)
+    {
+        for ( i = 0; i < MCAST_REPAIR_MAX; ++i ) {
+            struct rudp_mcast_repair *repair = &sender->repair[i];
+
+            if ( !repair->used )
+                continue;
+
+            for ( j = 0; j < repair->count && j < MCAST_UNICAST_MAX; ++j ) {
+                if ( repair->peer[j] != peer )
+                    continue;
+
+                repair->count--;
+                if ( repair->count < MCAST_UNICAST_MAX )
+                    repair->peer[j] = repair->peer[repair->count];
+                if ( repair->count == 0 )
+                    repair->used = 0;
+                break;
+            }
+        }
+    }
+}
+
+void rudp_mcast_sender_close(struct rudp_mcast_sender *sender)
+{
+    if ( sender->repair_scheduled )
+        ela_remove(sender->server->rudp->el, sender->repair_source);
+    sender->repair_scheduled = 0;
+
+    rudp_endpoint_close(&sender->endpoint);
+}
+
+void rudp_mcast_sender_deinit(struct rudp_mcast_sender *sender)
+{
+    struct rudp *rudp = sender->server->rudp;
+    unsigned int i;
+
+    if ( sender->repair_scheduled )
+        ela_remove(rudp->el, sender->repair_source);
+
+    for ( i = 0; i < MCAST_HISTORY; ++i )
+        if ( sender->history[i].payload )
+            rudp_payload_unref(rudp, sender->history[i].payload);
+
+    rudp_list_remove(&sender->server_item);
+    ela_source_free(rudp->el, sender->repair_source);
+    rudp_address_deinit(&sender->group);
+    rudp_endpoint_deinit(&sender->endpoint);
+    rudp_free(rudp, sender->history,
+              sizeof(*sender->history) * MCAST_HISTORY);
+    rudp_free(rudp, sender->repair,
+              sizeof(*sender->repair) * MCAST_REPAIR_MAX);
+}
+
+/* Receiver */
+
+static void _mcast_receiver_nack(struct ela_event_source *src,
+                                 int fd, uint32_t mask, void *data);
+
+static
+void mcast_receiver_schedule(struct rudp_mcast_receiver *receiver,
+                             rudp_time_t deadline)
+{
+    struct rudp *rudp = receiver->client->rudp;
+    struct timeval tv;
+    rudp_time_t delta;
+
+    if ( deadline >= receiver->nack_deadline )
+        return;
+
+    delta = deadline - rudp_timestamp();
+    if ( delta <= 0 )
+        delta = 1;
+
+    receiver->nack_deadline = deadline;
+    rudp_timestamp_to_timeval(&tv, delta);
+    ela_set_timeout(rudp->el, receiver->nack_source, &tv, ELA_EVENT_ONCE);
+    ela_add(rudp->el, receiver->nack_source);
+}
+
+static
+void mcast_receiver_deliver(struct rudp_mcast_receiver *receiver,
+                            const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_mcast_data *data = &pc->packet->mcast_data;
+
+    receiver->handler->handle_packet(
+        receiver, data->command - RUDP_CMD_APP,
+        data->data, pc->len - sizeof(*data));
+}
+
+static
+void mcast_receiver_lost(struct rudp_mcast_receiver *receiver,
+                         unsigned int count)
+{
+    if ( count == 0 )
+        return;
+
+    rudp_log_printf(receiver->client->rudp, RUDP_LOG_WARN,
+                    "Multicast channel %d lost %d packets\n",
+                    receiver->channel, count);
+
+    if ( receiver->handler->packet_lost )
+        receiver->handler->packet_lost(receiver, count);
+}
+
+static
+void mcast_slot_reset(struct rudp *rudp, struct rudp_mcast_slot *slot)
+{
+    if ( slot->pc )
+        rudp_packet_chain_free(rudp, slot->pc);
+    slot->pc = NULL;
+    slot->state = MCAST_SLOT_EMPTY;
+    slot->tries = 0;
+    slot->nack_at = 0;
+}
+
+/*
+  Delivers everything contiguous from next expected sequence number,
+  skipping given up packets.
+ */
+static
+void mcast_receiver_advance(struct rudp_mcast_receiver *receiver)
+{
+    struct rudp *rudp = receiver->client->rudp;
+    unsigned int lost = 0;
+
+    while ( (int16_t)(receiver->next_seq - receiver->max_seq) <= 0 ) {
+        struct rudp_mcast_slot *slot =
+            &receiver->slot[receiver->next_seq & (MCAST_WINDOW - 1)];
+
+        if ( slot->state == MCAST_SLOT_EMPTY )
+            break;
+
+        if ( slot->state == MCAST_SLOT_PRESENT )
+            mcast_receiver_deliver(receiver, slot->pc);
+        else
+            lost++;
+
+        mcast_slot_reset(rudp, slot);
+        receiver->next_seq++;
+    }
+
+    mcast_receiver_lost(receiver, lost);
+}
+
+/*
+  Gives up on everything before seq.
+ */
+static
+void mcast_receiver_skip(struct rudp_mcast_receiver *receiver, uint16_t seq)
+{
+    struct rudp *rudp = receiver->client->rudp;
+    unsigned int lost = 0;
+
+    while ( (int16_t)(seq - receiver->next_seq) > 0 ) {
+        struct rudp_mcast_slot *slot =
+            &receiver->slot[receiver->next_seq & (MCAST_WINDOW - 1)];
+
+        if ( slot->state == MCAST_SLOT_PRESENT )
+            mcast_receiver_deliver(receiver, slot->pc);
+        else
+            lost++;
+
+        mcast_slot_reset(rudp, slot);
+        receiver->next_seq++;
+    }
+
+    if ( (int16_t)(receiver->max_seq - receiver->next_seq) < 0 )
+        receiver->max_seq = receiver->next_seq - 1;
+
+    mcast_receiver_lost(receiver, lost);
+}
+
+static
+void mcast_receiver_incoming(struct rudp_mcast_receiver *receiver,
+                             const struct rudp_packet_chain *pc)
+{
+    struct rudp *rudp = receiver->client->rudp;
+    const struct rudp_packet_mcast_data *data = &pc->packet->mcast_data;
+    uint16_t seq = ntohs(data->seq);
+
+    if ( !receiver->started ) {
+        receiver->next_seq = seq;
+        receiver->max_seq = seq - 1;
+        receiver->started = 1;
+    }
+
+    int16_t delta = seq - receiver->next_seq;
+
+    // Stale or duplicate
+    if ( delta < 0 )
+        return;
+
+    if ( !receiver->reliable ) {
+        mcast_receiver_lost(receiver, delta);
+        mcast_receiver_deliver(receiver, pc);
+        receiver->next_seq = seq + 1;
+        receiver->max_seq = seq;
+        return;
+    }
+
+    if ( delta >= MCAST_WINDOW )
+        mcast_receiver_skip(receiver, seq - MCAST_WINDOW + 1);
+
+    struct rudp_mcast_slot *slot = &receiver->slot[seq & (MCAST_WINDOW - 1)];
+
+    if ( slot->state == MCAST_SLOT_PRESENT )
+        return;
+
+    if ( seq == receiver->next_seq ) {
+        mcast_slot_reset(rudp, slot);
+        mcast_receiver_deliver(receiver, pc);
+        receiver->next_seq++;
+        if ( (int16_t)(receiver->max_seq - seq) < 0 )
+            receiver->max_seq = seq;
+        mcast_receiver_advance(receiver);
+        return;
+    }
+
+    slot->pc = rudp_packet_chain_alloc(rudp, pc->len);
+    if ( slot->pc == NULL )
+        return;
+
+    memcpy(slot->pc->packet, pc->packet, pc->len);
+    slot->state = MCAST_SLOT_PRESENT;
+
+    if ( (int16_t)(seq - receiver->max_seq) <= 0 )
+        return;
+
+    // New hole(s) in the sequence, NACK them after a random delay
+    rudp_time_t now = rudp_timestamp();
+    rudp_time_t first = RUDP_TIME_MAX;
+    uint16_t s;
+
+    for ( s = receiver->max_seq + 1; s != seq; ++s ) {
+        struct rudp_mcast_slot *hole =
+            &receiver->slot[s & (MCAST_WINDOW - 1)];
+
+        mcast_slot_reset(rudp, hole);
+        hole->nack_at = now + rudp_random(rudp) % (receiver->nack_delay + 1);
+        if ( hole->nack_at < first )
+            first = hole->nack_at;
+    }
+
+    receiver->max_seq = seq;
+
+    mcast_receiver_schedule(receiver, first);
+}
+
+static
+void mcast_receiver_send_nack(struct rudp_mcast_receiver *receiver,
+                              const uint16_t *seq, uint16_t count)
+{
+    struct rudp_client *client = receiver->client;
+    struct rudp_packet_chain *pc = rudp_packet_chain_alloc(
+        client->rudp,
+        sizeof(struct rudp_packet_mcast_nack) + count * sizeof(uint16_t));
+    uint16_t i;
+
+    if ( pc == NULL )
+        return;
+
+    struct rudp_packet_mcast_nack *nack = &pc->packet->mcast_nack;
+
+    nack->header.command = RUDP_CMD_MCAST_NACK;
+    nack->channel = htons(receiver->channel);
+    nack->count = htons(count);
+    for ( i = 0; i < count; ++i )
+        nack->seq[i] = htons(seq[i]);
+
+    rudp_log_printf(client->rudp, RUDP_LOG_DEBUG,
+                    "%s channel %d asking for %d packets from %04x\n",
+                    __FUNCTION__, receiver->channel, count, seq[0]);
+
+    rudp_peer_send_unreliable(&client->peer, pc);
+}
+
+static
+void mcast_receiver_nack(struct rudp_mcast_receiver *receiver)
+{
+    rudp_time_t now = rudp_timestamp();
+    rudp_time_t next = RUDP_TIME_MAX;
+    rudp_time_t retry = 2 * receiver->client->peer.srtt + receiver->nack_delay;
+    uint16_t seq[MCAST_NACK_MAX];
+    uint16_t count = 0;
+    uint16_t s;
+
+    receiver->nack_deadline = RUDP_TIME_MAX;
+
+    for ( s = receiver->next_seq;
+          (int16_t)(s - receiver->max_seq) <= 0;
+          ++s ) {
+        struct rudp_mcast_slot *slot = &receiver->slot[s & (MCAST_WINDOW - 1)];
+
+        if ( slot->state != MCAST_SLOT_EMPTY )
+            continue;
+
+        if ( slot->nack_at > now ) {
+            if ( slot->nack_at < next )
+                next = slot->nack_at;
+            continue;
+        }
+
+        if ( slot->tries >= MCAST_NACK_RETRIES ) {
+            slot->state = MCAST_SLOT_LOST;
+            continue;
+        }
+
+        // Not a try, asked again once there is a connection to ask on
+        if ( !receiver->client->connected ) {
+            if ( now + retry < next )
+                next = now + retry;
+            continue;
+        }
+
+        // Rest goes in the next request, right away
+        if ( count == MCAST_NACK_MAX ) {
+            next = now;
+            continue;
+        }
+
+        seq[count++] = s;
+        slot->tries++;
+        slot->nack_at = now + retry;
+        if ( slot->nack_at < next )
+            next = slot->nack_at;
+    }
+
+    if ( count )
+        mcast_receiver_send_nack(receiver, seq, count);
+
+    mcast_receiver_advance(receiver);
+
+    if ( next != RUDP_TIME_MAX )
+        mcast_receiver_schedule(receiver, next);
+}
+
+static void _mcast_receiver_nack(struct ela_event_source *src,
+                                 int fd, uint32_t mask, void *data)
+{
+    return mcast_receiver_nack((struct rudp_mcast_receiver *)data);
+}
+
+static
+int mcast_data_check(const struct rudp_packet_chain *pc, uint16_t channel)
+{
+    const struct rudp_packet_mcast_data *data = &pc->packet->mcast_data;
+
+    return pc->len >= sizeof(*data)
+        && data->header.command == RUDP_CMD_MCAST_DATA
+        && ntohs(data->channel) == channel
+        && data->command >= RUDP_CMD_APP;
+}
+
+/*
+  - socket watcher
+     - endpoint packet reader
+        - multicast receiver packet handler <===
+ */
+static
+void mcast_receiver_handle_packet(struct rudp_endpoint *endpoint,
+                                  const struct sockaddr_storage *addr,
+                                  struct rudp_packet_chain *pc)
+{
+    struct rudp_mcast_receiver *receiver =
+        __container_of(endpoint, receiver, endpoint);
+
+    if ( !mcast_data_check(pc, receiver->channel) ) {
+        rudp_log_printf(endpoint->rudp, RUDP_LOG_DEBUG, "Garbage data\n");
+        return;
+    }
+
+    mcast_receiver_incoming(receiver, pc);
+}
+
+static const struct rudp_endpoint_handler mcast_receiver_endpoint_handler = {
+    .handle_packet = mcast_receiver_handle_packet,
+};
+
+void rudp_mcast_receiver_handle_repair(struct rudp_client *client,
+                                       const struct rudp_packet_chain *pc)
+{
+    struct rudp_mcast_receiver *receiver;
+
+    rudp_list_for_each(receiver, &client->mcast_list, client_item)
+    {
+        if ( !mcast_data_check(pc, receiver->channel) )
+            continue;
+
+        mcast_receiver_incoming(receiver, pc);
+        return;
+    }
+}
+
+rudp_error_t rudp_mcast_receiver_init(
+    struct rudp_mcast_receiver *receiver,
+    struct rudp_client *client,
+    const struct rudp_mcast_receiver_handler *handler,
+    uint16_t channel,
+    int reliable)
+{
+    struct rudp *rudp = client->rudp;
+
+    receiver->slot = rudp_alloc(rudp, sizeof(*receiver->slot) * MCAST_WINDOW);
+    if ( receiver->slot == NULL )
+        return ENOMEM;
+
+    memset(receiver->slot, 0, sizeof(*receiver->slot) * MCAST_WINDOW);
+
+    rudp_endpoint_init(&receiver->endpoint, rudp,
+                       &mcast_receiver_endpoint_handler);
+    rudp_endpoint_set_flags(&receiver->endpoint, RUDP_ENDPOINT_REUSEADDR);
+    ela_source_alloc(rudp->el, _mcast_receiver_nack, receiver,
+                     &receiver->nack_source);
+
+    receiver->handler = handler;
+    receiver->client = client;
+    receiver->channel = channel;
+    receiver->reliable = !!reliable;
+    receiver->started = 0;
+    receiver->nack_delay = MCAST_DEFAULT_NACK_DELAY;
+    receiver->nack_deadline = RUDP_TIME_MAX;
+
+    rudp_list_insert(&client->mcast_list, &receiver->client_item);
+
+    return 0;
+}
+
+rudp_error_t rudp_mcast_receiver_open(
+    struct rudp_mcast_receiver *receiver,
+    const struct sockaddr *group,
+    socklen_t len,
+    unsigned int ifindex)
+{
+    rudp_error_t err = mcast_endpoint_set_any(&receiver->endpoint,
+                                              group, len, 1);
+    if ( err )
+        return err;
+
+    err = rudp_endpoint_bind(&receiver->endpoint);
+    if ( err )
+        return err;
+
+    err = mcast_socket_join(receiver->endpoint.socket_fd, group, ifindex);
+    if ( err ) {
+        rudp_endpoint_close(&receiver->endpoint);
+        return err;
+    }
+
+    receiver->started = 0;
+
+    return 0;
+}
+
+void rudp_mcast_receiver_close(struct rudp_mcast_receiver *receiver)
+{
+    struct rudp *rudp = receiver->client->rudp;
+    unsigned int i;
+
+    if ( receiver->nack_deadline != RUDP_TIME_MAX )
+        ela_remove(rudp->el, receiver->nack_source);
+    receiver->nack_deadline = RUDP_TIME_MAX;
+
+    for ( i = 0; i < MCAST_WINDOW; ++i )
+        mcast_slot_reset(rudp, &receiver->slot[i]);
+
+    rudp_endpoint_close(&receiver->endpoint);
+}
+
+void rudp_mcast_receiver_deinit(struct rudp_mcast_receiver *receiver)
+{
+    struct rudp *rudp = receiver->client->rudp;
+    unsigned int i;
+
+    if ( receiver->nack_deadline != RUDP_TIME_MAX )
+        ela_remove(rudp->el, receiver->nack_source);
+
+    for ( i = 0; i < MCAST_WINDOW; ++i )
+        mcast_slot_reset(rudp, &receiver->slot[i]);
+
+    rudp_list_remove(&receiver->client_item);
+    ela_source_free(rudp->el, receiver->nack_source);
+    rudp_endpoint_deinit(&receiver->endpoint);
+    rudp_free(rudp, receiver->slot, sizeof(*receiver->slot) * MCAST_WINDOW);
+}
@@ -0,0 +1,757 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/multipath.h>
+#include <rudp/client.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_error.h"
+#include "rudp_packet.h"
+#include "rudp_endpoint.h"
+#include "rudp_peer.h"
+#include "rudp_server.h"
+#include "rudp_mpath.h"
+#include "rudp_shard.h"
+#include "rudp_crypto.h"
+
+#define PATH_PROBE_INTERVAL 200
+/* Path is down when no probe was answered for this long */
+#define PATH_DOWN_TIMEOUT 1000
+/* Loss rate is a fixed point ratio, 1 << 16 is 100% */
+#define PATH_LOSS_ONE 65536
+
+struct rudp_path
+{
+    struct rudp_endpoint *endpoint;
+    struct rudp_address address;
+    rudp_time_t srtt;
+    rudp_time_t rttvar;
+    rudp_time_t last_heard;
+    uint32_t loss;
+    uint32_t weight;
+    int32_t credit;
+    uint64_t packets_out;
+    uint8_t remote_known:1;
+    uint8_t joined:1;
+    uint8_t up:1;
+    uint8_t measured:1;
+    uint8_t probe_pending:1;
+};
+
+struct rudp_mpath
+{
+    struct rudp_peer *peer;
+    struct ela_event_source *probe_source;
+    uint8_t token[RUDP_PATH_TOKEN_SIZE];
+    uint8_t scheduler;
+    uint8_t client:1;
+    unsigned int count;
+    struct rudp_path path[RUDP_PATH_MAX];
+};
+
+static void _mpath_probe(struct ela_event_source *src,
+                         int fd, uint32_t mask, void *data);
+
+static
+struct rudp_mpath *mpath_new(struct rudp_peer *peer)
+{
+    struct rudp *rudp = peer->rudp;
+    struct rudp_mpath *mpath = rudp_alloc(rudp, sizeof(*mpath));
+    const struct sockaddr_storage *addr;
+    socklen_t size;
+    unsigned int i;
+
+    if ( mpath == NULL )
+        return NULL;
+
+    memset(mpath, 0, sizeof(*mpath));
+    mpath->peer = peer;
+
+    if ( ela_source_alloc(rudp->el, _mpath_probe, mpath,
+                          &mpath->probe_source) ) {
+        rudp_free(rudp, mpath, sizeof(*mpath));
+        return NULL;
+    }
+
+    for ( i = 0; i < RUDP_PATH_MAX; ++i ) {
+        rudp_address_init(&mpath->path[i].address, rudp);
+        mpath->path[i].weight = 1;
+        mpath->path[i].srtt = peer->srtt;
+        mpath->path[i].rttvar = peer->rttvar;
+    }
+
+    // First path is the one connection was established on
+    mpath->count = 1;
+    mpath->path[0].endpoint = peer->endpoint;
+    if ( rudp_address_get(&peer->address, &addr, &size) == 0 )
+        rudp_address_set(&mpath->path[0].address,
+                         (const struct sockaddr *)addr, size);
+    mpath->path[0].remote_known = 1;
+    mpath->path[0].joined = 1;
+    mpath->path[0].up = 1;
+    mpath->path[0].last_heard = rudp_timestamp();
+
+    return mpath;
+}
+
+static
+void mpath_probe_schedule(struct rudp_mpath *mpath)
+{
+    struct timeval tv;
+
+    rudp_timestamp_to_timeval(&tv, PATH_PROBE_INTERVAL);
+    ela_set_timeout(mpath->peer->rudp->el, mpath->probe_source,
+                    &tv, ELA_EVENT_ONCE);
+    ela_add(mpath->peer->rudp->el, mpath->probe_source);
+}
+
+void rudp_mpath_close(struct rudp_peer *peer)
+{
+    struct rudp_mpath *mpath = peer->mpath;
+    struct rudp *rudp = peer->rudp;
+    unsigned int i;
+
+    if ( mpath == NULL )
+        return;
+
+    peer->mpath = NULL;
+
+    ela_remove(rudp->el, mpath->probe_source);
+    ela_source_free(rudp->el, mpath->probe_source);
+
+    // Client path endpoints belong to path configurations
+    for ( i = 1; i < mpath->count; ++i )
+        if ( mpath->client && mpath->path[i].endpoint )
+            rudp_endpoint_close(mpath->path[i].endpoint);
+
+    for ( i = 0; i < RUDP_PATH_MAX; ++i )
+        rudp_address_deinit(&mpath->path[i].address);
+
+    rudp_free(rudp, mpath, sizeof(*mpath));
+}
+
+/* Path packets */
+
+static
+void mpath_send_probe(struct rudp_mpath *mpath, unsigned int index,
+                      struct rudp_endpoint *endpoint,
+                      const struct rudp_address *address,
+                      uint8_t command, uint32_t timestamp)
+{
+    struct rudp_packet_path_probe probe;
+
+    memset(&probe, 0, sizeof(probe));
+    probe.header.command = command;
+    if ( mpath->peer->shard_tag )
+        rudp_shard_stamp(mpath->peer, &probe.header.opt);
+    memcpy(probe.token, mpath->token, sizeof(probe.token));
+    probe.path = index;
+    probe.timestamp = htonl(timestamp);
+
+    rudp_endpoint_send(endpoint, address, &probe, sizeof(probe));
+}
+
+static
+void mpath_path_heard(struct rudp_mpath *mpath, unsigned int index,
+                      uint32_t timestamp)
+{
+    struct rudp_path *path = &mpath->path[index];
+    rudp_time_t now = rudp_timestamp();
+    rudp_time_t rtt = (uint32_t)now - timestamp;
+
+    if ( rtt < 0 || rtt > PATH_DOWN_TIMEOUT * 10 )
+        return;
+
+    if ( path->measured ) {
+        path->rttvar = (3 * path->rttvar + labs(path->srtt - rtt)) / 4;
+        path->srtt = (7 * path->srtt + rtt) / 8;
+    } else {
+        path->srtt = rtt;
+        path->rttvar = rtt / 2;
+        path->measured = 1;
+    }
+
+    path->probe_pending = 0;
+    path->last_heard = now;
+    path->joined = 1;
+
+    if ( !path->up ) {
+        rudp_log_printf(mpath->peer->rudp, RUDP_LOG_INFO,
+                        "Path %u up, rtt %d\n", index, (int)rtt);
+        path->up = 1;
+    }
+}
+
+static
+void _mpath_probe(struct ela_event_source *src,
+                  int fd, uint32_t mask, void *data)
+{
+    struct rudp_mpath *mpath = data;
+    rudp_time_t now = rudp_timestamp();
+    unsigned int i;
+    int lost = 0;
+
+    for ( i = 0; i < mpath->count; ++i ) {
+        struct rudp_path *path = &mpath->path[i];
+        uint32_t sample = path->probe_pending ? PATH_LOSS_ONE : 0;
+
+        if ( !path->remote_known || path->endpoint == NULL )
+            continue;
+
+        path->loss = (7 * path->loss + sample) / 8;
+        path->probe_pending = 1;
+
+        if ( path->up && now - path->last_heard > PATH_DOWN_TIMEOUT ) {
+            rudp_log_printf(mpath->peer->rudp, RUDP_LOG_WARN,
+                            "Path %u down\n", i);
+            path->up = 0;
+            lost = 1;
+        }
+
+        mpath_send_probe(mpath, i, path->endpoint, &path->address,
+                         path->joined ? RUDP_CMD_PATH_PROBE
+                                      : RUDP_CMD_PATH_JOIN,
+                         (uint32_t)now);
+    }
+
+    mpath_probe_schedule(mpath);
+
+    // Packet in flight may have been lost with the path
+    if ( lost )
+        rudp_peer_retransmit(mpath->peer);
+}
+
+int rudp_mpath_is_path_packet(const struct rudp_packet_chain *pc)
+{
+    switch ( pc->packet->header.command ) {
+    case RUDP_CMD_PATH_JOIN:
+    case RUDP_CMD_PATH_PROBE:
+    case RUDP_CMD_PATH_PROBE_ACK:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int rudp_mpath_token_match(const struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_path_probe *probe = &pc->packet->path_probe;
+
+    return peer->mpath
+        && pc->len >= sizeof(*probe)
+        && !memcmp(probe->token, peer->mpath->token, sizeof(probe->token));
+}
+
+int rudp_mpath_address_match(const struct rudp_peer *peer,
+                             const struct sockaddr_storage *addr)
+{
+    const struct rudp_mpath *mpath = peer->mpath;
+    unsigned int i;
+
+    for ( i = 1; i < mpath->count; ++i )
+        if ( mpath->path[i].remote_known
+             && !rudp_address_compare(&mpath->path[i].address, addr) )
+            return 1;
+
+    return 0;
+}
+
+void rudp_mpath_handle_path_packet(struct rudp_peer *peer,
+                                   struct rudp_endpoint *endpoint,
+                                   const struct sockaddr_storage *addr,
+                                   const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_path_probe *probe = &pc->packet->path_probe;
+    struct rudp_mpath *mpath = peer->mpath;
+    struct rudp_path *path;
+    unsigned int index = probe->path;
+
+    if ( !rudp_mpath_token_match(peer, pc) || index >= RUDP_PATH_MAX )
+        return;
+
+    path = &mpath->path[index];
+
+    switch ( probe->header.command ) {
+    case RUDP_CMD_PATH_JOIN:
+        // Only client joins paths
+        if ( mpath->client || index == 0 )
+            return;
+
+        if ( index >= mpath->count )
+            mpath->count = index + 1;
+
+        if ( !path->remote_known
+             || rudp_address_compare(&path->address, addr) ) {
+            rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                            "Path %u joined\n", index);
+            rudp_address_set(&path->address,
+                             (const struct sockaddr *)addr, sizeof(*addr));
+            path->endpoint = endpoint;
+            path->remote_known = 1;
+            path->joined = 1;
+            path->up = 1;
+            path->last_heard = rudp_timestamp();
+        }
+        // Answered as a probe
+        mpath_send_probe(mpath, index, endpoint, &path->address,
+                         RUDP_CMD_PATH_PROBE_ACK, ntohl(probe->timestamp));
+        break;
+
+    case RUDP_CMD_PATH_PROBE:
+        if ( index >= mpath->count || !path->remote_known )
+            return;
+
+        // Remote side of the path may have moved
+        if ( !mpath->client
+             && rudp_address_compare(&path->address, addr) )
+            rudp_address_set(&path->address,
+                             (const struct sockaddr *)addr, sizeof(*addr));
+
+        mpath_send_probe(mpath, index, endpoint, &path->address,
+                         RUDP_CMD_PATH_PROBE_ACK, ntohl(probe->timestamp));
+        break;
+
+    case RUDP_CMD_PATH_PROBE_ACK:
+        if ( index >= mpath->count || !path->remote_known )
+            return;
+
+        mpath_path_heard(mpath, index, ntohl(probe->timestamp));
+        break;
+    }
+}
+
+/* Scheduling */
+
+/*
+  Returns a mask of paths a packet must be sent on.
+ */
+static
+unsigned int mpath_pick(struct rudp_mpath *mpath)
+{
+    unsigned int i, mask = 0, best = 0;
+    int32_t total = 0;
+
+    for ( i = 0; i < mpath->count; ++i ) {
+        struct rudp_path *path = &mpath->path[i];
+
+        if ( path->up && path->remote_known && path->endpoint )
+            mask |= 1 << i;
+    }
+
+    // Nothing answers, keep trying the first path
+    if ( mask == 0 )
+        return 1;
+
+    switch ( mpath->scheduler ) {
+    case RUDP_PATH_REDUNDANT:
+        return mask;
+
+    case RUDP_PATH_WEIGHTED:
+        // Smooth weighted round robin
+        best = RUDP_PATH_MAX;
+        for ( i = 0; i < mpath->count; ++i ) {
+            struct rudp_path *path = &mpath->path[i];
+
+            if ( !(mask & (1 << i)) )
+                continue;
+
+            path->credit += path->weight;
+            total += path->weight;
+            if ( best == RUDP_PATH_MAX
+                 || path->credit > mpath->path[best].credit )
+                best = i;
+        }
+        mpath->path[best].credit -= total;
+        return 1 << best;
+
+    default:
+        best = RUDP_PATH_MAX;
+        for ( i = 0; i < mpath->count; ++i ) {
+            if ( !(mask & (1 << i)) )
+                continue;
+
+            if ( best == RUDP_PATH_MAX
+                 || mpath->path[i].srtt < mpath->path[best].srtt )
+                best = i;
+        }
+        return 1 << best;
+    }
+}
+
+/*
+  Endpoints of a peer may batch, and only release chains they were
+  given once flushed, in no particular order.  Each path but the last
+  one gets its own copy of a chain to release, sharing its payload.
+ */
+static
+struct rudp_packet_chain *mpath_chain_copy(struct rudp *rudp,
+                                           const struct rudp_packet_chain *pc)
+{
+    struct rudp_packet_chain *copy;
+
+    if ( pc->payload )
+        copy = rudp_packet_chain_alloc_payload(rudp, pc->len, pc->payload);
+    else
+        copy = rudp_packet_chain_alloc(rudp, pc->len);
+
+    if ( copy == NULL )
+        return NULL;
+
+    memcpy(copy->packet, pc->packet, pc->len);
+
+    return copy;
+}
+
+rudp_error_t rudp_mpath_send_chain(struct rudp_peer *peer,
+                                   struct rudp_packet_chain *pc,
+                                   int release)
+{
+    struct rudp_mpath *mpath = peer->mpath;
+    unsigned int mask = mpath_pick(mpath);
+    rudp_error_t err = 0;
+    unsigned int i;
+
+    for ( i = 0; mask; ++i ) {
+        struct rudp_path *path = &mpath->path[i];
+        struct rudp_packet_chain *sent = pc;
+
+        if ( !(mask & (1 << i)) )
+            continue;
+
+        mask &= ~(1 << i);
+
+        // Chain given to a batch may be released before others flush
+        if ( release && mask ) {
+            sent = mpath_chain_copy(peer->rudp, pc);
+            if ( sent == NULL ) {
+                if ( err == 0 )
+                    err = ENOMEM;
+                continue;
+            }
+        }
+
+        path->packets_out++;
+
+        rudp_error_t e = rudp_endpoint_send_chain(
+            path->endpoint, &path->address, sent, release);
+        if ( err == 0 )
+            err = e;
+    }
+
+    return err;
+}
+
+rudp_error_t rudp_mpath_send_raw(struct rudp_peer *peer,
+                                 const void *data, size_t len)
+{
+    struct rudp_mpath *mpath = peer->mpath;
+    unsigned int mask = mpath_pick(mpath);
+    rudp_error_t err = 0;
+    unsigned int i;
+
+    for ( i = 0; i < mpath->count; ++i ) {
+        struct rudp_path *path = &mpath->path[i];
+
+        if ( !(mask & (1 << i)) )
+            continue;
+
+        path->packets_out++;
+
+        rudp_error_t e = rudp_endpoint_send(
+            path->endpoint, &path->address, data, len);
+        if ( err == 0 )
+            err = e;
+    }
+
+    return err;
+}
+
+rudp_error_t rudp_mpath_path_info(const struct rudp_peer *peer,
+                                  unsigned int index,
+                                  struct rudp_path_info *info)
+{
+    const struct rudp_path *path;
+
+    if ( peer->mpath == NULL || index >= peer->mpath->count )
+        return ENOENT;
+
+    path = &peer->mpath->path[index];
+    info->srtt = path->srtt;
+    info->rttvar = path->rttvar;
+    info->loss_permille = (uint64_t)path->loss * 1000 / PATH_LOSS_ONE;
+    info->up = path->up;
+    info->packets_out = path->packets_out;
+
+    return 0;
+}
+
+/* Server side */
+
+void rudp_mpath_handle_token(struct rudp_peer *peer,
+                             const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_path_token *token = &pc->packet->path_token;
+    struct rudp_mpath *mpath;
+
+    if ( pc->len < sizeof(*token) || !peer->mpath_accept
+         || peer->mpath )
+        return;
+
+    mpath = mpath_new(peer);
+    if ( mpath == NULL )
+        return;
+
+    memcpy(mpath->token, token->token, sizeof(mpath->token));
+    mpath->scheduler = token->scheduler;
+    peer->mpath = mpath;
+
+    rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                    "Multipath connection, scheduler %d\n",
+                    (int)mpath->scheduler);
+
+    mpath_probe_schedule(mpath);
+}
+
+void rudp_server_set_multipath(
+    struct rudp_server *server,
+    int enable)
+{
+    struct server_peer *peer;
+
+    server->multipath = !!enable;
+
+    rudp_list_for_each(peer, &server->peer_list, server_item)
+        peer->base.mpath_accept = server->multipath;
+}
+
+rudp_error_t rudp_server_path_info(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    unsigned int path,
+    struct rudp_path_info *info)
+{
+    return rudp_mpath_path_info(peer, path, info);
+}
+
+/* Client side */
+
+static
+void path_handle_endpoint_packet(struct rudp_endpoint *endpoint,
+                                 const struct sockaddr_storage *addr,
+                                 struct rudp_packet_chain *pc)
+{
+    struct rudp_path_config *config =
+        __container_of(endpoint, config, endpoint);
+    struct rudp_client *client = config->client;
+
+    if ( !client->connected )
+        return;
+
+    if ( rudp_mpath_is_path_packet(pc) ) {
+        if ( client->peer.mpath )
+            rudp_mpath_handle_path_packet(&client->peer, endpoint, addr, pc);
+        return;
+    }
+
+    rudp_peer_incoming_packet(&client->peer, pc);
+}
+
+static const struct rudp_endpoint_handler path_endpoint_handler = {
+    .handle_packet = path_handle_endpoint_packet,
+};
+
+rudp_error_t rudp_client_add_path(
+    struct rudp_client *client,
+    const struct sockaddr *local, socklen_t local_len,
+    const struct sockaddr *remote, socklen_t remote_len,
+    unsigned int weight)
+{
+    struct rudp_path_config *config;
+    unsigned int count = 1;
+
+    rudp_list_for_each(config, &client->path_list, item)
+        count++;
+
+    if ( count >= RUDP_PATH_MAX )
+        return ENOSPC;
+
+    if ( (local && (local_len > sizeof(config->local) || local_len == 0))
+         || (remote && (remote_len > sizeof(config->remote)
+                        || remote_len == 0)) )
+        return EINVAL;
+
+    config = rudp_alloc(client->rudp, sizeof(*config));
+    if ( config == NULL )
+        return ENOMEM;
+
+    memset(config, 0, sizeof(*config));
+    config->client = client;
+    config->weight = weight ? weight : 1;
+    if ( local ) {
+        memcpy(&config->local, local, local_len);
+        config->local_len = local_len;
+    }
+    if ( remote ) {
+        memcpy(&config->remote, remote, remote_len);
+        config->remote_len = remote_len;
+    }
+
+    rudp_endpoint_init(&config->endpoint, client->rudp,
+                       &path_endpoint_handler);
+    rudp_list_append(&client->path_list, &config->item);
+
+    return 0;
+}
+
+void rudp_client_set_path_scheduler(
+    struct rudp_client *client,
+    enum rudp_path_scheduler scheduler)
+{
+    client->path_scheduler = scheduler;
+}
+
+rudp_error_t rudp_client_path_info(
+    struct rudp_client *client,
+    unsigned int path,
+    struct rudp_path_info *info)
+{
+    if ( !client->connected )
+        return ENOENT;
+
+    return rudp_mpath_path_info(&client->peer, path, info);
+}
+
+static
+rudp_error_t mpath_client_bind(struct rudp_client *client,
+                               struct rudp_path_config *config,
+                               struct rudp_path *path)
+{
+    const struct sockaddr_storage *server_addr;
+    struct sockaddr_storage bind_addr;
+    socklen_t size;
+    rudp_error_t err;
+
+    err = rudp_address_get(&client->address, &server_addr, &size);
+    if ( err )
+        return err;
+
+    if ( config->remote_len )
+        rudp_address_set(&path->address,
+                         (const struct sockaddr *)&config->remote,
+                         config->remote_len);
+    else
+        rudp_address_set(&path->address,
+                         (const struct sockaddr *)server_addr, size);
+
+    if ( config->local_len ) {
+        rudp_endpoint_set_addr(&config->endpoint,
+                               (const struct sockaddr *)&config->local,
+                               config->local_len);
+    } else {
+        memset(&bind_addr, 0, sizeof(bind_addr));
+        bind_addr.ss_family = server_addr->ss_family;
+        rudp_endpoint_set_addr(&config->endpoint,
+                               (const struct sockaddr *)&bind_addr,
+                               sizeof(bind_addr));
+    }
+
+    err = rudp_endpoint_bind(&config->endpoint);
+    if ( err )
+        return err;
+
+    path->endpoint = &config->endpoint;
+    path->weight = config->weight;
+    path->remote_known = 1;
+
+    return 0;
+}
+
+rudp_error_t rudp_mpath_client_start(struct rudp_client *client)
+{
+    struct rudp_peer *peer = &client->peer;
+    struct rudp_path_config *config;
+    struct rudp_packet_chain *pc;
+    struct rudp_packet_path_token *token;
+    struct rudp_mpath *mpath;
+    rudp_error_t err;
+
+    if ( rudp_list_empty(&client->path_list) || peer->mpath )
+        return 0;
+
+    mpath = mpath_new(peer);
+    if ( mpath == NULL )
+        return ENOMEM;
+
+    mpath->client = 1;
+    mpath->scheduler = client->path_scheduler;
+
+    // Token lets any address join the connection, it must not be guessed
+    err = rudp_crypto_random(mpath->token, RUDP_PATH_TOKEN_SIZE);
+    if ( err ) {
+        peer->mpath = mpath;
+        rudp_mpath_close(peer);
+        return err;
+    }
+
+    rudp_list_for_each(config, &client->path_list, item)
+    {
+        struct rudp_path *path = &mpath->path[mpath->count++];
+
+        err = mpath_client_bind(client, config, path);
+
+        // Path stays unused
+        if ( err )
+            rudp_log_printf(client->rudp, RUDP_LOG_WARN,
+                            "Path %u setup failed: %s\n",
+                            mpath->count - 1, strerror(err));
+    }
+
+    pc = rudp_packet_chain_alloc(client->rudp, sizeof(*token));
+    if ( pc == NULL ) {
+        peer->mpath = mpath;
+        rudp_mpath_close(peer);
+        return ENOMEM;
+    }
+
+    token = &pc->packet->path_token;
+    token->header.command = RUDP_CMD_PATH_TOKEN;
+    memcpy(token->token, mpath->token, sizeof(token->token));
+    token->scheduler = mpath->scheduler;
+    memset(token->reserved, 0, sizeof(token->reserved));
+
+    // Token goes on first path only, before paths are in use
+    rudp_peer_send_reliable(peer, pc);
+
+    peer->mpath = mpath;
+    mpath_probe_schedule(mpath);
+
+    return 0;
+}
+
+void rudp_mpath_client_deinit(struct rudp_client *client)
+{
+    struct rudp_path_config *config, *tmp;
+
+    rudp_list_for_each_safe(config, tmp, &client->path_list, item)
+    {
+        rudp_list_remove(&config->item);
+        rudp_endpoint_deinit(&config->endpoint);
+        rudp_free(client->rudp, config, sizeof(*config));
+    }
+}
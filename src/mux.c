@@ -0,0 +1,190 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/mux.h>
+#include <rudp/client.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_endpoint.h"
+#include "rudp_peer.h"
+#include "rudp_mux.h"
+
+static const struct rudp_endpoint_handler mux_endpoint_handler;
+
+/*
+  Hashes remote port and low bits of remote address, this is enough
+  to spread servers of a farm.
+ */
+static
+struct rudp_list *mux_bucket(struct rudp_client_mux *mux,
+                             const struct sockaddr_storage *addr)
+{
+    uint32_t key;
+
+    if ( addr->ss_family == AF_INET ) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+
+        key = ntohl(in->sin_addr.s_addr) ^ ((uint32_t)in->sin_port << 16);
+    } else {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)addr;
+        uint32_t low;
+
+        memcpy(&low, &in6->sin6_addr.s6_addr[12], sizeof(low));
+        key = ntohl(low) ^ ((uint32_t)in6->sin6_port << 16);
+    }
+
+    return &mux->bucket[(key * 2654435761u) >> 24];
+}
+
+static
+struct rudp_client *mux_lookup(struct rudp_client_mux *mux,
+                               const struct sockaddr_storage *addr)
+{
+    struct rudp_list *bucket = mux_bucket(mux, addr);
+    struct rudp_client *client;
+
+    rudp_list_for_each(client, bucket, mux_item)
+    {
+        if ( ! rudp_peer_address_compare(&client->peer, addr) )
+            return client;
+    }
+
+    return NULL;
+}
+
+rudp_error_t rudp_client_mux_init(struct rudp_client_mux *mux,
+                                  struct rudp *rudp)
+{
+    unsigned int i;
+
+    rudp_endpoint_init(&mux->endpoint, rudp, &mux_endpoint_handler);
+    mux->rudp = rudp;
+    mux->client_count = 0;
+
+    for ( i = 0; i < RUDP_CLIENT_MUX_BUCKETS; ++i )
+        rudp_list_init(&mux->bucket[i]);
+
+    return 0;
+}
+
+void rudp_client_mux_set_ipv4(struct rudp_client_mux *mux,
+                              const struct in_addr *address,
+                              const uint16_t port)
+{
+    rudp_endpoint_set_ipv4(&mux->endpoint, address, port);
+}
+
+rudp_error_t rudp_client_mux_set_addr(struct rudp_client_mux *mux,
+                                      const struct sockaddr *addr,
+                                      socklen_t addrlen)
+{
+    return rudp_endpoint_set_addr(&mux->endpoint, addr, addrlen);
+}
+
+void rudp_client_mux_set_dualstack(struct rudp_client_mux *mux,
+                                   int enable)
+{
+    uint32_t flags = mux->endpoint.flags & ~RUDP_ENDPOINT_DUALSTACK;
+
+    rudp_endpoint_set_flags(&mux->endpoint,
+                            flags | (enable ? RUDP_ENDPOINT_DUALSTACK : 0));
+}
+
+rudp_error_t rudp_client_mux_bind(struct rudp_client_mux *mux)
+{
+    return rudp_endpoint_bind(&mux->endpoint);
+}
+
+rudp_error_t rudp_client_mux_close(struct rudp_client_mux *mux)
+{
+    if ( mux->client_count )
+        return EBUSY;
+
+    rudp_endpoint_close(&mux->endpoint);
+    return 0;
+}
+
+rudp_error_t rudp_client_mux_deinit(struct rudp_client_mux *mux)
+{
+    if ( mux->client_count )
+        return EBUSY;
+
+    rudp_endpoint_deinit(&mux->endpoint);
+    return 0;
+}
+
+rudp_error_t rudp_client_mux_batch_begin(struct rudp_client_mux *mux)
+{
+    return rudp_endpoint_batch_begin(&mux->endpoint);
+}
+
+rudp_error_t rudp_client_mux_batch_flush(struct rudp_client_mux *mux)
+{
+    return rudp_endpoint_batch_flush(&mux->endpoint);
+}
+
+rudp_error_t rudp_mux_client_attach(struct rudp_client_mux *mux,
+                                    struct rudp_client *client,
+                                    const struct sockaddr_storage *addr)
+{
+    if ( mux->endpoint.socket_fd == -1 )
+        return EINVAL;
+
+    if ( mux_lookup(mux, addr) != NULL )
+        return EADDRINUSE;
+
+    rudp_list_append(mux_bucket(mux, addr), &client->mux_item);
+    mux->client_count++;
+
+    return 0;
+}
+
+void rudp_mux_client_detach(struct rudp_client *client)
+{
+    if ( rudp_list_empty(&client->mux_item) )
+        return;
+
+    rudp_list_remove(&client->mux_item);
+    rudp_list_init(&client->mux_item);
+    client->mux->client_count--;
+}
+
+/*
+  - socket watcher
+     - endpoint packet reader
+        - mux packet handler <===
+           - client packet handler
+ */
+static
+void mux_handle_endpoint_packet(struct rudp_endpoint *endpoint,
+                                const struct sockaddr_storage *addr,
+                                struct rudp_packet_chain *pc)
+{
+    struct rudp_client_mux *mux = __container_of(endpoint, mux, endpoint);
+    struct rudp_client *client = mux_lookup(mux, addr);
+
+    if ( client == NULL ) {
+        rudp_log_printf(mux->rudp, RUDP_LOG_DEBUG,
+                        "Mux: packet from unknown server\n");
+        return;
+    }
+
+    rudp_client_incoming(client, endpoint, addr, pc);
+}
+
+static const struct rudp_endpoint_handler mux_endpoint_handler = {
+    .handle_packet = mux_handle_endpoint_packet,
+};
@@ -9,9 +9,13 @@
   See AUTHORS for details
  */
 
+#include <string.h>
+#include <errno.h>
+
 #include <rudp/packet.h>
 #include "rudp_packet.h"
 #include "rudp_list.h"
+#include "rudp_arena.h"
 
 const char *rudp_command_name(enum rudp_command cmd)
 {
@@ -22,6 +26,16 @@ const char *rudp_command_name(enum rudp_command cmd)
     case RUDP_CMD_CONN_RSP: return "RUDP_CMD_CONN_RSP";
     case RUDP_CMD_PING: return "RUDP_CMD_PING";
     case RUDP_CMD_PONG: return "RUDP_CMD_PONG";
+    case RUDP_CMD_MCAST_DATA: return "RUDP_CMD_MCAST_DATA";
+    case RUDP_CMD_MCAST_NACK: return "RUDP_CMD_MCAST_NACK";
+    case RUDP_CMD_SHM_OFFER: return "RUDP_CMD_SHM_OFFER";
+    case RUDP_CMD_SHM_ACCEPT: return "RUDP_CMD_SHM_ACCEPT";
+    case RUDP_CMD_PATH_TOKEN: return "RUDP_CMD_PATH_TOKEN";
+    case RUDP_CMD_PATH_JOIN: return "RUDP_CMD_PATH_JOIN";
+    case RUDP_CMD_PATH_PROBE: return "RUDP_CMD_PATH_PROBE";
+    case RUDP_CMD_PATH_PROBE_ACK: return "RUDP_CMD_PATH_PROBE_ACK";
+    case RUDP_CMD_BUNDLE: return "RUDP_CMD_BUNDLE";
+    case RUDP_CMD_SEALED: return "RUDP_CMD_SEALED";
     case RUDP_CMD_APP: return "RUDP_CMD_APP";
     default:
         if ( (int) cmd < RUDP_CMD_APP )
@@ -33,6 +47,7 @@ const char *rudp_command_name(enum rudp_command cmd)
 
 #define DEFAULT_ALLOC_SIZE (RUDP_RECV_BUFFER_SIZE)
 #define FREE_PACKET_POOL 10
+#define FREE_LARGE_POOL 2
 
 struct rudp_packet_chain *rudp_packet_chain_alloc(
     struct rudp *rudp,
@@ -44,6 +59,13 @@ struct rudp_packet_chain *rudp_packet_chain_alloc(
     if ( alloc < DEFAULT_ALLOC_SIZE )
         alloc = DEFAULT_ALLOC_SIZE;
 
+    // Heap is only used once arena is exhausted
+    if ( alloc == DEFAULT_ALLOC_SIZE && rudp->arena ) {
+        pc = rudp_arena_get(rudp->arena);
+        if ( pc )
+            goto carved;
+    }
+
     if ( alloc == DEFAULT_ALLOC_SIZE ) {
         // We'll pass this is the list is empty as well
         rudp_list_for_each(pc, &rudp->free_packet_list, chain_item) {
@@ -51,12 +73,19 @@ struct rudp_packet_chain *rudp_packet_chain_alloc(
             rudp->free_packets--;
             goto found;
         }
+    } else if ( alloc == RUDP_RECV_LARGE_SIZE ) {
+        rudp_list_for_each(pc, &rudp->free_large_list, chain_item) {
+            rudp_list_remove(&pc->chain_item);
+            rudp->free_large_packets--;
+            goto found;
+        }
     }
 
     pc = rudp_alloc(rudp, sizeof(*pc)+alloc);
     if ( pc == NULL )
         return NULL;
 
+carved:
     rudp->allocated_packets++;
 
     pc->packet = (void*)(pc+1);
@@ -64,16 +93,63 @@ struct rudp_packet_chain *rudp_packet_chain_alloc(
 
 found:
     pc->len = asked;
+    pc->payload = NULL;
+    pc->pinned = 0;
+    pc->orphan = 0;
+    return pc;
+}
+
+/*
+  Chains referencing a shared payload only carry their own headers,
+  they are allocated at their exact size and never pooled.
+ */
+struct rudp_packet_chain *rudp_packet_chain_alloc_payload(
+    struct rudp *rudp,
+    size_t alloc,
+    struct rudp_payload *payload)
+{
+    struct rudp_packet_chain *pc = rudp_alloc(rudp, sizeof(*pc)+alloc);
+
+    if ( pc == NULL )
+        return NULL;
+
+    rudp->allocated_packets++;
+
+    pc->packet = (void*)(pc+1);
+    pc->alloc_size = alloc;
+    pc->len = alloc;
+    pc->payload = rudp_payload_ref(payload);
+    pc->pinned = 0;
+    pc->orphan = 0;
+
     return pc;
 }
 
 void rudp_packet_chain_free(struct rudp *rudp, struct rudp_packet_chain *pc)
 {
-    if ( pc->alloc_size == DEFAULT_ALLOC_SIZE ) {
+    // Kernel may still read it, last completion frees it
+    if ( pc->pinned ) {
+        pc->orphan = 1;
+        return;
+    }
+
+    if ( pc->payload ) {
+        rudp_payload_unref(rudp, pc->payload);
+        pc->payload = NULL;
+    }
+
+    if ( rudp->arena && rudp_arena_owns(rudp->arena, pc) ) {
+        rudp_arena_put(rudp->arena, pc);
+        rudp->allocated_packets--;
+    } else if ( pc->alloc_size == DEFAULT_ALLOC_SIZE ) {
         rudp_list_insert(&rudp->free_packet_list, &pc->chain_item);
         rudp->free_packets++;
+    } else if ( pc->alloc_size == RUDP_RECV_LARGE_SIZE
+                && rudp->free_large_packets < FREE_LARGE_POOL ) {
+        rudp_list_insert(&rudp->free_large_list, &pc->chain_item);
+        rudp->free_large_packets++;
     } else {
-        rudp_free(rudp, pc);
+        rudp_free(rudp, pc, sizeof(*pc) + pc->alloc_size);
         rudp->allocated_packets--;
     }
 
@@ -82,8 +158,183 @@ void rudp_packet_chain_free(struct rudp *rudp, struct rudp_packet_chain *pc)
             rudp_list_remove(&pc->chain_item);
             rudp->free_packets--;
             rudp->allocated_packets--;
-            rudp_free(rudp, pc);
+            rudp_free(rudp, pc, sizeof(*pc) + pc->alloc_size);
             break;
         }
     }
 }
+
+void rudp_packet_chain_unpin(struct rudp *rudp, struct rudp_packet_chain *pc)
+{
+    if ( --pc->pinned == 0 && pc->orphan ) {
+        pc->orphan = 0;
+        rudp_packet_chain_free(rudp, pc);
+    }
+}
+
+struct rudp_payload *rudp_payload_alloc(
+    struct rudp *rudp,
+    const void *data, size_t len)
+{
+    struct rudp_payload *payload = rudp_alloc(rudp, sizeof(*payload)+len);
+
+    if ( payload == NULL )
+        return NULL;
+
+    memcpy(payload+1, data, len);
+    payload->data = payload+1;
+    payload->len = len;
+    payload->refcount = 1;
+    payload->chain = NULL;
+    payload->done = NULL;
+    payload->done_priv = NULL;
+    payload->copied = 1;
+
+    return payload;
+}
+
+struct rudp_payload *rudp_payload_wrap(
+    struct rudp *rudp,
+    const void *data, size_t len,
+    rudp_buffer_done_func_t *done, void *priv)
+{
+    struct rudp_payload *payload = rudp_alloc(rudp, sizeof(*payload));
+
+    if ( payload == NULL )
+        return NULL;
+
+    payload->data = data;
+    payload->len = len;
+    payload->refcount = 1;
+    payload->chain = NULL;
+    payload->done = done;
+    payload->done_priv = priv;
+    payload->copied = 0;
+
+    return payload;
+}
+
+struct rudp_payload *rudp_payload_from_chain(
+    struct rudp *rudp,
+    struct rudp_packet_chain *pc,
+    size_t offset)
+{
+    struct rudp_payload *payload = rudp_alloc(rudp, sizeof(*payload));
+
+    if ( payload == NULL )
+        return NULL;
+
+    payload->data = (const uint8_t *)pc->packet + offset;
+    payload->len = pc->len - offset;
+    payload->refcount = 1;
+    payload->chain = pc;
+    payload->done = NULL;
+    payload->done_priv = NULL;
+    payload->copied = 0;
+
+    return payload;
+}
+
+struct rudp_packet_chain *rudp_packet_bundle_alloc(struct rudp *rudp)
+{
+    struct rudp_packet_chain *bundle =
+        rudp_packet_chain_alloc(rudp, RUDP_BUNDLE_MAX_SIZE);
+
+    if ( bundle == NULL )
+        return NULL;
+
+    // Room for the largest bundle, records are appended later
+    bundle->len = sizeof(struct rudp_packet_bundle);
+    memset(&bundle->packet->header, 0, sizeof(bundle->packet->header));
+    bundle->packet->header.command = RUDP_CMD_BUNDLE;
+
+    return bundle;
+}
+
+rudp_error_t rudp_packet_bundle_add(struct rudp_packet_chain *bundle,
+                                    const struct rudp_packet *packet,
+                                    size_t len)
+{
+    uint8_t *record = (uint8_t *)bundle->packet + bundle->len;
+
+    if ( bundle->len + 2 + len > RUDP_BUNDLE_MAX_SIZE
+         || bundle->len + 2 + len > bundle->alloc_size )
+        return ENOSPC;
+
+    record[0] = len >> 8;
+    record[1] = len;
+    memcpy(record + 2, packet, len);
+    bundle->len += 2 + len;
+
+    return 0;
+}
+
+rudp_error_t rudp_packet_conn_option_add(struct rudp_packet_chain *pc,
+                                         uint8_t type,
+                                         const void *value, size_t len)
+{
+    struct rudp_conn_option *option =
+        (struct rudp_conn_option *)((uint8_t *)pc->packet + pc->len);
+
+    if ( len > 255 || pc->len + sizeof(*option) + len > pc->alloc_size )
+        return ENOSPC;
+
+    option->type = type;
+    option->len = len;
+    memcpy(option->value, value, len);
+    pc->len += sizeof(*option) + len;
+
+    return 0;
+}
+
+const uint8_t *rudp_packet_conn_option_find(
+    const struct rudp_packet_chain *pc,
+    size_t offset, uint8_t type, size_t *len)
+{
+    const uint8_t *option = (const uint8_t *)pc->packet + offset;
+    const uint8_t *end = (const uint8_t *)pc->packet + pc->len;
+
+    if ( pc->len < offset )
+        return NULL;
+
+    while ( end - option >= 2 ) {
+        size_t size = option[1];
+
+        if ( size > (size_t)(end - option - 2) )
+            return NULL;
+
+        if ( option[0] == type ) {
+            *len = size;
+            return option + 2;
+        }
+
+        option += 2 + size;
+    }
+
+    return NULL;
+}
+
+struct rudp_packet_chain *rudp_packet_chain_take(
+    struct rudp *rudp,
+    struct rudp_packet_chain *pc)
+{
+    if ( rudp->rx_chain != pc )
+        return NULL;
+
+    rudp->rx_chain = NULL;
+    return pc;
+}
+
+void rudp_payload_unref(struct rudp *rudp, struct rudp_payload *payload)
+{
+    if ( --payload->refcount )
+        return;
+
+    if ( payload->chain )
+        rudp_packet_chain_free(rudp, payload->chain);
+    if ( payload->done )
+        payload->done(payload->data, payload->len, payload->done_priv);
+
+    rudp_free(rudp, payload, sizeof(*payload)
+              + (payload->copied ? payload->len : 0));
+}
@@ -20,6 +20,18 @@
 #include <rudp/peer.h>
 #include "rudp_list.h"
 #include "rudp_packet.h"
+#include "rudp_endpoint.h"
+#include "rudp_peer.h"
+#include "rudp_egress.h"
+#include "rudp_stats.h"
+#include "rudp_profile.h"
+#include "rudp_shm.h"
+#include "rudp_mpath.h"
+#include "rudp_redundancy.h"
+#include "rudp_codec.h"
+#include "rudp_crypto.h"
+#include "rudp_shard.h"
+#include "rudp_stream.h"
 
 /* Declarations */
 
@@ -27,7 +39,12 @@ static void peer_post_ack(struct rudp_peer *peer);
 static rudp_error_t peer_send_raw(
     struct rudp_peer *peer,
     const void *data, size_t len);
+static rudp_error_t peer_send_chain(
+    struct rudp_peer *peer,
+    struct rudp_packet_chain *pc,
+    int release);
 static int peer_handle_ack(struct rudp_peer *peer, uint16_t ack);
+static void peer_stats_out(struct rudp_peer *peer, size_t bytes);
 
 static void peer_service(struct rudp_peer *peer);
 static void _peer_service(struct ela_event_source *src,
@@ -51,6 +68,10 @@ enum peer_state
 void rudp_peer_reset(struct rudp_peer *peer)
 {
     struct rudp_packet_chain *pc, *tmp;
+
+    // Streams end before their queued fragments are released
+    rudp_stream_close(peer);
+
     rudp_list_for_each_safe(pc, tmp, &peer->sendq, chain_item)
     {
         rudp_list_remove(&pc->chain_item);
@@ -61,6 +82,14 @@ void rudp_peer_reset(struct rudp_peer *peer)
         ela_remove(peer->rudp->el, peer->service_source);
     peer->scheduled = 0;
 
+    if ( peer->egress_active )
+        rudp_egress_forget(peer);
+
+    rudp_shm_close(peer);
+    rudp_mpath_close(peer);
+    rudp_redundancy_close(peer);
+    rudp_crypto_close(peer);
+
     peer->abs_timeout_deadline = rudp_timestamp() + DROP_TIMEOUT;
     peer->in_seq_reliable = (uint16_t)-1;
     peer->in_seq_unreliable = 0;
@@ -89,15 +118,38 @@ void rudp_peer_init(
     peer->handler = handler;
     ela_source_alloc(rudp->el, _peer_service, peer, &peer->service_source);
     peer->scheduled = 0;
+    peer->egress = NULL;
+    peer->egress_active = 0;
+    peer->egress_rexmit = 0;
+    peer->egress_weight = 1;
+    peer->egress_deficit = 0;
+    peer->stats = NULL;
+    peer->shm = NULL;
+    peer->shm_accept = 0;
+    peer->mpath = NULL;
+    peer->mpath_accept = 0;
+    peer->redundancy = NULL;
+    peer->codec = NULL;
+    peer->codec_active = 0;
+    peer->codec_accept = NULL;
+    peer->codec_accept_count = 0;
+    peer->crypto = NULL;
+    peer->crypto_policy = NULL;
+    peer->shard_tag = 0;
+    peer->stream = NULL;
 
     rudp_peer_reset(peer);
 
     peer_service_schedule(peer);
+
+    rudp_stats_peer_register(rudp, peer);
 }
 
 void rudp_peer_deinit(struct rudp_peer *peer)
 {
     rudp_peer_reset(peer);
+    rudp_stats_peer_unregister(peer->rudp, peer);
+    peer->egress = NULL;
     rudp_address_deinit(&peer->address);
     ela_source_free(peer->rudp->el, peer->service_source);
     peer->service_source = NULL;
@@ -138,6 +190,49 @@ void rudp_peer_from_sockaddr(
     rudp_address_set(&peer->address, (struct sockaddr *) addr, sizeof (*addr));
 }
 
+void rudp_peer_state_save(const struct rudp_peer *peer,
+                          struct rudp_peer_state *state)
+{
+    rudp_time_t now = rudp_timestamp();
+
+    memset(state, 0, sizeof(*state));
+    state->timeout_left = peer->abs_timeout_deadline - now;
+    state->last_out_age = now - peer->last_out_time;
+    state->srtt = peer->srtt;
+    state->rttvar = peer->rttvar;
+    state->rto = peer->rto;
+    state->in_seq_reliable = peer->in_seq_reliable;
+    state->in_seq_unreliable = peer->in_seq_unreliable;
+    state->out_seq_reliable = peer->out_seq_reliable;
+    state->out_seq_unreliable = peer->out_seq_unreliable;
+    state->out_seq_acked = peer->out_seq_acked;
+    state->state = peer->state;
+    state->must_ack = peer->must_ack;
+}
+
+void rudp_peer_state_restore(struct rudp_peer *peer,
+                             const struct rudp_peer_state *state)
+{
+    rudp_time_t now = rudp_timestamp();
+
+    peer->abs_timeout_deadline = now + state->timeout_left;
+    peer->last_out_time = now - state->last_out_age;
+    peer->srtt = state->srtt;
+    peer->rttvar = state->rttvar;
+    peer->rto = state->rto;
+    peer->in_seq_reliable = state->in_seq_reliable;
+    peer->in_seq_unreliable = state->in_seq_unreliable;
+    peer->out_seq_reliable = state->out_seq_reliable;
+    peer->out_seq_unreliable = state->out_seq_unreliable;
+    peer->out_seq_acked = state->out_seq_acked;
+    peer->state = state->state;
+    peer->must_ack = state->must_ack;
+
+    if ( peer->scheduled )
+        ela_remove(peer->rudp->el, peer->service_source);
+    peer_service_schedule(peer);
+}
+
 /* Sync handling */
 
 enum packet_state
@@ -266,11 +361,15 @@ static void peer_service_schedule(struct rudp_peer *peer)
     struct rudp_packet_chain *head;
     rudp_list_for_each(head, &peer->sendq, chain_item)
     {
+        // Waiting for egress scheduler, only watch for timeout
+        if ( peer->egress_active )
+            break;
+
         struct rudp_packet_header *header = &head->packet->header;
 
         if ( header->opt & RUDP_OPT_RETRANSMITTED )
             // already transmitted head, wait for rto
-            delta = rudp_timestamp() - peer->last_out_time + peer->rto;
+            delta = peer->last_out_time + peer->rto - rudp_timestamp();
         else
             // transmit asap
             delta = 0;
@@ -284,6 +383,10 @@ static void peer_service_schedule(struct rudp_peer *peer)
     if ( to_delta < delta )
         delta = to_delta;
 
+    // In case a wakeup was lost
+    if ( peer->shm && delta > RUDP_SHM_POLL_INTERVAL )
+        delta = RUDP_SHM_POLL_INTERVAL;
+
     if ( delta <= 0 )
         delta = 1;
 
@@ -301,25 +404,55 @@ static void peer_service_schedule(struct rudp_peer *peer)
 }
 
 static
-void peer_handle_connreq(
+int peer_shm_receive(struct rudp_peer *peer)
+{
+    int count = rudp_shm_receive(peer);
+
+    // Handlers may have dropped the peer
+    if ( count < 0 )
+        return -1;
+
+    if ( count )
+        peer->abs_timeout_deadline = rudp_timestamp() + DROP_TIMEOUT;
+
+    return 0;
+}
+
+static
+rudp_error_t peer_handle_connreq(
     struct rudp_peer *peer,
-    const struct rudp_packet_header *header)
+    const struct rudp_packet_chain *req)
 {
     struct rudp_packet_chain *pc =
         rudp_packet_chain_alloc(peer->rudp,
                                 sizeof(struct rudp_packet_conn_rsp));
     struct rudp_packet_conn_rsp *response = &pc->packet->conn_rsp;
+    rudp_error_t err;
 
     response->header.command = RUDP_CMD_CONN_RSP;
     response->header.opt = 0;
     response->accepted = htonl(1);
 
+    err = rudp_crypto_answer(peer, req, pc);
+    if ( err ) {
+        rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
+                        "%s refusing connreq: %s\n", __FUNCTION__,
+                        strerror(err));
+        rudp_packet_chain_free(peer->rudp, pc);
+        return err;
+    }
+
+    rudp_codec_answer(peer, req, pc);
+    rudp_shard_answer(peer, pc);
+
     rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
                     "%s answering to connreq\n", __FUNCTION__);
 
     rudp_peer_send_unreliable(peer, pc);
 
     peer_service_schedule(peer);
+
+    return 0;
 }
 
 /*
@@ -328,10 +461,22 @@ void peer_handle_connreq(
         - server packet handler
            - peer packet handler <===
  */
-rudp_error_t rudp_peer_incoming_packet(
+static rudp_error_t peer_incoming_packet(
     struct rudp_peer *peer, struct rudp_packet_chain *pc)
 {
     const struct rudp_packet_header *header = &pc->packet->header;
+    // Handler code may relay the packet, header is rewritten then
+    int reliable = header->opt & RUDP_OPT_RELIABLE;
+
+    // Packets from the ring were sent before this one
+    if ( peer->shm && peer_shm_receive(peer) )
+        return 0;
+
+    if ( peer->stats ) {
+        rudp_stats_write_begin(&peer->stats->seq);
+        rudp_stats_count_in(&peer->stats->counters, pc->len);
+        rudp_stats_write_end(&peer->stats->seq);
+    }
 
     rudp_log_printf(peer->rudp, RUDP_LOG_IO,
                     "<<< incoming [%d] %s %s (%d) %04x:%04x\n",
@@ -351,6 +496,9 @@ rudp_error_t rudp_peer_incoming_packet(
                             "    broken ACK flag, ignoring packet\n");
             return EINVAL;
         }
+
+        if ( peer->stream )
+            rudp_stream_acked(peer);
     }
 
     enum packet_state state;
@@ -366,14 +514,23 @@ rudp_error_t rudp_peer_incoming_packet(
         if (peer->state == PEER_NEW
             && header->command == RUDP_CMD_CONN_REQ) {
             // Server side, handling new client
-            peer_handle_connreq(peer, header);
+            rudp_error_t err = peer_handle_connreq(peer, pc);
+            if ( err )
+                return err;
             peer->in_seq_reliable = ntohs(header->reliable);
             peer->state = PEER_RUN;
         } else if (peer->state == PEER_CONNECTING
                    && header->command == RUDP_CMD_CONN_RSP) {
             // Client side, handling new server
+            if ( rudp_crypto_handle_answer(peer, pc) ) {
+                rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
+                                "    response not accepted, ignored\n");
+                return EACCES;
+            }
             peer->in_seq_reliable = ntohs(header->reliable);
             peer_handle_ack(peer, ntohs(header->reliable_ack));
+            rudp_codec_handle_answer(peer, pc);
+            rudp_shard_handle_answer(peer, pc);
             peer->state = PEER_RUN;
         } else {
             rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
@@ -428,19 +585,48 @@ rudp_error_t rudp_peer_incoming_packet(
         case RUDP_CMD_CONN_RSP:
              break;
 
-        default:
+        case RUDP_CMD_SHM_OFFER:
+        case RUDP_CMD_SHM_ACCEPT:
+            if ( peer->state != PEER_RUN ) {
+                rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
+                                "       shm setup while not running\n");
+                break;
+            }
+
+            if ( header->command == RUDP_CMD_SHM_OFFER )
+                rudp_shm_handle_offer(peer, pc);
+            else
+                rudp_shm_handle_accept(peer, pc);
+            break;
+
+        case RUDP_CMD_PATH_TOKEN:
             if ( peer->state != PEER_RUN ) {
                 rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
-                                "       user payload while not running\n");
+                                "       path token while not running\n");
                 break;
             }
 
-            if ( header->command >= RUDP_CMD_APP )
-                peer->handler->handle_packet(peer, pc);
+            rudp_mpath_handle_token(peer, pc);
+            break;
+
+        case RUDP_CMD_MCAST_DATA:
+        case RUDP_CMD_MCAST_NACK:
+            if ( peer->state != PEER_RUN ) {
+                rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
+                                "       extension while not running\n");
+                break;
+            }
+
+            if ( peer->handler->handle_command )
+                peer->handler->handle_command(peer, pc);
+            break;
+
+        default:
+            rudp_peer_handle_data(peer, pc);
         }
     }
 
-    if ( header->opt & RUDP_OPT_RELIABLE ) {
+    if ( reliable ) {
         rudp_log_printf(peer->rudp, RUDP_LOG_DEBUG,
                         "       reliable packet, posting ack\n");
         peer_post_ack(peer);
@@ -451,6 +637,180 @@ rudp_error_t rudp_peer_incoming_packet(
     return 0;
 }
 
+/*
+  Bundled packets are handled in order, as if they were received one
+  by one.  Result is the one of the first packet, a connection request
+  may come first with early data.
+ */
+static rudp_error_t peer_incoming_bundle(
+    struct rudp_peer *peer, const struct rudp_packet_chain *pc)
+{
+    struct rudp *rudp = peer->rudp;
+    const uint8_t *record = pc->packet->bundle.records;
+    const uint8_t *end = (const uint8_t *)pc->packet + pc->len;
+    rudp_error_t err = EINVAL;
+    int first = 1;
+
+    if ( pc->len < sizeof(struct rudp_packet_bundle) )
+        return EINVAL;
+
+    while ( end - record >= 2 ) {
+        size_t size = (record[0] << 8) | record[1];
+        struct rudp_packet_chain *in;
+        uint8_t command;
+
+        record += 2;
+        if ( size < sizeof(struct rudp_packet_header)
+             || size > (size_t)(end - record) )
+            return EINVAL;
+
+        in = rudp_packet_chain_alloc(rudp, size);
+        if ( in == NULL )
+            return ENOMEM;
+
+        memcpy(in->packet, record, size);
+        record += size;
+
+        command = in->packet->header.command;
+        if ( command != RUDP_CMD_BUNDLE ) {
+            struct rudp_packet_chain *outer = rudp->rx_chain;
+
+            rudp_error_t e;
+
+            rudp->rx_chain = in;
+            e = peer_incoming_packet(peer, in);
+            if ( first )
+                err = e;
+            in = rudp->rx_chain;
+            rudp->rx_chain = outer;
+        }
+
+        if ( in )
+            rudp_packet_chain_free(rudp, in);
+
+        first = 0;
+
+        // Peer may be gone
+        if ( command == RUDP_CMD_CLOSE )
+            break;
+    }
+
+    return err;
+}
+
+/*
+  Handler gets the uncompressed packet as the one being received, it
+  may keep it.
+ */
+static
+void peer_handle_compressed(struct rudp_peer *peer,
+                            const struct rudp_packet_chain *pc)
+{
+    struct rudp *rudp = peer->rudp;
+    struct rudp_packet_chain *outer = rudp->rx_chain;
+    struct rudp_packet_chain *in = rudp_codec_decompress(peer, pc);
+
+    if ( in == NULL ) {
+        rudp_log_printf(rudp, RUDP_LOG_WARN,
+                        "       bad compressed payload, dropped\n");
+        return;
+    }
+
+    rudp->rx_chain = in;
+    rudp_peer_handle_data(peer, in);
+    in = rudp->rx_chain;
+    rudp->rx_chain = outer;
+
+    if ( in )
+        rudp_packet_chain_free(rudp, in);
+}
+
+void rudp_peer_handle_data(struct rudp_peer *peer,
+                           struct rudp_packet_chain *pc)
+{
+    struct rudp *rudp = peer->rudp;
+
+    if ( peer->state != PEER_RUN ) {
+        rudp_log_printf(rudp, RUDP_LOG_WARN,
+                        "       user payload while not running\n");
+        return;
+    }
+
+    if ( pc->packet->header.command < RUDP_CMD_APP )
+        return;
+
+    if ( pc->packet->header.opt & RUDP_OPT_COMPRESSED ) {
+        peer_handle_compressed(peer, pc);
+        return;
+    }
+
+    rudp_profile_enter(rudp, RUDP_STAGE_APP);
+    if ( pc->packet->header.opt & RUDP_OPT_STREAM )
+        rudp_stream_receive(peer, pc);
+    else
+        peer->handler->handle_packet(peer, pc);
+    rudp_profile_leave(rudp, RUDP_STAGE_APP);
+}
+
+/*
+  Carried packet is handled as the one being received, handlers may
+  keep it.
+ */
+static rudp_error_t peer_incoming_sealed(
+    struct rudp_peer *peer, const struct rudp_packet_chain *pc)
+{
+    struct rudp *rudp = peer->rudp;
+    struct rudp_packet_chain *outer = rudp->rx_chain;
+    struct rudp_packet_chain *in = rudp_crypto_open(peer, pc);
+    rudp_error_t err;
+
+    if ( in == NULL ) {
+        rudp_log_printf(rudp, RUDP_LOG_WARN,
+                        "    sealed packet not authentic, dropped\n");
+        return EINVAL;
+    }
+
+    rudp->rx_chain = in;
+    switch ( in->packet->header.command ) {
+    case RUDP_CMD_BUNDLE:
+        err = peer_incoming_bundle(peer, in);
+        break;
+    case RUDP_CMD_SEALED:
+        err = EINVAL;
+        break;
+    default:
+        err = peer_incoming_packet(peer, in);
+        break;
+    }
+    in = rudp->rx_chain;
+    rudp->rx_chain = outer;
+
+    if ( in )
+        rudp_packet_chain_free(rudp, in);
+
+    return err;
+}
+
+rudp_error_t rudp_peer_incoming_packet(
+    struct rudp_peer *peer, struct rudp_packet_chain *pc)
+{
+    struct rudp *rudp = peer->rudp;
+    rudp_error_t err;
+
+    rudp_profile_enter(rudp, RUDP_STAGE_PROTOCOL);
+    if ( pc->packet->header.command == RUDP_CMD_SEALED )
+        err = peer_incoming_sealed(peer, pc);
+    else if ( rudp_crypto_expects_sealed(peer, pc) )
+        err = EINVAL;
+    else if ( pc->packet->header.command == RUDP_CMD_BUNDLE )
+        err = peer_incoming_bundle(peer, pc);
+    else
+        err = peer_incoming_packet(peer, pc);
+    rudp_profile_leave(rudp, RUDP_STAGE_PROTOCOL);
+
+    return err;
+}
+
 
 /* Ack handling function */
 
@@ -551,14 +911,43 @@ void peer_post_ack(struct rudp_peer *peer)
 
 /* Sender functions */
 
+/*
+  Data packets go through the shared memory ring when there is one,
+  but only once everything sent on the network before was acked, so
+  that packets are received in order.
+ */
+static
+int peer_shm_send(struct rudp_peer *peer, struct rudp_packet_chain *pc)
+{
+    size_t size = rudp_packet_chain_size(pc);
+
+    if ( pc->packet->header.command < RUDP_CMD_APP
+         || ! rudp_list_empty(&peer->sendq)
+         || rudp_shm_send(peer, pc) )
+        return 0;
+
+    peer->sendto_err = 0;
+    peer_stats_out(peer, size);
+    peer->last_out_time = rudp_timestamp();
+    rudp_packet_chain_free(peer->rudp, pc);
+
+    return 1;
+}
+
 rudp_error_t rudp_peer_send_unreliable(
     struct rudp_peer *peer,
     struct rudp_packet_chain *pc)
 {
+    if ( peer->shm && peer_shm_send(peer, pc) )
+        return 0;
+
     pc->packet->header.opt = 0;
     pc->packet->header.reliable = htons(peer->out_seq_reliable);
     pc->packet->header.unreliable = htons(++(peer->out_seq_unreliable));
 
+    if ( peer->codec_active )
+        rudp_codec_compress(peer, pc);
+
     rudp_log_printf(peer->rudp, RUDP_LOG_IO,
                     ">>> outgoing unreliable %s (%d) %04x:%04x\n",
                     rudp_command_name(pc->packet->header.command),
@@ -571,15 +960,25 @@ rudp_error_t rudp_peer_send_unreliable(
     return peer->sendto_err;
 }
 
-rudp_error_t rudp_peer_send_reliable(
+static
+rudp_error_t peer_send_reliable(
     struct rudp_peer *peer,
-    struct rudp_packet_chain *pc)
+    struct rudp_packet_chain *pc,
+    uint8_t opt)
 {
-    pc->packet->header.opt = RUDP_OPT_RELIABLE;
+    // Shared memory receiver looks at flags too
+    pc->packet->header.opt = opt;
+    if ( peer->shm && peer_shm_send(peer, pc) )
+        return 0;
+
+    pc->packet->header.opt = RUDP_OPT_RELIABLE | opt;
     pc->packet->header.reliable = htons(++(peer->out_seq_reliable));
     pc->packet->header.unreliable = 0;
     peer->out_seq_unreliable = 0;
 
+    if ( peer->codec_active )
+        rudp_codec_compress(peer, pc);
+
     rudp_log_printf(peer->rudp, RUDP_LOG_IO,
                     ">>> outgoing reliable %s (%d) %04x:%04x\n",
                     rudp_command_name(pc->packet->header.command),
@@ -592,13 +991,106 @@ rudp_error_t rudp_peer_send_reliable(
     return peer->sendto_err;
 }
 
+rudp_error_t rudp_peer_send_reliable(
+    struct rudp_peer *peer,
+    struct rudp_packet_chain *pc)
+{
+    return peer_send_reliable(peer, pc, 0);
+}
+
+rudp_error_t rudp_peer_send_stream(
+    struct rudp_peer *peer,
+    struct rudp_packet_chain *pc)
+{
+    return peer_send_reliable(peer, pc, RUDP_OPT_STREAM);
+}
+
+static
+void peer_stats_out(struct rudp_peer *peer, size_t bytes)
+{
+    if ( peer->stats == NULL )
+        return;
+
+    rudp_stats_write_begin(&peer->stats->seq);
+    rudp_stats_count_out(&peer->stats->counters, bytes);
+    if ( peer->sendto_err )
+        peer->stats->counters.send_errors++;
+    rudp_stats_write_end(&peer->stats->seq);
+}
+
 static
 rudp_error_t peer_send_raw(
     struct rudp_peer *peer,
     const void *data, size_t len)
 {
-    peer->sendto_err = rudp_endpoint_send(
-        peer->endpoint, &peer->address, data, len);
+    struct rudp_packet_chain raw = {
+        .packet = (struct rudp_packet *)data,
+        .len = len,
+    };
+
+    if ( peer->crypto && rudp_crypto_seals(peer, &raw) ) {
+        struct rudp_packet_chain *sealed = rudp_crypto_seal(peer, &raw);
+
+        if ( sealed == NULL )
+            return peer->sendto_err = ENOMEM;
+
+        return peer_send_chain(peer, sealed, 1);
+    }
+
+    if ( peer->mpath )
+        peer->sendto_err = rudp_mpath_send_raw(peer, data, len);
+    else
+        peer->sendto_err = rudp_endpoint_send(
+            peer->endpoint, &peer->address, data, len);
+
+    peer_stats_out(peer, len);
+
+    peer->last_out_time = rudp_timestamp();
+    return peer->sendto_err;
+}
+
+static
+rudp_error_t peer_send_chain(
+    struct rudp_peer *peer,
+    struct rudp_packet_chain *pc,
+    int release)
+{
+    struct rudp_packet_chain *bundle = NULL;
+
+    if ( peer->redundancy )
+        bundle = rudp_redundancy_bundle(peer, pc);
+
+    if ( bundle ) {
+        if ( release )
+            rudp_packet_chain_free(peer->rudp, pc);
+        pc = bundle;
+        release = 1;
+    }
+
+    // Sealing copies the tag to the sealed header
+    if ( peer->shard_tag )
+        rudp_shard_stamp(peer, &pc->packet->header.opt);
+
+    if ( peer->crypto && rudp_crypto_seals(peer, pc) ) {
+        struct rudp_packet_chain *sealed = rudp_crypto_seal(peer, pc);
+
+        if ( release )
+            rudp_packet_chain_free(peer->rudp, pc);
+        if ( sealed == NULL )
+            return peer->sendto_err = ENOMEM;
+        pc = sealed;
+        release = 1;
+    }
+
+    size_t size = rudp_packet_chain_size(pc);
+
+    if ( peer->mpath )
+        peer->sendto_err = rudp_mpath_send_chain(peer, pc, release);
+    else
+        peer->sendto_err = rudp_endpoint_send_chain(
+            peer->endpoint, &peer->address, pc, release);
+
+    peer_stats_out(peer, size);
 
     peer->last_out_time = rudp_timestamp();
     return peer->sendto_err;
@@ -610,20 +1102,28 @@ rudp_error_t rudp_peer_send_connect(struct rudp_peer *peer)
         peer->rudp, sizeof(struct rudp_packet_conn_req));
 
     pc->packet->header.command = RUDP_CMD_CONN_REQ;
+    pc->packet->conn_req.data = 0;
+
+    // Without a key, answer is refused and connection times out
+    rudp_crypto_offer(peer, pc);
+    rudp_codec_offer(peer, pc);
 
     peer->state = PEER_CONNECTING;
 
     return rudp_peer_send_reliable(peer, pc);
 }
 
-rudp_error_t rudp_peer_send_close_noqueue(struct rudp_peer *peer)
+static
+rudp_error_t peer_send_noqueue(struct rudp_peer *peer, uint8_t command)
 {
     struct rudp_packet_header header = {
-        .command = RUDP_CMD_CLOSE,
+        .command = command,
         .opt = 0,
     };
 
     header.opt = 0;
+    if ( peer->shard_tag )
+        rudp_shard_stamp(peer, &header.opt);
     header.reliable = htons(peer->out_seq_reliable);
     header.unreliable = htons(++(peer->out_seq_unreliable));
 
@@ -637,47 +1137,274 @@ rudp_error_t rudp_peer_send_close_noqueue(struct rudp_peer *peer)
     return peer_send_raw(peer, &header, sizeof(header));
 }
 
+rudp_error_t rudp_peer_send_direct(struct rudp_peer *peer,
+                                   struct rudp_packet_chain *pc)
+{
+    rudp_log_printf(peer->rudp, RUDP_LOG_IO,
+                    ">>> outgoing direct %s (%d) %04x:%04x\n",
+                    rudp_command_name(pc->packet->header.command),
+                    pc->packet->header.command,
+                    ntohs(pc->packet->header.reliable),
+                    ntohs(pc->packet->header.unreliable));
+
+    return peer_send_chain(peer, pc, 1);
+}
+
+rudp_error_t rudp_peer_send_close_noqueue(struct rudp_peer *peer)
+{
+    return peer_send_noqueue(peer, RUDP_CMD_CLOSE);
+}
+
+rudp_error_t rudp_peer_send_noop_noqueue(struct rudp_peer *peer)
+{
+    return peer_send_noqueue(peer, RUDP_CMD_NOOP);
+}
+
 /* Worker functions */
 
+/*
+  Sends one packet of the queue.  Returns whether queue walk must
+  stop, i.e. when retransmitting the head.
+ */
+static int peer_send_one(struct rudp_peer *peer,
+                         struct rudp_packet_chain *pc)
+{
+    struct rudp_packet_header *header = &pc->packet->header;
+
+    if ( peer->must_ack ) {
+        header->opt |= RUDP_OPT_ACK;
+        header->reliable_ack = htons(peer->in_seq_reliable);
+//            peer->must_ack = 0;
+    }
+
+    rudp_log_printf(peer->rudp, RUDP_LOG_IO,
+                    ">>>>>> %ssend %sreliable %s %04x:%04x %s %04x\n",
+                    header->opt & RUDP_OPT_RETRANSMITTED ? "RE" : "",
+                    header->opt & RUDP_OPT_RELIABLE ? "" : "un",
+                    rudp_command_name(pc->packet->header.command),
+                    ntohs(pc->packet->header.reliable),
+                    ntohs(pc->packet->header.unreliable),
+                    header->opt & RUDP_OPT_ACK ? "ack" : "noack",
+                    ntohs(pc->packet->header.reliable_ack));
+
+    if ( (header->opt & RUDP_OPT_RELIABLE)
+         && (header->opt & RUDP_OPT_RETRANSMITTED) ) {
+        peer_send_chain(peer, pc, 0);
+        peer_rto_backoff(peer);
+
+        if ( peer->stats )
+            rudp_stats_peer_retransmit(peer);
+        return 1;
+    }
+
+    if ( header->opt & RUDP_OPT_RELIABLE ) {
+        peer_send_chain(peer, pc, 0);
+        header->opt |= RUDP_OPT_RETRANSMITTED;
+//        return 1;
+    } else {
+        rudp_list_remove(&pc->chain_item);
+        peer_send_chain(peer, pc, 1);
+    }
+
+    return 0;
+}
+
+/*
+  While connecting, data packets queued behind the connection request
+  ride along with it in a bundle, each time it is sent.  Server gets
+  them without waiting for a round trip.  Returns whether queue was
+  handled.
+ */
+static int peer_send_connect_bundle(struct rudp_peer *peer)
+{
+    struct rudp_packet_chain *head, *pc, *tmp, *bundle = NULL;
+    struct rudp_packet_header *header;
+    int retransmit;
+
+    if ( rudp_list_empty(&peer->sendq) )
+        return 0;
+
+    head = __container_of(peer->sendq.next, head, chain_item);
+    header = &head->packet->header;
+    if ( header->command != RUDP_CMD_CONN_REQ )
+        return 0;
+
+    // Data must wait for session keys
+    if ( peer->crypto )
+        return 0;
+
+    rudp_list_for_each_safe(pc, tmp, &peer->sendq, chain_item)
+    {
+        struct rudp_packet_header *h = &pc->packet->header;
+
+        if ( pc == head )
+            continue;
+
+        if ( h->command < RUDP_CMD_APP || pc->payload )
+            break;
+
+        if ( bundle == NULL ) {
+            bundle = rudp_packet_bundle_alloc(peer->rudp);
+            if ( bundle == NULL )
+                return 0;
+            rudp_packet_bundle_add(bundle, head->packet, head->len);
+        }
+
+        if ( rudp_packet_bundle_add(bundle, pc->packet, pc->len) )
+            break;
+
+        if ( h->opt & RUDP_OPT_RELIABLE ) {
+            h->opt |= RUDP_OPT_RETRANSMITTED;
+        } else {
+            rudp_list_remove(&pc->chain_item);
+            rudp_packet_chain_free(peer->rudp, pc);
+        }
+    }
+
+    if ( bundle == NULL )
+        return 0;
+
+    rudp_log_printf(peer->rudp, RUDP_LOG_IO,
+                    ">>>>>> send connection request with early data\n");
+
+    retransmit = header->opt & RUDP_OPT_RETRANSMITTED;
+    header->opt |= RUDP_OPT_RETRANSMITTED;
+
+    peer_send_chain(peer, bundle, 1);
+
+    if ( retransmit ) {
+        peer_rto_backoff(peer);
+        if ( peer->stats )
+            rudp_stats_peer_retransmit(peer);
+    }
+
+    return 1;
+}
+
 static void peer_send_queue(struct rudp_peer *peer)
 {
     struct rudp_packet_chain *pc, *tmp;
+
+    if ( peer->state == PEER_CONNECTING && peer_send_connect_bundle(peer) )
+        return;
+
+    rudp_profile_enter(peer->rudp, RUDP_STAGE_SEND_QUEUE);
+    rudp_list_for_each_safe(pc, tmp, &peer->sendq, chain_item)
+    {
+        if ( peer_send_one(peer, pc) )
+            break;
+
+        // Only the request goes until session keys are known
+        if ( peer->state == PEER_CONNECTING && peer->crypto )
+            break;
+    }
+    rudp_profile_leave(peer->rudp, RUDP_STAGE_SEND_QUEUE);
+}
+
+size_t rudp_peer_egress_send(struct rudp_peer *peer,
+                             size_t budget, int *more)
+{
+    struct rudp_packet_chain *pc, *tmp;
+    size_t sent = 0;
+
+    *more = 0;
+
+    rudp_profile_enter(peer->rudp, RUDP_STAGE_SEND_QUEUE);
+
     rudp_list_for_each_safe(pc, tmp, &peer->sendq, chain_item)
     {
         struct rudp_packet_header *header = &pc->packet->header;
+        int in_flight = (header->opt & RUDP_OPT_RELIABLE)
+            && (header->opt & RUDP_OPT_RETRANSMITTED);
+        size_t size = rudp_packet_chain_size(pc);
 
-        if ( peer->must_ack ) {
-            header->opt |= RUDP_OPT_ACK;
-            header->reliable_ack = htons(peer->in_seq_reliable);
-//            peer->must_ack = 0;
+        // Woken up for a retransmit, only head may go
+        if ( peer->egress_rexmit ) {
+            if ( !in_flight )
+                break;
+
+            if ( size > budget ) {
+                *more = 1;
+                break;
+            }
+
+            peer->egress_rexmit = 0;
+            peer_send_one(peer, pc);
+            sent = size;
+            break;
         }
 
-        rudp_log_printf(peer->rudp, RUDP_LOG_IO,
-                        ">>>>>> %ssend %sreliable %s %04x:%04x %s %04x\n",
-                        header->opt & RUDP_OPT_RETRANSMITTED ? "RE" : "",
-                        header->opt & RUDP_OPT_RELIABLE ? "" : "un",
-                        rudp_command_name(pc->packet->header.command),
-                        ntohs(pc->packet->header.reliable),
-                        ntohs(pc->packet->header.unreliable),
-                        header->opt & RUDP_OPT_ACK ? "ack" : "noack",
-                        ntohs(pc->packet->header.reliable_ack));
-
-        peer_send_raw(peer, header, pc->len);
-
-        if ( (header->opt & RUDP_OPT_RELIABLE)
-             && (header->opt & RUDP_OPT_RETRANSMITTED) ) {
-            peer_rto_backoff(peer);
+        // Already sent in a previous round
+        if ( in_flight )
+            continue;
+
+        if ( size > budget - sent ) {
+            *more = 1;
             break;
         }
 
-        if ( header->opt & RUDP_OPT_RELIABLE ) {
-            header->opt |= RUDP_OPT_RETRANSMITTED;
-//            break;
-        } else {
-            rudp_list_remove(&pc->chain_item);
-            rudp_packet_chain_free(peer->rudp, pc);
+        peer_send_one(peer, pc);
+        sent += size;
+    }
+
+    peer->egress_rexmit = 0;
+
+    rudp_profile_leave(peer->rudp, RUDP_STAGE_SEND_QUEUE);
+
+    return sent;
+}
+
+void rudp_peer_egress_done(struct rudp_peer *peer)
+{
+    peer->egress_rexmit = 0;
+    peer_service_schedule(peer);
+}
+
+void rudp_peer_flush(struct rudp_peer *peer)
+{
+    struct rudp_packet_chain *head;
+    rudp_list_for_each(head, &peer->sendq, chain_item)
+    {
+        struct rudp_packet_header *header = &head->packet->header;
+
+        // Head is in flight, let retransmit timer handle it
+        if ( header->opt & RUDP_OPT_RETRANSMITTED )
+            return;
+
+        break;
+    }
+
+    if ( rudp_list_empty(&peer->sendq) )
+        return;
+
+    if ( peer->egress ) {
+        rudp_egress_wake(peer->egress, peer);
+        return;
+    }
+
+    peer_send_queue(peer);
+    peer_service_schedule(peer);
+}
+
+void rudp_peer_retransmit(struct rudp_peer *peer)
+{
+    if ( rudp_list_empty(&peer->sendq) || peer->state == PEER_DEAD )
+        return;
+
+    if ( peer->egress ) {
+        struct rudp_packet_chain *head;
+        rudp_list_for_each(head, &peer->sendq, chain_item)
+        {
+            if ( head->packet->header.opt & RUDP_OPT_RETRANSMITTED )
+                peer->egress_rexmit = 1;
+            break;
         }
+        rudp_egress_wake(peer->egress, peer);
+        return;
     }
+
+    peer_send_queue(peer);
+    peer_service_schedule(peer);
 }
 
 
@@ -696,6 +1423,9 @@ static void peer_service(struct rudp_peer *peer)
 {
     peer->scheduled = 0;
 
+    if ( peer->shm && peer_shm_receive(peer) )
+        return;
+
     if ( peer->abs_timeout_deadline < rudp_timestamp() ) {
         peer->handler->dropped(peer);
         return;
@@ -711,7 +1441,18 @@ static void peer_service(struct rudp_peer *peer)
             peer_ping(peer);
     }
 
-    peer_send_queue(peer);
+    if ( peer->egress ) {
+        struct rudp_packet_chain *head;
+        rudp_list_for_each(head, &peer->sendq, chain_item)
+        {
+            if ( head->packet->header.opt & RUDP_OPT_RETRANSMITTED )
+                peer->egress_rexmit = 1;
+            rudp_egress_wake(peer->egress, peer);
+            break;
+        }
+    } else {
+        peer_send_queue(peer);
+    }
 
     peer_service_schedule(peer);
 }
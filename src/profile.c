@@ -0,0 +1,112 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include <rudp/profile.h>
+#include <rudp/rudp.h>
+#include "rudp_rudp.h"
+#include "rudp_profile.h"
+
+static const char *const stage_names[RUDP_STAGE_COUNT] = {
+    [RUDP_STAGE_RECV] = "endpoint recv",
+    [RUDP_STAGE_LOOKUP] = "peer lookup",
+    [RUDP_STAGE_PROTOCOL] = "peer protocol",
+    [RUDP_STAGE_APP] = "handle_packet",
+    [RUDP_STAGE_SEND_QUEUE] = "peer send queue",
+    [RUDP_STAGE_SEND] = "endpoint send",
+};
+
+static
+uint64_t profile_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static
+void profile_clear(struct rudp_profile *profile)
+{
+    memset(profile->stage, 0, sizeof(profile->stage));
+    profile->start_cycles = rudp_profile_clock();
+    profile->start_ns = profile_ns();
+}
+
+rudp_error_t rudp_profile_enable(struct rudp *rudp)
+{
+    struct rudp_profile *profile;
+
+    if ( rudp->profile )
+        return EBUSY;
+
+    profile = rudp_alloc(rudp, sizeof(*profile));
+    if ( profile == NULL )
+        return ENOMEM;
+
+    profile->depth = 0;
+    profile_clear(profile);
+
+    rudp->profile = profile;
+
+    return 0;
+}
+
+void rudp_profile_disable(struct rudp *rudp)
+{
+    if ( rudp->profile == NULL )
+        return;
+
+    rudp_free(rudp, rudp->profile, sizeof(*rudp->profile));
+    rudp->profile = NULL;
+}
+
+void rudp_profile_reset(struct rudp *rudp)
+{
+    if ( rudp->profile == NULL )
+        return;
+
+    /* Stages in progress stay on the stack, they will account from
+       now on. */
+    profile_clear(rudp->profile);
+}
+
+rudp_error_t rudp_profile_report(
+    struct rudp *rudp,
+    struct rudp_profile_report *report)
+{
+    const struct rudp_profile *profile = rudp->profile;
+    uint64_t elapsed_ns;
+
+    if ( profile == NULL )
+        return EINVAL;
+
+    memcpy(report->stage, profile->stage, sizeof(report->stage));
+    report->elapsed_cycles = rudp_profile_clock() - profile->start_cycles;
+
+    elapsed_ns = profile_ns() - profile->start_ns;
+    report->cycles_per_usec = elapsed_ns
+        ? report->elapsed_cycles * 1000 / elapsed_ns
+        : 0;
+
+    return 0;
+}
+
+const char *rudp_profile_stage_name(enum rudp_profile_stage stage)
+{
+    if ( (unsigned int)stage >= RUDP_STAGE_COUNT )
+        return "unknown";
+
+    return stage_names[stage];
+}
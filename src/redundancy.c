@@ -0,0 +1,410 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/redundancy.h>
+#include <rudp/client.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_peer.h"
+#include "rudp_redundancy.h"
+
+/*
+  Copy of a critical packet, along with its pending redundant
+  transmissions.
+ */
+struct rudp_redundant_packet
+{
+    struct rudp_list item;
+    struct rudp_packet_chain *pc;
+    rudp_time_t next;
+    rudp_time_t spacing;
+    uint8_t copies;
+    uint8_t bundles;
+};
+
+struct rudp_redundancy_queue
+{
+    struct rudp_peer *peer;
+    struct ela_event_source *copy_source;
+    struct rudp_list packets;
+    uint8_t scheduled:1;
+};
+
+static void _redundancy_copy(struct ela_event_source *src,
+                             int fd, uint32_t mask, void *data);
+
+static
+struct rudp_redundancy_queue *redundancy_queue_get(struct rudp_peer *peer)
+{
+    struct rudp *rudp = peer->rudp;
+    struct rudp_redundancy_queue *queue = peer->redundancy;
+
+    if ( queue != NULL )
+        return queue;
+
+    queue = rudp_alloc(rudp, sizeof(*queue));
+    if ( queue == NULL )
+        return NULL;
+
+    if ( ela_source_alloc(rudp->el, _redundancy_copy, queue,
+                          &queue->copy_source) ) {
+        rudp_free(rudp, queue, sizeof(*queue));
+        return NULL;
+    }
+
+    queue->peer = peer;
+    queue->scheduled = 0;
+    rudp_list_init(&queue->packets);
+
+    peer->redundancy = queue;
+
+    return queue;
+}
+
+/*
+  Whether there is no point in sending packet again.  Acked reliable
+  packets are known to be received.
+ */
+static
+int redundant_done(const struct rudp_peer *peer,
+                   const struct rudp_redundant_packet *rp)
+{
+    const struct rudp_packet_header *header = &rp->pc->packet->header;
+
+    if ( rp->copies == 0 && rp->bundles == 0 )
+        return 1;
+
+    if ( !(header->opt & RUDP_OPT_RELIABLE) )
+        return 0;
+
+    return (int16_t)(ntohs(header->reliable) - peer->out_seq_acked) <= 0;
+}
+
+static
+void redundant_forget(struct rudp *rudp, struct rudp_redundant_packet *rp)
+{
+    rudp_list_remove(&rp->item);
+    rudp_packet_chain_free(rudp, rp->pc);
+    rudp_free(rudp, rp, sizeof(*rp));
+}
+
+/*
+  Packets are not freed while being walked for copies or bundles,
+  only here.
+ */
+static
+void redundancy_sweep(struct rudp_redundancy_queue *queue)
+{
+    struct rudp_peer *peer = queue->peer;
+    struct rudp_redundant_packet *rp, *tmp;
+
+    rudp_list_for_each_safe(rp, tmp, &queue->packets, item)
+    {
+        if ( redundant_done(peer, rp) )
+            redundant_forget(peer->rudp, rp);
+    }
+}
+
+static
+void redundant_header_update(const struct rudp_peer *peer,
+                             struct rudp_packet_header *header)
+{
+    if ( header->opt & RUDP_OPT_RELIABLE )
+        header->opt |= RUDP_OPT_RETRANSMITTED;
+
+    if ( peer->must_ack ) {
+        header->opt |= RUDP_OPT_ACK;
+        header->reliable_ack = htons(peer->in_seq_reliable);
+    }
+}
+
+static
+void redundancy_copy_schedule(struct rudp_redundancy_queue *queue)
+{
+    struct rudp *rudp = queue->peer->rudp;
+    struct rudp_redundant_packet *rp;
+    rudp_time_t next = 0;
+    int pending = 0;
+    struct timeval tv;
+
+    rudp_list_for_each(rp, &queue->packets, item)
+    {
+        if ( rp->copies == 0 )
+            continue;
+
+        if ( !pending || rp->next < next )
+            next = rp->next;
+        pending = 1;
+    }
+
+    if ( queue->scheduled )
+        ela_remove(rudp->el, queue->copy_source);
+    queue->scheduled = 0;
+
+    if ( !pending )
+        return;
+
+    next -= rudp_timestamp();
+    if ( next < 0 )
+        next = 0;
+
+    rudp_timestamp_to_timeval(&tv, next);
+    ela_set_timeout(rudp->el, queue->copy_source, &tv, ELA_EVENT_ONCE);
+    ela_add(rudp->el, queue->copy_source);
+    queue->scheduled = 1;
+}
+
+static
+void _redundancy_copy(struct ela_event_source *src,
+                      int fd, uint32_t mask, void *data)
+{
+    struct rudp_redundancy_queue *queue = data;
+    struct rudp_peer *peer = queue->peer;
+    struct rudp_redundant_packet *rp;
+    rudp_time_t now = rudp_timestamp();
+
+    queue->scheduled = 0;
+
+    rudp_list_for_each(rp, &queue->packets, item)
+    {
+        struct rudp_packet_chain *pc;
+
+        if ( rp->copies == 0 || rp->next > now
+             || redundant_done(peer, rp) )
+            continue;
+
+        pc = rudp_packet_chain_alloc(peer->rudp, rp->pc->len);
+        if ( pc == NULL )
+            break;
+
+        redundant_header_update(peer, &rp->pc->packet->header);
+        memcpy(pc->packet, rp->pc->packet, rp->pc->len);
+
+        rp->copies--;
+        rp->next = now + rp->spacing;
+
+        rudp_peer_send_direct(peer, pc);
+    }
+
+    redundancy_sweep(queue);
+    redundancy_copy_schedule(queue);
+}
+
+rudp_error_t rudp_redundancy_send(struct rudp_peer *peer,
+                                  struct rudp_packet_chain *pc,
+                                  int reliable,
+                                  const struct rudp_redundancy *redundancy)
+{
+    struct rudp *rudp = peer->rudp;
+    struct rudp_redundancy_queue *queue;
+    struct rudp_redundant_packet *rp = NULL;
+    unsigned int copies = 0, bundles = 0;
+    rudp_error_t err;
+
+    if ( redundancy != NULL ) {
+        if ( redundancy->copies > RUDP_REDUNDANCY_MAX_COPIES
+             || redundancy->spacing < 0 ) {
+            rudp_packet_chain_free(rudp, pc);
+            return EINVAL;
+        }
+
+        if ( redundancy->mode & RUDP_REDUNDANCY_COPIES )
+            copies = redundancy->copies;
+        if ( redundancy->mode & RUDP_REDUNDANCY_BUNDLE )
+            bundles = redundancy->copies;
+    }
+
+    // Shared memory ring is lossless
+    if ( (copies || bundles) && peer->shm == NULL ) {
+        queue = redundancy_queue_get(peer);
+        if ( queue )
+            rp = rudp_alloc(rudp, sizeof(*rp));
+        if ( rp )
+            rp->pc = rudp_packet_chain_alloc(rudp, pc->len);
+        if ( rp && rp->pc == NULL ) {
+            rudp_free(rudp, rp, sizeof(*rp));
+            rp = NULL;
+        }
+        if ( rp == NULL ) {
+            rudp_packet_chain_free(rudp, pc);
+            return ENOMEM;
+        }
+    }
+
+    if ( reliable )
+        err = rudp_peer_send_reliable(peer, pc);
+    else
+        err = rudp_peer_send_unreliable(peer, pc);
+
+    if ( rp == NULL )
+        return err;
+
+    // Sequence numbers were given while queueing, codec may have
+    // shrunk the packet as well
+    memcpy(rp->pc->packet, pc->packet, pc->len);
+    rp->pc->len = pc->len;
+    rp->copies = copies;
+    rp->bundles = bundles;
+    rp->spacing = redundancy->spacing;
+    rp->next = rudp_timestamp() + redundancy->spacing;
+
+    queue = peer->redundancy;
+    rudp_list_append(&queue->packets, &rp->item);
+    redundancy_sweep(queue);
+    redundancy_copy_schedule(queue);
+
+    return err;
+}
+
+/*
+  Tells whether rp is a copy of pc.
+ */
+static
+int redundant_same(const struct rudp_redundant_packet *rp,
+                   const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_header *a = &rp->pc->packet->header;
+    const struct rudp_packet_header *b = &pc->packet->header;
+
+    return a->command == b->command
+        && (a->opt & RUDP_OPT_RELIABLE) == (b->opt & RUDP_OPT_RELIABLE)
+        && a->reliable == b->reliable
+        && a->unreliable == b->unreliable;
+}
+
+struct rudp_packet_chain *rudp_redundancy_bundle(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc)
+{
+    struct rudp_redundancy_queue *queue = peer->redundancy;
+    struct rudp_redundant_packet *rp;
+    struct rudp_packet_chain *bundle = NULL;
+    // Room is kept for the packet being sent
+    size_t size = sizeof(struct rudp_packet_bundle) + 2 + pc->len;
+
+    // Shared payloads are sent as is, bundles are not nested
+    if ( pc->payload || pc->packet->header.command == RUDP_CMD_BUNDLE )
+        return NULL;
+
+    rudp_list_for_each(rp, &queue->packets, item)
+    {
+        if ( rp->bundles == 0 || redundant_done(peer, rp)
+             || redundant_same(rp, pc)
+             || size + 2 + rp->pc->len > RUDP_BUNDLE_MAX_SIZE )
+            continue;
+
+        if ( bundle == NULL ) {
+            bundle = rudp_packet_bundle_alloc(peer->rudp);
+            if ( bundle == NULL )
+                return NULL;
+        }
+
+        redundant_header_update(peer, &rp->pc->packet->header);
+        rudp_packet_bundle_add(bundle, rp->pc->packet, rp->pc->len);
+        size += 2 + rp->pc->len;
+        rp->bundles--;
+    }
+
+    if ( bundle == NULL )
+        return NULL;
+
+    // Packet being sent goes last, it is the most recent one
+    rudp_packet_bundle_add(bundle, pc->packet, pc->len);
+
+    return bundle;
+}
+
+void rudp_redundancy_close(struct rudp_peer *peer)
+{
+    struct rudp_redundancy_queue *queue = peer->redundancy;
+    struct rudp *rudp = peer->rudp;
+    struct rudp_redundant_packet *rp, *tmp;
+
+    if ( queue == NULL )
+        return;
+
+    peer->redundancy = NULL;
+
+    rudp_list_for_each_safe(rp, tmp, &queue->packets, item)
+        redundant_forget(rudp, rp);
+
+    if ( queue->scheduled )
+        ela_remove(rudp->el, queue->copy_source);
+    ela_source_free(rudp->el, queue->copy_source);
+
+    rudp_free(rudp, queue, sizeof(*queue));
+}
+
+/* User API */
+
+static
+struct rudp_packet_chain *redundant_packet_new(
+    struct rudp *rudp, int command,
+    const void *data, const size_t size)
+{
+    struct rudp_packet_chain *pc = rudp_packet_chain_alloc(
+        rudp, sizeof(struct rudp_packet_header) + size);
+
+    if ( pc == NULL )
+        return NULL;
+
+    memcpy(&pc->packet->data.data[0], data, size);
+    pc->packet->header.command = RUDP_CMD_APP + command;
+
+    return pc;
+}
+
+rudp_error_t rudp_client_send_redundant(
+    struct rudp_client *client,
+    int reliable, int command,
+    const void *data, const size_t size,
+    const struct rudp_redundancy *redundancy)
+{
+    struct rudp_packet_chain *pc;
+
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    if ( !client->connected )
+        return EINVAL;
+
+    pc = redundant_packet_new(client->rudp, command, data, size);
+    if ( pc == NULL )
+        return ENOMEM;
+
+    return rudp_redundancy_send(&client->peer, pc, reliable, redundancy);
+}
+
+rudp_error_t rudp_server_send_redundant(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    int reliable, int command,
+    const void *data, const size_t size,
+    const struct rudp_redundancy *redundancy)
+{
+    struct rudp_packet_chain *pc;
+
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    pc = redundant_packet_new(server->rudp, command, data, size);
+    if ( pc == NULL )
+        return ENOMEM;
+
+    return rudp_redundancy_send(peer, pc, reliable, redundancy);
+}
@@ -0,0 +1,124 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/relay.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_peer.h"
+#include "rudp_server.h"
+
+/*
+  Gets a chain of our own for the packet being handled, without
+  copying if the receive buffer can be kept.
+ */
+static
+struct rudp_packet_chain *relay_chain_get(struct rudp *rudp,
+                                          struct rudp_packet_chain *in)
+{
+    struct rudp_packet_chain *pc = rudp_packet_chain_take(rudp, in);
+
+    if ( pc != NULL )
+        return pc;
+
+    pc = rudp_packet_chain_alloc(rudp, in->len);
+    if ( pc == NULL )
+        return NULL;
+
+    memcpy(pc->packet, in->packet, in->len);
+
+    return pc;
+}
+
+static
+rudp_error_t relay_one(struct rudp_peer *peer,
+                       struct rudp_packet_chain *pc,
+                       int reliable)
+{
+    rudp_error_t err;
+
+    if ( reliable )
+        err = rudp_peer_send_reliable(peer, pc);
+    else
+        err = rudp_peer_send_unreliable(peer, pc);
+
+    rudp_peer_flush(peer);
+
+    return err;
+}
+
+rudp_error_t rudp_server_relay_many(
+    struct rudp_server *server,
+    struct rudp_peer *const *peers,
+    size_t count,
+    int reliable)
+{
+    struct rudp_packet_chain *in = server->relay_chain;
+    struct rudp *rudp = server->rudp;
+    struct rudp_packet_chain *pc;
+    struct rudp_payload *payload;
+    rudp_error_t err = 0;
+    size_t i;
+    int command;
+
+    if ( in == NULL )
+        return EINVAL;
+
+    if ( count == 0 )
+        return 0;
+
+    command = in->packet->header.command - RUDP_CMD_APP;
+
+    pc = relay_chain_get(rudp, in);
+    if ( pc == NULL )
+        return ENOMEM;
+
+    server->relay_chain = NULL;
+
+    if ( count == 1 )
+        return relay_one(peers[0], pc, reliable);
+
+    // Destinations share the buffer, each one gets its own header
+    payload = rudp_payload_from_chain(rudp, pc,
+                                      sizeof(struct rudp_packet_header));
+    if ( payload == NULL ) {
+        rudp_packet_chain_free(rudp, pc);
+        return ENOMEM;
+    }
+
+    rudp_server_batch_begin(server);
+
+    for ( i = 0; i < count; ++i ) {
+        rudp_error_t e = rudp_server_send_payload(
+            server, (struct server_peer *)peers[i],
+            reliable, command, payload);
+        if ( err == 0 )
+            err = e;
+    }
+
+    rudp_server_batch_flush(server);
+    rudp_payload_unref(rudp, payload);
+
+    return err;
+}
+
+rudp_error_t rudp_server_relay(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    int reliable)
+{
+    return rudp_server_relay_many(server, &peer, 1, reliable);
+}
@@ -13,7 +13,11 @@
 #include <rudp/packet.h>
 #include <rudp/time.h>
 #include "rudp_list.h"
+#include "rudp_packet.h"
 #include "rudp_rudp.h"
+#include "rudp_stats.h"
+#include "rudp_profile.h"
+#include "rudp_arena.h"
 
 #include <stdlib.h>
 
@@ -26,7 +30,16 @@ rudp_error_t rudp_init(
     rudp->el = el;
 
     rudp_list_init(&rudp->free_packet_list);
+    rudp_list_init(&rudp->free_large_list);
+    rudp_list_init(&rudp->file_sender_list);
+    rudp_list_init(&rudp->file_receiver_list);
+    rudp->stats = NULL;
+    rudp->profile = NULL;
+    rudp->arena = NULL;
+    rudp->rx_chain = NULL;
+    rudp->rx_overflow = NULL;
     rudp->free_packets = 0;
+    rudp->free_large_packets = 0;
     rudp->allocated_packets = 0;
 
     rudp->seed = rudp_timestamp();
@@ -60,10 +73,26 @@ const struct rudp_handler rudp_handler_default =
 void rudp_deinit(struct rudp *rudp)
 {
     struct rudp_packet_chain *pc, *tmp;
+
+    rudp_stats_close(rudp);
+    rudp_profile_disable(rudp);
+
     rudp_list_for_each_safe(pc, tmp, &rudp->free_packet_list, chain_item) {
         rudp_list_remove(&pc->chain_item);
-        rudp_free(rudp, pc);
+        rudp_free(rudp, pc, sizeof(*pc) + pc->alloc_size);
     }
+
+    rudp_list_for_each_safe(pc, tmp, &rudp->free_large_list, chain_item) {
+        rudp_list_remove(&pc->chain_item);
+        rudp_free(rudp, pc, sizeof(*pc) + pc->alloc_size);
+    }
+
+    if ( rudp->rx_overflow )
+        rudp_free(rudp, rudp->rx_overflow,
+                  RUDP_RECV_LARGE_SIZE - RUDP_RECV_BUFFER_SIZE);
+    rudp->rx_overflow = NULL;
+
+    rudp_arena_close(rudp);
 }
 
 uint16_t rudp_random(struct rudp *rudp)
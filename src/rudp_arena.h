@@ -0,0 +1,65 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_ARENA_IMPL_H
+#define RUDP_ARENA_IMPL_H
+
+#include <stdint.h>
+#include <rudp/arena.h>
+#include <rudp/rudp.h>
+
+struct rudp_arena
+{
+    uint8_t *base;
+    size_t size;
+    size_t slot_size;
+    // Free slots, linked through their first bytes
+    void *free;
+    enum rudp_arena_pages pages;
+    unsigned int capacity;
+    unsigned int used;
+};
+
+/*
+  Returns a free slot, large enough for a pool chain and its
+  RUDP_RECV_BUFFER_SIZE packet, NULL if arena is exhausted.
+ */
+static inline
+void *rudp_arena_get(struct rudp_arena *arena)
+{
+    void *slot = arena->free;
+
+    if ( slot ) {
+        arena->free = *(void **)slot;
+        arena->used++;
+    }
+
+    return slot;
+}
+
+static inline
+int rudp_arena_owns(const struct rudp_arena *arena, const void *ptr)
+{
+    return (const uint8_t *)ptr >= arena->base
+        && (const uint8_t *)ptr < arena->base + arena->size;
+}
+
+static inline
+void rudp_arena_put(struct rudp_arena *arena, void *slot)
+{
+    *(void **)slot = arena->free;
+    arena->free = slot;
+    arena->used--;
+}
+
+void rudp_arena_close(struct rudp *rudp);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_CODEC_IMPL_H
+#define RUDP_CODEC_IMPL_H
+
+#include <rudp/codec.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/*
+  Adds the codec of peer, if any, to an outgoing connection request.
+ */
+void rudp_codec_offer(struct rudp_peer *peer, struct rudp_packet_chain *req);
+
+/*
+  Picks the codec offered in a connection request if peer accepts
+  it, and tells so in the response.
+ */
+void rudp_codec_answer(struct rudp_peer *peer,
+                       const struct rudp_packet_chain *req,
+                       struct rudp_packet_chain *rsp);
+
+/*
+  Enables compression if the connection response picked the offered
+  codec, forgets the codec otherwise.
+ */
+void rudp_codec_handle_answer(struct rudp_peer *peer,
+                              const struct rudp_packet_chain *rsp);
+
+/*
+  Compresses data of an outgoing packet in place, if worth it.
+  Header options must be set already, compression flag is added.
+ */
+void rudp_codec_compress(struct rudp_peer *peer,
+                         struct rudp_packet_chain *pc);
+
+/*
+  Returns an uncompressed copy of a compressed packet, NULL if it is
+  invalid.
+ */
+struct rudp_packet_chain *rudp_codec_decompress(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc);
+
+#endif
@@ -0,0 +1,106 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_CRYPTO_IMPL_H
+#define RUDP_CRYPTO_IMPL_H
+
+#include <rudp/crypto.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/*
+  Session keys and counters of an established encrypted connection,
+  for server handoff.
+ */
+struct rudp_crypto_state
+{
+    uint8_t tx_key[RUDP_CRYPTO_KEY_SIZE];
+    uint8_t rx_key[RUDP_CRYPTO_KEY_SIZE];
+    uint64_t tx_counter;
+    uint64_t rx_counter;
+    uint64_t rx_window;
+};
+
+/*
+  Fills data with random bytes from the system, for secrets that
+  must not be guessed.
+ */
+rudp_error_t rudp_crypto_random(void *data, size_t size);
+
+/*
+  Adds a public key to an outgoing connection request if peer policy
+  asks for encryption.
+ */
+rudp_error_t rudp_crypto_offer(struct rudp_peer *peer,
+                               struct rudp_packet_chain *req);
+
+/*
+  Answers the public key of a connection request, and sets session
+  keys up.  Returns EACCES if peer policy requires encryption and
+  request has no key.
+ */
+rudp_error_t rudp_crypto_answer(struct rudp_peer *peer,
+                                const struct rudp_packet_chain *req,
+                                struct rudp_packet_chain *rsp);
+
+/*
+  Sets session keys up from a connection response.  Returns EACCES
+  if encryption was asked for and response has no key, or a key that
+  does not confirm ours.  Keys are left as they were on error, so a
+  later genuine response may still be handled.
+ */
+rudp_error_t rudp_crypto_handle_answer(struct rudp_peer *peer,
+                                       const struct rudp_packet_chain *rsp);
+
+/*
+  Whether an outgoing packet must be sealed.  Handshake packets never
+  are.
+ */
+int rudp_crypto_seals(const struct rudp_peer *peer,
+                      const struct rudp_packet_chain *pc);
+
+/*
+  Whether an incoming clear text packet must be dropped.
+ */
+int rudp_crypto_expects_sealed(const struct rudp_peer *peer,
+                               const struct rudp_packet_chain *pc);
+
+/*
+  Returns a sealed copy of a packet, along with its shared payload.
+ */
+struct rudp_packet_chain *rudp_crypto_seal(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc);
+
+/*
+  Returns the clear text packet of a sealed one, NULL if it is not
+  authentic or replayed.
+ */
+struct rudp_packet_chain *rudp_crypto_open(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc);
+
+/*
+  Drops encryption state of a peer, if any.
+ */
+void rudp_crypto_close(struct rudp_peer *peer);
+
+/*
+  Fills state and returns 1 if peer connection is encrypted, returns
+  0 otherwise.
+ */
+int rudp_crypto_state_save(const struct rudp_peer *peer,
+                           struct rudp_crypto_state *state);
+
+rudp_error_t rudp_crypto_state_restore(struct rudp_peer *peer,
+                                       const struct rudp_crypto_state *state);
+
+#endif
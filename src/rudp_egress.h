@@ -0,0 +1,27 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_EGRESS_IMPL_H
+#define RUDP_EGRESS_IMPL_H
+
+#include <rudp/egress.h>
+
+/*
+  Puts a peer with packets to send in the scheduler's active list.
+ */
+void rudp_egress_wake(struct rudp_egress *egress, struct rudp_peer *peer);
+
+/*
+  Removes a peer from the scheduler's active list.
+ */
+void rudp_egress_forget(struct rudp_peer *peer);
+
+#endif
@@ -0,0 +1,39 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_ENDPOINT_IMPL_H
+#define RUDP_ENDPOINT_IMPL_H
+
+#include <rudp/endpoint.h>
+#include <rudp/packet.h>
+
+#define RUDP_ENDPOINT_BATCH_SIZE 32
+
+/*
+  Sends a packet chain (packet data, then shared payload if any).
+
+  If the endpoint is batching, the packet header is copied and the
+  rest of the chain is only referenced until the batch is flushed.
+  When release is set, chain ownership is given to the endpoint,
+  which frees it once sent.
+ */
+rudp_error_t rudp_endpoint_send_chain(struct rudp_endpoint *endpoint,
+                                      const struct rudp_address *addr,
+                                      struct rudp_packet_chain *pc,
+                                      int release);
+
+/*
+  Makes an unbound endpoint use an already bound socket, e.g. one
+  inherited from another process.  Endpoint takes ownership of fd.
+ */
+rudp_error_t rudp_endpoint_adopt(struct rudp_endpoint *endpoint, int fd);
+
+#endif
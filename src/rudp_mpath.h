@@ -0,0 +1,96 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_MPATH_IMPL_H
+#define RUDP_MPATH_IMPL_H
+
+#include <rudp/multipath.h>
+#include <rudp/client.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/*
+  Additional path declared on a client, brought up on connection.
+ */
+struct rudp_path_config
+{
+    struct rudp_list item;
+    struct rudp_client *client;
+    struct rudp_endpoint endpoint;
+    struct sockaddr_storage local;
+    socklen_t local_len;
+    struct sockaddr_storage remote;
+    socklen_t remote_len;
+    unsigned int weight;
+};
+
+/*
+  Creates multipath state of a freshly connected client and starts
+  joining its additional paths.
+ */
+rudp_error_t rudp_mpath_client_start(struct rudp_client *client);
+
+/*
+  Frees path configurations of a client.
+ */
+void rudp_mpath_client_deinit(struct rudp_client *client);
+
+/*
+  Handles RUDP_CMD_PATH_TOKEN, creating multipath state of a server
+  peer.
+ */
+void rudp_mpath_handle_token(struct rudp_peer *peer,
+                             const struct rudp_packet_chain *pc);
+
+/*
+  Tells whether packet is a path join, probe or probe answer.  Those
+  are handled by rudp_mpath_handle_path_packet instead of the peer.
+ */
+int rudp_mpath_is_path_packet(const struct rudp_packet_chain *pc);
+
+/*
+  Tells whether path packet belongs to this peer connection.
+ */
+int rudp_mpath_token_match(const struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc);
+
+/*
+  Tells whether address is the remote address of a path of the peer.
+ */
+int rudp_mpath_address_match(const struct rudp_peer *peer,
+                             const struct sockaddr_storage *addr);
+
+void rudp_mpath_handle_path_packet(struct rudp_peer *peer,
+                                   struct rudp_endpoint *endpoint,
+                                   const struct sockaddr_storage *addr,
+                                   const struct rudp_packet_chain *pc);
+
+/*
+  Sends a packet on the paths chosen by the scheduler.  Same
+  semantics as rudp_endpoint_send_chain.
+ */
+rudp_error_t rudp_mpath_send_chain(struct rudp_peer *peer,
+                                   struct rudp_packet_chain *pc,
+                                   int release);
+
+rudp_error_t rudp_mpath_send_raw(struct rudp_peer *peer,
+                                 const void *data, size_t len);
+
+rudp_error_t rudp_mpath_path_info(const struct rudp_peer *peer,
+                                  unsigned int path,
+                                  struct rudp_path_info *info);
+
+/*
+  Tears down multipath state of a peer, if any.
+ */
+void rudp_mpath_close(struct rudp_peer *peer);
+
+#endif
@@ -0,0 +1,40 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_MULTICAST_IMPL_H
+#define RUDP_MULTICAST_IMPL_H
+
+#include <rudp/multicast.h>
+#include <rudp/packet.h>
+
+struct rudp_peer;
+
+/*
+  Handles a RUDP_CMD_MCAST_NACK packet received from a server peer.
+ */
+void rudp_mcast_sender_handle_nack(struct rudp_server *server,
+                                   struct rudp_peer *peer,
+                                   const struct rudp_packet_chain *pc);
+
+/*
+  Forgets about all repairs pending for a peer going away.
+ */
+void rudp_mcast_sender_peer_forget(struct rudp_server *server,
+                                   struct rudp_peer *peer);
+
+/*
+  Handles a RUDP_CMD_MCAST_DATA packet repaired through the client
+  connection.
+ */
+void rudp_mcast_receiver_handle_repair(struct rudp_client *client,
+                                       const struct rudp_packet_chain *pc);
+
+#endif
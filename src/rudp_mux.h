@@ -0,0 +1,42 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_MUX_IMPL_H
+#define RUDP_MUX_IMPL_H
+
+#include <rudp/mux.h>
+#include <rudp/client.h>
+#include <rudp/packet.h>
+
+/*
+  Registers a client connecting to its server address.  Returns
+  EADDRINUSE if another client of the multiplexer talks to the same
+  server.
+ */
+rudp_error_t rudp_mux_client_attach(struct rudp_client_mux *mux,
+                                    struct rudp_client *client,
+                                    const struct sockaddr_storage *addr);
+
+/*
+  Forgets a client, if attached.
+ */
+void rudp_mux_client_detach(struct rudp_client *client);
+
+/*
+  Client packet handler, shared by own and multiplexed sockets.
+  Implemented in client.c.
+ */
+void rudp_client_incoming(struct rudp_client *client,
+                          struct rudp_endpoint *endpoint,
+                          const struct sockaddr_storage *addr,
+                          struct rudp_packet_chain *pc);
+
+#endif
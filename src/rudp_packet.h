@@ -20,6 +20,19 @@
 
 #define RUDP_RECV_BUFFER_SIZE 4096
 
+/*
+  Largest possible UDP datagram.  Incoming datagrams that do not fit
+  in a RUDP_RECV_BUFFER_SIZE chain are moved to a chain of this size
+  class, pooled apart.
+ */
+#define RUDP_RECV_LARGE_SIZE 65536
+
+/*
+  Bundles are kept below usual path MTU, so that they are never
+  fragmented.
+ */
+#define RUDP_BUNDLE_MAX_SIZE 1400
+
 struct rudp_packet_chain *rudp_packet_chain_alloc(
     struct rudp *rudp,
     size_t alloc);
@@ -28,4 +41,104 @@ void rudp_packet_chain_free(
     struct rudp *rudp,
     struct rudp_packet_chain *pc);
 
+/*
+  A pinned chain is referenced by the kernel for zero-copy sends.
+  Freeing it is deferred until it is unpinned as many times.
+ */
+static inline
+void rudp_packet_chain_pin(struct rudp_packet_chain *pc)
+{
+    pc->pinned++;
+}
+
+void rudp_packet_chain_unpin(struct rudp *rudp, struct rudp_packet_chain *pc);
+
+struct rudp_packet_chain *rudp_packet_chain_alloc_payload(
+    struct rudp *rudp,
+    size_t alloc,
+    struct rudp_payload *payload);
+
+struct rudp_payload *rudp_payload_alloc(
+    struct rudp *rudp,
+    const void *data, size_t len);
+
+/*
+  Wraps user data in a payload, without copying.  Data must stay
+  valid until done callback is called, on last release.
+ */
+struct rudp_payload *rudp_payload_wrap(
+    struct rudp *rudp,
+    const void *data, size_t len,
+    rudp_buffer_done_func_t *done, void *priv);
+
+static inline
+struct rudp_payload *rudp_payload_ref(struct rudp_payload *payload)
+{
+    payload->refcount++;
+    return payload;
+}
+
+/*
+  Size of the chain on the wire, including shared payload.
+ */
+static inline
+size_t rudp_packet_chain_size(const struct rudp_packet_chain *pc)
+{
+    return pc->len + (pc->payload ? pc->payload->len : 0);
+}
+
+void rudp_payload_unref(
+    struct rudp *rudp,
+    struct rudp_payload *payload);
+
+/*
+  Wraps packet data past offset in a payload, without copying.
+  Payload becomes owner of the chain.
+ */
+struct rudp_payload *rudp_payload_from_chain(
+    struct rudp *rudp,
+    struct rudp_packet_chain *pc,
+    size_t offset);
+
+/*
+  Incoming packet chains are owned by the code that received them,
+  and freed once handled.  The chain currently being handled is
+  recorded in rudp->rx_chain when it may be kept instead.
+
+  Takes ownership of pc if possible, returns NULL otherwise.
+ */
+struct rudp_packet_chain *rudp_packet_chain_take(
+    struct rudp *rudp,
+    struct rudp_packet_chain *pc);
+
+/*
+  Allocates an empty RUDP_CMD_BUNDLE packet.
+ */
+struct rudp_packet_chain *rudp_packet_bundle_alloc(struct rudp *rudp);
+
+/*
+  Appends a whole packet to a bundle.  Returns ENOSPC if bundle would
+  get larger than RUDP_BUNDLE_MAX_SIZE.
+ */
+rudp_error_t rudp_packet_bundle_add(struct rudp_packet_chain *bundle,
+                                    const struct rudp_packet *packet,
+                                    size_t len);
+
+/*
+  Appends an option to a connection request or response packet.
+  Returns ENOSPC if value is too long.
+ */
+rudp_error_t rudp_packet_conn_option_add(struct rudp_packet_chain *pc,
+                                         uint8_t type,
+                                         const void *value, size_t len);
+
+/*
+  Looks an option up in a connection request or response packet,
+  options start past the fixed part of the packet, of size offset.
+  Returns option value and sets its length, or NULL if absent.
+ */
+const uint8_t *rudp_packet_conn_option_find(
+    const struct rudp_packet_chain *pc,
+    size_t offset, uint8_t type, size_t *len);
+
 #endif
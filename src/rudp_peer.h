@@ -0,0 +1,101 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_PEER_IMPL_H
+#define RUDP_PEER_IMPL_H
+
+#include <rudp/peer.h>
+
+/*
+  Sends the pending part of the send queue right now instead of
+  waiting for the peer service to run.  Packets waiting for an ack
+  are left to the retransmit timer.
+ */
+void rudp_peer_flush(struct rudp_peer *peer);
+
+/*
+  Retransmits the packet waiting for an ack right now, without
+  waiting for the retransmit timer.  Used when the path it was sent
+  on is known to be broken.
+ */
+void rudp_peer_retransmit(struct rudp_peer *peer);
+
+/*
+  Called by egress scheduler when peer's turn comes.  Sends packets
+  from the queue as long as they fit in budget bytes.  Sets more if
+  some packets are still waiting.  Returns the count of bytes sent.
+ */
+size_t rudp_peer_egress_send(struct rudp_peer *peer,
+                             size_t budget, int *more);
+
+/*
+  Called by egress scheduler once peer has nothing left to send, so
+  that peer service takes over again.
+ */
+void rudp_peer_egress_done(struct rudp_peer *peer);
+
+/*
+  Hands a data packet to the peer handler, if peer is running.
+ */
+void rudp_peer_handle_data(struct rudp_peer *peer,
+                           struct rudp_packet_chain *pc);
+
+/*
+  Queues a streamed message fragment, i.e. a reliable packet flagged
+  with RUDP_OPT_STREAM.  Chain ownership is given.
+ */
+rudp_error_t rudp_peer_send_stream(struct rudp_peer *peer,
+                                   struct rudp_packet_chain *pc);
+
+/*
+  Immediately sends an unreliable RUDP_CMD_NOOP command, bypassing
+  the send queue.
+ */
+rudp_error_t rudp_peer_send_noop_noqueue(struct rudp_peer *peer);
+
+/*
+  Sends an already sequenced packet right now, bypassing the send
+  queue.  Chain ownership is given.
+ */
+rudp_error_t rudp_peer_send_direct(struct rudp_peer *peer,
+                                   struct rudp_packet_chain *pc);
+
+/*
+  Protocol state of a peer, as transferred to another process.
+  Times are relative to the moment state was saved.
+ */
+struct rudp_peer_state
+{
+    int64_t timeout_left;
+    int64_t last_out_age;
+    int64_t srtt;
+    int64_t rttvar;
+    int64_t rto;
+    uint16_t in_seq_reliable;
+    uint16_t in_seq_unreliable;
+    uint16_t out_seq_reliable;
+    uint16_t out_seq_unreliable;
+    uint16_t out_seq_acked;
+    uint8_t state;
+    uint8_t must_ack;
+};
+
+void rudp_peer_state_save(const struct rudp_peer *peer,
+                          struct rudp_peer_state *state);
+
+/*
+  Restores protocol state of a freshly initialized peer.  Packets of
+  the send queue must have been added beforehand.
+ */
+void rudp_peer_state_restore(struct rudp_peer *peer,
+                             const struct rudp_peer_state *state);
+
+#endif
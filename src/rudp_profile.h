@@ -0,0 +1,106 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_PROFILE_IMPL_H
+#define RUDP_PROFILE_IMPL_H
+
+#include <rudp/profile.h>
+#include <rudp/rudp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#else
+# include <time.h>
+#endif
+
+#define RUDP_PROFILE_DEPTH 8
+
+struct rudp_profile
+{
+    struct rudp_profile_stage_report stage[RUDP_STAGE_COUNT];
+    uint64_t stack_start[RUDP_PROFILE_DEPTH];
+    uint8_t stack_stage[RUDP_PROFILE_DEPTH];
+    unsigned int depth;
+    uint64_t start_cycles;
+    uint64_t start_ns;
+};
+
+static inline
+uint64_t rudp_profile_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/*
+  Enters a stage.  Time spent so far in the current stage is
+  accounted to it, nested stage starts.
+ */
+static inline
+void rudp_profile_enter(struct rudp *rudp, enum rudp_profile_stage stage)
+{
+    struct rudp_profile *profile = rudp->profile;
+
+    if ( profile == NULL )
+        return;
+
+    uint64_t now = rudp_profile_clock();
+
+    if ( profile->depth ) {
+        unsigned int top = profile->depth - 1;
+        profile->stage[profile->stack_stage[top]].cycles +=
+            now - profile->stack_start[top];
+    }
+
+    // Too deep, top stage keeps running, from now on
+    if ( profile->depth == RUDP_PROFILE_DEPTH ) {
+        profile->stack_start[profile->depth - 1] = now;
+        return;
+    }
+
+    profile->stack_stage[profile->depth] = stage;
+    profile->stack_start[profile->depth] = now;
+    profile->depth++;
+    profile->stage[stage].calls++;
+}
+
+/*
+  Leaves a stage, resumes the calling one.  Unbalanced calls (e.g. if
+  profiling got enabled in the middle of a stage) are ignored.
+ */
+static inline
+void rudp_profile_leave(struct rudp *rudp, enum rudp_profile_stage stage)
+{
+    struct rudp_profile *profile = rudp->profile;
+
+    if ( profile == NULL || profile->depth == 0 )
+        return;
+
+    unsigned int top = profile->depth - 1;
+
+    if ( profile->stack_stage[top] != stage )
+        return;
+
+    uint64_t now = rudp_profile_clock();
+
+    profile->stage[stage].cycles += now - profile->stack_start[top];
+    profile->depth--;
+
+    if ( profile->depth )
+        profile->stack_start[top - 1] = now;
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_REDUNDANCY_IMPL_H
+#define RUDP_REDUNDANCY_IMPL_H
+
+#include <rudp/redundancy.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/*
+  Queues a packet for sending, as rudp_peer_send_reliable or
+  rudp_peer_send_unreliable would, and keeps a copy of it for
+  redundant transmissions.  Chain ownership is given.
+ */
+rudp_error_t rudp_redundancy_send(struct rudp_peer *peer,
+                                  struct rudp_packet_chain *pc,
+                                  int reliable,
+                                  const struct rudp_redundancy *redundancy);
+
+/*
+  Builds a bundle packet carrying pending critical packets, then pc.
+  Returns NULL when there is nothing to carry along pc.  pc is left
+  untouched.
+ */
+struct rudp_packet_chain *rudp_redundancy_bundle(
+    struct rudp_peer *peer,
+    const struct rudp_packet_chain *pc);
+
+/*
+  Drops redundancy state of a peer, if any.
+ */
+void rudp_redundancy_close(struct rudp_peer *peer);
+
+#endif
@@ -37,10 +37,16 @@ void *rudp_alloc(struct rudp *rudp, size_t len)
     return rudp->handler->mem_alloc(rudp, len);
 }
 
+/*
+  Size is the one asked for when allocating buffer.
+ */
 static inline
-void rudp_free(struct rudp *rudp, void *buffer)
+void rudp_free(struct rudp *rudp, void *buffer, size_t size)
 {
-    return rudp->handler->mem_free(rudp, buffer);
+    if ( rudp->handler->mem_free_sized )
+        rudp->handler->mem_free_sized(rudp, buffer, size);
+    else
+        rudp->handler->mem_free(rudp, buffer);
 }
 
 #endif
@@ -0,0 +1,90 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_SERVER_IMPL_H
+#define RUDP_SERVER_IMPL_H
+
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/*
+  Additional listening endpoint of a server.
+ */
+struct rudp_server_listener
+{
+    struct rudp_list item;
+    struct rudp_server *server;
+    struct rudp_endpoint endpoint;
+};
+
+struct server_peer
+{
+    struct rudp_peer base;
+    struct rudp_list server_item;
+    struct rudp_list group_list;
+    struct rudp_server *server;
+    void *user_data;
+};
+
+/*
+  Closes sockets of additional server addresses, or forgets the
+  addresses altogether.
+ */
+void rudp_server_listeners_close(struct rudp_server *server);
+void rudp_server_listeners_free(struct rudp_server *server);
+
+/*
+  Adds a listening endpoint for an already bound socket.  fd is
+  closed on error.
+ */
+rudp_error_t rudp_server_listener_adopt(struct rudp_server *server, int fd);
+
+/*
+  Server endpoints are numbered from 0, the main one, then in the
+  order their addresses were added.  Index of an unknown endpoint is
+  0, and endpoint of an unknown index is NULL.
+ */
+unsigned int rudp_server_endpoint_index(struct rudp_server *server,
+                                        const struct rudp_endpoint *endpoint);
+struct rudp_endpoint *rudp_server_endpoint_get(struct rudp_server *server,
+                                               unsigned int index);
+
+/*
+  Starts or ends a batch on all the server endpoints.
+ */
+void rudp_server_batch_begin(struct rudp_server *server);
+void rudp_server_batch_flush(struct rudp_server *server);
+
+/*
+  Queues a shared payload to a peer and sends it right away.  Caller
+  is expected to have started a batch on the server endpoints.
+ */
+rudp_error_t rudp_server_send_payload(
+    struct rudp_server *server,
+    struct server_peer *peer,
+    int reliable, int command,
+    struct rudp_payload *payload);
+
+/*
+  Creates a peer for a new remote address, talking through a given
+  server endpoint, and adds it to the server.
+ */
+struct server_peer *rudp_server_peer_new(struct rudp_server *server,
+                                         struct rudp_endpoint *endpoint,
+                                         const struct sockaddr_storage *addr);
+
+/*
+  Removes a peer from all the groups it joined.
+ */
+void rudp_server_group_peer_forget(struct server_peer *peer);
+
+#endif
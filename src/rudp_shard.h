@@ -0,0 +1,49 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_SHARD_IMPL_H
+#define RUDP_SHARD_IMPL_H
+
+#include <rudp/shard.h>
+#include <rudp/server.h>
+#include <rudp/endpoint.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/*
+  Tells the shard tag of peer, if any, in a connection response.
+ */
+void rudp_shard_answer(struct rudp_peer *peer, struct rudp_packet_chain *rsp);
+
+/*
+  Learns the shard tag of the server from its connection response.
+ */
+void rudp_shard_handle_answer(struct rudp_peer *peer,
+                              const struct rudp_packet_chain *rsp);
+
+/*
+  Sets the incoming CPU of a freshly bound server endpoint, and
+  attaches the steering program to its reuseport group.
+ */
+rudp_error_t rudp_shard_endpoint_setup(struct rudp_server *server,
+                                       struct rudp_endpoint *endpoint);
+
+/*
+  Tags an outgoing packet header with the shard of peer.
+ */
+static inline
+void rudp_shard_stamp(const struct rudp_peer *peer, uint8_t *opt)
+{
+    *opt = (*opt & ~RUDP_OPT_SHARD_MASK)
+        | (peer->shard_tag << RUDP_OPT_SHARD_SHIFT);
+}
+
+#endif
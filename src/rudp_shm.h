@@ -0,0 +1,54 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_SHM_IMPL_H
+#define RUDP_SHM_IMPL_H
+
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/* Receiver polls its ring at least this often, in milliseconds */
+#define RUDP_SHM_POLL_INTERVAL 50
+
+/*
+  Proposes a shared memory transport to the peer, if its address is
+  local.  Does nothing otherwise.
+ */
+rudp_error_t rudp_shm_offer(struct rudp_peer *peer, uint32_t ring_size);
+
+/*
+  Handles RUDP_CMD_SHM_OFFER and RUDP_CMD_SHM_ACCEPT packets.
+ */
+void rudp_shm_handle_offer(struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc);
+void rudp_shm_handle_accept(struct rudp_peer *peer,
+                            const struct rudp_packet_chain *pc);
+
+/*
+  Tries to send a data packet through the ring.  Returns EAGAIN if
+  packet must go through the network.  Chain is left to the caller.
+ */
+rudp_error_t rudp_shm_send(struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc);
+
+/*
+  Delivers all the data packets waiting in the receive ring.  Returns
+  the count of packets read, or -1 if a handler closed the transport,
+  peer may be freed then and must not be used anymore.
+ */
+int rudp_shm_receive(struct rudp_peer *peer);
+
+/*
+  Tears down the shared memory transport of a peer, if any.
+ */
+void rudp_shm_close(struct rudp_peer *peer);
+
+#endif
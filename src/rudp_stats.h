@@ -0,0 +1,93 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_STATS_IMPL_H
+#define RUDP_STATS_IMPL_H
+
+#include <rudp/stats.h>
+#include <rudp/rudp.h>
+
+struct rudp_peer;
+struct rudp_endpoint;
+struct ela_event_source;
+
+struct rudp_stats
+{
+    struct rudp_stats_segment *segment;
+    size_t size;
+    struct rudp_stats_endpoint *endpoint_slot;
+    struct rudp_stats_peer *peer_slot;
+    struct rudp_endpoint **endpoint;
+    struct rudp_peer **peer;
+    struct ela_event_source *refresh_source;
+    char name[64];
+};
+
+/*
+  Seqlock writer side.  There is only one writer, the library, so
+  plain increments are fine, barriers order them with the record
+  update for readers.
+ */
+static inline
+void rudp_stats_write_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline
+void rudp_stats_write_end(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline
+void rudp_stats_count_out(struct rudp_stats_counters *counters,
+                          size_t bytes)
+{
+    counters->packets_out++;
+    counters->bytes_out += bytes;
+}
+
+static inline
+void rudp_stats_count_in(struct rudp_stats_counters *counters,
+                         size_t bytes)
+{
+    counters->packets_in++;
+    counters->bytes_in += bytes;
+}
+
+/*
+  Slot attribution, these do nothing if statistics are disabled or
+  slots are exhausted.
+ */
+void rudp_stats_endpoint_register(struct rudp *rudp,
+                                  struct rudp_endpoint *endpoint);
+void rudp_stats_endpoint_unregister(struct rudp *rudp,
+                                    struct rudp_endpoint *endpoint);
+void rudp_stats_peer_register(struct rudp *rudp, struct rudp_peer *peer);
+void rudp_stats_peer_unregister(struct rudp *rudp, struct rudp_peer *peer);
+
+/*
+  Accounts traffic of an endpoint, in the endpoint and global
+  records.  Callers check endpoint->stats first.
+ */
+void rudp_stats_endpoint_in(struct rudp_endpoint *endpoint, size_t bytes);
+void rudp_stats_endpoint_out(struct rudp_endpoint *endpoint, size_t bytes);
+void rudp_stats_endpoint_error(struct rudp_endpoint *endpoint);
+
+/*
+  Accounts a retransmit, in the peer and global records.  Callers
+  check peer->stats first.
+ */
+void rudp_stats_peer_retransmit(struct rudp_peer *peer);
+
+#endif
@@ -0,0 +1,84 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_STREAM_IMPL_H
+#define RUDP_STREAM_IMPL_H
+
+#include <rudp/stream.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+static inline
+void rudp_stream_put64(uint8_t *p, uint64_t value)
+{
+    int i;
+
+    for ( i = 7; i >= 0; --i ) {
+        p[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+static inline
+uint64_t rudp_stream_get64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    int i;
+
+    for ( i = 0; i < 8; ++i )
+        value = (value << 8) | p[i];
+
+    return value;
+}
+
+/*
+  Queues a streamed message to peer.  Command is the packet one,
+  i.e. with RUDP_CMD_APP added.
+ */
+rudp_error_t rudp_stream_send(struct rudp_peer *peer, uint8_t command,
+                              const void *data, size_t size,
+                              rudp_buffer_done_func_t *done, void *priv);
+
+/*
+  Queues data of file id to peer, from offset.  Fragment done is
+  called as each fragment is released, done once the whole range is.
+ */
+rudp_error_t rudp_stream_send_file(struct rudp_peer *peer, uint32_t id,
+                                   const void *data, size_t size,
+                                   uint64_t offset,
+                                   rudp_buffer_done_func_t *fragment_done,
+                                   rudp_buffer_done_func_t *done,
+                                   void *priv);
+
+/*
+  Stops queueing data of file id.
+ */
+void rudp_stream_cancel_file(struct rudp_peer *peer, uint32_t id);
+
+/*
+  Queues more fragments once acknowledges made room in the window.
+ */
+void rudp_stream_acked(struct rudp_peer *peer);
+
+/*
+  Handles a sequenced stream fragment.
+ */
+void rudp_stream_receive(struct rudp_peer *peer,
+                         const struct rudp_packet_chain *pc);
+
+/*
+  Forgets messages being sent, and ends the one being received, if
+  any, along with file transfers.  Buffers are released once no
+  packet references them anymore.
+ */
+void rudp_stream_close(struct rudp_peer *peer);
+
+#endif
@@ -0,0 +1,31 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_TRANSFER_IMPL_H
+#define RUDP_TRANSFER_IMPL_H
+
+#include <rudp/transfer.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+
+/*
+  Handles a sequenced stream packet with the RUDP_STREAM_FILE flag.
+ */
+void rudp_transfer_receive(struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc);
+
+/*
+  Ends transfers going on with peer, that goes away.  Receivers keep
+  what they have for a later offer.
+ */
+void rudp_transfer_close(struct rudp_peer *peer);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_XDP_IMPL_H
+#define RUDP_XDP_IMPL_H
+
+#include <sys/uio.h>
+#include <rudp/xdp.h>
+#include <rudp/endpoint.h>
+
+/*
+  Queues a datagram on the AF_XDP socket.  Returns EAGAIN when the
+  datagram cannot go this way and must be sent through the normal
+  socket.
+ */
+rudp_error_t rudp_xdp_send(struct rudp_endpoint *endpoint,
+                           const struct sockaddr_storage *addr,
+                           const struct iovec *iov, size_t iovcnt);
+
+/*
+  Makes kernel transmit queued datagrams.
+ */
+void rudp_xdp_kick(struct rudp_endpoint *endpoint);
+
+#endif
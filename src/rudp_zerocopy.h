@@ -0,0 +1,59 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#ifndef RUDP_ZEROCOPY_IMPL_H
+#define RUDP_ZEROCOPY_IMPL_H
+
+#include <rudp/endpoint.h>
+#include <rudp/packet.h>
+
+/*
+  A datagram sent with MSG_ZEROCOPY.  Kernel reads the header from
+  here, the rest from the pinned chain.
+ */
+struct rudp_zerocopy_slot
+{
+    struct rudp_packet_header header;
+    struct rudp_packet_chain *pc;
+    uint32_t id;
+    uint8_t state;
+};
+
+/*
+  Returns a slot if chain must be sent with MSG_ZEROCOPY, NULL if it
+  must be sent as usual.  Chain is pinned, and its header copied in
+  the slot.  Slots must be given back with rudp_zerocopy_sent, in
+  the order chains are passed to the kernel.
+ */
+struct rudp_zerocopy_slot *rudp_zerocopy_reserve(
+    struct rudp_endpoint *endpoint,
+    struct rudp_packet_chain *pc);
+
+/*
+  Records whether kernel accepted the datagram of a slot.
+ */
+void rudp_zerocopy_sent(struct rudp_endpoint *endpoint,
+                        struct rudp_zerocopy_slot *slot,
+                        int accepted);
+
+/*
+  Reads completion notifications from the socket error queue, and
+  unpins chains kernel is done with.
+ */
+void rudp_zerocopy_complete(struct rudp_endpoint *endpoint);
+
+/*
+  Drops zero-copy state of an endpoint about to be closed.  No slot
+  may be reserved.
+ */
+void rudp_zerocopy_close(struct rudp_endpoint *endpoint);
+
+#endif
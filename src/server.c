@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <rudp/packet.h>
 #include <rudp/server.h>
@@ -20,16 +21,18 @@
 #include "rudp_list.h"
 #include "rudp_packet.h"
 #include "rudp_rudp.h"
-
-struct server_peer
-{
-    struct rudp_peer base;
-    struct rudp_list server_item;
-    struct rudp_server *server;
-    void *user_data;
-};
+#include "rudp_peer.h"
+#include "rudp_server.h"
+#include "rudp_endpoint.h"
+#include "rudp_multicast.h"
+#include "rudp_profile.h"
+#include "rudp_mpath.h"
+#include "rudp_shard.h"
+#include "rudp_stream.h"
+#include "rudp_stats.h"
 
 static const struct rudp_endpoint_handler server_endpoint_handler;
+static const struct rudp_endpoint_handler listener_endpoint_handler;
 
 rudp_error_t rudp_server_init(
     struct rudp_server *server,
@@ -38,33 +41,212 @@ rudp_error_t rudp_server_init(
 {
     rudp_endpoint_init(&server->endpoint, rudp, &server_endpoint_handler);
     rudp_list_init(&server->peer_list);
+    rudp_list_init(&server->mcast_list);
+    rudp_list_init(&server->listener_list);
+    rudp_egress_init(&server->egress, rudp, &server->endpoint);
     server->handler = handler;
+    server->stream_handler = NULL;
     server->rudp = rudp;
+    server->fair_queueing = 0;
+    server->shm = 0;
+    server->multipath = 0;
+    server->shard_index = 0;
+    server->shard_count = 0;
+    server->shard_steering = 0;
+    server->shard_cpu = -1;
+    server->codec_count = 0;
+    memset(&server->crypto, 0, sizeof(server->crypto));
+    server->relay_chain = NULL;
+    server->new_peer = NULL;
     return 0;
 }
 
-rudp_error_t rudp_server_bind(struct rudp_server *server)
+static
+rudp_error_t server_endpoint_bind(struct rudp_server *server,
+                                  struct rudp_endpoint *endpoint)
 {
-    rudp_error_t err = rudp_endpoint_bind(&server->endpoint);
+    rudp_error_t err = rudp_endpoint_bind(endpoint);
+
+    if ( err == 0 && server->shard_count ) {
+        err = rudp_shard_endpoint_setup(server, endpoint);
+        if ( err )
+            rudp_endpoint_close(endpoint);
+    }
 
     if ( err )
-        rudp_log_printf(server->endpoint.rudp, RUDP_LOG_ERROR,
+        rudp_log_printf(server->rudp, RUDP_LOG_ERROR,
                         "Binding of server to %s failed\n",
-                        rudp_address_text(&server->endpoint.addr));
+                        rudp_address_text(&endpoint->addr));
     else
-        rudp_log_printf(server->endpoint.rudp, RUDP_LOG_INFO,
+        rudp_log_printf(server->rudp, RUDP_LOG_INFO,
                         "Bound server to %s\n",
-                        rudp_address_text(&server->endpoint.addr));
+                        rudp_address_text(&endpoint->addr));
 
     return err;
 }
 
+void rudp_server_listeners_close(struct rudp_server *server)
+{
+    struct rudp_server_listener *listener;
+
+    rudp_list_for_each(listener, &server->listener_list, item)
+    {
+        if ( listener->endpoint.socket_fd != -1 )
+            rudp_endpoint_close(&listener->endpoint);
+    }
+}
+
+rudp_error_t rudp_server_bind(struct rudp_server *server)
+{
+    struct rudp_server_listener *listener;
+    rudp_error_t err = server_endpoint_bind(server, &server->endpoint);
+
+    if ( err )
+        return err;
+
+    rudp_list_for_each(listener, &server->listener_list, item)
+    {
+        // Same socket options everywhere
+        rudp_endpoint_set_flags(&listener->endpoint, server->endpoint.flags);
+
+        err = server_endpoint_bind(server, &listener->endpoint);
+        if ( err ) {
+            rudp_server_listeners_close(server);
+            rudp_endpoint_close(&server->endpoint);
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+rudp_error_t rudp_server_add_addr(
+    struct rudp_server *server,
+    const struct sockaddr *addr,
+    socklen_t addrlen)
+{
+    struct rudp_server_listener *listener;
+    rudp_error_t err;
+
+    if ( rudp_list_length(&server->listener_list)
+         >= RUDP_SERVER_LISTENER_MAX - 1 )
+        return ENOSPC;
+
+    listener = rudp_alloc(server->rudp, sizeof(*listener));
+    if ( listener == NULL )
+        return ENOMEM;
+
+    listener->server = server;
+    rudp_endpoint_init(&listener->endpoint, server->rudp,
+                       &listener_endpoint_handler);
+
+    err = rudp_endpoint_set_addr(&listener->endpoint, addr, addrlen);
+
+    // Server may be running already
+    if ( err == 0 && server->endpoint.socket_fd != -1 ) {
+        rudp_endpoint_set_flags(&listener->endpoint, server->endpoint.flags);
+        err = server_endpoint_bind(server, &listener->endpoint);
+    }
+
+    if ( err ) {
+        rudp_endpoint_deinit(&listener->endpoint);
+        rudp_free(server->rudp, listener, sizeof(*listener));
+        return err;
+    }
+
+    rudp_list_append(&server->listener_list, &listener->item);
+
+    return 0;
+}
+
+rudp_error_t rudp_server_listener_adopt(struct rudp_server *server, int fd)
+{
+    struct rudp_server_listener *listener;
+    rudp_error_t err;
+
+    listener = rudp_alloc(server->rudp, sizeof(*listener));
+    if ( listener == NULL ) {
+        close(fd);
+        return ENOMEM;
+    }
+
+    listener->server = server;
+    rudp_endpoint_init(&listener->endpoint, server->rudp,
+                       &listener_endpoint_handler);
+
+    err = rudp_endpoint_adopt(&listener->endpoint, fd);
+    if ( err ) {
+        rudp_endpoint_deinit(&listener->endpoint);
+        rudp_free(server->rudp, listener, sizeof(*listener));
+        return err;
+    }
+
+    rudp_list_append(&server->listener_list, &listener->item);
+
+    return 0;
+}
+
+unsigned int rudp_server_endpoint_index(struct rudp_server *server,
+                                        const struct rudp_endpoint *endpoint)
+{
+    struct rudp_server_listener *listener;
+    unsigned int index = 1;
+
+    rudp_list_for_each(listener, &server->listener_list, item)
+    {
+        if ( &listener->endpoint == endpoint )
+            return index;
+        index++;
+    }
+
+    return 0;
+}
+
+struct rudp_endpoint *rudp_server_endpoint_get(struct rudp_server *server,
+                                               unsigned int index)
+{
+    struct rudp_server_listener *listener;
+
+    if ( index == 0 )
+        return &server->endpoint;
+
+    rudp_list_for_each(listener, &server->listener_list, item)
+    {
+        if ( --index == 0 )
+            return &listener->endpoint;
+    }
+
+    return NULL;
+}
+
+void rudp_server_batch_begin(struct rudp_server *server)
+{
+    struct rudp_server_listener *listener;
+
+    rudp_endpoint_batch_begin(&server->endpoint);
+
+    rudp_list_for_each(listener, &server->listener_list, item)
+        rudp_endpoint_batch_begin(&listener->endpoint);
+}
+
+void rudp_server_batch_flush(struct rudp_server *server)
+{
+    struct rudp_server_listener *listener;
+
+    rudp_endpoint_batch_flush(&server->endpoint);
+
+    rudp_list_for_each(listener, &server->listener_list, item)
+        rudp_endpoint_batch_flush(&listener->endpoint);
+}
+
 static void server_peer_forget(struct rudp_server *server,
                                struct server_peer *peer)
 {
     rudp_list_remove(&peer->server_item);
+    rudp_server_group_peer_forget(peer);
+    rudp_mcast_sender_peer_forget(server, &peer->base);
     rudp_peer_deinit(&peer->base);
-    rudp_free(server->rudp, peer);
+    rudp_free(server->rudp, peer, sizeof(*peer));
 }
 
 void rudp_server_client_close(struct rudp_server *server,
@@ -84,28 +266,70 @@ rudp_error_t rudp_server_close(struct rudp_server *server)
         rudp_server_client_close(server, &peer->base);
     }
 
+    rudp_server_listeners_close(server);
     rudp_endpoint_close(&server->endpoint);
     return 0;
 }
 
+void rudp_server_listeners_free(struct rudp_server *server)
+{
+    struct rudp_server_listener *listener, *tmp;
+
+    rudp_list_for_each_safe(listener, tmp, &server->listener_list, item)
+    {
+        rudp_endpoint_deinit(&listener->endpoint);
+        rudp_free(server->rudp, listener, sizeof(*listener));
+    }
+    rudp_list_init(&server->listener_list);
+}
+
 rudp_error_t rudp_server_deinit(struct rudp_server *server)
 {
+    rudp_server_listeners_free(server);
+    rudp_egress_deinit(&server->egress);
     rudp_endpoint_deinit(&server->endpoint);
     rudp_list_init(&server->peer_list);
     return 0;
 }
 
+/*
+  A remote address may talk to several server addresses, these are
+  different connections.
+ */
 static
 struct server_peer *rudp_server_peer_lookup(struct rudp_server *server,
+                                          struct rudp_endpoint *endpoint,
                                           const struct sockaddr_storage *addr)
 {
-    struct server_peer *peer;
+    struct server_peer *peer, *path = NULL;
     rudp_list_for_each(peer, &server->peer_list, server_item)
     {
-        if ( ! rudp_peer_address_compare(&peer->base, addr) )
+        if ( peer->base.endpoint == endpoint
+             && ! rudp_peer_address_compare(&peer->base, addr) )
             return peer;
+
+        // Additional paths of multipath peers, if no main address matches
+        if ( path == NULL && peer->base.mpath
+             && rudp_mpath_address_match(&peer->base, addr) )
+            path = peer;
     }
-    return NULL;
+    return path;
+}
+
+/*
+  New peers are announced once their connection request is handled,
+  before any early data it carried is delivered.
+ */
+static
+void server_peer_announce(struct rudp_server *server)
+{
+    struct rudp_peer *peer = server->new_peer;
+
+    if ( peer == NULL )
+        return;
+
+    server->new_peer = NULL;
+    server->handler->peer_new(server, peer);
 }
 
 static
@@ -113,12 +337,65 @@ void server_handle_data_packet(struct rudp_peer *_peer,
                                struct rudp_packet_chain *pc)
 {
     struct server_peer *peer = (struct server_peer *)_peer;
+    struct rudp_server *server = peer->server;
     struct rudp_packet_data *header = &pc->packet->data;
 
-    peer->server->handler->handle_packet(
-        peer->server, &peer->base,
+    if ( server->new_peer == _peer )
+        server_peer_announce(server);
+
+    // Handler may relay it
+    server->relay_chain = pc;
+
+    server->handler->handle_packet(
+        server, &peer->base,
         header->header.command - RUDP_CMD_APP,
         header->data, pc->len - sizeof(header));
+
+    server->relay_chain = NULL;
+}
+
+static
+void server_handle_command(struct rudp_peer *_peer,
+                           struct rudp_packet_chain *pc)
+{
+    struct server_peer *peer = (struct server_peer *)_peer;
+
+    if ( pc->packet->header.command == RUDP_CMD_MCAST_NACK )
+        rudp_mcast_sender_handle_nack(peer->server, _peer, pc);
+}
+
+static
+void server_stream_begin(struct rudp_peer *_peer, int command, uint64_t size)
+{
+    struct server_peer *peer = (struct server_peer *)_peer;
+    struct rudp_server *server = peer->server;
+
+    if ( server->new_peer == _peer )
+        server_peer_announce(server);
+
+    if ( server->stream_handler )
+        server->stream_handler->begin(server, _peer, command, size);
+}
+
+static
+void server_stream_chunk(struct rudp_peer *_peer, uint64_t offset,
+                         const void *data, size_t len)
+{
+    struct server_peer *peer = (struct server_peer *)_peer;
+    struct rudp_server *server = peer->server;
+
+    if ( server->stream_handler )
+        server->stream_handler->chunk(server, _peer, offset, data, len);
+}
+
+static
+void server_stream_end(struct rudp_peer *_peer, rudp_error_t err)
+{
+    struct server_peer *peer = (struct server_peer *)_peer;
+    struct rudp_server *server = peer->server;
+
+    if ( server->stream_handler )
+        server->stream_handler->end(server, _peer, err);
 }
 
 static
@@ -137,19 +414,31 @@ void server_peer_dropped(struct rudp_peer *_peer)
 
     rudp_log_printf(peer->base.rudp, RUDP_LOG_INFO, "Peer dropped\n");
 
-    peer->server->handler->peer_dropped(peer->server, _peer);
+    // Message being received ends before the peer goes
+    rudp_stream_close(_peer);
+
+    // User never heard of it
+    if ( peer->server->new_peer == _peer )
+        peer->server->new_peer = NULL;
+    else
+        peer->server->handler->peer_dropped(peer->server, _peer);
 
     server_peer_forget(peer->server, peer);
 }
 
 static const struct rudp_peer_handler server_peer_handler = {
     .handle_packet = server_handle_data_packet,
+    .handle_command = server_handle_command,
     .link_info = server_link_info,
     .dropped = server_peer_dropped,
+    .stream_begin = server_stream_begin,
+    .stream_chunk = server_stream_chunk,
+    .stream_end = server_stream_end,
 };
 
-static struct server_peer *server_peer_new(struct rudp_server *server,
-                                           const struct sockaddr_storage *addr)
+struct server_peer *rudp_server_peer_new(struct rudp_server *server,
+                                         struct rudp_endpoint *endpoint,
+                                         const struct sockaddr_storage *addr)
 {
     struct server_peer *peer = rudp_alloc(server->rudp, sizeof(*peer));
 
@@ -159,18 +448,60 @@ static struct server_peer *server_peer_new(struct rudp_server *server,
     rudp_peer_from_sockaddr(
         &peer->base, server->rudp,
         addr, &server_peer_handler,
-        &server->endpoint);
+        endpoint);
+
+    // No room for its address, it could not be answered
+    if ( peer->base.address.addr == NULL ) {
+        rudp_peer_deinit(&peer->base);
+        rudp_free(server->rudp, peer, sizeof(*peer));
+        return NULL;
+    }
 
     rudp_log_printf(server->rudp, RUDP_LOG_INFO, "New connection\n");
 
     rudp_list_insert(&server->peer_list, &peer->server_item);
+    rudp_list_init(&peer->group_list);
 
     peer->server = server;
     peer->user_data = NULL;
+    peer->base.shm_accept = server->shm;
+    peer->base.mpath_accept = server->multipath;
+    peer->base.codec_accept = server->codec;
+    peer->base.codec_accept_count = server->codec_count;
+    peer->base.crypto_policy = &server->crypto;
+    if ( server->shard_count )
+        peer->base.shard_tag = server->shard_index + 1;
+
+    if ( server->fair_queueing )
+        rudp_egress_attach(&server->egress, &peer->base, 1);
 
     return peer;
 }
 
+/*
+  Connection request may come alone, or first in a bundle with early
+  data.  Options may follow its fixed part.
+ */
+static
+int server_is_conn_req(const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_header *header = &pc->packet->header;
+    const uint8_t *record = pc->packet->bundle.records;
+
+    if ( header->command == RUDP_CMD_CONN_REQ )
+        return pc->len >= sizeof(struct rudp_packet_conn_req);
+
+    if ( header->command != RUDP_CMD_BUNDLE
+         || pc->len < sizeof(struct rudp_packet_bundle) + 2
+                      + sizeof(struct rudp_packet_conn_req) )
+        return 0;
+
+    return (size_t)((record[0] << 8) | record[1])
+               >= sizeof(struct rudp_packet_conn_req)
+        && ((const struct rudp_packet_header *)(record + 2))->command
+               == RUDP_CMD_CONN_REQ;
+}
+
 /*
   - socket watcher
      - endpoint packet reader
@@ -184,44 +515,91 @@ static struct server_peer *server_peer_new(struct rudp_server *server,
   garbage.
  */
 static
-void server_handle_endpoint_packet(struct rudp_endpoint *endpoint,
-                                           const struct sockaddr_storage *addr,
-                                           struct rudp_packet_chain *pc)
+void server_incoming(struct rudp_server *server,
+                     struct rudp_endpoint *endpoint,
+                     const struct sockaddr_storage *addr,
+                     struct rudp_packet_chain *pc)
 {
-    struct rudp_server *server = __container_of(endpoint, server, endpoint);
-    struct server_peer *peer = rudp_server_peer_lookup(server, addr);
+    struct server_peer *peer;
     rudp_error_t err;
 
+    // Path packets may come from addresses not known yet
+    if ( rudp_mpath_is_path_packet(pc) ) {
+        rudp_list_for_each(peer, &server->peer_list, server_item)
+        {
+            if ( rudp_mpath_token_match(&peer->base, pc) ) {
+                rudp_mpath_handle_path_packet(&peer->base, endpoint,
+                                              addr, pc);
+                return;
+            }
+        }
+        goto garbage;
+    }
+
+    rudp_profile_enter(server->rudp, RUDP_STAGE_LOOKUP);
+    peer = rudp_server_peer_lookup(server, endpoint, addr);
+    rudp_profile_leave(server->rudp, RUDP_STAGE_LOOKUP);
+
     if ( peer != NULL ) {
         rudp_peer_incoming_packet(&peer->base, pc);
         return;
     }
 
-    struct rudp_packet_header *header = &pc->packet->header;
-
-    if ( pc->len != sizeof(struct rudp_packet_conn_req)
-         || header->command != RUDP_CMD_CONN_REQ )
+    if ( !server_is_conn_req(pc) )
         goto garbage;
 
-    peer = server_peer_new(server, addr);
-    if ( peer == NULL )
+    peer = rudp_server_peer_new(server, endpoint, addr);
+    if ( peer == NULL ) {
+        // Dropped for want of memory, as the endpoint would
+        if ( endpoint->stats )
+            rudp_stats_endpoint_error(endpoint);
         return;
+    }
+
+    server->new_peer = &peer->base;
 
     err = rudp_peer_incoming_packet(&peer->base, pc);
-    if ( err == 0 )
-        server->handler->peer_new(server, &peer->base);
-    else
+    if ( err == 0 ) {
+        server_peer_announce(server);
+    } else {
+        server->new_peer = NULL;
         server_peer_forget(server, peer);
+    }
     return;
 
 garbage:
     rudp_log_printf(server->rudp, RUDP_LOG_DEBUG, "Garbage data\n");
 }
 
+static
+void server_handle_endpoint_packet(struct rudp_endpoint *endpoint,
+                                   const struct sockaddr_storage *addr,
+                                   struct rudp_packet_chain *pc)
+{
+    struct rudp_server *server = __container_of(endpoint, server, endpoint);
+
+    server_incoming(server, endpoint, addr, pc);
+}
+
+static
+void listener_handle_endpoint_packet(struct rudp_endpoint *endpoint,
+                                     const struct sockaddr_storage *addr,
+                                     struct rudp_packet_chain *pc)
+{
+    struct rudp_server_listener *listener =
+        __container_of(endpoint, listener, endpoint);
+
+    server_incoming(listener->server, endpoint, addr, pc);
+}
+
 static const struct rudp_endpoint_handler server_endpoint_handler = {
     .handle_packet = server_handle_endpoint_packet,
 };
 
+static const struct rudp_endpoint_handler listener_endpoint_handler = {
+    .handle_packet = listener_handle_endpoint_packet,
+};
+
 /***/
 
 rudp_error_t rudp_server_send(
@@ -250,6 +628,63 @@ rudp_error_t rudp_server_send(
         return rudp_peer_send_unreliable(peer, pc);
 }
 
+rudp_error_t rudp_server_send_buffer(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    int reliable, int command,
+    const void *data, size_t size,
+    rudp_buffer_done_func_t *done, void *priv)
+{
+    struct rudp_payload *payload;
+    struct rudp_packet_chain *pc;
+
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    payload = rudp_payload_wrap(server->rudp, data, size, done, priv);
+    if ( payload == NULL )
+        return ENOMEM;
+
+    pc = rudp_packet_chain_alloc_payload(
+        server->rudp, sizeof(struct rudp_packet_header), payload);
+    if ( pc == NULL ) {
+        // Not referenced yet, user keeps the buffer
+        payload->done = NULL;
+        rudp_payload_unref(server->rudp, payload);
+        return ENOMEM;
+    }
+    rudp_payload_unref(server->rudp, payload);
+
+    pc->packet->header.command = RUDP_CMD_APP + command;
+
+    // Queued even on a socket error, buffer is released as usual
+    if ( reliable )
+        return rudp_peer_send_reliable(peer, pc);
+    else
+        return rudp_peer_send_unreliable(peer, pc);
+}
+
+void rudp_server_set_stream_handler(
+    struct rudp_server *server,
+    const struct rudp_server_stream_handler *handler)
+{
+    server->stream_handler = handler;
+}
+
+rudp_error_t rudp_server_send_stream(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    int command,
+    const void *data, size_t size,
+    rudp_buffer_done_func_t *done, void *priv)
+{
+    if ( (command + RUDP_CMD_APP) > 255 )
+        return EINVAL;
+
+    return rudp_stream_send(peer, RUDP_CMD_APP + command,
+                            data, size, done, priv);
+}
+
 rudp_error_t rudp_server_send_all(
     struct rudp_server *server,
     int reliable, int command,
@@ -259,14 +694,100 @@ rudp_error_t rudp_server_send_all(
     if ( (command + RUDP_CMD_APP) > 255 )
         return EINVAL;
 
+    struct rudp_payload *payload = rudp_payload_alloc(server->rudp,
+                                                      data, size);
+    if ( payload == NULL )
+        return ENOMEM;
+
+    rudp_server_batch_begin(server);
+
     struct server_peer *peer, *tmp;
     rudp_list_for_each_safe(peer, tmp, &server->peer_list, server_item)
     {
-        rudp_server_send(server, &peer->base, reliable, command, data, size);
+        rudp_server_send_payload(server, peer, reliable, command, payload);
     }
+
+    rudp_server_batch_flush(server);
+    rudp_payload_unref(server->rudp, payload);
+
     return 0;
 }
 
+rudp_error_t rudp_server_send_payload(
+    struct rudp_server *server,
+    struct server_peer *peer,
+    int reliable, int command,
+    struct rudp_payload *payload)
+{
+    struct rudp_packet_chain *pc = rudp_packet_chain_alloc_payload(
+        server->rudp, sizeof(struct rudp_packet_header), payload);
+    rudp_error_t err;
+
+    if ( pc == NULL )
+        return ENOMEM;
+
+    pc->packet->header.command = RUDP_CMD_APP + command;
+
+    if ( reliable )
+        err = rudp_peer_send_reliable(&peer->base, pc);
+    else
+        err = rudp_peer_send_unreliable(&peer->base, pc);
+
+    rudp_peer_flush(&peer->base);
+
+    return err;
+}
+
+
+void rudp_server_set_fair_queueing(
+    struct rudp_server *server,
+    int enable,
+    uint64_t bytes_per_sec)
+{
+    struct server_peer *peer;
+
+    server->fair_queueing = !!enable;
+    rudp_egress_set_rate(&server->egress, bytes_per_sec);
+
+    rudp_list_for_each(peer, &server->peer_list, server_item)
+    {
+        if ( enable )
+            rudp_egress_attach(&server->egress, &peer->base,
+                               peer->base.egress_weight);
+        else
+            rudp_egress_detach(&peer->base);
+    }
+}
+
+void rudp_server_set_dualstack(
+    struct rudp_server *server,
+    int enable)
+{
+    uint32_t flags = server->endpoint.flags & ~RUDP_ENDPOINT_DUALSTACK;
+
+    rudp_endpoint_set_flags(&server->endpoint,
+                            flags | (enable ? RUDP_ENDPOINT_DUALSTACK : 0));
+}
+
+void rudp_server_set_shm(
+    struct rudp_server *server,
+    int enable)
+{
+    struct server_peer *peer;
+
+    server->shm = !!enable;
+
+    rudp_list_for_each(peer, &server->peer_list, server_item)
+        peer->base.shm_accept = server->shm;
+}
+
+void rudp_server_peer_set_weight(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    unsigned int weight)
+{
+    peer->egress_weight = weight ? weight : 1;
+}
 
 /*
   For the two following functions, server context pointer is actually
@@ -0,0 +1,218 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/shard.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include "rudp_packet.h"
+#include "rudp_shard.h"
+
+/* Peer stage */
+
+void rudp_shard_answer(struct rudp_peer *peer, struct rudp_packet_chain *rsp)
+{
+    if ( peer->shard_tag == 0 )
+        return;
+
+    rudp_packet_conn_option_add(rsp, RUDP_CONN_OPT_SHARD,
+                                &peer->shard_tag, sizeof(peer->shard_tag));
+}
+
+void rudp_shard_handle_answer(struct rudp_peer *peer,
+                              const struct rudp_packet_chain *rsp)
+{
+    size_t len;
+    const uint8_t *value = rudp_packet_conn_option_find(
+        rsp, sizeof(struct rudp_packet_conn_rsp), RUDP_CONN_OPT_SHARD, &len);
+
+    peer->shard_tag = 0;
+
+    if ( value && len == 1 && *value <= RUDP_SHARD_MAX )
+        peer->shard_tag = *value;
+}
+
+#if defined(__linux__)
+
+#include <stdio.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+
+#ifndef SO_INCOMING_CPU
+# define SO_INCOMING_CPU 49
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+# define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED 1
+#endif
+
+#define SHARD_NODE_MAX 1024
+
+/* Server stage */
+
+rudp_error_t rudp_server_set_shard(
+    struct rudp_server *server,
+    unsigned int index,
+    unsigned int count,
+    enum rudp_shard_steering steering,
+    int cpu)
+{
+    if ( count == 0 || count > RUDP_SHARD_MAX || index >= count )
+        return EINVAL;
+
+    // Program only knows the modulo, it would steer to another shard
+    if ( steering == RUDP_SHARD_STEER_CPU && cpu >= 0
+         && (unsigned int)cpu % count != index )
+        return EINVAL;
+
+    if ( server->endpoint.socket_fd != -1 )
+        return EBUSY;
+
+    server->shard_index = index;
+    server->shard_count = count;
+    server->shard_steering = steering;
+    server->shard_cpu = cpu;
+
+    rudp_endpoint_set_flags(&server->endpoint,
+                            server->endpoint.flags | RUDP_ENDPOINT_REUSEPORT);
+
+    return 0;
+}
+
+/*
+  Program runs on UDP payload, and returns the index of the socket
+  in the reuseport group.  An index out of the group makes the kernel
+  fall back to its hash.
+ */
+rudp_error_t rudp_shard_endpoint_setup(struct rudp_server *server,
+                                       struct rudp_endpoint *endpoint)
+{
+    struct sock_filter code[] = {
+        // Tag, in option bits of second byte
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, RUDP_OPT_SHARD_MASK),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, RUDP_OPT_SHARD_SHIFT),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 2, 0),
+        BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 1),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        // Untagged
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, server->shard_count),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+
+    if ( server->shard_steering == RUDP_SHARD_STEER_HASH )
+        code[6] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, (uint32_t)-1);
+
+    if ( server->shard_cpu >= 0
+         && setsockopt(endpoint->socket_fd, SOL_SOCKET, SO_INCOMING_CPU,
+                       &server->shard_cpu, sizeof(server->shard_cpu)) )
+        return errno;
+
+    if ( setsockopt(endpoint->socket_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                    &prog, sizeof(prog)) )
+        return errno;
+
+    return 0;
+}
+
+/* Thread placement */
+
+/*
+  NUMA node of a CPU, as linked in sysfs, -1 when unknown.
+ */
+static
+int shard_cpu_node(int cpu)
+{
+    char path[64];
+    struct dirent *entry;
+    DIR *dir;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if ( dir == NULL )
+        return -1;
+
+    while ( (entry = readdir(dir)) != NULL )
+        if ( sscanf(entry->d_name, "node%d", &node) == 1 )
+            break;
+
+    closedir(dir);
+
+    return node;
+}
+
+rudp_error_t rudp_shard_pin_thread(int cpu)
+{
+    unsigned long nodes[SHARD_NODE_MAX / (8 * sizeof(unsigned long))];
+    const size_t bits = 8 * sizeof(unsigned long);
+    cpu_set_t set;
+    int node;
+
+    if ( cpu < 0 || cpu >= CPU_SETSIZE )
+        return EINVAL;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ( sched_setaffinity(0, sizeof(set), &set) )
+        return errno;
+
+    node = shard_cpu_node(cpu);
+    if ( node < 0 || node >= SHARD_NODE_MAX )
+        return 0;
+
+    // Best effort, memory policy may be denied
+    memset(nodes, 0, sizeof(nodes));
+    nodes[node / bits] |= 1UL << (node % bits);
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes, SHARD_NODE_MAX);
+
+    return 0;
+}
+
+#else
+
+rudp_error_t rudp_server_set_shard(
+    struct rudp_server *server,
+    unsigned int index,
+    unsigned int count,
+    enum rudp_shard_steering steering,
+    int cpu)
+{
+    return ENOTSUP;
+}
+
+rudp_error_t rudp_shard_endpoint_setup(struct rudp_server *server,
+                                       struct rudp_endpoint *endpoint)
+{
+    return ENOTSUP;
+}
+
+rudp_error_t rudp_shard_pin_thread(int cpu)
+{
+    return ENOTSUP;
+}
+
+#endif
@@ -0,0 +1,528 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include <rudp/rudp.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_peer.h"
+#include "rudp_stats.h"
+#include "rudp_shm.h"
+
+/* "rshm" */
+#define SHM_MAGIC 0x7273686d
+#define SHM_VERSION 1
+#define SHM_NAME_PREFIX "/rudp-shm."
+#define SHM_RING_MIN 4096
+#define SHM_RING_MAX (64 << 20)
+/* Record length marking the end of the ring, reader must wrap */
+#define SHM_WRAP 0xffffffff
+#define SHM_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+/*
+  Ring control block.  Producer and consumer indexes are free-running
+  byte counters, on separate cache lines.
+ */
+struct shm_ring
+{
+    uint32_t head;
+    uint8_t pad0[60];
+    uint32_t tail;
+    uint8_t pad1[60];
+    uint32_t need_wakeup;
+    uint8_t pad2[60];
+};
+
+/*
+  Segment header, followed by data of ring 0 (from offering peer),
+  then data of ring 1 (to offering peer).
+ */
+struct shm_segment
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t token;
+    uint32_t ring_size;
+    uint8_t pad[48];
+    struct shm_ring ring[2];
+};
+
+struct shm_record
+{
+    uint32_t len;
+    uint32_t reserved;
+};
+
+struct rudp_shm
+{
+    struct shm_segment *segment;
+    size_t size;
+    struct shm_ring *tx;
+    struct shm_ring *rx;
+    uint8_t *tx_data;
+    uint8_t *rx_data;
+    uint32_t ring_size;
+    uint32_t token;
+    char name[RUDP_SHM_NAME_SIZE];
+    uint8_t linked:1;
+    uint8_t ready:1;
+    uint8_t in_rx:1;
+    uint8_t dying:1;
+    uint8_t closed:1;
+};
+
+static
+size_t shm_segment_size(uint32_t ring_size)
+{
+    return sizeof(struct shm_segment) + 2 * (size_t)ring_size;
+}
+
+static
+int shm_ring_size_valid(uint32_t ring_size)
+{
+    return ring_size >= SHM_RING_MIN && ring_size <= SHM_RING_MAX
+        && (ring_size & (ring_size - 1)) == 0;
+}
+
+/*
+  Attaches rings of a mapped segment to a shm context.  Offering peer
+  transmits on ring 0.
+ */
+static
+void shm_setup(struct rudp_shm *shm, int offering)
+{
+    uint8_t *data = (uint8_t *)(shm->segment + 1);
+
+    shm->tx = &shm->segment->ring[!offering];
+    shm->rx = &shm->segment->ring[!!offering];
+    shm->tx_data = data + (offering ? 0 : shm->ring_size);
+    shm->rx_data = data + (offering ? shm->ring_size : 0);
+}
+
+static
+void shm_free(struct rudp *rudp, struct rudp_shm *shm)
+{
+    if ( shm->segment )
+        munmap(shm->segment, shm->size);
+    if ( shm->linked )
+        shm_unlink(shm->name);
+    rudp_free(rudp, shm, sizeof(*shm));
+}
+
+/*
+  A remote address is local if we can bind a socket to it.
+ */
+static
+int shm_address_is_local(const struct rudp_address *address)
+{
+    const struct sockaddr_storage *addr;
+    struct sockaddr_storage local;
+    socklen_t size;
+    int fd, ret;
+
+    if ( rudp_address_get(address, &addr, &size) )
+        return 0;
+
+    memcpy(&local, addr, size);
+    switch ( local.ss_family ) {
+    case AF_INET:
+        ((struct sockaddr_in *)&local)->sin_port = 0;
+        break;
+    case AF_INET6:
+        ((struct sockaddr_in6 *)&local)->sin6_port = 0;
+        break;
+    default:
+        return 0;
+    }
+
+    fd = socket(local.ss_family, SOCK_DGRAM, 0);
+    if ( fd == -1 )
+        return 0;
+
+    ret = bind(fd, (const struct sockaddr *)&local, size);
+    close(fd);
+
+    return ret == 0;
+}
+
+rudp_error_t rudp_shm_offer(struct rudp_peer *peer, uint32_t ring_size)
+{
+    struct rudp *rudp = peer->rudp;
+    struct rudp_packet_chain *pc;
+    struct rudp_packet_shm_offer *offer;
+    struct rudp_shm *shm;
+    rudp_error_t err;
+    int fd;
+
+    if ( peer->shm )
+        return EBUSY;
+
+    if ( !shm_ring_size_valid(ring_size) )
+        return EINVAL;
+
+    if ( !shm_address_is_local(&peer->address) )
+        return 0;
+
+    shm = rudp_alloc(rudp, sizeof(*shm));
+    if ( shm == NULL )
+        return ENOMEM;
+
+    memset(shm, 0, sizeof(*shm));
+    shm->ring_size = ring_size;
+    shm->size = shm_segment_size(ring_size);
+    shm->token = ((uint32_t)rudp_random(rudp) << 16) | rudp_random(rudp);
+    snprintf(shm->name, sizeof(shm->name), SHM_NAME_PREFIX "%u.%08x",
+             (unsigned int)getpid(), shm->token);
+
+    fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ( fd == -1 ) {
+        err = errno;
+        goto fail;
+    }
+    shm->linked = 1;
+
+    if ( ftruncate(fd, shm->size) ) {
+        err = errno;
+        close(fd);
+        goto fail;
+    }
+
+    shm->segment = mmap(NULL, shm->size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    close(fd);
+    if ( shm->segment == MAP_FAILED ) {
+        shm->segment = NULL;
+        err = errno;
+        goto fail;
+    }
+
+    shm->segment->magic = SHM_MAGIC;
+    shm->segment->version = SHM_VERSION;
+    shm->segment->token = shm->token;
+    shm->segment->ring_size = ring_size;
+    shm->segment->ring[0].need_wakeup = 1;
+    shm->segment->ring[1].need_wakeup = 1;
+    shm_setup(shm, 1);
+
+    pc = rudp_packet_chain_alloc(rudp, sizeof(*offer));
+    if ( pc == NULL ) {
+        err = ENOMEM;
+        goto fail;
+    }
+
+    offer = &pc->packet->shm_offer;
+    offer->header.command = RUDP_CMD_SHM_OFFER;
+    offer->token = htonl(shm->token);
+    offer->ring_size = htonl(ring_size);
+    memset(offer->name, 0, sizeof(offer->name));
+    strcpy(offer->name, shm->name);
+
+    peer->shm = shm;
+
+    rudp_log_printf(rudp, RUDP_LOG_INFO,
+                    "Offering shared memory transport %s\n", shm->name);
+
+    return rudp_peer_send_reliable(peer, pc);
+
+fail:
+    shm_free(rudp, shm);
+    return err;
+}
+
+static
+rudp_error_t shm_map(struct rudp_peer *peer,
+                     const struct rudp_packet_shm_offer *offer)
+{
+    struct rudp *rudp = peer->rudp;
+    struct rudp_shm *shm;
+    struct stat st;
+    uint32_t ring_size = ntohl(offer->ring_size);
+    rudp_error_t err = 0;
+    int fd;
+
+    if ( memchr(offer->name, 0, sizeof(offer->name)) == NULL
+         || strncmp(offer->name, SHM_NAME_PREFIX,
+                    strlen(SHM_NAME_PREFIX))
+         || !shm_ring_size_valid(ring_size) )
+        return EINVAL;
+
+    shm = rudp_alloc(rudp, sizeof(*shm));
+    if ( shm == NULL )
+        return ENOMEM;
+
+    memset(shm, 0, sizeof(*shm));
+    shm->ring_size = ring_size;
+    shm->size = shm_segment_size(ring_size);
+    shm->token = ntohl(offer->token);
+    strcpy(shm->name, offer->name);
+
+    // Fails if peer is not on the same host
+    fd = shm_open(shm->name, O_RDWR, 0);
+    if ( fd == -1 ) {
+        err = errno;
+        goto fail;
+    }
+
+    if ( fstat(fd, &st) == 0 && (size_t)st.st_size == shm->size )
+        shm->segment = mmap(NULL, shm->size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+    close(fd);
+
+    if ( shm->segment == NULL || shm->segment == MAP_FAILED ) {
+        shm->segment = NULL;
+        err = EINVAL;
+        goto fail;
+    }
+
+    if ( shm->segment->magic != SHM_MAGIC
+         || shm->segment->version != SHM_VERSION
+         || shm->segment->token != shm->token
+         || shm->segment->ring_size != ring_size ) {
+        err = EINVAL;
+        goto fail;
+    }
+
+    shm_setup(shm, 0);
+    shm->ready = 1;
+    peer->shm = shm;
+
+    return 0;
+
+fail:
+    shm_free(rudp, shm);
+    return err;
+}
+
+void rudp_shm_handle_offer(struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_shm_offer *offer = &pc->packet->shm_offer;
+    struct rudp_packet_chain *out;
+    struct rudp_packet_shm_accept *answer;
+    rudp_error_t err = EPERM;
+
+    if ( pc->len < sizeof(*offer) )
+        return;
+
+    if ( peer->shm_accept && peer->shm == NULL )
+        err = shm_map(peer, offer);
+
+    rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                    "Shared memory transport %.*s %s (%s)\n",
+                    (int)sizeof(offer->name), offer->name,
+                    err ? "refused" : "accepted", strerror(err));
+
+    out = rudp_packet_chain_alloc(peer->rudp, sizeof(*answer));
+    if ( out == NULL )
+        return;
+
+    answer = &out->packet->shm_accept;
+    answer->header.command = RUDP_CMD_SHM_ACCEPT;
+    answer->token = offer->token;
+    answer->accepted = htonl(err == 0);
+
+    rudp_peer_send_reliable(peer, out);
+}
+
+void rudp_shm_handle_accept(struct rudp_peer *peer,
+                            const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_shm_accept *answer = &pc->packet->shm_accept;
+    struct rudp_shm *shm = peer->shm;
+
+    if ( pc->len < sizeof(*answer) || shm == NULL || shm->ready
+         || ntohl(answer->token) != shm->token )
+        return;
+
+    // Both peers have it mapped, or never will
+    shm_unlink(shm->name);
+    shm->linked = 0;
+
+    if ( !ntohl(answer->accepted) ) {
+        rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                        "Shared memory transport refused\n");
+        rudp_shm_close(peer);
+        return;
+    }
+
+    rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                    "Shared memory transport accepted\n");
+
+    shm->ready = 1;
+}
+
+rudp_error_t rudp_shm_send(struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc)
+{
+    struct rudp_shm *shm = peer->shm;
+    struct shm_record *record;
+    size_t len, size;
+    uint32_t head, tail, offset, contiguous, need;
+
+    if ( shm == NULL || !shm->ready )
+        return EAGAIN;
+
+    len = rudp_packet_chain_size(pc);
+    size = SHM_ALIGN(sizeof(*record) + len);
+    if ( size > shm->ring_size / 2 )
+        return EAGAIN;
+
+    head = shm->tx->head;
+    tail = __atomic_load_n(&shm->tx->tail, __ATOMIC_ACQUIRE);
+    offset = head & (shm->ring_size - 1);
+    contiguous = shm->ring_size - offset;
+    need = size;
+    if ( contiguous < size )
+        need += contiguous;
+
+    if ( shm->ring_size - (head - tail) < need )
+        return EAGAIN;
+
+    if ( contiguous < size ) {
+        record = (struct shm_record *)(shm->tx_data + offset);
+        record->len = SHM_WRAP;
+        head += contiguous;
+        offset = 0;
+    }
+
+    record = (struct shm_record *)(shm->tx_data + offset);
+    record->len = len;
+    memcpy(record + 1, pc->packet, pc->len);
+    if ( pc->payload )
+        memcpy((uint8_t *)(record + 1) + pc->len,
+               pc->payload->data, pc->payload->len);
+
+    __atomic_store_n(&shm->tx->head, head + size, __ATOMIC_SEQ_CST);
+
+    // Reader went to sleep on an empty ring
+    if ( __atomic_exchange_n(&shm->tx->need_wakeup, 0, __ATOMIC_SEQ_CST) )
+        rudp_peer_send_noop_noqueue(peer);
+
+    return 0;
+}
+
+static
+void shm_deliver(struct rudp_peer *peer, uint8_t *data, uint32_t len)
+{
+    struct rudp_packet_chain pc;
+
+    if ( len < sizeof(struct rudp_packet_header) )
+        return;
+
+    pc.packet = (struct rudp_packet *)data;
+    pc.alloc_size = len;
+    pc.len = len;
+    pc.payload = NULL;
+    rudp_list_init(&pc.chain_item);
+
+    if ( peer->stats ) {
+        rudp_stats_write_begin(&peer->stats->seq);
+        rudp_stats_count_in(&peer->stats->counters, len);
+        rudp_stats_write_end(&peer->stats->seq);
+    }
+
+    rudp_peer_handle_data(peer, &pc);
+}
+
+int rudp_shm_receive(struct rudp_peer *peer)
+{
+    struct rudp_shm *shm = peer->shm;
+    struct rudp *rudp = peer->rudp;
+    int count = 0;
+    uint32_t head, tail;
+
+    if ( shm == NULL || shm->in_rx )
+        return 0;
+
+    shm->in_rx = 1;
+    tail = shm->rx->tail;
+
+    while ( !shm->dying ) {
+        head = __atomic_load_n(&shm->rx->head, __ATOMIC_ACQUIRE);
+
+        if ( head == tail ) {
+            // Ask for a wakeup, then check again for a racing writer
+            __atomic_store_n(&shm->rx->need_wakeup, 1, __ATOMIC_SEQ_CST);
+            if ( __atomic_load_n(&shm->rx->head, __ATOMIC_SEQ_CST) == tail )
+                break;
+            __atomic_store_n(&shm->rx->need_wakeup, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        while ( tail != head && !shm->dying ) {
+            uint32_t offset = tail & (shm->ring_size - 1);
+            struct shm_record *record =
+                (struct shm_record *)(shm->rx_data + offset);
+            uint32_t len = record->len;
+
+            if ( len == SHM_WRAP ) {
+                tail += shm->ring_size - offset;
+                continue;
+            }
+
+            if ( len > shm->ring_size / 2
+                 || offset + sizeof(*record) + len > shm->ring_size ) {
+                rudp_log_printf(rudp, RUDP_LOG_ERROR,
+                                "Corrupted shared memory ring\n");
+                shm->dying = 1;
+                peer->shm = NULL;
+                break;
+            }
+
+            shm_deliver(peer, (uint8_t *)(record + 1), len);
+            count++;
+
+            tail += SHM_ALIGN(sizeof(*record) + len);
+            __atomic_store_n(&shm->rx->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+
+    shm->in_rx = 0;
+
+    // Peer may be gone along with it
+    if ( shm->closed )
+        count = -1;
+
+    if ( shm->dying )
+        shm_free(rudp, shm);
+
+    return count;
+}
+
+void rudp_shm_close(struct rudp_peer *peer)
+{
+    struct rudp_shm *shm = peer->shm;
+
+    if ( shm == NULL )
+        return;
+
+    peer->shm = NULL;
+
+    // Called from a packet handler, receive loop frees it
+    if ( shm->in_rx ) {
+        shm->dying = 1;
+        shm->closed = 1;
+        return;
+    }
+
+    shm_free(peer->rudp, shm);
+}
@@ -0,0 +1,538 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/stats.h>
+#include <rudp/rudp.h>
+#include <rudp/peer.h>
+#include <rudp/endpoint.h>
+#include "rudp_list.h"
+#include "rudp_rudp.h"
+#include "rudp_stats.h"
+
+/* Gauges refresh period, in milliseconds */
+#define STATS_REFRESH_INTERVAL 100
+/* Reader gives up after this count of inconsistent copies */
+#define STATS_READ_RETRIES 1000
+
+static void _stats_refresh(struct ela_event_source *src,
+                           int fd, uint32_t mask, void *data);
+
+static
+rudp_error_t stats_shm_name(char *buffer, size_t size, const char *name)
+{
+    if ( name == NULL || *name == 0 || strchr(name, '/') )
+        return EINVAL;
+
+    if ( (size_t)snprintf(buffer, size, "/rudp.%s", name) >= size )
+        return ENAMETOOLONG;
+
+    return 0;
+}
+
+static
+void stats_refresh_schedule(struct rudp *rudp)
+{
+    struct timeval tv;
+
+    rudp_timestamp_to_timeval(&tv, STATS_REFRESH_INTERVAL);
+    ela_set_timeout(rudp->el, rudp->stats->refresh_source,
+                    &tv, ELA_EVENT_ONCE);
+    ela_add(rudp->el, rudp->stats->refresh_source);
+}
+
+rudp_error_t rudp_stats_open(
+    struct rudp *rudp,
+    const char *name,
+    unsigned int max_endpoints,
+    unsigned int max_peers)
+{
+    struct rudp_stats *stats;
+    struct rudp_stats_segment *segment;
+    size_t endpoint_offset, peer_offset, size;
+    rudp_error_t err;
+    int fd;
+
+    if ( rudp->stats )
+        return EBUSY;
+
+    stats = rudp_alloc(rudp, sizeof(*stats));
+    if ( stats == NULL )
+        return ENOMEM;
+
+    memset(stats, 0, sizeof(*stats));
+
+    err = stats_shm_name(stats->name, sizeof(stats->name), name);
+    if ( err )
+        goto free_stats;
+
+    stats->endpoint = rudp_alloc(
+        rudp, sizeof(*stats->endpoint) * (max_endpoints + 1));
+    stats->peer = rudp_alloc(
+        rudp, sizeof(*stats->peer) * (max_peers + 1));
+    if ( stats->endpoint == NULL || stats->peer == NULL ) {
+        err = ENOMEM;
+        goto free_owners;
+    }
+
+    memset(stats->endpoint, 0, sizeof(*stats->endpoint) * max_endpoints);
+    memset(stats->peer, 0, sizeof(*stats->peer) * max_peers);
+
+    endpoint_offset = sizeof(*segment);
+    peer_offset = endpoint_offset
+        + sizeof(struct rudp_stats_endpoint) * max_endpoints;
+    size = peer_offset + sizeof(struct rudp_stats_peer) * max_peers;
+
+    fd = shm_open(stats->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( fd == -1 ) {
+        err = errno;
+        goto free_owners;
+    }
+
+    if ( ftruncate(fd, size) == -1 ) {
+        err = errno;
+        close(fd);
+        goto unlink;
+    }
+
+    segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if ( segment == MAP_FAILED ) {
+        err = errno;
+        goto unlink;
+    }
+
+    // Segment is zero-filled by ftruncate
+    segment->version = RUDP_STATS_VERSION;
+    segment->pid = getpid();
+    segment->max_endpoints = max_endpoints;
+    segment->max_peers = max_peers;
+    segment->endpoint_offset = endpoint_offset;
+    segment->peer_offset = peer_offset;
+    segment->global.refresh_time = rudp_timestamp();
+    // Readers check magic last
+    __atomic_store_n(&segment->magic, RUDP_STATS_MAGIC, __ATOMIC_RELEASE);
+
+    stats->segment = segment;
+    stats->size = size;
+    stats->endpoint_slot = (struct rudp_stats_endpoint *)
+        ((uint8_t *)segment + endpoint_offset);
+    stats->peer_slot = (struct rudp_stats_peer *)
+        ((uint8_t *)segment + peer_offset);
+
+    ela_source_alloc(rudp->el, _stats_refresh, rudp, &stats->refresh_source);
+
+    rudp->stats = stats;
+
+    stats_refresh_schedule(rudp);
+
+    rudp_log_printf(rudp, RUDP_LOG_INFO,
+                    "Statistics published in %s\n", stats->name);
+
+    return 0;
+
+unlink:
+    shm_unlink(stats->name);
+free_owners:
+    if ( stats->endpoint )
+        rudp_free(rudp, stats->endpoint,
+                  sizeof(*stats->endpoint) * (max_endpoints + 1));
+    if ( stats->peer )
+        rudp_free(rudp, stats->peer,
+                  sizeof(*stats->peer) * (max_peers + 1));
+free_stats:
+    rudp_free(rudp, stats, sizeof(*stats));
+    return err;
+}
+
+void rudp_stats_close(struct rudp *rudp)
+{
+    struct rudp_stats *stats = rudp->stats;
+    unsigned int i;
+
+    if ( stats == NULL )
+        return;
+
+    for ( i = 0; i < stats->segment->max_endpoints; ++i )
+        if ( stats->endpoint[i] )
+            stats->endpoint[i]->stats = NULL;
+
+    for ( i = 0; i < stats->segment->max_peers; ++i )
+        if ( stats->peer[i] )
+            stats->peer[i]->stats = NULL;
+
+    ela_remove(rudp->el, stats->refresh_source);
+    ela_source_free(rudp->el, stats->refresh_source);
+
+    rudp_free(rudp, stats->endpoint,
+              sizeof(*stats->endpoint) * (stats->segment->max_endpoints + 1));
+    rudp_free(rudp, stats->peer,
+              sizeof(*stats->peer) * (stats->segment->max_peers + 1));
+
+    munmap(stats->segment, stats->size);
+    shm_unlink(stats->name);
+
+    rudp_free(rudp, stats, sizeof(*stats));
+
+    rudp->stats = NULL;
+}
+
+/* Slot attribution */
+
+void rudp_stats_endpoint_register(struct rudp *rudp,
+                                  struct rudp_endpoint *endpoint)
+{
+    struct rudp_stats *stats = rudp->stats;
+    unsigned int i;
+
+    if ( stats == NULL || endpoint->stats )
+        return;
+
+    for ( i = 0; i < stats->segment->max_endpoints; ++i ) {
+        struct rudp_stats_endpoint *slot = &stats->endpoint_slot[i];
+
+        if ( stats->endpoint[i] )
+            continue;
+
+        stats->endpoint[i] = endpoint;
+        endpoint->stats = slot;
+
+        rudp_stats_write_begin(&slot->seq);
+        memset(&slot->counters, 0, sizeof(slot->counters));
+        snprintf(slot->address, sizeof(slot->address), "%s",
+                 rudp_address_text(&endpoint->addr));
+        slot->in_use = 1;
+        rudp_stats_write_end(&slot->seq);
+
+        rudp_stats_write_begin(&stats->segment->global.seq);
+        stats->segment->global.endpoints++;
+        rudp_stats_write_end(&stats->segment->global.seq);
+        return;
+    }
+}
+
+void rudp_stats_endpoint_unregister(struct rudp *rudp,
+                                    struct rudp_endpoint *endpoint)
+{
+    struct rudp_stats *stats = rudp->stats;
+    struct rudp_stats_endpoint *slot = endpoint->stats;
+
+    if ( stats == NULL || slot == NULL )
+        return;
+
+    stats->endpoint[slot - stats->endpoint_slot] = NULL;
+    endpoint->stats = NULL;
+
+    rudp_stats_write_begin(&slot->seq);
+    slot->in_use = 0;
+    rudp_stats_write_end(&slot->seq);
+
+    rudp_stats_write_begin(&stats->segment->global.seq);
+    stats->segment->global.endpoints--;
+    rudp_stats_write_end(&stats->segment->global.seq);
+}
+
+void rudp_stats_peer_register(struct rudp *rudp, struct rudp_peer *peer)
+{
+    struct rudp_stats *stats = rudp->stats;
+    struct rudp_stats_global *global;
+    unsigned int i;
+
+    if ( stats == NULL || peer->stats )
+        return;
+
+    global = &stats->segment->global;
+
+    for ( i = 0; i < stats->segment->max_peers; ++i ) {
+        struct rudp_stats_peer *slot = &stats->peer_slot[i];
+
+        if ( stats->peer[i] )
+            continue;
+
+        stats->peer[i] = peer;
+        peer->stats = slot;
+
+        rudp_stats_write_begin(&slot->seq);
+        memset(&slot->counters, 0, sizeof(slot->counters));
+        slot->address[0] = 0;
+        slot->srtt = peer->srtt;
+        slot->rttvar = peer->rttvar;
+        slot->rto = peer->rto;
+        slot->queue_depth = 0;
+        slot->state = peer->state;
+        slot->in_use = 1;
+        rudp_stats_write_end(&slot->seq);
+
+        rudp_stats_write_begin(&global->seq);
+        global->peers++;
+        rudp_stats_write_end(&global->seq);
+        return;
+    }
+
+    rudp_stats_write_begin(&global->seq);
+    global->peers_untracked++;
+    rudp_stats_write_end(&global->seq);
+}
+
+void rudp_stats_peer_unregister(struct rudp *rudp, struct rudp_peer *peer)
+{
+    struct rudp_stats *stats = rudp->stats;
+    struct rudp_stats_peer *slot = peer->stats;
+
+    if ( stats == NULL || slot == NULL )
+        return;
+
+    stats->peer[slot - stats->peer_slot] = NULL;
+    peer->stats = NULL;
+
+    rudp_stats_write_begin(&slot->seq);
+    slot->in_use = 0;
+    rudp_stats_write_end(&slot->seq);
+
+    rudp_stats_write_begin(&stats->segment->global.seq);
+    stats->segment->global.peers--;
+    rudp_stats_write_end(&stats->segment->global.seq);
+}
+
+/* Traffic accounting */
+
+void rudp_stats_endpoint_in(struct rudp_endpoint *endpoint, size_t bytes)
+{
+    struct rudp_stats_global *global = &endpoint->rudp->stats->segment->global;
+
+    rudp_stats_write_begin(&endpoint->stats->seq);
+    rudp_stats_count_in(&endpoint->stats->counters, bytes);
+    rudp_stats_write_end(&endpoint->stats->seq);
+
+    rudp_stats_write_begin(&global->seq);
+    rudp_stats_count_in(&global->counters, bytes);
+    rudp_stats_write_end(&global->seq);
+}
+
+void rudp_stats_endpoint_out(struct rudp_endpoint *endpoint, size_t bytes)
+{
+    struct rudp_stats_global *global = &endpoint->rudp->stats->segment->global;
+
+    rudp_stats_write_begin(&endpoint->stats->seq);
+    rudp_stats_count_out(&endpoint->stats->counters, bytes);
+    rudp_stats_write_end(&endpoint->stats->seq);
+
+    rudp_stats_write_begin(&global->seq);
+    rudp_stats_count_out(&global->counters, bytes);
+    rudp_stats_write_end(&global->seq);
+}
+
+void rudp_stats_endpoint_error(struct rudp_endpoint *endpoint)
+{
+    struct rudp_stats_global *global = &endpoint->rudp->stats->segment->global;
+
+    rudp_stats_write_begin(&endpoint->stats->seq);
+    endpoint->stats->counters.send_errors++;
+    rudp_stats_write_end(&endpoint->stats->seq);
+
+    rudp_stats_write_begin(&global->seq);
+    global->counters.send_errors++;
+    rudp_stats_write_end(&global->seq);
+}
+
+void rudp_stats_peer_retransmit(struct rudp_peer *peer)
+{
+    struct rudp_stats_global *global = &peer->rudp->stats->segment->global;
+
+    rudp_stats_write_begin(&peer->stats->seq);
+    peer->stats->counters.retransmits++;
+    rudp_stats_write_end(&peer->stats->seq);
+
+    rudp_stats_write_begin(&global->seq);
+    global->counters.retransmits++;
+    rudp_stats_write_end(&global->seq);
+}
+
+/* Gauges */
+
+static
+void stats_refresh(struct rudp *rudp)
+{
+    struct rudp_stats *stats = rudp->stats;
+    struct rudp_stats_global *global = &stats->segment->global;
+    unsigned int i;
+
+    for ( i = 0; i < stats->segment->max_peers; ++i ) {
+        struct rudp_peer *peer = stats->peer[i];
+        struct rudp_stats_peer *slot = &stats->peer_slot[i];
+
+        if ( peer == NULL )
+            continue;
+
+        rudp_stats_write_begin(&slot->seq);
+        slot->srtt = peer->srtt;
+        slot->rttvar = peer->rttvar;
+        slot->rto = peer->rto;
+        slot->queue_depth = rudp_list_length(&peer->sendq);
+        slot->state = peer->state;
+        snprintf(slot->address, sizeof(slot->address), "%s",
+                 rudp_address_text(&peer->address));
+        rudp_stats_write_end(&slot->seq);
+    }
+
+    rudp_stats_write_begin(&global->seq);
+    global->allocated_packets = rudp->allocated_packets;
+    global->free_packets = rudp->free_packets;
+    global->refresh_time = rudp_timestamp();
+    rudp_stats_write_end(&global->seq);
+
+    stats_refresh_schedule(rudp);
+}
+
+static void _stats_refresh(struct ela_event_source *src,
+                           int fd, uint32_t mask, void *data)
+{
+    return stats_refresh((struct rudp *)data);
+}
+
+/* Reader side */
+
+rudp_error_t rudp_stats_reader_open(
+    struct rudp_stats_reader *reader,
+    const char *name)
+{
+    const struct rudp_stats_segment *segment;
+    char shm_name[64];
+    struct stat st;
+    rudp_error_t err;
+    int fd;
+
+    err = stats_shm_name(shm_name, sizeof(shm_name), name);
+    if ( err )
+        return err;
+
+    fd = shm_open(shm_name, O_RDONLY, 0);
+    if ( fd == -1 )
+        return errno;
+
+    if ( fstat(fd, &st) == -1 ) {
+        err = errno;
+        close(fd);
+        return err;
+    }
+
+    if ( (size_t)st.st_size < sizeof(*segment) ) {
+        close(fd);
+        return EPROTO;
+    }
+
+    segment = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if ( segment == MAP_FAILED )
+        return errno;
+
+    if ( __atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE)
+             != RUDP_STATS_MAGIC
+         || segment->version != RUDP_STATS_VERSION
+         || segment->peer_offset
+             + (size_t)segment->max_peers * sizeof(struct rudp_stats_peer)
+             > (size_t)st.st_size ) {
+        munmap((void *)segment, st.st_size);
+        return EPROTO;
+    }
+
+    reader->segment = segment;
+    reader->size = st.st_size;
+
+    return 0;
+}
+
+void rudp_stats_reader_close(struct rudp_stats_reader *reader)
+{
+    munmap((void *)reader->segment, reader->size);
+    reader->segment = NULL;
+    reader->size = 0;
+}
+
+/*
+  Seqlock reader side.  Copy is retried while writer is updating the
+  record.
+ */
+static
+int stats_read(const uint32_t *seq, void *dest, const void *src, size_t size)
+{
+    unsigned int tries;
+
+    for ( tries = 0; tries < STATS_READ_RETRIES; ++tries ) {
+        uint32_t before = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+
+        if ( before & 1 )
+            continue;
+
+        memcpy(dest, src, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if ( __atomic_load_n(seq, __ATOMIC_RELAXED) == before )
+            return 1;
+    }
+
+    return 0;
+}
+
+int rudp_stats_reader_global(
+    const struct rudp_stats_reader *reader,
+    struct rudp_stats_global *global)
+{
+    const struct rudp_stats_global *src = &reader->segment->global;
+
+    return stats_read(&src->seq, global, src, sizeof(*global));
+}
+
+int rudp_stats_reader_endpoint(
+    const struct rudp_stats_reader *reader,
+    unsigned int index,
+    struct rudp_stats_endpoint *endpoint)
+{
+    const struct rudp_stats_segment *segment = reader->segment;
+    const struct rudp_stats_endpoint *src;
+
+    if ( index >= segment->max_endpoints )
+        return 0;
+
+    src = (const struct rudp_stats_endpoint *)
+        ((const uint8_t *)segment + segment->endpoint_offset) + index;
+
+    return stats_read(&src->seq, endpoint, src, sizeof(*endpoint))
+        && endpoint->in_use;
+}
+
+int rudp_stats_reader_peer(
+    const struct rudp_stats_reader *reader,
+    unsigned int index,
+    struct rudp_stats_peer *peer)
+{
+    const struct rudp_stats_segment *segment = reader->segment;
+    const struct rudp_stats_peer *src;
+
+    if ( index >= segment->max_peers )
+        return 0;
+
+    src = (const struct rudp_stats_peer *)
+        ((const uint8_t *)segment + segment->peer_offset) + index;
+
+    return stats_read(&src->seq, peer, src, sizeof(*peer))
+        && peer->in_use;
+}
@@ -0,0 +1,383 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/stream.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_list.h"
+#include "rudp_packet.h"
+#include "rudp_peer.h"
+#include "rudp_rudp.h"
+#include "rudp_stream.h"
+#include "rudp_transfer.h"
+
+/*
+  Fragments are kept below usual path MTU, as bundles are.
+ */
+#define STREAM_FRAGMENT_DATA \
+    (RUDP_BUNDLE_MAX_SIZE - sizeof(struct rudp_packet_stream))
+
+/*
+  A message being sent, or the range of a file from start.  It is
+  only on the peer list until all its fragments are queued, and lives
+  until they are all released.
+ */
+struct stream_tx
+{
+    struct rudp_list item;
+    struct rudp *rudp;
+    const uint8_t *data;
+    uint64_t size;
+    uint64_t start;
+    uint64_t offset;
+    uint32_t id;
+    uint8_t command;
+    uint8_t flags;
+    uint8_t queued;
+    unsigned int pending;
+    rudp_buffer_done_func_t *fragment_done;
+    rudp_buffer_done_func_t *done;
+    void *priv;
+};
+
+struct rudp_stream
+{
+    struct rudp_list tx_list;
+    uint64_t rx_size;
+    uint64_t rx_offset;
+    uint8_t rx_active;
+};
+
+static
+struct rudp_stream *stream_get(struct rudp_peer *peer)
+{
+    struct rudp_stream *stream = peer->stream;
+
+    if ( stream )
+        return stream;
+
+    stream = rudp_alloc(peer->rudp, sizeof(*stream));
+    if ( stream == NULL )
+        return NULL;
+
+    rudp_list_init(&stream->tx_list);
+    stream->rx_size = 0;
+    stream->rx_offset = 0;
+    stream->rx_active = 0;
+    peer->stream = stream;
+
+    return stream;
+}
+
+/* Sender */
+
+static
+void stream_tx_release(struct stream_tx *tx)
+{
+    if ( tx->done )
+        tx->done(tx->data, tx->size, tx->priv);
+
+    rudp_free(tx->rudp, tx, sizeof(*tx));
+}
+
+static
+void stream_fragment_done(const void *data, size_t size, void *priv)
+{
+    struct stream_tx *tx = priv;
+
+    if ( tx->fragment_done )
+        tx->fragment_done(data, size, tx->priv);
+
+    if ( --tx->pending == 0 && tx->queued )
+        stream_tx_release(tx);
+}
+
+/*
+  No more fragment of this message will be queued.
+ */
+static
+void stream_tx_queued(struct stream_tx *tx)
+{
+    rudp_list_remove(&tx->item);
+    tx->queued = 1;
+
+    if ( tx->pending == 0 )
+        stream_tx_release(tx);
+}
+
+static
+rudp_error_t stream_tx_fragment(struct rudp_peer *peer, struct stream_tx *tx)
+{
+    uint64_t len = tx->size - tx->offset;
+    struct rudp_payload *payload;
+    struct rudp_packet_chain *pc;
+    uint8_t flags = tx->flags;
+
+    if ( len > STREAM_FRAGMENT_DATA )
+        len = STREAM_FRAGMENT_DATA;
+
+    if ( tx->offset == tx->start )
+        flags |= RUDP_STREAM_BEGIN;
+    if ( tx->offset + len == tx->size )
+        flags |= RUDP_STREAM_END;
+
+    payload = rudp_payload_wrap(peer->rudp, tx->data + tx->offset, len,
+                                stream_fragment_done, tx);
+    if ( payload == NULL )
+        return ENOMEM;
+
+    pc = rudp_packet_chain_alloc_payload(
+        peer->rudp, sizeof(struct rudp_packet_stream), payload);
+    if ( pc == NULL ) {
+        payload->done = NULL;
+        rudp_payload_unref(peer->rudp, payload);
+        return ENOMEM;
+    }
+
+    // Chain holds the only reference from now on
+    tx->pending++;
+    rudp_payload_unref(peer->rudp, payload);
+
+    pc->packet->stream.header.command = tx->command;
+    pc->packet->stream.flags = flags;
+    memset(pc->packet->stream.reserved, 0,
+           sizeof(pc->packet->stream.reserved));
+    pc->packet->stream.id = htonl(tx->id);
+    rudp_stream_put64(pc->packet->stream.size, tx->size);
+    rudp_stream_put64(pc->packet->stream.offset, tx->offset);
+
+    tx->offset += len;
+
+    rudp_peer_send_stream(peer, pc);
+
+    return 0;
+}
+
+/*
+  Queues fragments of the oldest message while window allows.
+ */
+static
+void stream_tx_fill(struct rudp_peer *peer)
+{
+    struct rudp_stream *stream = peer->stream;
+    struct stream_tx *tx;
+
+    while ( peer->stream == stream && !rudp_list_empty(&stream->tx_list)
+            && (uint16_t)(peer->out_seq_reliable - peer->out_seq_acked)
+                   < RUDP_STREAM_WINDOW )
+    {
+        tx = __container_of(stream->tx_list.next, tx, item);
+
+        if ( stream_tx_fragment(peer, tx) )
+            return;
+
+        if ( tx->offset == tx->size )
+            stream_tx_queued(tx);
+    }
+}
+
+static
+struct stream_tx *stream_tx_new(struct rudp_peer *peer,
+                                const void *data, size_t size,
+                                rudp_buffer_done_func_t *done, void *priv)
+{
+    struct rudp_stream *stream = stream_get(peer);
+    struct stream_tx *tx;
+
+    if ( stream == NULL )
+        return NULL;
+
+    tx = rudp_alloc(peer->rudp, sizeof(*tx));
+    if ( tx == NULL )
+        return NULL;
+
+    tx->rudp = peer->rudp;
+    tx->data = data;
+    tx->size = size;
+    tx->start = 0;
+    tx->offset = 0;
+    tx->id = 0;
+    tx->command = RUDP_CMD_APP;
+    tx->flags = 0;
+    tx->queued = 0;
+    tx->pending = 0;
+    tx->fragment_done = NULL;
+    tx->done = done;
+    tx->priv = priv;
+
+    rudp_list_append(&stream->tx_list, &tx->item);
+
+    return tx;
+}
+
+rudp_error_t rudp_stream_send(struct rudp_peer *peer, uint8_t command,
+                              const void *data, size_t size,
+                              rudp_buffer_done_func_t *done, void *priv)
+{
+    struct stream_tx *tx = stream_tx_new(peer, data, size, done, priv);
+
+    if ( tx == NULL )
+        return ENOMEM;
+
+    tx->command = command;
+
+    stream_tx_fill(peer);
+
+    return 0;
+}
+
+rudp_error_t rudp_stream_send_file(struct rudp_peer *peer, uint32_t id,
+                                   const void *data, size_t size,
+                                   uint64_t offset,
+                                   rudp_buffer_done_func_t *fragment_done,
+                                   rudp_buffer_done_func_t *done,
+                                   void *priv)
+{
+    struct stream_tx *tx = stream_tx_new(peer, data, size, done, priv);
+
+    if ( tx == NULL )
+        return ENOMEM;
+
+    tx->id = id;
+    tx->flags = RUDP_STREAM_FILE;
+    tx->start = offset;
+    tx->offset = offset;
+    tx->fragment_done = fragment_done;
+
+    stream_tx_fill(peer);
+
+    return 0;
+}
+
+void rudp_stream_cancel_file(struct rudp_peer *peer, uint32_t id)
+{
+    struct stream_tx *tx, *tmp;
+
+    if ( peer->stream == NULL )
+        return;
+
+    rudp_list_for_each_safe(tx, tmp, &peer->stream->tx_list, item)
+        if ( (tx->flags & RUDP_STREAM_FILE) && tx->id == id )
+            stream_tx_queued(tx);
+}
+
+void rudp_stream_acked(struct rudp_peer *peer)
+{
+    stream_tx_fill(peer);
+}
+
+/* Receiver */
+
+static
+void stream_rx_end(struct rudp_peer *peer, rudp_error_t err)
+{
+    peer->stream->rx_active = 0;
+
+    if ( peer->handler->stream_end )
+        peer->handler->stream_end(peer, err);
+}
+
+void rudp_stream_receive(struct rudp_peer *peer,
+                         const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_stream *packet = &pc->packet->stream;
+    struct rudp_stream *stream;
+    uint64_t size, offset;
+    size_t len;
+
+    if ( pc->len < sizeof(*packet) ) {
+        rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
+                        "       short stream fragment, dropped\n");
+        return;
+    }
+
+    if ( packet->flags & RUDP_STREAM_FILE ) {
+        rudp_transfer_receive(peer, pc);
+        return;
+    }
+
+    stream = stream_get(peer);
+    if ( stream == NULL )
+        return;
+
+    len = pc->len - sizeof(*packet);
+    size = rudp_stream_get64(packet->size);
+    offset = rudp_stream_get64(packet->offset);
+
+    if ( packet->flags & RUDP_STREAM_BEGIN ) {
+        if ( stream->rx_active )
+            stream_rx_end(peer, ECONNABORTED);
+
+        if ( offset != 0 )
+            return;
+
+        stream->rx_active = 1;
+        stream->rx_size = size;
+        stream->rx_offset = 0;
+
+        if ( peer->handler->stream_begin )
+            peer->handler->stream_begin(
+                peer, packet->header.command - RUDP_CMD_APP, size);
+
+        // Handler may have dropped the peer
+        if ( peer->stream != stream )
+            return;
+    }
+
+    if ( !stream->rx_active )
+        return;
+
+    if ( size != stream->rx_size || offset != stream->rx_offset
+         || len > size - offset ) {
+        rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
+                        "       broken stream fragment\n");
+        stream_rx_end(peer, EPROTO);
+        return;
+    }
+
+    stream->rx_offset += len;
+
+    if ( len && peer->handler->stream_chunk )
+        peer->handler->stream_chunk(peer, offset, packet->data, len);
+
+    if ( peer->stream != stream )
+        return;
+
+    if ( packet->flags & RUDP_STREAM_END ) {
+        if ( stream->rx_offset == size )
+            stream_rx_end(peer, 0);
+        else
+            stream_rx_end(peer, EPROTO);
+    }
+}
+
+void rudp_stream_close(struct rudp_peer *peer)
+{
+    struct rudp_stream *stream = peer->stream;
+    struct stream_tx *tx, *tmp;
+
+    rudp_transfer_close(peer);
+
+    if ( stream == NULL )
+        return;
+
+    rudp_list_for_each_safe(tx, tmp, &stream->tx_list, item)
+        stream_tx_queued(tx);
+
+    if ( stream->rx_active )
+        stream_rx_end(peer, ECONNRESET);
+
+    peer->stream = NULL;
+    rudp_free(peer->rudp, stream, sizeof(*stream));
+}
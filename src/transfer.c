@@ -0,0 +1,711 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <rudp/transfer.h>
+#include <rudp/client.h>
+#include <rudp/server.h>
+#include <rudp/peer.h>
+#include <rudp/packet.h>
+#include "rudp_list.h"
+#include "rudp_packet.h"
+#include "rudp_peer.h"
+#include "rudp_rudp.h"
+#include "rudp_stream.h"
+#include "rudp_transfer.h"
+
+/*
+  Mapping of a file being sent.  Fragments in flight reference it,
+  it is unmapped once sender closed and the last one is released.
+ */
+struct rudp_file_map
+{
+    struct rudp *rudp;
+    struct rudp_file_sender *sender;
+    void *base;
+    size_t size;
+    unsigned int refs;
+};
+
+static
+void transfer_progress_fill(struct rudp_file_progress *progress,
+                            uint64_t size, uint64_t done, uint64_t start,
+                            rudp_time_t start_time, rudp_time_t end_time)
+{
+    progress->size = size;
+    progress->done = done;
+    progress->elapsed = end_time - start_time;
+    progress->rate = progress->elapsed
+        ? (done - start) * 1000 / progress->elapsed : 0;
+}
+
+/*
+  Control packets carry no data, except offers, that carry the file
+  version.
+ */
+static
+void transfer_send_packet(struct rudp_peer *peer, uint8_t flags,
+                          uint32_t id, uint64_t size, uint64_t offset,
+                          const uint64_t *version)
+{
+    size_t len = sizeof(struct rudp_packet_stream)
+        + (version ? sizeof(*version) : 0);
+    struct rudp_packet_chain *pc = rudp_packet_chain_alloc(peer->rudp, len);
+
+    if ( pc == NULL )
+        return;
+
+    memset(pc->packet, 0, sizeof(struct rudp_packet_stream));
+    pc->packet->stream.header.command = RUDP_CMD_APP;
+    pc->packet->stream.flags = RUDP_STREAM_FILE | flags;
+    pc->packet->stream.id = htonl(id);
+    rudp_stream_put64(pc->packet->stream.size, size);
+    rudp_stream_put64(pc->packet->stream.offset, offset);
+    if ( version )
+        rudp_stream_put64(pc->packet->stream.data, *version);
+
+    rudp_peer_send_stream(peer, pc);
+}
+
+static
+void transfer_send_control(struct rudp_peer *peer, uint8_t flags,
+                           uint32_t id, uint64_t size, uint64_t offset)
+{
+    transfer_send_packet(peer, flags, id, size, offset, NULL);
+}
+
+/* Sender */
+
+static
+void transfer_map_unref(struct rudp_file_map *map)
+{
+    if ( --map->refs )
+        return;
+
+    if ( map->base )
+        munmap(map->base, map->size);
+    rudp_free(map->rudp, map, sizeof(*map));
+}
+
+static
+void transfer_sender_report(struct rudp_file_sender *sender, int force)
+{
+    struct rudp_file_progress progress;
+    rudp_time_t now = rudp_timestamp();
+
+    if ( !force && now - sender->last_progress < RUDP_FILE_PROGRESS_INTERVAL )
+        return;
+
+    sender->last_progress = now;
+
+    if ( sender->handler->progress == NULL )
+        return;
+
+    rudp_file_sender_progress(sender, &progress);
+    sender->handler->progress(sender, &progress);
+}
+
+static
+void transfer_sender_end(struct rudp_file_sender *sender, rudp_error_t err)
+{
+    if ( sender->sending && sender->peer )
+        rudp_stream_cancel_file(sender->peer, sender->id);
+
+    if ( err == 0 )
+        sender->acked = sender->size;
+
+    if ( sender->sending )
+        transfer_sender_report(sender, 1);
+
+    sender->sending = 0;
+    sender->peer = NULL;
+
+    sender->handler->end(sender, err);
+}
+
+static
+void transfer_fragment_done(const void *data, size_t len, void *priv)
+{
+    struct rudp_file_map *map = priv;
+    struct rudp_file_sender *sender = map->sender;
+
+    if ( sender == NULL || !sender->sending )
+        return;
+
+    sender->acked += len;
+    transfer_sender_report(sender, 0);
+}
+
+static
+void transfer_map_done(const void *data, size_t len, void *priv)
+{
+    transfer_map_unref(priv);
+}
+
+rudp_error_t rudp_file_sender_init(
+    struct rudp_file_sender *sender,
+    struct rudp *rudp,
+    const struct rudp_file_sender_handler *handler,
+    uint32_t id)
+{
+    sender->handler = handler;
+    sender->rudp = rudp;
+    sender->peer = NULL;
+    sender->map = NULL;
+    sender->size = 0;
+    sender->start = 0;
+    sender->acked = 0;
+    sender->start_time = 0;
+    sender->last_progress = 0;
+    sender->version = 0;
+    sender->id = id;
+    sender->sending = 0;
+
+    rudp_list_insert(&rudp->file_sender_list, &sender->rudp_item);
+
+    return 0;
+}
+
+rudp_error_t rudp_file_sender_open(
+    struct rudp_file_sender *sender,
+    const char *path)
+{
+    struct rudp_file_map *map;
+    struct stat st;
+    rudp_error_t err;
+    int fd;
+
+    if ( sender->map )
+        return EBUSY;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if ( fd == -1 )
+        return errno;
+
+    if ( fstat(fd, &st) ) {
+        err = errno;
+        goto close;
+    }
+
+    map = rudp_alloc(sender->rudp, sizeof(*map));
+    if ( map == NULL ) {
+        err = ENOMEM;
+        goto close;
+    }
+
+    map->rudp = sender->rudp;
+    map->sender = sender;
+    map->size = st.st_size;
+    map->refs = 1;
+    map->base = NULL;
+
+    // Empty files cannot be mapped, and need not be
+    if ( map->size ) {
+        map->base = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+        if ( map->base == MAP_FAILED ) {
+            err = errno;
+            rudp_free(sender->rudp, map, sizeof(*map));
+            goto close;
+        }
+        madvise(map->base, map->size, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    sender->map = map;
+    sender->size = map->size;
+    sender->acked = 0;
+    // Tells a file replaced by another one of the same size
+    sender->version = (uint64_t)st.st_mtim.tv_sec * 1000000000
+        + st.st_mtim.tv_nsec;
+
+    return 0;
+
+close:
+    close(fd);
+    return err;
+}
+
+void rudp_file_sender_close(struct rudp_file_sender *sender)
+{
+    // Receiver gives up too
+    if ( sender->peer ) {
+        if ( sender->sending )
+            rudp_stream_cancel_file(sender->peer, sender->id);
+        transfer_send_control(sender->peer, RUDP_STREAM_REFUSE,
+                              sender->id, sender->size, 0);
+    }
+
+    sender->peer = NULL;
+    sender->sending = 0;
+
+    if ( sender->map ) {
+        sender->map->sender = NULL;
+        transfer_map_unref(sender->map);
+    }
+
+    sender->map = NULL;
+    sender->size = 0;
+}
+
+rudp_error_t rudp_file_sender_deinit(struct rudp_file_sender *sender)
+{
+    rudp_file_sender_close(sender);
+    rudp_list_remove(&sender->rudp_item);
+    return 0;
+}
+
+void rudp_file_sender_progress(const struct rudp_file_sender *sender,
+                               struct rudp_file_progress *progress)
+{
+    transfer_progress_fill(progress, sender->size, sender->acked,
+                           sender->start, sender->start_time,
+                           sender->sending ? rudp_timestamp()
+                                           : sender->last_progress);
+}
+
+static
+rudp_error_t transfer_offer(struct rudp_peer *peer,
+                            struct rudp_file_sender *sender)
+{
+    struct rudp_file_sender *other;
+
+    if ( sender->map == NULL )
+        return EINVAL;
+
+    if ( sender->peer )
+        return EBUSY;
+
+    // Answers would not tell them apart
+    rudp_list_for_each(other, &sender->rudp->file_sender_list, rudp_item)
+        if ( other->peer == peer && other->id == sender->id )
+            return EBUSY;
+
+    sender->peer = peer;
+    sender->sending = 0;
+
+    transfer_send_packet(peer, RUDP_STREAM_OFFER,
+                         sender->id, sender->size, 0, &sender->version);
+
+    return 0;
+}
+
+rudp_error_t rudp_client_send_file(struct rudp_client *client,
+                                   struct rudp_file_sender *sender)
+{
+    if ( !client->connected && !client->connecting )
+        return ENOTCONN;
+
+    return transfer_offer(&client->peer, sender);
+}
+
+rudp_error_t rudp_server_send_file(struct rudp_server *server,
+                                   struct rudp_peer *peer,
+                                   struct rudp_file_sender *sender)
+{
+    return transfer_offer(peer, sender);
+}
+
+static
+struct rudp_file_sender *transfer_sender_find(struct rudp_peer *peer,
+                                              uint32_t id)
+{
+    struct rudp_file_sender *sender;
+
+    rudp_list_for_each(sender, &peer->rudp->file_sender_list, rudp_item)
+        if ( sender->peer == peer && sender->id == id )
+            return sender;
+
+    return NULL;
+}
+
+static
+void transfer_handle_accept(struct rudp_peer *peer, uint32_t id,
+                            uint64_t offset)
+{
+    struct rudp_file_sender *sender = transfer_sender_find(peer, id);
+    struct rudp_file_map *map;
+    rudp_error_t err;
+
+    if ( sender == NULL )
+        return;
+
+    // Receiver has it all
+    if ( offset >= sender->size ) {
+        transfer_sender_end(sender, 0);
+        return;
+    }
+
+    if ( sender->sending )
+        return;
+
+    map = sender->map;
+    sender->sending = 1;
+    sender->start = offset;
+    sender->acked = offset;
+    sender->start_time = rudp_timestamp();
+    sender->last_progress = sender->start_time;
+
+    map->refs++;
+    err = rudp_stream_send_file(peer, id, map->base, map->size, offset,
+                                transfer_fragment_done, transfer_map_done,
+                                map);
+    if ( err ) {
+        map->refs--;
+        transfer_sender_end(sender, err);
+    }
+}
+
+/* Receiver */
+
+static
+void transfer_receiver_report(struct rudp_file_receiver *receiver, int force)
+{
+    struct rudp_file_progress progress;
+    rudp_time_t now = rudp_timestamp();
+
+    if ( !force
+         && now - receiver->last_progress < RUDP_FILE_PROGRESS_INTERVAL )
+        return;
+
+    receiver->last_progress = now;
+
+    if ( receiver->handler->progress == NULL )
+        return;
+
+    transfer_progress_fill(&progress, receiver->size, receiver->offset,
+                           receiver->start, receiver->start_time, now);
+    receiver->handler->progress(receiver, &progress);
+}
+
+static
+void transfer_receiver_unmap(struct rudp_file_receiver *receiver)
+{
+    if ( receiver->mapped && receiver->base )
+        munmap(receiver->base, receiver->size);
+
+    receiver->base = NULL;
+    receiver->mapped = 0;
+}
+
+static
+void transfer_receiver_end(struct rudp_file_receiver *receiver,
+                           rudp_error_t err)
+{
+    transfer_receiver_report(receiver, 1);
+    receiver->peer = NULL;
+
+    // Whole file is on disk, a later offer prepares it again
+    if ( err == 0 )
+        transfer_receiver_unmap(receiver);
+
+    receiver->handler->end(receiver, err);
+}
+
+/*
+  Largest file offset, off_t is signed.
+ */
+#define TRANSFER_OFF_MAX \
+    ((uint64_t)((((off_t)1 << (sizeof(off_t) * 8 - 2)) - 1) * 2 + 1))
+
+/*
+  Destination is allocated on disk before it is written, so that a
+  full disk shows up now rather than as a fault while mapped.  Size
+  comes from the peer, it must fit both a mapping and a file.
+
+  What receiver has is only kept for an offer of the same version, a
+  version of 0 is unknown, e.g. after rudp_file_receiver_open().
+ */
+static
+rudp_error_t transfer_receiver_prepare(struct rudp_file_receiver *receiver,
+                                       uint64_t size, uint64_t version)
+{
+    rudp_error_t err;
+    void *base = NULL;
+
+    if ( size > SIZE_MAX || size > TRANSFER_OFF_MAX )
+        return EFBIG;
+
+    // Another file behind the same identifier
+    if ( (receiver->version && receiver->version != version)
+         || (receiver->mapped && receiver->size != size) )
+        receiver->offset = 0;
+    receiver->version = version;
+
+    if ( receiver->mapped && receiver->size == size )
+        return 0;
+
+    transfer_receiver_unmap(receiver);
+
+    if ( receiver->offset > size )
+        receiver->offset = 0;
+
+    if ( size ) {
+        err = posix_fallocate(receiver->fd, 0, size);
+        if ( err && err != EOPNOTSUPP && err != EINVAL )
+            return err;
+    }
+
+    if ( ftruncate(receiver->fd, size) )
+        return errno;
+
+    if ( size ) {
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    receiver->fd, 0);
+        if ( base == MAP_FAILED )
+            return errno;
+        madvise(base, size, MADV_SEQUENTIAL);
+    }
+
+    receiver->base = base;
+    receiver->size = size;
+    receiver->mapped = 1;
+
+    return 0;
+}
+
+rudp_error_t rudp_file_receiver_init(
+    struct rudp_file_receiver *receiver,
+    struct rudp *rudp,
+    const struct rudp_file_receiver_handler *handler,
+    uint32_t id)
+{
+    struct rudp_file_receiver *other;
+
+    rudp_list_for_each(other, &rudp->file_receiver_list, rudp_item)
+        if ( other->id == id )
+            return EEXIST;
+
+    receiver->handler = handler;
+    receiver->rudp = rudp;
+    receiver->peer = NULL;
+    receiver->base = NULL;
+    receiver->size = 0;
+    receiver->offset = 0;
+    receiver->version = 0;
+    receiver->start = 0;
+    receiver->start_time = 0;
+    receiver->last_progress = 0;
+    receiver->id = id;
+    receiver->fd = -1;
+    receiver->mapped = 0;
+
+    rudp_list_insert(&rudp->file_receiver_list, &receiver->rudp_item);
+
+    return 0;
+}
+
+rudp_error_t rudp_file_receiver_open(
+    struct rudp_file_receiver *receiver,
+    const char *path,
+    uint64_t offset)
+{
+    if ( receiver->fd != -1 )
+        return EBUSY;
+
+    receiver->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if ( receiver->fd == -1 )
+        return errno;
+
+    receiver->offset = offset;
+    receiver->version = 0;
+    receiver->size = 0;
+
+    return 0;
+}
+
+void rudp_file_receiver_close(struct rudp_file_receiver *receiver)
+{
+    if ( receiver->peer )
+        transfer_send_control(receiver->peer, RUDP_STREAM_REFUSE,
+                              receiver->id, receiver->size, 0);
+    receiver->peer = NULL;
+
+    transfer_receiver_unmap(receiver);
+
+    if ( receiver->fd != -1 )
+        close(receiver->fd);
+    receiver->fd = -1;
+}
+
+rudp_error_t rudp_file_receiver_deinit(struct rudp_file_receiver *receiver)
+{
+    rudp_file_receiver_close(receiver);
+    rudp_list_remove(&receiver->rudp_item);
+    return 0;
+}
+
+void rudp_file_receiver_progress(const struct rudp_file_receiver *receiver,
+                                 struct rudp_file_progress *progress)
+{
+    transfer_progress_fill(progress, receiver->size, receiver->offset,
+                           receiver->start, receiver->start_time,
+                           receiver->peer ? rudp_timestamp()
+                                          : receiver->last_progress);
+}
+
+static
+struct rudp_file_receiver *transfer_receiver_find(struct rudp *rudp,
+                                                  uint32_t id)
+{
+    struct rudp_file_receiver *receiver;
+
+    rudp_list_for_each(receiver, &rudp->file_receiver_list, rudp_item)
+        if ( receiver->id == id )
+            return receiver;
+
+    return NULL;
+}
+
+static
+void transfer_handle_offer(struct rudp_peer *peer, uint32_t id,
+                           uint64_t size, uint64_t version)
+{
+    struct rudp_file_receiver *receiver =
+        transfer_receiver_find(peer->rudp, id);
+    rudp_error_t err;
+
+    if ( receiver && receiver->peer == peer )
+        transfer_receiver_end(receiver, ECONNABORTED);
+
+    if ( receiver == NULL || receiver->fd == -1 || receiver->peer ) {
+        rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                        "       no receiver for file %08x\n", id);
+        transfer_send_control(peer, RUDP_STREAM_REFUSE, id, size, 0);
+        return;
+    }
+
+    // Identifier is all a peer needs to know, user decides who may write
+    if ( receiver->handler->accept
+         && !receiver->handler->accept(receiver, peer, size) ) {
+        rudp_log_printf(peer->rudp, RUDP_LOG_INFO,
+                        "       file %08x refused by handler\n", id);
+        transfer_send_control(peer, RUDP_STREAM_REFUSE, id, size, 0);
+        return;
+    }
+
+    err = transfer_receiver_prepare(receiver, size, version);
+    if ( err ) {
+        transfer_send_control(peer, RUDP_STREAM_REFUSE, id, size, 0);
+        receiver->handler->end(receiver, err);
+        return;
+    }
+
+    receiver->peer = peer;
+    receiver->start = receiver->offset;
+    receiver->start_time = rudp_timestamp();
+    receiver->last_progress = receiver->start_time;
+
+    transfer_send_control(peer, RUDP_STREAM_ACCEPT,
+                          id, size, receiver->offset);
+
+    if ( receiver->offset == size )
+        transfer_receiver_end(receiver, 0);
+}
+
+static
+void transfer_handle_data(struct rudp_peer *peer,
+                          const struct rudp_packet_stream *packet,
+                          uint32_t id, uint64_t size, uint64_t offset,
+                          size_t len)
+{
+    struct rudp_file_receiver *receiver =
+        transfer_receiver_find(peer->rudp, id);
+
+    if ( receiver == NULL || receiver->peer != peer )
+        return;
+
+    if ( size != receiver->size || offset != receiver->offset
+         || len > size - offset ) {
+        rudp_log_printf(peer->rudp, RUDP_LOG_WARN,
+                        "       broken file fragment\n");
+        transfer_send_control(peer, RUDP_STREAM_REFUSE, id, size, 0);
+        transfer_receiver_end(receiver, EPROTO);
+        return;
+    }
+
+    if ( len )
+        memcpy(receiver->base + offset, packet->data, len);
+    receiver->offset += len;
+
+    if ( !(packet->flags & RUDP_STREAM_END) ) {
+        transfer_receiver_report(receiver, 0);
+        return;
+    }
+
+    if ( receiver->offset != size ) {
+        transfer_send_control(peer, RUDP_STREAM_REFUSE, id, size, 0);
+        transfer_receiver_end(receiver, EPROTO);
+        return;
+    }
+
+    // Tells sender the whole file is there
+    transfer_send_control(peer, RUDP_STREAM_ACCEPT, id, size, size);
+    transfer_receiver_end(receiver, 0);
+}
+
+/* Peer stage */
+
+void rudp_transfer_receive(struct rudp_peer *peer,
+                           const struct rudp_packet_chain *pc)
+{
+    const struct rudp_packet_stream *packet = &pc->packet->stream;
+    uint32_t id = ntohl(packet->id);
+    uint64_t size = rudp_stream_get64(packet->size);
+    uint64_t offset = rudp_stream_get64(packet->offset);
+    struct rudp_file_receiver *receiver;
+    struct rudp_file_sender *sender;
+
+    if ( packet->flags & RUDP_STREAM_OFFER ) {
+        uint64_t version = 0;
+
+        if ( pc->len >= sizeof(*packet) + sizeof(version) )
+            version = rudp_stream_get64(packet->data);
+        transfer_handle_offer(peer, id, size, version);
+    } else if ( packet->flags & RUDP_STREAM_ACCEPT ) {
+        transfer_handle_accept(peer, id, offset);
+    } else if ( packet->flags & RUDP_STREAM_REFUSE ) {
+        // Either side may give up
+        sender = transfer_sender_find(peer, id);
+        if ( sender )
+            transfer_sender_end(sender, ECONNREFUSED);
+
+        receiver = transfer_receiver_find(peer->rudp, id);
+        if ( receiver && receiver->peer == peer )
+            transfer_receiver_end(receiver, ECONNABORTED);
+    } else {
+        transfer_handle_data(peer, packet, id, size, offset,
+                             pc->len - sizeof(*packet));
+    }
+}
+
+void rudp_transfer_close(struct rudp_peer *peer)
+{
+    struct rudp_file_sender *sender, *stmp;
+    struct rudp_file_receiver *receiver, *rtmp;
+
+    rudp_list_for_each_safe(sender, stmp,
+                            &peer->rudp->file_sender_list, rudp_item)
+        if ( sender->peer == peer )
+            transfer_sender_end(sender, ECONNRESET);
+
+    rudp_list_for_each_safe(receiver, rtmp,
+                            &peer->rudp->file_receiver_list, rudp_item)
+        if ( receiver->peer == peer )
+            transfer_receiver_end(receiver, ECONNRESET);
+}
@@ -0,0 +1,862 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+
+#include <rudp/xdp.h>
+#include <rudp/endpoint.h>
+#include <rudp/rudp.h>
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_error.h"
+#include "rudp_xdp.h"
+
+#if defined(__linux__)
+
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include "rudp_list.h"
+#include "rudp_stats.h"
+#include "rudp_profile.h"
+
+#ifndef AF_XDP
+# define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+# define SOL_XDP 283
+#endif
+
+/*
+  UMEM is split in fixed size frames.  First half is given to the
+  kernel for reception through the fill ring, second half is used
+  for transmission.
+ */
+#define XDP_FRAME_SIZE 4096
+#define XDP_RX_FRAMES 1024
+#define XDP_TX_FRAMES 1024
+#define XDP_FRAMES (XDP_RX_FRAMES + XDP_TX_FRAMES)
+/* Makes IP header, and rudp packet, 32-bit aligned in frames */
+#define XDP_HEADROOM 2
+#define XDP_HEADERS_SIZE \
+    (sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct udphdr))
+#define XDP_NEIGHBOURS 256
+#define XDP_KICK_RETRIES 64
+
+#define XDP_IP_FRAGMENT 0x3fff
+
+struct xdp_ring
+{
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *desc;
+    uint32_t size;
+    void *map;
+    size_t map_size;
+};
+
+/*
+  Link-layer addresses learned from frames received from a remote
+  host.
+ */
+struct xdp_neighbour
+{
+    uint32_t remote_ip;
+    uint32_t local_ip;
+    uint8_t remote_mac[ETH_ALEN];
+    uint8_t local_mac[ETH_ALEN];
+};
+
+struct rudp_xdp
+{
+    struct rudp_endpoint *endpoint;
+    struct ela_event_source *source;
+    int fd;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    uint8_t *umem;
+    struct xdp_ring fill;
+    struct xdp_ring comp;
+    struct xdp_ring rx;
+    struct xdp_ring tx;
+    uint64_t tx_free[XDP_TX_FRAMES];
+    unsigned int tx_free_count;
+    struct rudp_packet_chain rx_chain;
+    struct xdp_neighbour neighbour[XDP_NEIGHBOURS];
+    uint32_t local_ip;
+    uint16_t local_port;
+    uint16_t ip_id;
+    uint8_t mapped:1;
+    uint8_t tx_pending:1;
+    uint8_t in_rx:1;
+    uint8_t dying:1;
+};
+
+static
+uint32_t ring_load(const uint32_t *index)
+{
+    return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+}
+
+static
+void ring_store(uint32_t *index, uint32_t value)
+{
+    __atomic_store_n(index, value, __ATOMIC_RELEASE);
+}
+
+static
+rudp_error_t xdp_ring_map(struct xdp_ring *ring, int fd,
+                          const struct xdp_ring_offset *off,
+                          uint32_t size, size_t desc_size,
+                          off_t pgoff)
+{
+    uint8_t *map;
+
+    ring->map_size = off->desc + size * desc_size;
+    map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if ( map == MAP_FAILED )
+        return errno;
+
+    ring->map = map;
+    ring->producer = (uint32_t *)(map + off->producer);
+    ring->consumer = (uint32_t *)(map + off->consumer);
+    ring->desc = map + off->desc;
+    ring->size = size;
+
+    return 0;
+}
+
+static
+void xdp_ring_unmap(struct xdp_ring *ring)
+{
+    if ( ring->map )
+        munmap(ring->map, ring->map_size);
+    ring->map = NULL;
+}
+
+static
+int xdp_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+#define XDP_INSN(c, d, s, o, i)                                 \
+    ((struct bpf_insn){ .code = (c), .dst_reg = (d),            \
+                        .src_reg = (s), .off = (o), .imm = (i) })
+
+/*
+  Program redirecting non-fragmented, option-less IPv4 UDP datagrams
+  for the endpoint port (and address) to the AF_XDP socket of the
+  receive queue.  Everything else goes to the kernel stack.
+ */
+static
+int xdp_prog_load(struct rudp_xdp *xdp)
+{
+    enum { PASS = 25 };
+    const struct bpf_insn prog[] = {
+        /* 0 */ XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+        /* 1 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 1,
+                         offsetof(struct xdp_md, data), 0),
+        /* 2 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, 3, 1,
+                         offsetof(struct xdp_md, data_end), 0),
+        /* 3 */ XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),
+        /* 4 */ XDP_INSN(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0,
+                         XDP_HEADERS_SIZE),
+        /* 5 */ XDP_INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, PASS - 6, 0),
+        /* 6 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2,
+                         offsetof(struct ethhdr, h_proto), 0),
+        /* 7 */ XDP_INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 8,
+                         htons(ETH_P_IP)),
+        /* 8 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2,
+                         sizeof(struct ethhdr), 0),
+        /* 9 */ XDP_INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 10,
+                         0x45),
+        /* 10 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_B, 5, 2,
+                          sizeof(struct ethhdr)
+                          + offsetof(struct iphdr, protocol), 0),
+        /* 11 */ XDP_INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 12,
+                          IPPROTO_UDP),
+        /* 12 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2,
+                          sizeof(struct ethhdr)
+                          + offsetof(struct iphdr, frag_off), 0),
+        /* 13 */ XDP_INSN(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0,
+                          htons(XDP_IP_FRAGMENT)),
+        /* 14 */ XDP_INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 15, 0),
+        /* 15 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_H, 5, 2,
+                          sizeof(struct ethhdr) + sizeof(struct iphdr)
+                          + offsetof(struct udphdr, dest), 0),
+        /* 16 */ XDP_INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 17,
+                          xdp->local_port),
+        /* 17 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, 5, 2,
+                          sizeof(struct ethhdr)
+                          + offsetof(struct iphdr, daddr), 0),
+        /* 18 */ xdp->local_ip
+                 ? XDP_INSN(BPF_JMP32 | BPF_JNE | BPF_K, 5, 0, PASS - 19,
+                            xdp->local_ip)
+                 : XDP_INSN(BPF_JMP | BPF_JA, 0, 0, 0, 0),
+        /* 19 */ XDP_INSN(BPF_LDX | BPF_MEM | BPF_W, 2, 6,
+                          offsetof(struct xdp_md, rx_queue_index), 0),
+        /* 20 */ XDP_INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD,
+                          0, xdp->map_fd),
+        /* 21 */ XDP_INSN(0, 0, 0, 0, 0),
+        /* 22 */ XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),
+        /* 23 */ XDP_INSN(BPF_JMP | BPF_CALL, 0, 0, 0,
+                          BPF_FUNC_redirect_map),
+        /* 24 */ XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        /* 25 */ XDP_INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),
+        /* 26 */ XDP_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.insns = (uintptr_t)prog;
+    attr.license = (uintptr_t)"Dual BSD/GPL";
+
+    return xdp_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static
+rudp_error_t xdp_prog_attach(struct rudp_xdp *xdp,
+                             unsigned int ifindex,
+                             unsigned int queue,
+                             uint32_t flags)
+{
+    union bpf_attr attr;
+    uint32_t key = queue;
+    uint32_t value = xdp->fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(key);
+    attr.value_size = sizeof(value);
+    attr.max_entries = queue + 1;
+    xdp->map_fd = xdp_bpf(BPF_MAP_CREATE, &attr);
+    if ( xdp->map_fd < 0 )
+        return errno;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xdp->map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    if ( xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0 )
+        return errno;
+
+    xdp->prog_fd = xdp_prog_load(xdp);
+    if ( xdp->prog_fd < 0 )
+        return errno;
+
+    // Program stays attached as long as the link is open
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xdp->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = (flags & RUDP_XDP_SKB_MODE)
+        ? XDP_FLAGS_SKB_MODE : 0;
+    xdp->link_fd = xdp_bpf(BPF_LINK_CREATE, &attr);
+    if ( xdp->link_fd < 0 )
+        return errno;
+
+    return 0;
+}
+
+static
+rudp_error_t xdp_socket_open(struct rudp_xdp *xdp,
+                             unsigned int ifindex,
+                             unsigned int queue,
+                             uint32_t flags)
+{
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen = sizeof(off);
+    int size;
+    unsigned int i;
+    rudp_error_t err;
+
+    xdp->umem = mmap(NULL, XDP_FRAMES * XDP_FRAME_SIZE,
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ( xdp->umem == MAP_FAILED ) {
+        xdp->umem = NULL;
+        return errno;
+    }
+
+    xdp->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if ( xdp->fd == -1 )
+        return errno == EAFNOSUPPORT ? ENOTSUP : errno;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t)xdp->umem;
+    reg.len = XDP_FRAMES * XDP_FRAME_SIZE;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    reg.headroom = XDP_HEADROOM;
+    if ( setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) )
+        return errno;
+
+    size = XDP_RX_FRAMES;
+    if ( setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+                    &size, sizeof(size))
+         || setsockopt(xdp->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) )
+        return errno;
+
+    size = XDP_TX_FRAMES;
+    if ( setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+                    &size, sizeof(size))
+         || setsockopt(xdp->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) )
+        return errno;
+
+    if ( getsockopt(xdp->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) )
+        return errno;
+
+    err = xdp_ring_map(&xdp->fill, xdp->fd, &off.fr, XDP_RX_FRAMES,
+                       sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+    if ( !err )
+        err = xdp_ring_map(&xdp->comp, xdp->fd, &off.cr, XDP_TX_FRAMES,
+                           sizeof(uint64_t),
+                           XDP_UMEM_PGOFF_COMPLETION_RING);
+    if ( !err )
+        err = xdp_ring_map(&xdp->rx, xdp->fd, &off.rx, XDP_RX_FRAMES,
+                           sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+    if ( !err )
+        err = xdp_ring_map(&xdp->tx, xdp->fd, &off.tx, XDP_TX_FRAMES,
+                           sizeof(struct xdp_desc), XDP_PGOFF_TX_RING);
+    if ( err )
+        return err;
+
+    for ( i = 0; i < XDP_RX_FRAMES; ++i )
+        ((uint64_t *)xdp->fill.desc)[i] = (uint64_t)i * XDP_FRAME_SIZE;
+    ring_store(xdp->fill.producer, XDP_RX_FRAMES);
+
+    for ( i = 0; i < XDP_TX_FRAMES; ++i )
+        xdp->tx_free[i] = (uint64_t)(XDP_RX_FRAMES + i) * XDP_FRAME_SIZE;
+    xdp->tx_free_count = XDP_TX_FRAMES;
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+    if ( flags & RUDP_XDP_ZEROCOPY )
+        sxdp.sxdp_flags = XDP_ZEROCOPY;
+    else if ( flags & RUDP_XDP_SKB_MODE )
+        sxdp.sxdp_flags = XDP_COPY;
+
+    if ( bind(xdp->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) )
+        return errno;
+
+    return 0;
+}
+
+static
+void xdp_free(struct rudp *rudp, struct rudp_xdp *xdp)
+{
+    if ( xdp->source ) {
+        ela_remove(rudp->el, xdp->source);
+        ela_source_free(rudp->el, xdp->source);
+    }
+
+    // Closing the link detaches the program
+    if ( xdp->link_fd >= 0 )
+        close(xdp->link_fd);
+    if ( xdp->prog_fd >= 0 )
+        close(xdp->prog_fd);
+    if ( xdp->map_fd >= 0 )
+        close(xdp->map_fd);
+
+    xdp_ring_unmap(&xdp->fill);
+    xdp_ring_unmap(&xdp->comp);
+    xdp_ring_unmap(&xdp->rx);
+    xdp_ring_unmap(&xdp->tx);
+
+    if ( xdp->fd >= 0 )
+        close(xdp->fd);
+    if ( xdp->umem )
+        munmap(xdp->umem, XDP_FRAMES * XDP_FRAME_SIZE);
+
+    rudp_free(rudp, xdp, sizeof(*xdp));
+}
+
+static
+struct xdp_neighbour *xdp_neighbour_get(struct rudp_xdp *xdp,
+                                        uint32_t remote_ip)
+{
+    uint32_t hash = ntohl(remote_ip) * 2654435761u;
+
+    return &xdp->neighbour[hash >> 24];
+}
+
+static
+void xdp_complete(struct rudp_xdp *xdp)
+{
+    uint32_t cons = *xdp->comp.consumer;
+    uint32_t avail = ring_load(xdp->comp.producer) - cons;
+    const uint64_t *addr = xdp->comp.desc;
+    uint32_t i;
+
+    for ( i = 0; i < avail; ++i )
+        xdp->tx_free[xdp->tx_free_count++] =
+            addr[(cons + i) & (xdp->comp.size - 1)]
+            & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+
+    ring_store(xdp->comp.consumer, cons + avail);
+}
+
+static
+void xdp_kick(struct rudp_xdp *xdp)
+{
+    unsigned int retries = 0;
+
+    if ( !xdp->tx_pending )
+        return;
+
+    // Kernel may process a limited count of frames per call
+    while ( ring_load(xdp->tx.consumer) != *xdp->tx.producer
+            && retries++ < XDP_KICK_RETRIES ) {
+        if ( sendto(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1
+             && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS )
+            break;
+    }
+
+    xdp->tx_pending = ring_load(xdp->tx.consumer) != *xdp->tx.producer;
+
+    xdp_complete(xdp);
+}
+
+static
+uint16_t xdp_ip_checksum(const void *data, size_t len)
+{
+    const uint16_t *word = data;
+    uint32_t sum = 0;
+
+    for ( ; len > 1; len -= 2 )
+        sum += *word++;
+
+    while ( sum >> 16 )
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
+static
+void xdp_handle_frame(struct rudp_xdp *xdp, uint8_t *frame, uint32_t len)
+{
+    struct rudp_endpoint *endpoint = xdp->endpoint;
+    struct rudp *rudp = endpoint->rudp;
+    const struct ethhdr *eth = (const struct ethhdr *)frame;
+    const struct iphdr *ip = (const struct iphdr *)(eth + 1);
+    const struct udphdr *udp;
+    struct xdp_neighbour *neighbour;
+    struct sockaddr_storage addr;
+    struct rudp_packet_chain *pc;
+    size_t ihl, tot_len, udp_len;
+    uint8_t *payload;
+
+    rudp_profile_enter(rudp, RUDP_STAGE_RECV);
+
+    if ( len < XDP_HEADERS_SIZE
+         || eth->h_proto != htons(ETH_P_IP)
+         || ip->version != 4
+         || ip->protocol != IPPROTO_UDP
+         || (ip->frag_off & htons(XDP_IP_FRAGMENT)) )
+        goto drop;
+
+    ihl = ip->ihl * 4;
+    tot_len = ntohs(ip->tot_len);
+    if ( ihl < sizeof(*ip)
+         || tot_len < ihl + sizeof(*udp)
+         || sizeof(*eth) + tot_len > len )
+        goto drop;
+
+    // Sum over a valid header, checksum included, is zero
+    if ( xdp_ip_checksum(ip, ihl) != 0 )
+        goto drop;
+
+    udp = (const struct udphdr *)((const uint8_t *)ip + ihl);
+    udp_len = ntohs(udp->len);
+    if ( udp->dest != xdp->local_port
+         || udp_len < sizeof(*udp)
+         || udp_len > tot_len - ihl )
+        goto drop;
+
+    neighbour = xdp_neighbour_get(xdp, ip->saddr);
+    neighbour->remote_ip = ip->saddr;
+    neighbour->local_ip = ip->daddr;
+    memcpy(neighbour->remote_mac, eth->h_source, ETH_ALEN);
+    memcpy(neighbour->local_mac, eth->h_dest, ETH_ALEN);
+
+    // Same addresses as the socket path gives, see endpoint_recvmsg()
+    memset(&addr, 0, sizeof(addr));
+    if ( xdp->mapped && !(endpoint->flags & RUDP_ENDPOINT_DUALSTACK) ) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = udp->source;
+        sin6->sin6_addr.s6_addr32[2] = htonl(0xffff);
+        sin6->sin6_addr.s6_addr32[3] = ip->saddr;
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+
+        sin->sin_family = AF_INET;
+        sin->sin_port = udp->source;
+        sin->sin_addr.s_addr = ip->saddr;
+    }
+
+    payload = (uint8_t *)(udp + 1);
+    udp_len -= sizeof(*udp);
+
+    rudp_profile_leave(rudp, RUDP_STAGE_RECV);
+
+    if ( endpoint->stats )
+        rudp_stats_endpoint_in(endpoint, udp_len);
+
+    // Packet is handed in place, unless it is misaligned
+    if ( ((uintptr_t)payload & 3) == 0 ) {
+        pc = &xdp->rx_chain;
+        pc->packet = (struct rudp_packet *)payload;
+        pc->alloc_size = udp_len;
+        pc->len = udp_len;
+        pc->payload = NULL;
+
+        endpoint->handler->handle_packet(endpoint, &addr, pc);
+        return;
+    }
+
+    pc = rudp_packet_chain_alloc(rudp, udp_len);
+    if ( pc == NULL )
+        return;
+
+    memcpy(pc->packet, payload, udp_len);
+    rudp->rx_chain = pc;
+    endpoint->handler->handle_packet(endpoint, &addr, pc);
+    pc = rudp->rx_chain;
+    rudp->rx_chain = NULL;
+    if ( pc )
+        rudp_packet_chain_free(rudp, pc);
+    return;
+
+drop:
+    rudp_profile_leave(rudp, RUDP_STAGE_RECV);
+}
+
+/*
+  - xsk watcher
+     - xdp frame reader <===
+        - server/client packet handler
+ */
+static
+void _xdp_handle_incoming(struct ela_event_source *src,
+                          int fd, uint32_t mask, void *data)
+{
+    struct rudp_xdp *xdp = data;
+    struct rudp_endpoint *endpoint = xdp->endpoint;
+    struct rudp *rudp = endpoint->rudp;
+    const struct xdp_desc *desc = xdp->rx.desc;
+    uint64_t *fill = xdp->fill.desc;
+    uint32_t cons = *xdp->rx.consumer;
+    uint32_t prod = *xdp->fill.producer;
+    uint32_t avail = ring_load(xdp->rx.producer) - cons;
+    uint32_t i;
+
+    xdp->in_rx = 1;
+    rudp_endpoint_batch_begin(endpoint);
+
+    for ( i = 0; i < avail; ++i ) {
+        const struct xdp_desc *d = &desc[(cons + i) & (xdp->rx.size - 1)];
+
+        if ( !xdp->dying )
+            xdp_handle_frame(xdp, xdp->umem + d->addr, d->len);
+
+        fill[(prod + i) & (xdp->fill.size - 1)] = d->addr;
+    }
+
+    ring_store(xdp->rx.consumer, cons + avail);
+    ring_store(xdp->fill.producer, prod + avail);
+
+    xdp->in_rx = 0;
+
+    if ( xdp->dying ) {
+        xdp_free(rudp, xdp);
+        rudp_endpoint_batch_flush(endpoint);
+        return;
+    }
+
+    rudp_endpoint_batch_flush(endpoint);
+    xdp_complete(xdp);
+}
+
+rudp_error_t rudp_endpoint_xdp_attach(
+    struct rudp_endpoint *endpoint,
+    const char *ifname,
+    unsigned int queue,
+    uint32_t flags)
+{
+    struct rudp *rudp = endpoint->rudp;
+    struct sockaddr_storage local;
+    socklen_t size = sizeof(local);
+    struct rudp_xdp *xdp;
+    unsigned int ifindex;
+    rudp_error_t err;
+
+    if ( endpoint->xdp )
+        return EBUSY;
+
+    if ( endpoint->socket_fd == -1 )
+        return EINVAL;
+
+    ifindex = if_nametoindex(ifname);
+    if ( ifindex == 0 )
+        return ENODEV;
+
+    if ( getsockname(endpoint->socket_fd,
+                     (struct sockaddr *)&local, &size) )
+        return errno;
+
+    xdp = rudp_alloc(rudp, sizeof(*xdp));
+    if ( xdp == NULL )
+        return ENOMEM;
+
+    memset(xdp, 0, sizeof(*xdp));
+    xdp->endpoint = endpoint;
+    xdp->fd = -1;
+    xdp->map_fd = -1;
+    xdp->prog_fd = -1;
+    xdp->link_fd = -1;
+    rudp_list_init(&xdp->rx_chain.chain_item);
+
+    switch ( local.ss_family ) {
+    case AF_INET: {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)&local;
+
+        xdp->local_ip = sin->sin_addr.s_addr;
+        xdp->local_port = sin->sin_port;
+        break;
+    }
+    case AF_INET6: {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)&local;
+
+        xdp->mapped = 1;
+        xdp->local_port = sin6->sin6_port;
+        if ( IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr) ) {
+            xdp->local_ip = sin6->sin6_addr.s6_addr32[3];
+            break;
+        }
+        if ( IN6_IS_ADDR_UNSPECIFIED(&sin6->sin6_addr) )
+            break;
+
+        // Native IPv6 is not supported
+        err = EAFNOSUPPORT;
+        goto fail;
+    }
+    default:
+        err = EAFNOSUPPORT;
+        goto fail;
+    }
+
+    err = xdp_socket_open(xdp, ifindex, queue, flags);
+    if ( err )
+        goto fail;
+
+    err = xdp_prog_attach(xdp, ifindex, queue, flags);
+    if ( err )
+        goto fail;
+
+    ela_source_alloc(rudp->el, _xdp_handle_incoming, xdp, &xdp->source);
+
+    ela_error_t eerr = ela_set_fd(rudp->el, xdp->source, xdp->fd,
+                                  ELA_EVENT_READABLE);
+    if ( !eerr )
+        eerr = ela_add(rudp->el, xdp->source);
+    if ( eerr ) {
+        err = rudp_error_from_ela(eerr);
+        goto fail;
+    }
+
+    endpoint->xdp = xdp;
+
+    rudp_log_printf(rudp, RUDP_LOG_INFO,
+                    "AF_XDP socket attached to %s queue %u\n",
+                    ifname, queue);
+
+    return 0;
+
+fail:
+    xdp_free(rudp, xdp);
+    return err;
+}
+
+void rudp_endpoint_xdp_detach(struct rudp_endpoint *endpoint)
+{
+    struct rudp_xdp *xdp = endpoint->xdp;
+
+    if ( xdp == NULL )
+        return;
+
+    endpoint->xdp = NULL;
+    xdp_kick(xdp);
+
+    // Called from a packet handler, frame reader frees it
+    if ( xdp->in_rx ) {
+        xdp->dying = 1;
+        return;
+    }
+
+    xdp_free(endpoint->rudp, xdp);
+}
+
+rudp_error_t rudp_xdp_send(struct rudp_endpoint *endpoint,
+                           const struct sockaddr_storage *addr,
+                           const struct iovec *iov, size_t iovcnt)
+{
+    struct rudp_xdp *xdp = endpoint->xdp;
+    const struct xdp_neighbour *neighbour;
+    struct xdp_desc *desc;
+    struct ethhdr *eth;
+    struct iphdr *ip;
+    struct udphdr *udp;
+    uint32_t remote_ip, prod;
+    uint16_t remote_port;
+    uint64_t frame;
+    uint8_t *data;
+    size_t len = 0, i;
+
+    switch ( addr->ss_family ) {
+    case AF_INET: {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+
+        remote_ip = sin->sin_addr.s_addr;
+        remote_port = sin->sin_port;
+        break;
+    }
+    case AF_INET6: {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+
+        if ( !IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr) )
+            return EAGAIN;
+        remote_ip = sin6->sin6_addr.s6_addr32[3];
+        remote_port = sin6->sin6_port;
+        break;
+    }
+    default:
+        return EAGAIN;
+    }
+
+    neighbour = xdp_neighbour_get(xdp, remote_ip);
+    if ( neighbour->remote_ip != remote_ip )
+        return EAGAIN;
+
+    for ( i = 0; i < iovcnt; ++i )
+        len += iov[i].iov_len;
+
+    if ( XDP_HEADROOM + XDP_HEADERS_SIZE + len > XDP_FRAME_SIZE )
+        return EAGAIN;
+
+    if ( xdp->tx_free_count == 0 )
+        xdp_complete(xdp);
+    if ( xdp->tx_free_count == 0 )
+        return EAGAIN;
+
+    frame = xdp->tx_free[--xdp->tx_free_count];
+    data = xdp->umem + frame + XDP_HEADROOM;
+
+    eth = (struct ethhdr *)data;
+    memcpy(eth->h_dest, neighbour->remote_mac, ETH_ALEN);
+    memcpy(eth->h_source, neighbour->local_mac, ETH_ALEN);
+    eth->h_proto = htons(ETH_P_IP);
+
+    ip = (struct iphdr *)(eth + 1);
+    ip->version = 4;
+    ip->ihl = sizeof(*ip) / 4;
+    ip->tos = 0;
+    ip->tot_len = htons(sizeof(*ip) + sizeof(*udp) + len);
+    ip->id = htons(xdp->ip_id++);
+    ip->frag_off = htons(0x4000);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_UDP;
+    ip->check = 0;
+    ip->saddr = xdp->local_ip ? xdp->local_ip : neighbour->local_ip;
+    ip->daddr = remote_ip;
+    ip->check = xdp_ip_checksum(ip, sizeof(*ip));
+
+    // No UDP checksum, this is legal over IPv4
+    udp = (struct udphdr *)(ip + 1);
+    udp->source = xdp->local_port;
+    udp->dest = remote_port;
+    udp->len = htons(sizeof(*udp) + len);
+    udp->check = 0;
+
+    data = (uint8_t *)(udp + 1);
+    for ( i = 0; i < iovcnt; ++i ) {
+        memcpy(data, iov[i].iov_base, iov[i].iov_len);
+        data += iov[i].iov_len;
+    }
+
+    prod = *xdp->tx.producer;
+    desc = &((struct xdp_desc *)xdp->tx.desc)[prod & (xdp->tx.size - 1)];
+    desc->addr = frame + XDP_HEADROOM;
+    desc->len = XDP_HEADERS_SIZE + len;
+    desc->options = 0;
+    ring_store(xdp->tx.producer, prod + 1);
+
+    xdp->tx_pending = 1;
+
+    return 0;
+}
+
+void rudp_xdp_kick(struct rudp_endpoint *endpoint)
+{
+    if ( endpoint->xdp )
+        xdp_kick(endpoint->xdp);
+}
+
+#else
+
+rudp_error_t rudp_endpoint_xdp_attach(
+    struct rudp_endpoint *endpoint,
+    const char *ifname,
+    unsigned int queue,
+    uint32_t flags)
+{
+    return ENOTSUP;
+}
+
+void rudp_endpoint_xdp_detach(struct rudp_endpoint *endpoint)
+{
+}
+
+rudp_error_t rudp_xdp_send(struct rudp_endpoint *endpoint,
+                           const struct sockaddr_storage *addr,
+                           const struct iovec *iov, size_t iovcnt)
+{
+    return EAGAIN;
+}
+
+void rudp_xdp_kick(struct rudp_endpoint *endpoint)
+{
+}
+
+#endif
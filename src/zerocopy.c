@@ -0,0 +1,286 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include <rudp/endpoint.h>
+#include <rudp/rudp.h>
+#include "rudp_rudp.h"
+#include "rudp_packet.h"
+#include "rudp_zerocopy.h"
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+/*
+  Bounds the memory kept for the kernel.  When all slots are busy,
+  datagrams are sent as usual.
+ */
+#define ZEROCOPY_SLOTS 256
+
+enum slot_state
+{
+    SLOT_RESERVED,
+    SLOT_SENT,
+    SLOT_DONE,
+    SLOT_DEAD,
+};
+
+struct rudp_zerocopy
+{
+    size_t threshold;
+    /* Kernel numbers accepted MSG_ZEROCOPY sends from 0 */
+    uint32_t next_id;
+    unsigned int head;
+    unsigned int tail;
+    uint64_t sent;
+    uint64_t copied;
+    struct rudp_zerocopy_slot slot[ZEROCOPY_SLOTS];
+};
+
+rudp_error_t rudp_endpoint_set_zerocopy(struct rudp_endpoint *endpoint,
+                                        size_t threshold)
+{
+    struct rudp_zerocopy *zc = endpoint->zerocopy;
+    int on = 1;
+
+    if ( endpoint->socket_fd == -1 )
+        return EINVAL;
+
+    if ( zc == NULL ) {
+        if ( threshold == 0 )
+            return 0;
+
+        if ( setsockopt(endpoint->socket_fd, SOL_SOCKET, SO_ZEROCOPY,
+                        &on, sizeof(on)) )
+            return errno == ENOPROTOOPT ? ENOTSUP : errno;
+
+        zc = rudp_alloc(endpoint->rudp, sizeof(*zc));
+        if ( zc == NULL )
+            return ENOMEM;
+
+        memset(zc, 0, sizeof(*zc));
+        endpoint->zerocopy = zc;
+    }
+
+    // Pending slots still complete when disabled
+    zc->threshold = threshold;
+
+    return 0;
+}
+
+void rudp_endpoint_zerocopy_stats(const struct rudp_endpoint *endpoint,
+                                  uint64_t *sent, uint64_t *copied)
+{
+    const struct rudp_zerocopy *zc = endpoint->zerocopy;
+
+    *sent = zc ? zc->sent : 0;
+    *copied = zc ? zc->copied : 0;
+}
+
+/*
+  Slots are given back in order, chains are unpinned as soon as all
+  older slots are done.
+ */
+static
+void zerocopy_release(struct rudp_endpoint *endpoint)
+{
+    struct rudp_zerocopy *zc = endpoint->zerocopy;
+
+    while ( zc->head != zc->tail ) {
+        struct rudp_zerocopy_slot *slot =
+            &zc->slot[zc->head % ZEROCOPY_SLOTS];
+
+        if ( slot->state != SLOT_DONE && slot->state != SLOT_DEAD )
+            break;
+
+        rudp_packet_chain_unpin(endpoint->rudp, slot->pc);
+        slot->pc = NULL;
+        zc->head++;
+    }
+}
+
+struct rudp_zerocopy_slot *rudp_zerocopy_reserve(
+    struct rudp_endpoint *endpoint,
+    struct rudp_packet_chain *pc)
+{
+    struct rudp_zerocopy *zc = endpoint->zerocopy;
+    struct rudp_zerocopy_slot *slot;
+
+    if ( zc == NULL || zc->threshold == 0
+         || rudp_packet_chain_size(pc) < zc->threshold )
+        return NULL;
+
+    if ( zc->tail - zc->head == ZEROCOPY_SLOTS )
+        rudp_zerocopy_complete(endpoint);
+
+    if ( zc->tail - zc->head == ZEROCOPY_SLOTS )
+        return NULL;
+
+    slot = &zc->slot[zc->tail++ % ZEROCOPY_SLOTS];
+    slot->header = pc->packet->header;
+    slot->pc = pc;
+    slot->state = SLOT_RESERVED;
+    rudp_packet_chain_pin(pc);
+
+    return slot;
+}
+
+void rudp_zerocopy_sent(struct rudp_endpoint *endpoint,
+                        struct rudp_zerocopy_slot *slot,
+                        int accepted)
+{
+    struct rudp_zerocopy *zc = endpoint->zerocopy;
+
+    if ( accepted ) {
+        slot->id = zc->next_id++;
+        slot->state = SLOT_SENT;
+        zc->sent++;
+    } else {
+        // Released on next completion pass, caller may still use it
+        slot->state = SLOT_DEAD;
+    }
+}
+
+/*
+  A notification covers a range of ids, usually in order.
+ */
+static
+void zerocopy_done(struct rudp_zerocopy *zc, uint32_t lo, uint32_t hi,
+                   int copied)
+{
+    unsigned int i;
+
+    for ( i = zc->head; i != zc->tail; ++i ) {
+        struct rudp_zerocopy_slot *slot = &zc->slot[i % ZEROCOPY_SLOTS];
+
+        if ( slot->state != SLOT_SENT
+             || (uint32_t)(slot->id - lo) > (uint32_t)(hi - lo) )
+            continue;
+
+        slot->state = SLOT_DONE;
+        if ( copied )
+            zc->copied++;
+    }
+}
+
+void rudp_zerocopy_complete(struct rudp_endpoint *endpoint)
+{
+    struct rudp_zerocopy *zc = endpoint->zerocopy;
+
+    if ( zc == NULL )
+        return;
+
+    for (;;) {
+        uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+        struct msghdr msg;
+        struct cmsghdr *cmsg;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if ( recvmsg(endpoint->socket_fd, &msg,
+                     MSG_ERRQUEUE | MSG_DONTWAIT) == -1 )
+            break;
+
+        for ( cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+              cmsg = CMSG_NXTHDR(&msg, cmsg) ) {
+            const struct sock_extended_err *err;
+
+            if ( !(cmsg->cmsg_level == SOL_IP
+                   && cmsg->cmsg_type == IP_RECVERR)
+                 && !(cmsg->cmsg_level == SOL_IPV6
+                      && cmsg->cmsg_type == IPV6_RECVERR) )
+                continue;
+
+            err = (const struct sock_extended_err *)CMSG_DATA(cmsg);
+            if ( err->ee_origin != SO_EE_ORIGIN_ZEROCOPY
+                 || err->ee_errno != 0 )
+                continue;
+
+            zerocopy_done(zc, err->ee_info, err->ee_data,
+                          err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+        }
+    }
+
+    zerocopy_release(endpoint);
+}
+
+/*
+  Chains kernel did not report on yet are unpinned anyway: socket
+  goes away, datagrams still queued may carry whatever their buffers
+  hold by then.
+ */
+void rudp_zerocopy_close(struct rudp_endpoint *endpoint)
+{
+    struct rudp_zerocopy *zc = endpoint->zerocopy;
+
+    if ( zc == NULL )
+        return;
+
+    rudp_zerocopy_complete(endpoint);
+
+    for ( ; zc->head != zc->tail; zc->head++ ) {
+        struct rudp_zerocopy_slot *slot =
+            &zc->slot[zc->head % ZEROCOPY_SLOTS];
+
+        rudp_packet_chain_unpin(endpoint->rudp, slot->pc);
+    }
+
+    endpoint->zerocopy = NULL;
+    rudp_free(endpoint->rudp, zc, sizeof(*zc));
+}
+
+#else
+
+rudp_error_t rudp_endpoint_set_zerocopy(struct rudp_endpoint *endpoint,
+                                        size_t threshold)
+{
+    if ( endpoint->socket_fd == -1 )
+        return EINVAL;
+
+    return threshold ? ENOTSUP : 0;
+}
+
+void rudp_endpoint_zerocopy_stats(const struct rudp_endpoint *endpoint,
+                                  uint64_t *sent, uint64_t *copied)
+{
+    *sent = 0;
+    *copied = 0;
+}
+
+struct rudp_zerocopy_slot *rudp_zerocopy_reserve(
+    struct rudp_endpoint *endpoint,
+    struct rudp_packet_chain *pc)
+{
+    return NULL;
+}
+
+void rudp_zerocopy_sent(struct rudp_endpoint *endpoint,
+                        struct rudp_zerocopy_slot *slot,
+                        int accepted)
+{
+}
+
+void rudp_zerocopy_complete(struct rudp_endpoint *endpoint)
+{
+}
+
+void rudp_zerocopy_close(struct rudp_endpoint *endpoint)
+{
+}
+
+#endif
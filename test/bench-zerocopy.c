@@ -0,0 +1,265 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+/*
+  bench-zerocopy, CPU cost of sending with and without MSG_ZEROCOPY.
+
+  bench-zerocopy -l                         receiving side
+  bench-zerocopy [-s size] [-n count] host  sending side
+
+  Sending side sends the same stream of unreliable messages twice,
+  once plainly, once with MSG_ZEROCOPY, and prints the CPU time it
+  spent per megabyte in each case.  Use two hosts: loopback always
+  copies.
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include <rudp/rudp.h>
+#include <rudp/client.h>
+#include <rudp/server.h>
+
+#define BENCH_PORT 4243
+
+static uint64_t received_bytes;
+
+static
+void server_handle_packet(struct rudp_server *server,
+                          struct rudp_peer *peer,
+                          int command, const void *data, size_t len)
+{
+    received_bytes += len;
+}
+
+static
+void server_link_info(struct rudp_server *server,
+                      struct rudp_peer *peer,
+                      struct rudp_link_info *info)
+{
+}
+
+static
+void server_peer_dropped(struct rudp_server *server, struct rudp_peer *peer)
+{
+    printf("peer gone, %llu bytes received\n",
+           (unsigned long long)received_bytes);
+    received_bytes = 0;
+}
+
+static
+void server_peer_new(struct rudp_server *server, struct rudp_peer *peer)
+{
+    printf("new peer\n");
+}
+
+static const struct rudp_server_handler server_handler = {
+    .handle_packet = server_handle_packet,
+    .link_info = server_link_info,
+    .peer_dropped = server_peer_dropped,
+    .peer_new = server_peer_new,
+};
+
+static
+void client_handle_packet(struct rudp_client *client,
+                          int command, const void *data, size_t len)
+{
+}
+
+static
+void client_link_info(struct rudp_client *client,
+                      struct rudp_link_info *info)
+{
+}
+
+static
+void client_server_lost(struct rudp_client *client)
+{
+    fprintf(stderr, "server lost\n");
+    exit(1);
+}
+
+static
+void client_connected(struct rudp_client *client)
+{
+    ela_exit(client->rudp->el);
+}
+
+static const struct rudp_client_handler client_handler = {
+    .handle_packet = client_handle_packet,
+    .link_info = client_link_info,
+    .server_lost = client_server_lost,
+    .connected = client_connected,
+};
+
+static
+void handle_timeout(struct ela_event_source *source,
+                    int fd, uint32_t mask, void *data)
+{
+    ela_exit(data);
+}
+
+/*
+  Runs the event loop for a while, for completions and acks.
+ */
+static
+void run_for(struct ela_el *el, struct ela_event_source *timer, int ms)
+{
+    struct timeval tv = { ms / 1000, (ms % 1000) * 1000 };
+
+    ela_set_timeout(el, timer, &tv, ELA_EVENT_ONCE);
+    ela_add(el, timer);
+    ela_run(el);
+}
+
+static
+double cpu_seconds(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static
+int listen_mode(struct rudp *rudp)
+{
+    struct rudp_server server;
+    struct in_addr any = { INADDR_ANY };
+    rudp_error_t err;
+
+    rudp_server_init(&server, rudp, &server_handler);
+    rudp_server_set_ipv4(&server, &any, BENCH_PORT);
+
+    err = rudp_server_bind(&server);
+    if ( err ) {
+        fprintf(stderr, "bind: %s\n", strerror(err));
+        return 1;
+    }
+
+    printf("listening on port %d\n", BENCH_PORT);
+    ela_run(rudp->el);
+
+    rudp_server_close(&server);
+    rudp_server_deinit(&server);
+
+    return 0;
+}
+
+static
+void bench_pass(struct rudp_client *client, struct ela_event_source *timer,
+                const char *name, size_t size, unsigned long count)
+{
+    struct ela_el *el = client->rudp->el;
+    uint64_t sent0, copied0, sent, copied;
+    char *buffer = malloc(size);
+    double cpu;
+    unsigned long i;
+
+    memset(buffer, 0x5a, size);
+    rudp_endpoint_zerocopy_stats(&client->endpoint, &sent0, &copied0);
+
+    cpu = cpu_seconds();
+    for ( i = 0; i < count; ++i ) {
+        rudp_client_send(client, 0, 0, buffer, size);
+
+        if ( i % 4096 == 4095 )
+            run_for(el, timer, 0);
+    }
+    run_for(el, timer, 100);
+    cpu = cpu_seconds() - cpu;
+
+    rudp_endpoint_zerocopy_stats(&client->endpoint, &sent, &copied);
+
+    printf("%-9s %8.3f s CPU %8.1f us/MB  zerocopy %llu, copied %llu\n",
+           name, cpu, cpu * 1e6 / ((double)size * count / 1e6),
+           (unsigned long long)(sent - sent0),
+           (unsigned long long)(copied - copied0));
+
+    free(buffer);
+}
+
+int main(int argc, char **argv)
+{
+    struct ela_el *el = ela_create(NULL);
+    struct ela_event_source *timer;
+    struct rudp rudp;
+    struct rudp_client client;
+    size_t size = 4000;
+    unsigned long count = 200000;
+    int listen = 0;
+    rudp_error_t err;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "ls:n:")) != -1 ) {
+        switch ( opt ) {
+        case 'l':
+            listen = 1;
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr,
+                    "usage: %s -l | [-s size] [-n count] host\n", argv[0]);
+            return 1;
+        }
+    }
+
+    rudp_init(&rudp, el, RUDP_HANDLER_DEFAULT);
+
+    if ( listen )
+        return listen_mode(&rudp);
+
+    if ( optind >= argc ) {
+        fprintf(stderr, "no host given\n");
+        return 1;
+    }
+
+    ela_source_alloc(el, handle_timeout, el, &timer);
+
+    rudp_client_init(&client, &rudp, &client_handler);
+    rudp_client_set_hostname(&client, argv[optind], BENCH_PORT, 0);
+    err = rudp_client_connect(&client);
+    if ( err ) {
+        fprintf(stderr, "connect: %s\n", strerror(err));
+        return 1;
+    }
+    ela_run(el);
+
+    bench_pass(&client, timer, "sendmsg", size, count);
+
+    err = rudp_endpoint_set_zerocopy(&client.endpoint, size);
+    if ( err ) {
+        fprintf(stderr, "zerocopy: %s\n", strerror(err));
+        return 1;
+    }
+    bench_pass(&client, timer, "zerocopy", size, count);
+
+    rudp_client_close(&client);
+    rudp_client_deinit(&client);
+    ela_source_free(el, timer);
+    rudp_deinit(&rudp);
+    ela_close(el);
+
+    return 0;
+}
@@ -0,0 +1,254 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+/*
+  Multicast channel test, on the loopback interface.
+
+  "test-mcast server" sends lines typed on stdin to the channel,
+  "test-mcast client" connects to the server and prints the channel
+  contents.
+ */
+
+#include <sys/socket.h>
+#include <stdio.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <rudp/rudp.h>
+#include <rudp/server.h>
+#include <rudp/client.h>
+#include <rudp/multicast.h>
+
+#define GROUP "239.255.42.42"
+#define GROUP_PORT 4243
+#define CHANNEL 1
+
+#define display_err(statement) \
+    do { \
+    rudp_error_t err = statement; \
+    printf("%s:%d %s: %s\n", __FILE__, __LINE__, #statement, strerror(err)); \
+    } while(0)
+
+static
+void server_handle_packet(struct rudp_server *server,
+                          struct rudp_peer *peer,
+                          int command, const void *data, size_t len)
+{
+}
+
+static
+void server_link_info(
+    struct rudp_server *server,
+    struct rudp_peer *peer,
+    struct rudp_link_info *info)
+{
+}
+
+static
+void server_peer_dropped(struct rudp_server *server, struct rudp_peer *peer)
+{
+    printf("%s:%d %s\n", __FILE__, __LINE__, __FUNCTION__);
+}
+
+static
+void server_peer_new(struct rudp_server *server, struct rudp_peer *peer)
+{
+    printf("%s:%d %s\n", __FILE__, __LINE__, __FUNCTION__);
+}
+
+static const struct rudp_server_handler server_handler = {
+    .handle_packet = server_handle_packet,
+    .link_info = server_link_info,
+    .peer_dropped = server_peer_dropped,
+    .peer_new = server_peer_new,
+};
+
+static
+void client_handle_packet(struct rudp_client *client,
+                          int command, const void *data, size_t len)
+{
+}
+
+static
+void client_link_info(struct rudp_client *client, struct rudp_link_info *info)
+{
+}
+
+static
+void client_connected(struct rudp_client *client)
+{
+    printf("%s:%d %s\n", __FILE__, __LINE__, __FUNCTION__);
+}
+
+static
+void client_server_lost(struct rudp_client *client)
+{
+    printf("%s:%d %s\n", __FILE__, __LINE__, __FUNCTION__);
+    ela_exit(client->rudp->el);
+}
+
+static const struct rudp_client_handler client_handler = {
+    .handle_packet = client_handle_packet,
+    .link_info = client_link_info,
+    .connected = client_connected,
+    .server_lost = client_server_lost,
+};
+
+static
+void mcast_handle_packet(struct rudp_mcast_receiver *receiver,
+                         int command, const void *data, size_t len)
+{
+    printf(">>> channel %d command %d message '''",
+           receiver->channel, command);
+    fwrite(data, 1, len, stdout);
+    printf("'''\n");
+    if ( !strncmp((const char *)data, "quit", 4) )
+        ela_exit(receiver->client->rudp->el);
+}
+
+static
+void mcast_packet_lost(struct rudp_mcast_receiver *receiver,
+                       unsigned int count)
+{
+    printf("%s:%d %s %d\n", __FILE__, __LINE__, __FUNCTION__, count);
+}
+
+static const struct rudp_mcast_receiver_handler mcast_handler = {
+    .handle_packet = mcast_handle_packet,
+    .packet_lost = mcast_packet_lost,
+};
+
+static
+void handle_stdin(
+    struct ela_event_source *source,
+    int fd, uint32_t mask, void *data)
+{
+    struct rudp_mcast_sender *sender = data;
+    char buffer[512], *tmp;
+
+    tmp = fgets(buffer, 512, stdin);
+    if ( tmp == NULL ) {
+        ela_exit(sender->server->rudp->el);
+        return;
+    }
+
+    rudp_mcast_sender_send(sender, 0, tmp, strlen(tmp));
+    if ( !strncmp(tmp, "quit", 4) )
+        ela_exit(sender->server->rudp->el);
+}
+
+static
+int run_server(struct rudp *rudp, const struct sockaddr_in *group,
+               unsigned int ifindex)
+{
+    struct rudp_server server;
+    struct rudp_mcast_sender sender;
+    struct ela_event_source *source;
+    struct in_addr address;
+
+    address.s_addr = INADDR_ANY;
+
+    display_err(  rudp_server_init(&server, rudp, &server_handler)  );
+    rudp_server_set_ipv4(&server, &address, 4242);
+    display_err(  rudp_server_bind(&server)  );
+
+    display_err(  rudp_mcast_sender_init(&sender, &server, CHANNEL)  );
+    display_err(  rudp_mcast_sender_open(&sender,
+                                         (const struct sockaddr *)group,
+                                         sizeof(*group), ifindex)  );
+
+    ela_source_alloc(rudp->el, handle_stdin, &sender, &source);
+    ela_set_fd(rudp->el, source, 0, ELA_EVENT_READABLE);
+    ela_add(rudp->el, source);
+
+    ela_run(rudp->el);
+
+    ela_remove(rudp->el, source);
+    ela_source_free(rudp->el, source);
+
+    rudp_mcast_sender_close(&sender);
+    rudp_mcast_sender_deinit(&sender);
+
+    display_err(  rudp_server_close(&server)  );
+    display_err(  rudp_server_deinit(&server)  );
+
+    return 0;
+}
+
+static
+int run_client(struct rudp *rudp, const struct sockaddr_in *group,
+               unsigned int ifindex)
+{
+    struct rudp_client client;
+    struct rudp_mcast_receiver receiver;
+    struct in_addr address;
+
+    address.s_addr = htonl(INADDR_LOOPBACK);
+
+    display_err(  rudp_client_init(&client, rudp, &client_handler)  );
+    rudp_client_set_ipv4(&client, &address, 4242);
+    display_err(  rudp_client_connect(&client)  );
+
+    display_err(  rudp_mcast_receiver_init(&receiver, &client,
+                                           &mcast_handler, CHANNEL, 1)  );
+    display_err(  rudp_mcast_receiver_open(&receiver,
+                                           (const struct sockaddr *)group,
+                                           sizeof(*group), ifindex)  );
+
+    ela_run(rudp->el);
+
+    rudp_mcast_receiver_close(&receiver);
+    rudp_mcast_receiver_deinit(&receiver);
+
+    display_err(  rudp_client_close(&client)  );
+    display_err(  rudp_client_deinit(&client)  );
+
+    return 0;
+}
+
+extern const struct rudp_handler verbose_handler;
+
+int main(int argc, char **argv)
+{
+    struct ela_el *el = ela_create(NULL);
+    struct rudp rudp;
+    const struct rudp_handler *my_handler = RUDP_HANDLER_DEFAULT;
+    struct sockaddr_in group;
+    unsigned int ifindex = if_nametoindex("lo");
+    int server = 0;
+    int i, ret;
+
+    for ( i = 1; i < argc; ++i ) {
+        if ( !strcmp(argv[i], "-v") )
+            my_handler = &verbose_handler;
+        else if ( !strcmp(argv[i], "server") )
+            server = 1;
+    }
+
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons(GROUP_PORT);
+    inet_pton(AF_INET, GROUP, &group.sin_addr);
+
+    rudp_init(&rudp, el, my_handler);
+
+    if ( server )
+        ret = run_server(&rudp, &group, ifindex);
+    else
+        ret = run_client(&rudp, &group, ifindex);
+
+    rudp_deinit(&rudp);
+    ela_close(el);
+
+    return ret;
+}
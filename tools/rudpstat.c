@@ -0,0 +1,243 @@
+/*
+  Librudp, a reliable UDP transport library.
+
+  This file is part of FOILS, the Freebox Open Interface
+  Libraries. This file is distributed under a 2-clause BSD license,
+  see LICENSE.TXT for details.
+
+  Copyright (c) 2011, Freebox SAS
+  See AUTHORS for details
+ */
+
+/*
+  rudpstat, live view of a rudp statistics segment.
+
+  rudpstat [-s rtt|rexmit|queue|bytes] [-i interval] [-n count] [-e] name
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <rudp/stats.h>
+
+enum sort_key
+{
+    SORT_RTT,
+    SORT_REXMIT,
+    SORT_QUEUE,
+    SORT_BYTES,
+};
+
+struct peer_line
+{
+    struct rudp_stats_peer stats;
+    uint64_t bytes_rate;
+};
+
+static const char *const state_names[] = {
+    "new", "run", "conn", "dead",
+};
+
+static enum sort_key sort_key = SORT_RTT;
+
+static
+int64_t peer_key(const struct peer_line *line)
+{
+    switch ( sort_key ) {
+    case SORT_RTT:
+        return line->stats.srtt;
+    case SORT_REXMIT:
+        return line->stats.counters.retransmits;
+    case SORT_QUEUE:
+        return line->stats.queue_depth;
+    case SORT_BYTES:
+        return line->bytes_rate;
+    }
+    return 0;
+}
+
+static
+int peer_compare(const void *a, const void *b)
+{
+    int64_t ka = peer_key(a), kb = peer_key(b);
+
+    return ka < kb ? 1 : ka > kb ? -1 : 0;
+}
+
+static
+void print_counters(const struct rudp_stats_counters *c)
+{
+    printf("in %llu pkt / %llu B, out %llu pkt / %llu B, "
+           "rexmit %llu, errors %llu\n",
+           (unsigned long long)c->packets_in,
+           (unsigned long long)c->bytes_in,
+           (unsigned long long)c->packets_out,
+           (unsigned long long)c->bytes_out,
+           (unsigned long long)c->retransmits,
+           (unsigned long long)c->send_errors);
+}
+
+static
+void show(const struct rudp_stats_reader *reader,
+          struct peer_line *lines,
+          struct rudp_stats_peer *previous,
+          unsigned int interval,
+          int show_endpoints)
+{
+    const struct rudp_stats_segment *segment = reader->segment;
+    struct rudp_stats_global global;
+    unsigned int i, count = 0;
+
+    if ( !rudp_stats_reader_global(reader, &global) ) {
+        printf("segment busy\n");
+        return;
+    }
+
+    printf("pid %u, %u endpoints, %u peers (%u untracked), "
+           "packets %u allocated %u free\n",
+           segment->pid, global.endpoints, global.peers,
+           global.peers_untracked,
+           global.allocated_packets, global.free_packets);
+    printf("total: ");
+    print_counters(&global.counters);
+
+    if ( show_endpoints ) {
+        for ( i = 0; i < segment->max_endpoints; ++i ) {
+            struct rudp_stats_endpoint endpoint;
+
+            if ( !rudp_stats_reader_endpoint(reader, i, &endpoint) )
+                continue;
+
+            printf("endpoint %s: ", endpoint.address);
+            print_counters(&endpoint.counters);
+        }
+    }
+
+    for ( i = 0; i < segment->max_peers; ++i ) {
+        struct peer_line *line = &lines[count];
+
+        if ( !rudp_stats_reader_peer(reader, i, &line->stats) ) {
+            previous[i].in_use = 0;
+            continue;
+        }
+
+        line->bytes_rate = 0;
+        if ( interval && previous[i].in_use
+             && !strcmp(previous[i].address, line->stats.address) )
+            line->bytes_rate = (line->stats.counters.bytes_out
+                                - previous[i].counters.bytes_out)
+                * 1000 / interval;
+
+        previous[i] = line->stats;
+        count++;
+    }
+
+    qsort(lines, count, sizeof(*lines), peer_compare);
+
+    printf("\n%-28s %5s %6s %6s %6s %6s %10s %10s %8s %10s\n",
+           "peer", "state", "srtt", "rttvar", "rto", "queue",
+           "pkt in", "pkt out", "rexmit", "out B/s");
+
+    for ( i = 0; i < count; ++i ) {
+        const struct rudp_stats_peer *p = &lines[i].stats;
+
+        printf("%-28s %5s %6d %6d %6d %6u %10llu %10llu %8llu %10llu\n",
+               p->address,
+               p->state < 4 ? state_names[p->state] : "?",
+               p->srtt, p->rttvar, p->rto, p->queue_depth,
+               (unsigned long long)p->counters.packets_in,
+               (unsigned long long)p->counters.packets_out,
+               (unsigned long long)p->counters.retransmits,
+               (unsigned long long)lines[i].bytes_rate);
+    }
+}
+
+static
+void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-s rtt|rexmit|queue|bytes] [-i interval_ms]"
+            " [-n count] [-e] name\n",
+            name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct rudp_stats_reader reader;
+    struct peer_line *lines;
+    struct rudp_stats_peer *previous;
+    unsigned int interval = 1000;
+    int show_endpoints = 0;
+    int count = 0, i;
+    rudp_error_t err;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "s:i:n:e")) != -1 ) {
+        switch ( opt ) {
+        case 's':
+            if ( !strcmp(optarg, "rtt") )
+                sort_key = SORT_RTT;
+            else if ( !strcmp(optarg, "rexmit") )
+                sort_key = SORT_REXMIT;
+            else if ( !strcmp(optarg, "queue") )
+                sort_key = SORT_QUEUE;
+            else if ( !strcmp(optarg, "bytes") )
+                sort_key = SORT_BYTES;
+            else
+                usage(argv[0]);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'e':
+            show_endpoints = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( optind + 1 != argc )
+        usage(argv[0]);
+
+    err = rudp_stats_reader_open(&reader, argv[optind]);
+    if ( err ) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(err));
+        return 1;
+    }
+
+    lines = calloc(reader.segment->max_peers + 1, sizeof(*lines));
+    previous = calloc(reader.segment->max_peers + 1, sizeof(*previous));
+    if ( lines == NULL || previous == NULL ) {
+        fprintf(stderr, "%s\n", strerror(ENOMEM));
+        return 1;
+    }
+
+    for ( i = 0; count == 0 || i < count; ++i ) {
+        if ( i && isatty(1) )
+            printf("\033[H\033[2J");
+
+        show(&reader, lines, previous, i ? interval : 0, show_endpoints);
+        fflush(stdout);
+
+        if ( interval == 0 || (count && i + 1 == count) )
+            break;
+
+        usleep(interval * 1000);
+        if ( !isatty(1) )
+            printf("\n");
+    }
+
+    free(lines);
+    free(previous);
+    rudp_stats_reader_close(&reader);
+
+    return 0;
+}